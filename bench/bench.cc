@@ -0,0 +1,207 @@
+#include "bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+
+namespace {
+	struct Bench {
+		std::string name;
+		BenchKind kind;
+		BenchFunc func;
+	};
+
+	struct BenchResult {
+		std::string name;
+		BenchKind kind;
+		int samples;
+		long iterations;
+		double min_ns, median_ns, mean_ns, max_ns; // Per call.
+		double items_per_sec, bytes_per_sec;
+	};
+
+	std::vector<Bench>& registry()
+	{
+		static std::vector<Bench> benches;
+		return benches;
+	}
+
+	const char* kind_name(BenchKind kind)
+	{
+		return kind == kMicroBench ? "micro" : "macro";
+	}
+
+	double run_sample(const Bench& bench, BenchState& state)
+	{
+		auto begin = std::chrono::steady_clock::now();
+		bench.func(state);
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	}
+
+	BenchResult run_bench(const Bench& bench, int samples, double min_time_ns)
+	{
+		BenchState state;
+		run_sample(bench, state); // Warm up caches and allocators.
+
+		// Grow the micro loop until one sample is long enough to time.
+		if (bench.kind == kMicroBench) {
+			double ns;
+			while ((ns = run_sample(bench, state)) < min_time_ns &&
+			       state.iterations < (1L << 30)) {
+				double scale = ns > 0 ? min_time_ns / ns : 10.0;
+				state.iterations = std::max(state.iterations * 2,
+				        static_cast<long>(state.iterations * std::min(scale * 1.2, 10.0)));
+			}
+		}
+
+		std::vector<double> per_call;
+		for (int i = 0; i < samples; i++)
+			per_call.push_back(run_sample(bench, state) / state.iterations);
+		std::sort(per_call.begin(), per_call.end());
+
+		BenchResult r;
+		r.name = bench.name;
+		r.kind = bench.kind;
+		r.samples = samples;
+		r.iterations = state.iterations;
+		r.min_ns = per_call.front();
+		r.max_ns = per_call.back();
+		r.median_ns = per_call[per_call.size() / 2];
+		r.mean_ns = std::accumulate(per_call.begin(), per_call.end(), 0.0) / per_call.size();
+		r.items_per_sec = state.items * 1e9 / r.median_ns;
+		r.bytes_per_sec = state.bytes * 1e9 / r.median_ns;
+		return r;
+	}
+
+	std::string pretty_time(double ns)
+	{
+		std::ostringstream os;
+		os << std::fixed << std::setprecision(2);
+		if (ns < 1e3)
+			os << ns << " ns";
+		else if (ns < 1e6)
+			os << ns / 1e3 << " us";
+		else if (ns < 1e9)
+			os << ns / 1e6 << " ms";
+		else
+			os << ns / 1e9 << " s";
+		return os.str();
+	}
+
+	void write_json(const std::string& file, const std::vector<BenchResult>& results)
+	{
+		std::ofstream out(file);
+		std::time_t now = std::time(nullptr);
+		char stamp[32];
+		std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+		out << std::setprecision(9);
+		out << "{\n  \"context\": {\"date\": \"" << stamp << "\", \"compiler\": \""
+		    << __VERSION__ << "\"},\n  \"benchmarks\": [\n";
+		for (size_t i = 0; i < results.size(); i++) {
+			const BenchResult& r = results[i];
+			out << "    {\"name\": \"" << r.name << "\", \"kind\": \"" << kind_name(r.kind)
+			    << "\", \"samples\": " << r.samples << ", \"iterations\": " << r.iterations
+			    << ", \"min_ns\": " << r.min_ns << ", \"median_ns\": " << r.median_ns
+			    << ", \"mean_ns\": " << r.mean_ns << ", \"max_ns\": " << r.max_ns
+			    << ", \"items_per_second\": " << r.items_per_sec
+			    << ", \"bytes_per_second\": " << r.bytes_per_sec << "}"
+			    << (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		out << "  ]\n}\n";
+	}
+
+	void write_csv(const std::string& file, const std::vector<BenchResult>& results)
+	{
+		std::ofstream out(file);
+		out << std::setprecision(9);
+		out << "name,kind,samples,iterations,min_ns,median_ns,mean_ns,max_ns,"
+		       "items_per_second,bytes_per_second\n";
+		for (const BenchResult& r : results) {
+			out << r.name << "," << kind_name(r.kind) << "," << r.samples << ","
+			    << r.iterations << "," << r.min_ns << "," << r.median_ns << ","
+			    << r.mean_ns << "," << r.max_ns << "," << r.items_per_sec << ","
+			    << r.bytes_per_sec << "\n";
+		}
+	}
+
+	void usage(const char* argv0)
+	{
+		std::cerr << "usage: " << argv0 << " [--filter <substring>] [--samples <n>]"
+		          << " [--min-time <ms>] [--json <file>] [--csv <file>] [--list]\n";
+	}
+};
+
+void RegisterBench(const std::string& name, BenchKind kind, BenchFunc func)
+{
+	registry().push_back(Bench{name, kind, func});
+}
+
+int main(int argc, char* argv[])
+{
+	std::string filter, json_file, csv_file;
+	int samples = 10;
+	double min_time_ms = 20.0;
+	bool list_only = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--filter" && has_value)
+			filter = argv[++i];
+		else if (arg == "--samples" && has_value)
+			samples = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "--min-time" && has_value)
+			min_time_ms = std::atof(argv[++i]);
+		else if (arg == "--json" && has_value)
+			json_file = argv[++i];
+		else if (arg == "--csv" && has_value)
+			csv_file = argv[++i];
+		else if (arg == "--list")
+			list_only = true;
+		else {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	RegisterMengerBenches();
+	RegisterJpegBenches();
+	RegisterPipelineBenches();
+	RegisterOceanBenches();
+	RegisterWaveBenches();
+	RegisterSoftRasterBenches();
+	RegisterJobBenches();
+	RegisterSceneBenches();
+
+	std::vector<BenchResult> results;
+	for (const Bench& bench : registry()) {
+		if (!filter.empty() && bench.name.find(filter) == std::string::npos)
+			continue;
+		if (list_only) {
+			std::cout << bench.name << " (" << kind_name(bench.kind) << ")\n";
+			continue;
+		}
+		BenchResult r = run_bench(bench, samples, min_time_ms * 1e6);
+		std::cout << std::left << std::setw(40) << r.name
+		          << std::right << std::setw(12) << pretty_time(r.median_ns)
+		          << "  (min " << pretty_time(r.min_ns) << ", max " << pretty_time(r.max_ns) << ")";
+		if (r.items_per_sec > 0)
+			std::cout << "  " << std::setprecision(4) << r.items_per_sec / 1e6 << " Mitems/s";
+		if (r.bytes_per_sec > 0)
+			std::cout << "  " << std::setprecision(4) << r.bytes_per_sec / (1 << 20) << " MiB/s";
+		std::cout << std::endl;
+		results.push_back(r);
+	}
+
+	if (!json_file.empty())
+		write_json(json_file, results);
+	if (!csv_file.empty())
+		write_csv(csv_file, results);
+	return EXIT_SUCCESS;
+}
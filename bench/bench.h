@@ -0,0 +1,45 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * A tiny benchmark harness for menger_bench.
+ *
+ * Micro benchmarks run their body state.iterations times per sample and are
+ * reported per call; the harness picks iterations so that one sample lasts
+ * at least --min-time.  Macro benchmarks run one whole operation per sample.
+ * Every benchmark gets one untimed warm-up sample.
+ */
+enum BenchKind { kMicroBench, kMacroBench };
+
+struct BenchState {
+	long iterations = 1; // Calls the body must make in this sample.
+	double items = 0;    // Work items handled per call, e.g. triangles.
+	double bytes = 0;    // Bytes produced or consumed per call.
+};
+
+typedef std::function<void(BenchState&)> BenchFunc;
+
+void RegisterBench(const std::string& name, BenchKind kind, BenchFunc func);
+
+// Each bench_*.cc file provides one of these; bench.cc calls them all.
+void RegisterMengerBenches();
+void RegisterJpegBenches();
+void RegisterPipelineBenches();
+void RegisterOceanBenches();
+void RegisterWaveBenches();
+void RegisterSoftRasterBenches();
+void RegisterJobBenches();
+void RegisterSceneBenches();
+
+// Keeps the optimizer from discarding a result we only compute for timing.
+template<typename T>
+inline void DoNotOptimize(const T& value)
+{
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include "bench.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <job_system.h>
+#include <menger.h>
+#include <ocean.h>
+#include <voxel_export.h>
+
+namespace {
+	const char* kVoxelFile = "menger_bench_jobs.vox";
+
+	// Enough arithmetic per item that scaling is not bound by memory.
+	float busy_work(size_t i)
+	{
+		float x = float(i);
+		for (int k = 0; k < 64; k++)
+			x = std::sqrt(x + k);
+		return x;
+	}
+
+	// Powers of two up to one per hardware thread, and that count itself.
+	std::vector<int> thread_counts()
+	{
+		int hardware = std::max(1u, std::thread::hardware_concurrency());
+		std::vector<int> counts;
+		for (int n = 1; n < hardware; n *= 2)
+			counts.push_back(n);
+		counts.push_back(hardware);
+		return counts;
+	}
+
+	// Restarting the pool costs thread creation, so only do it on a change;
+	// the warm-up sample absorbs that.
+	void use_threads(int threads)
+	{
+		if (g_jobs.threads() != threads)
+			g_jobs.set_threads(threads);
+	}
+};
+
+void RegisterJobBenches()
+{
+	const int hardware = std::max(1u, std::thread::hardware_concurrency());
+
+	// What scheduling costs, with jobs that do nothing: throughput of many
+	// in flight at once, and the latency of one job there and back.
+	RegisterBench("JobSystem::run/empty", kMicroBench, [hardware](BenchState& state) {
+		use_threads(hardware);
+		JobGroup group;
+		for (long i = 0; i < state.iterations; i++)
+			g_jobs.run([] {}, &group);
+		g_jobs.wait(group);
+	});
+	RegisterBench("JobSystem::run/round_trip", kMicroBench, [hardware](BenchState& state) {
+		use_threads(hardware);
+		for (long i = 0; i < state.iterations; i++) {
+			JobGroup group;
+			g_jobs.run([] {}, &group);
+			g_jobs.wait(group);
+		}
+	});
+	RegisterBench("JobSystem::depend/chain_1024", kMacroBench, [hardware](BenchState& state) {
+		use_threads(hardware);
+		JobGroup group;
+		std::vector<Job*> jobs(1024);
+		for (Job*& job : jobs)
+			job = g_jobs.create([] {}, &group);
+		for (size_t i = 1; i < jobs.size(); i++)
+			g_jobs.depend(jobs[i], jobs[i - 1]);
+		for (Job* job : jobs)
+			g_jobs.submit(job);
+		g_jobs.wait(group);
+		state.items = jobs.size();
+	});
+	for (size_t grain : { 1, 64 }) {
+		RegisterBench("parallel_for/empty/65536/grain_" + std::to_string(grain), kMacroBench,
+			[hardware, grain](BenchState& state) {
+				use_threads(hardware);
+				g_jobs.parallel_for(0, 65536, grain, [](size_t, size_t) {});
+				state.items = 65536;
+			});
+	}
+
+	// Scaling with the number of workers, on arithmetic alone and on the
+	// subsystems that run on the pool.
+	for (int threads : thread_counts()) {
+		std::string suffix = "/threads_" + std::to_string(threads);
+		RegisterBench("parallel_for/busy/1M" + suffix, kMacroBench,
+			[threads, sums = std::make_shared<std::vector<float>>(1024)](BenchState& state) {
+				use_threads(threads);
+				g_jobs.parallel_for(0, 1 << 20, 1024, [&sums](size_t begin, size_t end) {
+					float sum = 0.0f;
+					for (size_t i = begin; i < end; i++)
+						sum += busy_work(i);
+					(*sums)[begin / 1024] = sum;
+				});
+				DoNotOptimize(sums->data());
+				state.items = 1 << 20;
+			});
+		RegisterBench("Ocean::simulate/256" + suffix, kMacroBench,
+			[threads, ocean = std::shared_ptr<Ocean>(), time = 0.0f](BenchState& state) mutable {
+				use_threads(threads);
+				if (!ocean) {
+					OceanParams params;
+					params.grid = 256;
+					ocean = std::make_shared<Ocean>(params);
+				}
+				time += 1.0f / 60.0f;
+				ocean->simulate(time);
+				DoNotOptimize(ocean->normals().data());
+				state.items = 256 * 256;
+			});
+		RegisterBench("generate_geometry/level_4" + suffix, kMacroBench,
+			[threads](BenchState& state) {
+				use_threads(threads);
+				Menger menger(glm::vec3(-0.5f), glm::vec3(0.5f));
+				menger.set_nesting_level(4);
+				std::vector<glm::vec4> vertices;
+				std::vector<glm::uvec3> faces;
+				menger.generate_geometry(vertices, faces);
+				DoNotOptimize(faces.data());
+				state.items = faces.size();
+			});
+		RegisterBench("ExportVoxels/bricks/level_6" + suffix, kMacroBench,
+			[threads](BenchState& state) {
+				use_threads(threads);
+				VoxelExportStats stats;
+				ExportVoxels(kVoxelFile, 6, glm::vec3(-0.5f), glm::vec3(0.5f), kVoxelBricks,
+				             &stats);
+				std::remove(kVoxelFile);
+				state.bytes = stats.bytes;
+				state.items = stats.filled;
+			});
+	}
+}
@@ -0,0 +1,121 @@
+#include "bench.h"
+#include <cstdio>
+#include <memory>
+#include <jpeg_encoder.h>
+#include <jpegio.h>
+#include <texture_loader.h>
+
+namespace {
+	const int kWidth = 800, kHeight = 600;
+	const char* kJpegFile = "menger_bench.jpg";
+
+	// A deterministic test card: smooth gradients with a checkerboard on top,
+	// which gives the encoder both flat and high-frequency blocks.
+	std::vector<unsigned char> make_test_image(int width, int height)
+	{
+		std::vector<unsigned char> pixels(width * height * 3);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				unsigned char* p = &pixels[(y * width + x) * 3];
+				bool check = ((x / 32) + (y / 32)) % 2;
+				p[0] = static_cast<unsigned char>(255 * x / width);
+				p[1] = static_cast<unsigned char>(255 * y / height);
+				p[2] = check ? 200 : 40;
+			}
+		}
+		return pixels;
+	}
+
+	long file_size(const char* file)
+	{
+		long size = 0;
+		FILE* f = fopen(file, "rb");
+		if (f) {
+			fseek(f, 0, SEEK_END);
+			size = ftell(f);
+			fclose(f);
+		}
+		return size;
+	}
+};
+
+void RegisterJpegBenches()
+{
+	std::shared_ptr<std::vector<unsigned char>> pixels(
+			new std::vector<unsigned char>(make_test_image(kWidth, kHeight)));
+
+	RegisterBench("SaveJPEG/800x600", kMacroBench, [pixels](BenchState& state) {
+		SaveJPEG(kJpegFile, kWidth, kHeight, pixels->data());
+		state.items = kWidth * kHeight;
+		state.bytes = file_size(kJpegFile);
+		std::remove(kJpegFile);
+	});
+
+	RegisterBench("EncodeJPEG/800x600", kMacroBench,
+		[pixels, data = std::vector<unsigned char>()](BenchState& state) mutable {
+			std::vector<const unsigned char*> rows(kHeight);
+			for (int y = 0; y < kHeight; y++)
+				rows[y] = &(*pixels)[(kHeight - 1 - y) * kWidth * 3];
+			EncodeJPEG(kWidth, kHeight, rows.data(), JpegOptions(), &data);
+			state.items = kWidth * kHeight;
+			state.bytes = data.size();
+		});
+
+	// Whole frames per second through the pool, encoded to memory only: a
+	// burst of viewer-sized frames, and one 4K frame split into strips.
+	struct Burst { int width, height, frames; };
+	for (Burst burst : { Burst{ kWidth, kHeight, 16 }, Burst{ 3840, 2160, 1 } }) {
+		std::shared_ptr<std::vector<unsigned char>> image(new std::vector<unsigned char>(
+				make_test_image(burst.width, burst.height)));
+		std::string name = "JpegEncoder/" + std::to_string(burst.width) + "x" +
+		                   std::to_string(burst.height) + "x" + std::to_string(burst.frames);
+		RegisterBench(name, kMacroBench,
+			[burst, image, encoder = std::make_shared<JpegEncoder>()](BenchState& state) {
+				for (int i = 0; i < burst.frames; i++)
+					encoder->submit({}, burst.width, burst.height, 3, *image);
+				encoder->flush();
+				state.items = burst.frames;
+				state.bytes = burst.frames * image->size();
+			});
+	}
+
+	RegisterBench("LoadJPEG/800x600", kMacroBench, [pixels](BenchState& state) {
+		if (file_size(kJpegFile) == 0)
+			SaveJPEG(kJpegFile, kWidth, kHeight, pixels->data());
+		Image image;
+		LoadJPEG(kJpegFile, &image);
+		DoNotOptimize(image.bytes.data());
+		state.items = kWidth * kHeight;
+		state.bytes = image.bytes.size();
+	});
+
+	// Straight to RGBA, and at 1/4 scale through the scaled inverse DCT.
+	for (int denom : { 1, 4 }) {
+		std::string name = "LoadJPEG/800x600/rgba_1_" + std::to_string(denom);
+		RegisterBench(name, kMacroBench, [pixels, denom](BenchState& state) {
+			if (file_size(kJpegFile) == 0)
+				SaveJPEG(kJpegFile, kWidth, kHeight, pixels->data());
+			JpegDecodeOptions options;
+			options.rgba = true;
+			options.scale_denom = denom;
+			Image image;
+			LoadJPEG(kJpegFile, &image, options);
+			DoNotOptimize(image.bytes.data());
+			state.items = kWidth * kHeight;
+			state.bytes = image.bytes.size();
+		});
+	}
+
+	// Everything a worker does for one texture: decode and mip chain.
+	RegisterBench("TextureLoader::decode/800x600", kMacroBench,
+		[pixels, mips = std::vector<TextureLoader::Mip>()](BenchState& state) mutable {
+			if (file_size(kJpegFile) == 0)
+				SaveJPEG(kJpegFile, kWidth, kHeight, pixels->data());
+			TextureLoader::decode(kJpegFile, 0, &mips);
+			size_t bytes = 0;
+			for (const TextureLoader::Mip& mip : mips)
+				bytes += mip.rgba.size();
+			state.items = kWidth * kHeight;
+			state.bytes = bytes;
+		});
+}
@@ -0,0 +1,231 @@
+#include "bench.h"
+#include <cstdio>
+#include <memory>
+#include <glm/gtc/matrix_transform.hpp>
+#include <menger.h>
+#include <camera.h>
+#include <floor.h>
+#include <index_optimizer.h>
+#include <meshlet.h>
+#include <objio.h>
+#include <voxel_export.h>
+
+namespace {
+	const int kMaxBenchLevel = 4;
+	const char* kObjFile = "menger_bench.obj";
+	const char* kVoxelFile = "menger_bench.vox";
+
+	glm::vec3 kMin(-0.5f, -0.5f, -0.5f);
+	glm::vec3 kMax(0.5f, 0.5f, 0.5f);
+};
+
+void RegisterMengerBenches()
+{
+	for (int level = 0; level <= kMaxBenchLevel; level++) {
+		RegisterBench("generate_geometry/level_" + std::to_string(level), kMacroBench,
+			[level](BenchState& state) {
+				Menger menger(kMin, kMax);
+				menger.set_nesting_level(level);
+				std::vector<glm::vec4> vertices;
+				std::vector<glm::uvec3> faces;
+				menger.generate_geometry(vertices, faces);
+				DoNotOptimize(faces.data());
+				state.items = faces.size();
+			});
+	}
+
+	for (int level = 0; level <= kMaxBenchLevel; level++) {
+		RegisterBench("generate_geometry_normals/level_" + std::to_string(level), kMacroBench,
+			[level](BenchState& state) {
+				Menger menger(kMin, kMax);
+				menger.set_nesting_level(level);
+				std::vector<glm::vec4> vertices;
+				std::vector<glm::vec3> normals;
+				std::vector<glm::uvec3> faces;
+				menger.generate_geometry(vertices, normals, faces);
+				DoNotOptimize(faces.data());
+				state.items = faces.size();
+			});
+	}
+
+	RegisterBench("generate_menger", kMicroBench, [](BenchState& state) {
+		Menger menger(kMin, kMax);
+		std::vector<glm::vec4> vertices;
+		std::vector<glm::uvec3> faces;
+		vertices.reserve(8 * 1024);
+		faces.reserve(12 * 1024);
+		for (long i = 0; i < state.iterations; i++) {
+			if (faces.size() >= 12 * 1024) {
+				vertices.clear();
+				faces.clear();
+			}
+			menger.generate_menger(vertices, faces, kMin, kMax);
+		}
+		DoNotOptimize(faces.data());
+		state.items = 12;
+	});
+
+	for (int level = 0; level <= kMaxBenchLevel; level++) {
+		std::shared_ptr<std::vector<glm::vec4>> vertices(new std::vector<glm::vec4>);
+		std::shared_ptr<std::vector<glm::uvec3>> faces(new std::vector<glm::uvec3>);
+		RegisterBench("SaveObj/level_" + std::to_string(level), kMacroBench,
+			[level, vertices, faces](BenchState& state) {
+				if (faces->empty()) {
+					Menger menger(kMin, kMax);
+					menger.set_nesting_level(level);
+					menger.generate_geometry(*vertices, *faces);
+				}
+				SaveObj(kObjFile, *vertices, *faces);
+				FILE* f = fopen(kObjFile, "rb");
+				if (f) {
+					fseek(f, 0, SEEK_END);
+					state.bytes = ftell(f);
+					fclose(f);
+				}
+				std::remove(kObjFile);
+				state.items = faces->size();
+			});
+	}
+
+	// Level 4 for comparison with SaveObj, level 6 for where the mesh
+	// would no longer fit.
+	for (int level : { 4, 6 }) {
+		for (VoxelFormat format : { kVoxelBits, kVoxelRle, kVoxelBricks }) {
+			RegisterBench(std::string("ExportVoxels/") + VoxelFormatName(format) + "/level_" +
+					std::to_string(level), kMacroBench,
+				[level, format](BenchState& state) {
+					VoxelExportStats stats;
+					ExportVoxels(kVoxelFile, level, kMin, kMax, format, &stats);
+					std::remove(kVoxelFile);
+					state.bytes = stats.bytes;
+					state.items = stats.filled;
+				});
+		}
+	}
+
+	// Each pass on its own, from the order generate_geometry leaves.
+	for (int level = 2; level <= kMaxBenchLevel; level++) {
+		for (unsigned pass : { kIndexPassWeld, kIndexPassCache, kIndexPassOverdraw, kIndexPassFetch }) {
+			std::shared_ptr<std::vector<glm::vec4>> vertices(new std::vector<glm::vec4>);
+			std::shared_ptr<std::vector<glm::vec3>> normals(new std::vector<glm::vec3>);
+			std::shared_ptr<std::vector<glm::uvec3>> faces(new std::vector<glm::uvec3>);
+			RegisterBench("OptimizeIndices/" + IndexPassNames(pass) + "/level_" +
+					std::to_string(level), kMacroBench,
+				[level, pass, vertices, normals, faces](BenchState& state) {
+					if (faces->empty()) {
+						Menger menger(kMin, kMax);
+						menger.set_nesting_level(level);
+						menger.generate_geometry(*vertices, *normals, *faces);
+					}
+					std::vector<glm::vec4> v = *vertices;
+					std::vector<glm::vec3> n = *normals;
+					std::vector<glm::uvec3> f = *faces;
+					OptimizeIndices(pass, &v, &n, &f);
+					DoNotOptimize(f.data());
+					state.items = f.size();
+				});
+		}
+	}
+
+	for (int level = 2; level <= kMaxBenchLevel; level++) {
+		std::shared_ptr<std::vector<glm::vec4>> vertices(new std::vector<glm::vec4>);
+		std::shared_ptr<std::vector<glm::vec3>> normals(new std::vector<glm::vec3>);
+		std::shared_ptr<std::vector<glm::uvec3>> faces(new std::vector<glm::uvec3>);
+		RegisterBench("BuildMeshlets/level_" + std::to_string(level), kMacroBench,
+			[level, vertices, normals, faces](BenchState& state) {
+				if (faces->empty()) {
+					Menger menger(kMin, kMax);
+					menger.set_nesting_level(level);
+					menger.generate_geometry(*vertices, *normals, *faces);
+				}
+				std::vector<glm::vec4> v = *vertices;
+				std::vector<glm::vec3> n = *normals;
+				std::vector<glm::uvec3> f = *faces;
+				std::vector<Meshlet> meshlets;
+				std::vector<uint16_t> local_indices;
+				BuildMeshlets(&v, &n, &f, &meshlets, &local_indices);
+				DoNotOptimize(meshlets.data());
+				state.items = f.size();
+			});
+	}
+
+	// From the viewer's default camera; items are meshlets tested.
+	for (int level = 2; level <= kMaxBenchLevel; level++) {
+		std::shared_ptr<std::vector<Meshlet>> meshlets(new std::vector<Meshlet>);
+		RegisterBench("CullMeshlets/level_" + std::to_string(level), kMicroBench,
+			[level, meshlets](BenchState& state) {
+				if (meshlets->empty()) {
+					Menger menger(kMin, kMax);
+					menger.set_nesting_level(level);
+					std::vector<glm::vec4> vertices;
+					std::vector<glm::vec3> normals;
+					std::vector<glm::uvec3> faces;
+					std::vector<uint16_t> local_indices;
+					menger.generate_geometry(vertices, normals, faces);
+					BuildMeshlets(&vertices, &normals, &faces, meshlets.get(), &local_indices);
+				}
+				Camera camera;
+				glm::mat4 view_projection = glm::perspective(glm::radians(45.0f),
+						800.0f / 600.0f, 0.0001f, 1000.0f) * camera.get_view_matrix();
+				std::vector<uint32_t> visible;
+				visible.reserve(meshlets->size());
+				for (long i = 0; i < state.iterations; i++) {
+					visible.clear();
+					MeshletCullStats stats;
+					CullMeshlets(*meshlets, view_projection, camera.get_eye_position(),
+					             &visible, &stats);
+					DoNotOptimize(visible.data());
+				}
+				state.items = meshlets->size();
+			});
+	}
+
+	RegisterBench("FloorClipmap/build", kMicroBench, [](BenchState& state) {
+		size_t patches = 0;
+		for (long i = 0; i < state.iterations; i++) {
+			FloorClipmap floor;
+			floor.update(glm::vec3(0.0f));
+			patches = floor.visible_patches();
+			DoNotOptimize(floor.vertices().data());
+		}
+		state.items = patches;
+	});
+
+	// A walk along x: most frames stay inside every window, and each cell
+	// crossed rewrites a column of slots in the levels it moves.
+	RegisterBench("FloorClipmap::update/walk", kMicroBench, [](BenchState& state) {
+		FloorClipmap floor;
+		glm::vec3 eye(0.0f);
+		for (long i = 0; i < state.iterations; i++) {
+			eye.x += 0.1f;
+			floor.update(eye);
+			floor.clear_dirty();
+		}
+		DoNotOptimize(floor.vertices().data());
+	});
+
+	RegisterBench("Camera::get_view_matrix", kMicroBench, [](BenchState& state) {
+		Camera camera;
+		for (long i = 0; i < state.iterations; i++) {
+			glm::mat4 view = camera.get_view_matrix();
+			DoNotOptimize(view);
+		}
+	});
+
+	for (int fps = 0; fps <= 1; fps++) {
+		std::shared_ptr<Camera> camera(new Camera);
+		if (fps)
+			camera->toggleFPS();
+		RegisterBench(fps ? "Camera::rotate/fps" : "Camera::rotate/orbit", kMicroBench,
+			[camera](BenchState& state) {
+				camera->setMouseCoord(0.0f, 0.0f);
+				// Sweep back and forth so the camera stays in a sane range.
+				for (long i = 0; i < state.iterations; i++) {
+					float t = (i & 63) < 32 ? (i & 31) : 32 - (i & 31);
+					camera->rotate(t, 0.5f * t);
+				}
+				glm::mat4 view = camera->get_view_matrix();
+				DoNotOptimize(view);
+			});
+	}
+}
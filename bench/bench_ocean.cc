@@ -0,0 +1,25 @@
+#include "bench.h"
+#include <memory>
+#include <ocean.h>
+
+void RegisterOceanBenches()
+{
+	// One simulated frame at 60 Hz per call; the spectrum is drawn in the
+	// warm-up sample.
+	for (int grid : { 128, 256, 512 }) {
+		RegisterBench("Ocean::simulate/" + std::to_string(grid), kMacroBench,
+			[grid, ocean = std::shared_ptr<Ocean>(), time = 0.0f](BenchState& state) mutable {
+				if (!ocean) {
+					OceanParams params;
+					params.grid = grid;
+					ocean = std::make_shared<Ocean>(params);
+				}
+				time += 1.0f / 60.0f;
+				ocean->simulate(time);
+				DoNotOptimize(ocean->normals().data());
+				state.items = grid * grid;
+				state.bytes = sizeof(float) * (ocean->displacement().size() +
+				                               ocean->normals().size());
+			});
+	}
+}
@@ -0,0 +1,540 @@
+#include "bench.h"
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <camera.h>
+#include <floor.h>
+#include <index_optimizer.h>
+#include <menger.h>
+#include <meshlet.h>
+#include <per_frame.h>
+#include <scene.h>
+#include <shader_cache.h>
+#include <shaders.h>
+
+/*
+ * Triangle throughput of the two cube pipelines: the geometry shader that
+ * derives a flat normal per triangle, and per-face normal attributes with
+ * no geometry shader.  One call draws the whole sponge into an offscreen
+ * target from the viewer's default camera; each sample ends in glFinish,
+ * so the time covers the GPU work rather than just command submission.
+ *
+ * The index_order benches draw the same meshes after each index pass, for
+ * the effect of vertex reuse and overdraw on that time, and the
+ * cube_culling benches draw them with nothing culled, with back faces
+ * culled by the GPU, and with whole meshlets culled on the CPU first.
+ *
+ * The scene_draw benches cull a grid of sponges from the default camera,
+ * stream the transforms of those in view and draw them, either with one
+ * instanced call per level or with one call per sponge.
+ *
+ * The floor_draw benches draw the floor clipmap from its vertex and flag
+ * buffers and from nothing, as the eye walks along x.
+ */
+namespace {
+	const int kWidth = 800, kHeight = 600;
+	const int kMinPipelineLevel = 2;
+	const int kMaxPipelineLevel = 4;
+	const int kMinIndexOrderLevel = 3;
+	const unsigned kIndexOrders[] = { 0, kIndexPassWeld | kIndexPassCache, kIndexPassOverdraw,
+	                                  kIndexPassAll };
+
+	glm::vec3 kMin(-0.5f, -0.5f, -0.5f);
+	glm::vec3 kMax(0.5f, 0.5f, 0.5f);
+
+	enum { kCullNone, kCullFaces, kCullMeshlets, kNumCullModes };
+	const char* kCullModeNames[kNumCullModes] = { "none", "faces", "meshlets" };
+
+	enum { kGeometryShaderCube, kNormalsCube, kNumCubePipelines };
+	const char* kPipelineNames[kNumCubePipelines] = { "geometry_shader", "normals" };
+
+	enum { kDrawInstanced, kDrawPerInstance, kNumSceneDraws };
+	const char* kSceneDrawNames[kNumSceneDraws] = { "instanced", "per_instance" };
+	const GLuint kInstanceAttribute = 2;
+
+	enum { kFloorBuffers, kFloorProcedural, kNumFloorModes };
+	const char* kFloorModeNames[kNumFloorModes] = { "buffers", "procedural" };
+
+	struct PipelineContext {
+		bool ok = false;
+		GLuint programs[kNumCubePipelines];
+		GLuint scene_program;
+		glm::mat4 projection;
+		glm::mat4 view_projection;
+		glm::vec3 eye;
+		GLuint uniform_buffer;
+	};
+
+	struct SpongeMesh {
+		GLuint vao = 0;
+		GLsizei index_count = 0;
+		std::vector<Meshlet> meshlets;  // Indices are 16-bit if there are any.
+	};
+
+	struct SceneMesh {
+		GLuint vao = 0;
+		GLuint instance_buffer = 0;
+		SceneMeshes meshes;
+		SpongeScene scene;
+	};
+
+	// A hidden window whose context renders into an offscreen target, with
+	// both cube programs and the per-frame block set up.  Built on first use
+	// so that --list and CPU-only filters never touch the GPU.
+	PipelineContext& pipeline_context()
+	{
+		static PipelineContext ctx;
+		static bool tried = false;
+		if (tried)
+			return ctx;
+		tried = true;
+
+		if (!glfwInit()) {
+			std::cerr << "cube_pipeline: glfwInit failed\n";
+			return ctx;
+		}
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+		GLFWwindow* window = glfwCreateWindow(kWidth, kHeight, "menger_bench", nullptr, nullptr);
+		if (!window) {
+			std::cerr << "cube_pipeline: cannot create an OpenGL 4.1 context\n";
+			return ctx;
+		}
+		glfwMakeContextCurrent(window);
+		glewExperimental = GL_TRUE;
+		if (glewInit() != GLEW_OK) {
+			std::cerr << "cube_pipeline: glewInit failed\n";
+			return ctx;
+		}
+		glGetError();  // clear GLEW's error for it
+
+		GLuint framebuffer, renderbuffers[2];
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(2, renderbuffers);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, kWidth, kHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, kWidth, kHeight);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+		glViewport(0, 0, kWidth, kHeight);
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_LESS);
+
+		const std::vector<std::pair<GLuint, std::string>> frag_data = {
+			{ 0, "fragment_color" },
+		};
+		std::vector<ProgramSpec> specs = {
+			{ "cube",
+			  { { GL_VERTEX_SHADER, vertex_shader },
+			    { GL_GEOMETRY_SHADER, geometry_shader },
+			    { GL_FRAGMENT_SHADER, fragment_shader } },
+			  { { 0, "vertex_position" } }, frag_data },
+			{ "cube_normals",
+			  { { GL_VERTEX_SHADER, cube_vertex_shader },
+			    { GL_FRAGMENT_SHADER, fragment_shader } },
+			  { { 0, "vertex_position" }, { 1, "vertex_normal" } }, frag_data },
+			{ "instances",
+			  { { GL_VERTEX_SHADER, instance_vertex_shader },
+			    { GL_FRAGMENT_SHADER, fragment_shader } },
+			  { { 0, "vertex_position" }, { 1, "vertex_normal" },
+			    { kInstanceAttribute, "instance_transform" } }, frag_data },
+		};
+		ShaderCache cache("");
+		std::vector<GLuint> programs = cache.build(specs);
+		for (size_t i = 0; i < programs.size(); i++) {
+			glUniformBlockBinding(programs[i],
+					glGetUniformBlockIndex(programs[i], "PerFrame"), kPerFrameBinding);
+		}
+		for (int i = 0; i < kNumCubePipelines; i++)
+			ctx.programs[i] = programs[i];
+		ctx.scene_program = programs[kNumCubePipelines];
+
+		Camera camera;
+		PerFrameUniforms per_frame = PerFrameUniforms();
+		per_frame.projection = glm::perspective(glm::radians(45.0f),
+				static_cast<float>(kWidth) / kHeight, 0.0001f, 1000.0f);
+		per_frame.view = camera.get_view_matrix();
+		per_frame.light_position = glm::vec4(-10.0f, 10.0f, 0.0f, 1.0f);
+		per_frame.eye_position = glm::vec4(camera.get_eye_position(), 1.0f);
+		ctx.projection = per_frame.projection;
+		ctx.view_projection = per_frame.projection * per_frame.view;
+		ctx.eye = camera.get_eye_position();
+		glGenBuffers(1, &ctx.uniform_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, ctx.uniform_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(per_frame), &per_frame, GL_STATIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, kPerFrameBinding, ctx.uniform_buffer);
+
+		ctx.ok = glGetError() == GL_NO_ERROR;
+		if (!ctx.ok)
+			std::cerr << "cube_pipeline: OpenGL setup failed\n";
+		return ctx;
+	}
+
+	// Uploads the sponge in the layout the pipeline expects into a new VAO,
+	// after the given index passes and optionally split into meshlets.
+	SpongeMesh make_mesh(int pipeline, int level, unsigned index_passes = 0,
+	                     bool meshlets = false)
+	{
+		Menger menger(kMin, kMax);
+		menger.set_nesting_level(level);
+		std::vector<glm::vec4> vertices;
+		std::vector<glm::vec3> normals;
+		std::vector<glm::uvec3> faces;
+		if (pipeline == kNormalsCube)
+			menger.generate_geometry(vertices, normals, faces);
+		else
+			menger.generate_geometry(vertices, faces);
+		OptimizeIndices(index_passes, &vertices, &normals, &faces);
+		SpongeMesh mesh;
+		std::vector<uint16_t> local_indices;
+		if (meshlets)
+			BuildMeshlets(&vertices, &normals, &faces, &mesh.meshlets, &local_indices);
+
+		GLuint buffers[3];
+		glGenVertexArrays(1, &mesh.vao);
+		glBindVertexArray(mesh.vao);
+		glGenBuffers(3, buffers);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * vertices.size(),
+				vertices.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(0);
+		if (!normals.empty()) {
+			glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * normals.size(),
+					normals.data(), GL_STATIC_DRAW);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+			glEnableVertexAttribArray(1);
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[2]);
+		if (meshlets) {
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * local_indices.size(),
+					local_indices.data(), GL_STATIC_DRAW);
+		} else {
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::uvec3) * faces.size(),
+					faces.data(), GL_STATIC_DRAW);
+		}
+		mesh.index_count = faces.size() * 3;
+		return mesh;
+	}
+
+	// A grid of count sponges and every level's mesh, uploaded as the
+	// viewer does with --scene.
+	void make_scene(size_t count, SceneMesh* mesh)
+	{
+		MakeSceneGrid(count, &mesh->scene);
+		BuildSceneMeshes(&mesh->meshes);
+		GLuint buffers[3];
+		glGenVertexArrays(1, &mesh->vao);
+		glBindVertexArray(mesh->vao);
+		glGenBuffers(3, buffers);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * mesh->meshes.vertices.size(),
+				mesh->meshes.vertices.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * mesh->meshes.normals.size(),
+				mesh->meshes.normals.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(1);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[2]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::uvec3) * mesh->meshes.faces.size(),
+				mesh->meshes.faces.data(), GL_STATIC_DRAW);
+		glGenBuffers(1, &mesh->instance_buffer);
+		for (int column = 0; column < 4; column++) {
+			glEnableVertexAttribArray(kInstanceAttribute + column);
+			glVertexAttribDivisor(kInstanceAttribute + column, 1);
+		}
+	}
+
+	// The viewer's floor program for either mode, built on first use since
+	// tessellation stages are slow to compile.
+	GLuint floor_program(int mode)
+	{
+		static GLuint programs[kNumFloorModes];
+		if (programs[mode])
+			return programs[mode];
+		std::vector<std::pair<GLuint, std::string>> attributes;
+		if (mode == kFloorBuffers)
+			attributes = { { 0, "vertex_position" }, { 1, "patch_flags" } };
+		ShaderCache cache("");
+		GLuint program = cache.build({
+			{ "floor",
+			  { { GL_VERTEX_SHADER, mode == kFloorProcedural ? procedural_floor_vertex_shader
+			                                                 : floor_vertex_shader },
+			    { GL_TESS_CONTROL_SHADER, quadTessControlShader },
+			    { GL_TESS_EVALUATION_SHADER, quadTessEvaluationShader },
+			    { GL_GEOMETRY_SHADER, geometry_shader },
+			    { GL_FRAGMENT_SHADER, floor_fragment_shader } },
+			  attributes, { { 0, "fragment_color" } } } })[0];
+		glUniformBlockBinding(program, glGetUniformBlockIndex(program, "PerFrame"),
+				kPerFrameBinding);
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "is_floor"), 1);
+		if (mode == kFloorProcedural) {
+			FloorLayout layout;
+			glUniform1i(glGetUniformLocation(program, "floor_levels"), layout.levels);
+			glUniform1i(glGetUniformLocation(program, "floor_ring"), layout.ring);
+			glUniform1f(glGetUniformLocation(program, "floor_cell"), layout.cell);
+			glUniform1f(glGetUniformLocation(program, "floor_height"), kFloorHeight);
+		}
+		programs[mode] = program;
+		return program;
+	}
+
+	// Points the transform attributes at the instance'th mat4 of the
+	// bound array buffer.
+	void point_instances(size_t instance)
+	{
+		for (int column = 0; column < 4; column++) {
+			glVertexAttribPointer(kInstanceAttribute + column, 4, GL_FLOAT, GL_FALSE,
+					sizeof(glm::mat4), reinterpret_cast<const void*>(
+						sizeof(glm::mat4) * instance + sizeof(glm::vec4) * column));
+		}
+	}
+};
+
+void RegisterPipelineBenches()
+{
+	for (int pipeline = 0; pipeline < kNumCubePipelines; pipeline++) {
+		for (int level = kMinPipelineLevel; level <= kMaxPipelineLevel; level++) {
+			std::shared_ptr<SpongeMesh> mesh(new SpongeMesh);
+			RegisterBench(std::string("cube_pipeline/") + kPipelineNames[pipeline] +
+					"/level_" + std::to_string(level), kMicroBench,
+				[pipeline, level, mesh](BenchState& state) {
+					PipelineContext& ctx = pipeline_context();
+					if (!ctx.ok)
+						return;
+					if (!mesh->vao)
+						*mesh = make_mesh(pipeline, level);
+					glUseProgram(ctx.programs[pipeline]);
+					glBindVertexArray(mesh->vao);
+					for (long i = 0; i < state.iterations; i++) {
+						glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+						glDrawElements(GL_TRIANGLES, mesh->index_count, GL_UNSIGNED_INT, 0);
+					}
+					glFinish();
+					state.items = mesh->index_count / 3;
+				});
+		}
+	}
+
+	for (int pipeline = 0; pipeline < kNumCubePipelines; pipeline++) {
+		for (int level = kMinIndexOrderLevel; level <= kMaxPipelineLevel; level++) {
+			for (unsigned passes : kIndexOrders) {
+				std::shared_ptr<SpongeMesh> mesh(new SpongeMesh);
+				RegisterBench(std::string("index_order/") + kPipelineNames[pipeline] +
+						"/level_" + std::to_string(level) + "/" + IndexPassNames(passes),
+						kMicroBench,
+					[pipeline, level, passes, mesh](BenchState& state) {
+						PipelineContext& ctx = pipeline_context();
+						if (!ctx.ok)
+							return;
+						if (!mesh->vao)
+							*mesh = make_mesh(pipeline, level, passes);
+						glUseProgram(ctx.programs[pipeline]);
+						glBindVertexArray(mesh->vao);
+						for (long i = 0; i < state.iterations; i++) {
+							glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+							glDrawElements(GL_TRIANGLES, mesh->index_count, GL_UNSIGNED_INT, 0);
+						}
+						glFinish();
+						state.items = mesh->index_count / 3;
+					});
+			}
+		}
+	}
+
+	// Items are the triangles of the whole sponge, drawn or not, so rates
+	// compare directly.
+	for (int pipeline = 0; pipeline < kNumCubePipelines; pipeline++) {
+		for (int level = kMinIndexOrderLevel; level <= kMaxPipelineLevel; level++) {
+			for (int mode = 0; mode < kNumCullModes; mode++) {
+				std::shared_ptr<SpongeMesh> mesh(new SpongeMesh);
+				RegisterBench(std::string("cube_culling/") + kPipelineNames[pipeline] +
+						"/level_" + std::to_string(level) + "/" + kCullModeNames[mode],
+						kMicroBench,
+					[pipeline, level, mode, mesh](BenchState& state) {
+						PipelineContext& ctx = pipeline_context();
+						if (!ctx.ok)
+							return;
+						if (!mesh->vao)
+							*mesh = make_mesh(pipeline, level, 0, mode == kCullMeshlets);
+						glUseProgram(ctx.programs[pipeline]);
+						glBindVertexArray(mesh->vao);
+						if (mode != kCullNone)
+							glEnable(GL_CULL_FACE);
+						std::vector<uint32_t> visible;
+						std::vector<GLsizei> counts;
+						std::vector<const void*> offsets;
+						std::vector<GLint> base_vertices;
+						for (long i = 0; i < state.iterations; i++) {
+							glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+							if (mode != kCullMeshlets) {
+								glDrawElements(GL_TRIANGLES, mesh->index_count, GL_UNSIGNED_INT, 0);
+								continue;
+							}
+							visible.clear();
+							counts.clear();
+							offsets.clear();
+							base_vertices.clear();
+							MeshletCullStats stats;
+							CullMeshlets(mesh->meshlets, ctx.view_projection, ctx.eye,
+							             &visible, &stats);
+							for (uint32_t m : visible) {
+								const Meshlet& meshlet = mesh->meshlets[m];
+								counts.push_back(meshlet.triangle_count * 3);
+								offsets.push_back(reinterpret_cast<const void*>(
+										sizeof(uint16_t) * 3 * meshlet.triangle_offset));
+								base_vertices.push_back(meshlet.vertex_offset);
+							}
+							glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(),
+									GL_UNSIGNED_SHORT, offsets.data(), visible.size(),
+									base_vertices.data());
+						}
+						glFinish();
+						glDisable(GL_CULL_FACE);
+						state.items = mesh->index_count / 3;
+					});
+			}
+		}
+	}
+
+	// Items are every sponge in the scene, drawn or not.
+	for (size_t count : { 10000, 100000 }) {
+		for (int draw = 0; draw < kNumSceneDraws; draw++) {
+			std::shared_ptr<SceneMesh> mesh(new SceneMesh);
+			RegisterBench("scene_draw/" + std::to_string(count) + "/" + kSceneDrawNames[draw],
+					kMicroBench,
+				[count, draw, mesh](BenchState& state) {
+					PipelineContext& ctx = pipeline_context();
+					if (!ctx.ok)
+						return;
+					if (!mesh->vao)
+						make_scene(count, mesh.get());
+					const SceneMeshes& meshes = mesh->meshes;
+					glUseProgram(ctx.scene_program);
+					glBindVertexArray(mesh->vao);
+					glBindBuffer(GL_ARRAY_BUFFER, mesh->instance_buffer);
+					glEnable(GL_CULL_FACE);
+					SceneDrawList draws;
+					for (long i = 0; i < state.iterations; i++) {
+						glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+						SceneCullStats stats;
+						mesh->scene.cull(ctx.view_projection, ctx.eye,
+						                 0.5f * kHeight * ctx.projection[1][1], kSceneMaxLevel,
+						                 &draws, &stats);
+						glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * draws.transforms.size(),
+								draws.transforms.data(), GL_STREAM_DRAW);
+						for (int level = 0; level <= kSceneMaxLevel; level++) {
+							const void* indices = reinterpret_cast<const void*>(
+									sizeof(glm::uvec3) * meshes.first_face[level]);
+							GLsizei index_count = 3 * meshes.face_count[level];
+							if (draw == kDrawInstanced) {
+								if (draws.count(level) == 0)
+									continue;
+								point_instances(draws.first[level]);
+								glDrawElementsInstancedBaseVertex(GL_TRIANGLES, index_count,
+										GL_UNSIGNED_INT, indices, draws.count(level),
+										meshes.base_vertex[level]);
+								continue;
+							}
+							for (size_t j = draws.first[level]; j < draws.first[level + 1]; j++) {
+								point_instances(j);
+								glDrawElementsInstancedBaseVertex(GL_TRIANGLES, index_count,
+										GL_UNSIGNED_INT, indices, 1, meshes.base_vertex[level]);
+							}
+						}
+					}
+					glFinish();
+					glDisable(GL_CULL_FACE);
+					state.items = count;
+				});
+		}
+	}
+
+	// Items are patch slots.  The buffer floor uploads the slots each step
+	// of the walk rewrites, as the viewer does; the procedural floor only
+	// sees the eye move in the per-frame block.
+	for (int mode = 0; mode < kNumFloorModes; mode++) {
+		std::shared_ptr<FloorClipmap> floor(new FloorClipmap);
+		RegisterBench(std::string("floor_draw/") + kFloorModeNames[mode], kMicroBench,
+			[mode, floor, vao = GLuint(0), buffers = std::vector<GLuint>(2),
+			 eye = glm::vec3(0.0f)](BenchState& state) mutable {
+				PipelineContext& ctx = pipeline_context();
+				if (!ctx.ok)
+					return;
+				if (!vao) {
+					eye = ctx.eye;
+					glGenVertexArrays(1, &vao);
+					glBindVertexArray(vao);
+					if (mode == kFloorBuffers) {
+						floor->update(eye);
+						floor->clear_dirty();
+						glGenBuffers(2, buffers.data());
+						glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+						glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * floor->vertices().size(),
+								floor->vertices().data(), GL_DYNAMIC_DRAW);
+						glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+						glEnableVertexAttribArray(0);
+						glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+						glBufferData(GL_ARRAY_BUFFER, sizeof(uint32_t) * floor->flags().size(),
+								floor->flags().data(), GL_DYNAMIC_DRAW);
+						glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, 0, 0);
+						glEnableVertexAttribArray(1);
+					}
+				}
+				FloorLayout layout;
+				glUseProgram(floor_program(mode));
+				glBindVertexArray(vao);
+				glBindBuffer(GL_UNIFORM_BUFFER, ctx.uniform_buffer);
+				glPatchParameteri(GL_PATCH_VERTICES, 4);
+				for (long i = 0; i < state.iterations; i++) {
+					glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+					eye.x += 0.1f;
+					glm::vec4 eye_position(eye, 1.0f);
+					glBufferSubData(GL_UNIFORM_BUFFER, offsetof(PerFrameUniforms, eye_position),
+							sizeof(eye_position), &eye_position);
+					if (mode == kFloorProcedural) {
+						glDrawArraysInstanced(GL_PATCHES, 0, 4 * layout.ring * layout.ring,
+								layout.levels);
+						continue;
+					}
+					floor->update(eye);
+					for (int l = 0; l < floor->levels(); l++) {
+						FloorClipmap::Range range = floor->dirty_vertices(l);
+						if (!range.empty()) {
+							glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+							glBufferSubData(GL_ARRAY_BUFFER, range.begin * sizeof(glm::vec4),
+									(range.end - range.begin) * sizeof(glm::vec4),
+									floor->vertices().data() + range.begin);
+						}
+						range = floor->dirty_flags(l);
+						if (!range.empty()) {
+							glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+							glBufferSubData(GL_ARRAY_BUFFER, range.begin * sizeof(uint32_t),
+									(range.end - range.begin) * sizeof(uint32_t),
+									floor->flags().data() + range.begin);
+						}
+					}
+					floor->clear_dirty();
+					glDrawArrays(GL_PATCHES, 0, floor->vertices().size());
+				}
+				glFinish();
+				// Put the eye back for the benches after this one.
+				glm::vec4 eye_position(ctx.eye, 1.0f);
+				glBufferSubData(GL_UNIFORM_BUFFER, offsetof(PerFrameUniforms, eye_position),
+						sizeof(eye_position), &eye_position);
+				state.items = layout.patches();
+			});
+	}
+}
@@ -0,0 +1,50 @@
+#include "bench.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <memory>
+#include <camera.h>
+#include <scene.h>
+
+namespace {
+	const int kWidth = 800, kHeight = 600;
+
+	enum { kDefaultView, kOverview, kNumSceneViews };
+	const char* kSceneViewNames[kNumSceneViews] = { "default_view", "overview" };
+};
+
+void RegisterSceneBenches()
+{
+	// Culling and level selection for grids of sponges, from the viewer's
+	// default camera, which sees a small part of a large grid, and from
+	// high above, where every instance is in view and gets drawn.
+	for (size_t count : { 10000, 100000, 1000000 }) {
+		std::shared_ptr<SpongeScene> scene(new SpongeScene);
+		for (int view = 0; view < kNumSceneViews; view++) {
+			RegisterBench("SpongeScene::cull/" + std::to_string(count) + "/" +
+					kSceneViewNames[view], kMicroBench,
+				[count, view, scene](BenchState& state) {
+					if (scene->empty())
+						MakeSceneGrid(count, scene.get());
+					glm::mat4 projection = glm::perspective(glm::radians(45.0f),
+							float(kWidth) / kHeight, 0.0001f, 1000.0f);
+					Camera camera;
+					glm::vec3 eye = camera.get_eye_position();
+					glm::mat4 view_matrix = camera.get_view_matrix();
+					if (view == kOverview) {
+						// Sponges are spaced 2.25 apart; rise until all fit.
+						float extent = 1.2f * std::sqrt(float(count));
+						eye = glm::vec3(0.0f, 2.5f * extent, 0.01f);
+						view_matrix = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+					}
+					SceneDrawList draws;
+					SceneCullStats stats;
+					for (long i = 0; i < state.iterations; i++) {
+						scene->cull(projection * view_matrix, eye, 0.5f * kHeight * projection[1][1],
+						            kSceneMaxLevel, &draws, &stats);
+						DoNotOptimize(draws.transforms.data());
+					}
+					state.items = count;
+				});
+		}
+	}
+}
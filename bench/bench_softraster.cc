@@ -0,0 +1,57 @@
+#include "bench.h"
+#include <floor.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <memory>
+#include <menger.h>
+#include <softraster.h>
+
+namespace {
+	const int kWidth = 800;
+	const int kHeight = 600;
+
+	// The viewer's default camera and light.
+	SoftUniforms default_uniforms()
+	{
+		const glm::vec3 eye(0.0f, 10.0f, 10.0f);
+		SoftUniforms uniforms;
+		uniforms.projection = glm::perspective(glm::radians(45.0f),
+				float(kWidth) / kHeight, 0.0001f, 1000.0f);
+		uniforms.view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		uniforms.light_position = glm::vec4(-10.0f, 10.0f, 0.0f, 1.0f);
+		uniforms.eye_position = eye;
+		return uniforms;
+	}
+
+	struct Scene {
+		std::vector<glm::vec4> vertices;
+		std::vector<glm::uvec3> faces;
+		FloorClipmap floor;
+		SoftRasterizer raster{ kWidth, kHeight };
+	};
+};
+
+void RegisterSoftRasterBenches()
+{
+	// One whole frame of sponge and floor per call.
+	for (int level = 0; level <= 4; level++) {
+		RegisterBench("SoftRasterizer/level_" + std::to_string(level), kMacroBench,
+			[level, scene = std::shared_ptr<Scene>()](BenchState& state) mutable {
+				const SoftUniforms uniforms = default_uniforms();
+				if (!scene) {
+					scene = std::make_shared<Scene>();
+					Menger menger(glm::vec3(-0.5f), glm::vec3(0.5f));
+					menger.set_nesting_level(level);
+					menger.generate_geometry(scene->vertices, scene->faces);
+					scene->floor.update(uniforms.eye_position);
+				}
+				SoftRasterizer& raster = scene->raster;
+				raster.begin_frame(uniforms);
+				raster.draw_mesh(scene->vertices, scene->faces);
+				raster.draw_floor(scene->floor);
+				raster.end_frame();
+				DoNotOptimize(raster.pixels().data());
+				state.items = raster.submitted_triangles();
+				state.bytes = raster.pixels().size();
+			});
+	}
+}
@@ -0,0 +1,37 @@
+#include "bench.h"
+#include <floor.h>
+#include <waves.h>
+
+void RegisterWaveBenches()
+{
+	// Points spread over the floor, as buoys and debris would be.
+	for (size_t count : { 256, 4096, 65536 }) {
+		RegisterBench("WaveField::query/" + std::to_string(count), kMicroBench,
+			[count](BenchState& state) {
+				WaveField waves(kFloorHeight);
+				waves.set_time(1.5f, 0.5f);
+				std::vector<float> x(count), z(count), height(count);
+				std::vector<float> nx(count), ny(count), nz(count);
+				for (size_t i = 0; i < count; i++) {
+					x[i] = -20.0f + 40.0f * ((i * 7919) % count) / count;
+					z[i] = -20.0f + 40.0f * ((i * 104729) % count) / count;
+				}
+				for (long i = 0; i < state.iterations; i++) {
+					waves.query(count, x.data(), z.data(), height.data(),
+					            nx.data(), ny.data(), nz.data());
+					DoNotOptimize(height.data());
+				}
+				state.items = count;
+			});
+	}
+
+	RegisterBench("WaveField::height", kMicroBench, [](BenchState& state) {
+		WaveField waves(kFloorHeight);
+		waves.set_time(1.5f, 0.5f);
+		float sum = 0.0f;
+		for (long i = 0; i < state.iterations; i++)
+			sum += waves.height(0.01f * (i & 1023), 0.0f);
+		DoNotOptimize(sum);
+		state.items = 1;
+	});
+}
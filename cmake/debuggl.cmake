@@ -0,0 +1,7 @@
+# OFF compiles CHECK_GL_ERROR down to the bare statement for release builds.
+OPTION(DEBUGGL_CHECKS "Compile in the CHECK_GL_ERROR checks" ON)
+IF (DEBUGGL_CHECKS)
+	ADD_DEFINITIONS(-DDEBUGGL_ENABLED=1)
+ELSE ()
+	ADD_DEFINITIONS(-DDEBUGGL_ENABLED=0)
+ENDIF ()
@@ -0,0 +1,4 @@
+# The shared job system (g_jobs) runs its workers on std::threads, and
+# JpegEncoder writes files on one of its own.
+FIND_PACKAGE(Threads REQUIRED)
+LIST(APPEND stdgl_libraries ${CMAKE_THREAD_LIBS_INIT})
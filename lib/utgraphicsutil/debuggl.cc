@@ -1,6 +1,58 @@
 #include "debuggl.h"
+#include <GL/glew.h>
 #include <portable_gl.h>
 #include <GLFW/glfw3.h>
+#include <atomic>
+#include <iostream>
+
+bool debuggl_sync_checks = DEBUGGL_ENABLED;
+
+namespace {
+	std::atomic<long> async_errors(0);
+
+	const char* source_name(GLenum source) {
+		switch (source) {
+			case GL_DEBUG_SOURCE_API: return "API";
+			case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window system";
+			case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+			case GL_DEBUG_SOURCE_THIRD_PARTY: return "third party";
+			case GL_DEBUG_SOURCE_APPLICATION: return "application";
+			default: return "other";
+		}
+	}
+
+	// May be called from a driver thread, so it only prints and counts.
+	void APIENTRY debug_callback(GLenum source, GLenum type, GLuint id,
+	                             GLenum severity, GLsizei length,
+	                             const GLchar* message, const void* user)
+	{
+		if (type == GL_DEBUG_TYPE_ERROR)
+			async_errors++;
+		std::cerr << "OpenGL debug (" << source_name(source) << ", id " << id << ")"
+		          << (type == GL_DEBUG_TYPE_ERROR ? " error: " : ": ")
+		          << message << std::endl;
+	}
+
+	bool install_debug_callback()
+	{
+		if (GLEW_VERSION_4_3 || GLEW_KHR_debug) {
+			glEnable(GL_DEBUG_OUTPUT);
+			glDebugMessageCallback(debug_callback, nullptr);
+			// Errors and anything the driver rates medium or worse.
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+			glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_HIGH, 0, nullptr, GL_TRUE);
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_MEDIUM, 0, nullptr, GL_TRUE);
+			return true;
+		}
+		if (GLEW_ARB_debug_output) {
+			glDebugMessageCallbackARB(debug_callback, nullptr);
+			glDebugMessageControlARB(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_LOW_ARB, 0, nullptr, GL_FALSE);
+			return true;
+		}
+		return false;
+	}
+};
 
 const char* DebugGLErrorToString(int error) {
 	switch (error) {
@@ -26,6 +78,33 @@ const char* DebugGLErrorToString(int error) {
 	return "Unicorns Exist";
 }
 
+DebugGLMode debugglSetMode(DebugGLMode mode)
+{
+	if (!DEBUGGL_ENABLED)
+		mode = kDebugGLOff;
+	if (mode == kDebugGLAsync && !install_debug_callback()) {
+		std::cerr << "KHR_debug is not available, falling back to glGetError checks\n";
+		mode = kDebugGLSync;
+	}
+	debuggl_sync_checks = (mode == kDebugGLSync);
+	return mode;
+}
+
+const char* debugglModeName(DebugGLMode mode)
+{
+	switch (mode) {
+		case kDebugGLOff: return "off";
+		case kDebugGLAsync: return "async";
+		case kDebugGLSync: return "sync";
+	}
+	return "unknown";
+}
+
+long debugglAsyncErrorCount()
+{
+	return async_errors;
+}
+
 void debugglTerminate()
 {
 	glfwTerminate();
@@ -1,6 +1,33 @@
 #ifndef DEBUGGL_H
 #define DEBUGGL_H
 
+/*
+ * DEBUGGL_ENABLED=0 (cmake -DDEBUGGL_CHECKS=OFF) is the release build:
+ * CHECK_GL_ERROR only runs its statement.
+ *
+ * Otherwise the checking mode is picked at runtime with debugglSetMode:
+ *   kDebugGLSync   glGetError() after every CHECK_GL_ERROR. Exact line
+ *                  numbers, but each call can force a pipeline sync.
+ *   kDebugGLAsync  errors are reported by the driver through a KHR_debug
+ *                  callback, without stalling; CHECK_GL_ERROR is a no-op.
+ *   kDebugGLOff    no checking at all.
+ * The shader and program checks always run; they are only used at startup.
+ */
+#ifndef DEBUGGL_ENABLED
+#define DEBUGGL_ENABLED 1
+#endif
+
+enum DebugGLMode { kDebugGLOff, kDebugGLAsync, kDebugGLSync };
+
+// Needs a current context. Async falls back to sync when neither GL 4.3,
+// KHR_debug nor ARB_debug_output is available. Returns the mode in effect.
+DebugGLMode debugglSetMode(DebugGLMode mode);
+const char* debugglModeName(DebugGLMode mode);
+// Errors reported through the debug callback so far.
+long debugglAsyncErrorCount();
+
+extern bool debuggl_sync_checks;
+
 void debugglTerminate();
 
 #define CHECK_SUCCESS(x)   \
@@ -46,17 +73,24 @@ void debugglTerminate();
     }                                                                        \
   } while (0)
 
+#if DEBUGGL_ENABLED
 #define CHECK_GL_ERROR(statement)                                             \
   do {                                                                        \
     { statement; }                                                            \
     GLenum error = GL_NO_ERROR;                                               \
-    if ((error = glGetError()) != GL_NO_ERROR) {                              \
+    if (debuggl_sync_checks && (error = glGetError()) != GL_NO_ERROR) {       \
       std::cerr << __func__ << " Line :" << __LINE__ << " OpenGL Error: code  = " << error \
                 << " description =  " << DebugGLErrorToString(int(error));    \
       debugglTerminate();                                                        \
       exit(EXIT_FAILURE);                                                     \
     }                                                                         \
   } while (0)
+#else
+#define CHECK_GL_ERROR(statement)                                             \
+  do {                                                                        \
+    { statement; }                                                            \
+  } while (0)
+#endif
 
 const char* DebugGLErrorToString(int error);
 
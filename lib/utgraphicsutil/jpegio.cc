@@ -1,92 +1,267 @@
 #include "jpegio.h"
+#include <algorithm>
 #include <vector>
-#include <jpeglib.h>
+#include <setjmp.h>
 #include <stdio.h>
+#include <jpeglib.h>
 
-bool SaveJPEG(const std::string& filename,
-              int image_width,
-              int image_height,
-              const unsigned char* pixels)
+namespace {
+	// Rows handed to jpeg_read_scanlines per call; libjpeg returns fewer
+	// if it buffers fewer.
+	const JDIMENSION kRowsPerCall = 16;
+
+	// libjpeg's own error_exit calls exit(), which would take the whole
+	// viewer down from a worker thread over one bad file.  This one prints
+	// the message and jumps back to the setjmp of the call that failed.
+	// Between that setjmp and any libjpeg call, callers keep only locals
+	// without destructors, since a longjmp skips them.
+	struct ErrorManager {
+		struct jpeg_error_mgr pub;
+		jmp_buf jump;
+	};
+
+	void error_exit(j_common_ptr cinfo)
+	{
+		(*cinfo->err->output_message)(cinfo);
+		longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+	}
+
+	// libjpeg destination that appends to a std::vector, growing it as the
+	// encoder fills the spare capacity.
+	struct VectorDestination {
+		struct jpeg_destination_mgr pub;
+		std::vector<unsigned char>* out;
+	};
+
+	void init_destination(j_compress_ptr cinfo)
+	{
+		VectorDestination* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+		dest->out->resize(std::max<size_t>(dest->out->capacity(), 4096));
+		dest->pub.next_output_byte = dest->out->data();
+		dest->pub.free_in_buffer = dest->out->size();
+	}
+
+	boolean empty_output_buffer(j_compress_ptr cinfo)
+	{
+		// libjpeg only calls this with the whole buffer used up.
+		VectorDestination* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+		size_t used = dest->out->size();
+		dest->out->resize(used * 2);
+		dest->pub.next_output_byte = dest->out->data() + used;
+		dest->pub.free_in_buffer = dest->out->size() - used;
+		return TRUE;
+	}
+
+	void term_destination(j_compress_ptr cinfo)
+	{
+		VectorDestination* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+		dest->out->resize(dest->out->size() - dest->pub.free_in_buffer);
+	}
+
+	// libjpeg source over a buffer holding the whole file.
+	void init_source(j_decompress_ptr)
+	{
+	}
+
+	boolean fill_input_buffer(j_decompress_ptr cinfo)
+	{
+		// Out of data: hand libjpeg an EOI so a truncated file still ends.
+		static const JOCTET kEoi[2] = { 0xFF, JPEG_EOI };
+		cinfo->src->next_input_byte = kEoi;
+		cinfo->src->bytes_in_buffer = 2;
+		return TRUE;
+	}
+
+	void skip_input_data(j_decompress_ptr cinfo, long count)
+	{
+		if (count <= 0)
+			return;
+		size_t skip = std::min<size_t>(count, cinfo->src->bytes_in_buffer);
+		cinfo->src->next_input_byte += skip;
+		cinfo->src->bytes_in_buffer -= skip;
+	}
+
+	void term_source(j_decompress_ptr)
+	{
+	}
+};
+
+int JpegMcuWidth(JpegSubsampling subsampling)
+{
+	return subsampling == kJpeg444 ? 8 : 16;
+}
+
+int JpegMcuHeight(JpegSubsampling subsampling)
+{
+	return subsampling == kJpeg420 ? 16 : 8;
+}
+
+bool EncodeJPEG(int image_width,
+                int image_height,
+                const unsigned char* const* rows,
+                const JpegOptions& options,
+                std::vector<unsigned char>* out)
 {
 	struct jpeg_compress_struct cinfo;
-	struct jpeg_error_mgr jerr;
-	FILE* outfile;
-	JSAMPROW row_pointer[1];
-	int row_stride;
+	ErrorManager jerr;
+	VectorDestination dest;
 
-	cinfo.err = jpeg_std_error(&jerr);
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = error_exit;
 	jpeg_create_compress(&cinfo);
-
-	outfile = fopen(filename.c_str(), "wb");
-	if (outfile == NULL)
+	if (setjmp(jerr.jump)) {
+		jpeg_destroy_compress(&cinfo);
 		return false;
+	}
 
-	jpeg_stdio_dest(&cinfo, outfile);
+	dest.pub.init_destination = init_destination;
+	dest.pub.empty_output_buffer = empty_output_buffer;
+	dest.pub.term_destination = term_destination;
+	dest.out = out;
+	cinfo.dest = &dest.pub;
 
 	cinfo.image_width = image_width;
 	cinfo.image_height = image_height;
 	cinfo.input_components = 3;
 	cinfo.in_color_space = JCS_RGB;
 	jpeg_set_defaults(&cinfo);
-	jpeg_set_quality(&cinfo, 100, (boolean)true);
+	jpeg_set_quality(&cinfo, options.quality, (boolean)true);
+	// Chroma components keep libjpeg's 1x1 sampling; luma sets the ratio.
+	cinfo.comp_info[0].h_samp_factor = options.subsampling == kJpeg444 ? 1 : 2;
+	cinfo.comp_info[0].v_samp_factor = options.subsampling == kJpeg420 ? 2 : 1;
+	cinfo.restart_interval = options.restart_interval;
 	jpeg_start_compress(&cinfo, (boolean)true);
 
-	row_stride = image_width * 3;
-
+	// libjpeg takes as many rows per call as it can buffer.
 	while (cinfo.next_scanline < cinfo.image_height) {
-		row_pointer[0] = const_cast<unsigned char*>(
-				&pixels[(cinfo.image_height - 1 - cinfo.next_scanline) * row_stride]);
-		jpeg_write_scanlines(&cinfo, row_pointer, 1);
+		jpeg_write_scanlines(&cinfo,
+				const_cast<JSAMPARRAY>(rows + cinfo.next_scanline),
+				cinfo.image_height - cinfo.next_scanline);
 	}
 
 	jpeg_finish_compress(&cinfo);
-	fclose(outfile);
-
 	jpeg_destroy_compress(&cinfo);
 	return true;
 }
 
-bool LoadJPEG(const std::string& file_name, Image* image)
+bool SaveJPEG(const std::string& filename,
+              int image_width,
+              int image_height,
+              const unsigned char* pixels,
+              const JpegOptions& options)
+{
+	std::vector<const unsigned char*> rows(image_height);
+	size_t row_stride = size_t(image_width) * 3;
+	for (int y = 0; y < image_height; y++)
+		rows[y] = &pixels[(image_height - 1 - y) * row_stride];
+
+	std::vector<unsigned char> data;
+	if (!EncodeJPEG(image_width, image_height, rows.data(), options, &data))
+		return false;
+
+	FILE* outfile = fopen(filename.c_str(), "wb");
+	if (outfile == NULL)
+		return false;
+	bool written = fwrite(data.data(), 1, data.size(), outfile) == data.size();
+	return fclose(outfile) == 0 && written;
+}
+
+bool DecodeJPEG(const unsigned char* data,
+                size_t size,
+                Image* image,
+                const JpegDecodeOptions& options)
 {
-	FILE* file = fopen(file_name.c_str(), "rb");
 	struct jpeg_decompress_struct info;
-	struct jpeg_error_mgr err;
+	ErrorManager err;
+	struct jpeg_source_mgr src;
 
-	info.err = jpeg_std_error(&err);
+	info.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = error_exit;
 	jpeg_create_decompress(&info);
-
-	if (file == NULL)
+	if (setjmp(err.jump)) {
+		jpeg_destroy_decompress(&info);
 		return false;
+	}
 
-	jpeg_stdio_src(&info, file);
-	jpeg_read_header(&info, (boolean)true);
+	src.next_input_byte = data;
+	src.bytes_in_buffer = size;
+	src.init_source = init_source;
+	src.fill_input_buffer = fill_input_buffer;
+	src.skip_input_data = skip_input_data;
+	src.resync_to_restart = jpeg_resync_to_restart;
+	src.term_source = term_source;
+	info.src = &src;
+
+	if (jpeg_read_header(&info, (boolean)true) != JPEG_HEADER_OK) {
+		jpeg_destroy_decompress(&info);
+		return false;
+	}
+	info.scale_num = 1;
+	info.scale_denom = options.scale_denom;
+	while (options.max_size > 0 && info.scale_denom < 8 &&
+	       std::max(info.image_width, info.image_height) >
+	       unsigned(options.max_size) * info.scale_denom)
+		info.scale_denom *= 2;
+	// libjpeg converts grayscale too, so rows need no repacking.
+	int channels = 3;
+	info.out_color_space = JCS_RGB;
+#ifdef JCS_EXTENSIONS
+	if (options.rgba) {
+		info.out_color_space = JCS_EXT_RGBA;
+		channels = 4;
+	}
+#endif
 	jpeg_start_decompress(&info);
 
 	image->width = info.output_width;
 	image->height = info.output_height;
+	int out_channels = options.rgba ? 4 : 3;
+	image->stride = image->width * out_channels;
+	image->bytes.resize(size_t(image->stride) * image->height);
 
-	int channels = info.num_components;
-	long size = image->width * image->height * 3;
-
-	image->bytes.resize(size);
-
-	int a = (channels > 2 ? 1 : 0);
-	int b = (channels > 2 ? 2 : 0);
-	std::vector<unsigned char> scan_line(image->width * channels, 0);
-	unsigned char* p1 = &scan_line[0];
-	unsigned char** p2 = &p1;
-	unsigned char* out_scan_line = image->bytes.data();
+	// Decode straight into the image, as many rows per call as libjpeg
+	// will take.
+	size_t row_stride = channels == out_channels ? image->stride : size_t(image->width) * channels;
 	while (info.output_scanline < info.output_height) {
-		jpeg_read_scanlines(&info, p2, 1);
-		for (int i = 0; i < image->width; ++i) {
-			out_scan_line[3 * i] = scan_line[channels * i];
-			out_scan_line[3 * i + 1] = scan_line[channels * i + a];
-			out_scan_line[3 * i + 2] = scan_line[channels * i + b];
-		}
-		out_scan_line += image->width * 3;
+		JSAMPROW rows[kRowsPerCall];
+		JDIMENSION count = std::min(kRowsPerCall, info.output_height - info.output_scanline);
+		for (JDIMENSION i = 0; i < count; i++)
+			rows[i] = &image->bytes[(info.output_scanline + i) * row_stride];
+		jpeg_read_scanlines(&info, rows, count);
 	}
 	jpeg_finish_decompress(&info);
-	fclose(file);
+	jpeg_destroy_decompress(&info);
+
+	// Without libjpeg-turbo's RGBA output, spread RGB out backwards.
+	if (channels != out_channels) {
+		unsigned char* p = image->bytes.data();
+		for (size_t i = size_t(image->width) * image->height; i-- > 0;) {
+			p[4 * i + 3] = 255;
+			p[4 * i + 2] = p[3 * i + 2];
+			p[4 * i + 1] = p[3 * i + 1];
+			p[4 * i] = p[3 * i];
+		}
+	}
 	return true;
 }
 
+bool LoadJPEG(const std::string& file_name,
+              Image* image,
+              const JpegDecodeOptions& options)
+{
+	FILE* file = fopen(file_name.c_str(), "rb");
+	if (file == NULL)
+		return false;
+	std::vector<unsigned char> data;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size > 0) {
+		data.resize(size);
+		data.resize(fread(data.data(), 1, data.size(), file));
+	}
+	fclose(file);
+	if (data.empty())
+		return false;
+	return DecodeJPEG(data.data(), data.size(), image, options);
+}
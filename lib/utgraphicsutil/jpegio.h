@@ -2,12 +2,50 @@
 #define JPEGIO_H
 
 #include <string>
+#include <vector>
 #include "image.h"
 
+enum JpegSubsampling { kJpeg444, kJpeg422, kJpeg420 };
+
+struct JpegOptions {
+	int quality = 100;
+	JpegSubsampling subsampling = kJpeg420;  // What libjpeg picks by default.
+	int restart_interval = 0;  // MCUs between restart markers, 0 for none.
+};
+
+// Pixel size of one MCU, the unit restart intervals count in.
+int JpegMcuWidth(JpegSubsampling subsampling);
+int JpegMcuHeight(JpegSubsampling subsampling);
+
+// Encodes RGB8 rows, top row first, into out, replacing its contents.
+bool EncodeJPEG(int image_width,
+                int image_height,
+                const unsigned char* const* rows,
+                const JpegOptions& options,
+                std::vector<unsigned char>* out);
+// Pixels are RGB8 with the bottom row first, as glReadPixels returns them.
 bool SaveJPEG(const std::string& filename,
               int image_width,
               int image_height,
-              const unsigned char* pixels);
-bool LoadJPEG(const std::string& file_name, Image* image);
+              const unsigned char* pixels,
+              const JpegOptions& options = JpegOptions());
+struct JpegDecodeOptions {
+	// Decode at 1/scale_denom of the full size (1, 2, 4 or 8) using
+	// libjpeg's scaled inverse DCT, which is much cheaper than a full
+	// decode plus downsampling.
+	int scale_denom = 1;
+	// If set, scale_denom is raised (up to 8) until neither side is larger.
+	int max_size = 0;
+	bool rgba = false;  // Four channels with alpha 255 instead of RGB.
+};
+
+// Rows come out top row first; image->stride is the bytes per row.
+bool DecodeJPEG(const unsigned char* data,
+                size_t size,
+                Image* image,
+                const JpegDecodeOptions& options = JpegDecodeOptions());
+bool LoadJPEG(const std::string& file_name,
+              Image* image,
+              const JpegDecodeOptions& options = JpegDecodeOptions());
 
 #endif
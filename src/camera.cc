@@ -28,6 +28,21 @@ Camera::get_eye_position() const {
 	return eye_;
 }
 
+CameraPose
+Camera::get_pose() const {
+	return CameraPose{ eye_, center_, up_ };
+}
+
+void
+Camera::set_pose(const CameraPose& pose) {
+	eye_ = pose.eye;
+	center_ = pose.center;
+	up_ = glm::normalize(pose.up);
+	look_ = glm::normalize(center_ - eye_);
+	right_ = glm::normalize(glm::cross(look_, up_));
+	camera_distance_ = glm::length(center_ - eye_);
+}
+
 void
 Camera::toggleFPS() {
 	fps_on = !fps_on;
@@ -4,10 +4,19 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 
+// What the view depends on; enough to put a camera back where it was.
+struct CameraPose {
+	glm::vec3 eye;
+	glm::vec3 center;
+	glm::vec3 up;
+};
+
 class Camera {
 public:
 	glm::mat4 get_view_matrix() const;
 	glm::vec3 get_eye_position() const;
+	CameraPose get_pose() const;
+	void set_pose(const CameraPose& pose);
 	void toggleFPS();
 	void setMouseCoord(float mouse_x, float mouse_y);
 	void rotate(float mouse_x, float mouse_y);
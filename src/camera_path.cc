@@ -0,0 +1,254 @@
+#include "camera_path.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+
+namespace {
+	const uint32_t kPathMagic = 0x4854504d;  // "MPTH"
+	const uint32_t kPathVersion = 2;
+
+	// Field by field, with no padding: magic, version, then int64 frames,
+	// pose key count and state key count.
+	const size_t kHeaderSize = 4 + 4 + 3 * 8;
+	// int64 frame, then eye, center and up as three floats each.
+	const size_t kPoseKeySize = 8 + 9 * 4;
+	// int64 frame, int32 nesting level and ocean mode, float wireframe
+	// threshold, a byte for each of the three bools, float tessellation
+	// pixels, int32 inner and outer level.
+	const size_t kStateKeySize = 8 + 3 * 4 + 3 + 3 * 4;
+
+	template <typename T>
+	void put(std::string* out, T value)
+	{
+		out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	void put_vec3(std::string* out, const glm::vec3& v)
+	{
+		put<float>(out, v.x);
+		put<float>(out, v.y);
+		put<float>(out, v.z);
+	}
+
+	// Reads fields back in the order put() wrote them; ok() turns false,
+	// and stays false, at the first read past the end or bad bool.
+	class Reader {
+	public:
+		explicit Reader(const std::string& data) : data_(data) {}
+
+		size_t remaining() const { return data_.size() - pos_; }
+		bool ok() const { return ok_; }
+
+		template <typename T>
+		T get()
+		{
+			T value = T();
+			if (!ok_ || remaining() < sizeof(T)) {
+				ok_ = false;
+				return value;
+			}
+			std::memcpy(&value, data_.data() + pos_, sizeof(T));
+			pos_ += sizeof(T);
+			return value;
+		}
+
+		glm::vec3 get_vec3()
+		{
+			float x = get<float>();
+			float y = get<float>();
+			float z = get<float>();
+			return glm::vec3(x, y, z);
+		}
+
+		bool get_bool()
+		{
+			uint8_t byte = get<uint8_t>();
+			if (byte > 1)
+				ok_ = false;
+			return byte == 1;
+		}
+
+	private:
+		const std::string& data_;
+		size_t pos_ = 0;
+		bool ok_ = true;
+	};
+
+	bool same_pose(const CameraPose& a, const CameraPose& b)
+	{
+		return a.eye == b.eye && a.center == b.center && a.up == b.up;
+	}
+
+	template <typename Key>
+	void advance(const std::vector<Key>& keys, long frame, size_t* next)
+	{
+		if (*next > 0 && keys[*next - 1].frame > frame)
+			*next = 0;
+		while (*next < keys.size() && keys[*next].frame <= frame)
+			(*next)++;
+	}
+};
+
+bool
+ViewState::operator==(const ViewState& other) const
+{
+	return nesting_level == other.nesting_level && ocean_mode == other.ocean_mode &&
+	       wireframe_thresh == other.wireframe_thresh &&
+	       line_polygons == other.line_polygons && cube_normals == other.cube_normals &&
+	       adaptive_tess == other.adaptive_tess && tess_pixels == other.tess_pixels &&
+	       inner_level == other.inner_level && outer_level == other.outer_level;
+}
+
+void
+CameraPath::record(long frame, const CameraPose& pose, const ViewState& state)
+{
+	if (poses_.empty() || !same_pose(poses_.back().pose, pose))
+		poses_.push_back(PoseKey{ frame, pose });
+	if (states_.empty() || states_.back().state != state)
+		states_.push_back(StateKey{ frame, state });
+	frames_ = std::max(frames_, frame + 1);
+}
+
+bool
+CameraPath::save(const std::string& file) const
+{
+	std::string data;
+	data.reserve(kHeaderSize + kPoseKeySize * poses_.size() + kStateKeySize * states_.size());
+	put<uint32_t>(&data, kPathMagic);
+	put<uint32_t>(&data, kPathVersion);
+	put<int64_t>(&data, frames_);
+	put<int64_t>(&data, poses_.size());
+	put<int64_t>(&data, states_.size());
+	for (const PoseKey& key : poses_) {
+		put<int64_t>(&data, key.frame);
+		put_vec3(&data, key.pose.eye);
+		put_vec3(&data, key.pose.center);
+		put_vec3(&data, key.pose.up);
+	}
+	for (const StateKey& key : states_) {
+		const ViewState& state = key.state;
+		put<int64_t>(&data, key.frame);
+		put<int32_t>(&data, state.nesting_level);
+		put<int32_t>(&data, state.ocean_mode);
+		put<float>(&data, state.wireframe_thresh);
+		put<uint8_t>(&data, state.line_polygons);
+		put<uint8_t>(&data, state.cube_normals);
+		put<uint8_t>(&data, state.adaptive_tess);
+		put<float>(&data, state.tess_pixels);
+		put<int32_t>(&data, state.inner_level);
+		put<int32_t>(&data, state.outer_level);
+	}
+	std::ofstream out(file, std::ios::binary);
+	out.write(data.data(), data.size());
+	return bool(out);
+}
+
+bool
+CameraPath::load(const std::string& file)
+{
+	std::ifstream in(file, std::ios::binary);
+	if (!in)
+		return false;
+	std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	Reader reader(data);
+	if (reader.get<uint32_t>() != kPathMagic || reader.get<uint32_t>() != kPathVersion)
+		return false;
+	int64_t frames = reader.get<int64_t>();
+	int64_t pose_count = reader.get<int64_t>();
+	int64_t state_count = reader.get<int64_t>();
+	// Both counts must account for exactly the rest of the file, which also
+	// keeps a corrupt count from sizing the vectors.
+	size_t rest = reader.remaining();
+	if (!reader.ok() || frames < 1 || pose_count < 1 || state_count < 1 ||
+	    uint64_t(pose_count) > rest / kPoseKeySize ||
+	    uint64_t(state_count) > rest / kStateKeySize ||
+	    kPoseKeySize * pose_count + kStateKeySize * state_count != rest)
+		return false;
+
+	// Keys must start at frame 0 and go strictly forward within the
+	// recording, or at() would hand back the wrong ones.
+	std::vector<PoseKey> poses(pose_count);
+	for (int64_t i = 0; i < pose_count; i++) {
+		PoseKey& key = poses[i];
+		int64_t frame = reader.get<int64_t>();
+		key.pose.eye = reader.get_vec3();
+		key.pose.center = reader.get_vec3();
+		key.pose.up = reader.get_vec3();
+		if ((i == 0 && frame != 0) || (i > 0 && frame <= poses[i - 1].frame) ||
+		    frame >= frames)
+			return false;
+		key.frame = frame;
+	}
+	std::vector<StateKey> states(state_count);
+	for (int64_t i = 0; i < state_count; i++) {
+		StateKey& key = states[i];
+		ViewState& state = key.state;
+		int64_t frame = reader.get<int64_t>();
+		state.nesting_level = reader.get<int32_t>();
+		state.ocean_mode = reader.get<int32_t>();
+		state.wireframe_thresh = reader.get<float>();
+		state.line_polygons = reader.get_bool();
+		state.cube_normals = reader.get_bool();
+		state.adaptive_tess = reader.get_bool();
+		state.tess_pixels = reader.get<float>();
+		state.inner_level = reader.get<int32_t>();
+		state.outer_level = reader.get<int32_t>();
+		if ((i == 0 && frame != 0) || (i > 0 && frame <= states[i - 1].frame) ||
+		    frame >= frames)
+			return false;
+		key.frame = frame;
+	}
+	if (!reader.ok())
+		return false;
+
+	poses_.swap(poses);
+	states_.swap(states);
+	frames_ = frames;
+	next_pose_ = next_state_ = 0;
+	return true;
+}
+
+void
+CameraPath::at(long frame, CameraPose* pose, ViewState* state)
+{
+	advance(poses_, frame, &next_pose_);
+	advance(states_, frame, &next_state_);
+	*pose = poses_[std::max<size_t>(next_pose_, 1) - 1].pose;
+	*state = states_[std::max<size_t>(next_state_, 1) - 1].state;
+}
+
+void
+PrintFrameTimeReport(std::ostream& os, const std::vector<float>& frame_ms)
+{
+	if (frame_ms.empty())
+		return;
+	double total = 0.0;
+	for (float ms : frame_ms)
+		total += ms;
+	os << std::fixed << std::setprecision(2)
+	   << "frames: " << frame_ms.size() << " in " << total / 1000.0 << " s, "
+	   << 1000.0 * frame_ms.size() / total << " fps\n" << std::defaultfloat;
+	PrintPercentiles(os, "frame", frame_ms);
+}
+
+void
+PrintPercentiles(std::ostream& os, const std::string& label, const std::vector<float>& ms)
+{
+	if (ms.empty())
+		return;
+	std::vector<float> sorted = ms;
+	std::sort(sorted.begin(), sorted.end());
+	auto percentile = [&sorted](double p) {
+		return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+	};
+	double total = 0.0;
+	for (float m : ms)
+		total += m;
+	os << std::fixed << std::setprecision(2)
+	   << label << " ms: mean " << total / ms.size() << ", p50 " << percentile(0.50)
+	   << ", p95 " << percentile(0.95) << ", p99 " << percentile(0.99)
+	   << ", max " << sorted.back() << "\n" << std::defaultfloat;
+}
@@ -0,0 +1,73 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "camera.h"
+
+// Everything besides the camera that changes what a frame draws.
+struct ViewState {
+	int nesting_level = 0;
+	int ocean_mode = 0;
+	float wireframe_thresh = 0.0f;
+	bool line_polygons = false;
+	bool cube_normals = true;
+	bool adaptive_tess = true;
+	float tess_pixels = 16.0f;
+	int inner_level = 0;
+	int outer_level = 0;
+
+	bool operator==(const ViewState& other) const;
+	bool operator!=(const ViewState& other) const { return !(*this == other); }
+};
+
+/*
+ * A recorded walk through the scene, frame by frame, for replaying the same
+ * frames in another build and comparing their timing.
+ *
+ * Only changes are kept: a pose or state is stored with the frame it first
+ * appears in and holds until the next one, so a still camera costs nothing.
+ * The file is a versioned header followed by the two key arrays, written
+ * field by field with fixed-width types in the machine's byte order; load()
+ * rejects truncated files, out-of-range bools and keys out of frame order.
+ */
+class CameraPath {
+public:
+	// Call once per frame, frames counting up from 0.
+	void record(long frame, const CameraPose& pose, const ViewState& state);
+
+	bool save(const std::string& file) const;
+	bool load(const std::string& file);
+
+	// Frames recorded; replay runs 0 .. frames() - 1.
+	long frames() const { return frames_; }
+	long pose_keys() const { return poses_.size(); }
+	long state_keys() const { return states_.size(); }
+	// What was in effect at frame; calls should go forward.
+	void at(long frame, CameraPose* pose, ViewState* state);
+
+private:
+	struct PoseKey {
+		long frame;
+		CameraPose pose;
+	};
+
+	struct StateKey {
+		long frame;
+		ViewState state;
+	};
+
+	std::vector<PoseKey> poses_;
+	std::vector<StateKey> states_;
+	long frames_ = 0;
+	size_t next_pose_ = 0;
+	size_t next_state_ = 0;
+};
+
+// Frame count, total time and the PrintPercentiles line of frame_ms.
+void PrintFrameTimeReport(std::ostream& os, const std::vector<float>& frame_ms);
+// "<label> ms: mean, p50, p95, p99, max" of ms, if there are any.
+void PrintPercentiles(std::ostream& os, const std::string& label, const std::vector<float>& ms);
+
+#endif
@@ -0,0 +1,215 @@
+#include "draw_batcher.h"
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <utility>
+
+bool
+DrawBatcher::supported()
+{
+	// The extensions alone are not enough: the material shaders are GLSL
+	// 4.30, for std430 storage blocks and explicit bindings.
+	return GLEW_VERSION_4_3;
+}
+
+void
+DrawBatcher::init()
+{
+	glGenBuffers(1, &command_buffer_);
+	glGenBuffers(1, &material_buffer_);
+	glGenBuffers(1, &draw_index_buffer_);
+}
+
+void
+DrawBatcher::pack(const std::vector<Material>& materials)
+{
+	std::vector<std::shared_ptr<Image>> images;
+	for (const Material& material : materials) {
+		if (material.texture &&
+		    std::find(images.begin(), images.end(), material.texture) == images.end())
+			images.push_back(material.texture);
+	}
+	if (images == packed_)
+		return;
+
+	if (!arrays_.empty())
+		glDeleteTextures(arrays_.size(), arrays_.data());
+	arrays_.clear();
+	packed_ = images;
+	layers_.assign(images.size(), Layer{ -1, -1 });
+
+	// One array per texture size, in order of first use.
+	std::vector<std::pair<int, int>> sizes;
+	std::vector<int> counts;
+	for (size_t i = 0; i < images.size(); i++) {
+		std::pair<int, int> size(images[i]->width, images[i]->height);
+		size_t array = std::find(sizes.begin(), sizes.end(), size) - sizes.begin();
+		if (array == sizes.size()) {
+			sizes.push_back(size);
+			counts.push_back(0);
+		}
+		layers_[i] = Layer{ int(array), counts[array]++ };
+	}
+
+	arrays_.resize(sizes.size());
+	glGenTextures(arrays_.size(), arrays_.data());
+	glActiveTexture(GL_TEXTURE0 + kMaterialTextureUnit);
+	std::vector<unsigned char> rgba;
+	for (size_t array = 0; array < arrays_.size(); array++) {
+		int width = sizes[array].first, height = sizes[array].second;
+		glBindTexture(GL_TEXTURE_2D_ARRAY, arrays_[array]);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, counts[array], 0,
+		             GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		for (size_t i = 0; i < images.size(); i++) {
+			if (layers_[i].array != int(array))
+				continue;
+			// Images are RGB unless their stride says otherwise; GL gets
+			// RGBA rows, which never need unpack alignment.
+			const Image& image = *images[i];
+			int stride = image.stride > 0 ? image.stride : width * 3;
+			int channels = stride >= width * 4 ? 4 : 3;
+			rgba.resize(size_t(width) * height * 4);
+			for (int y = 0; y < height; y++) {
+				const unsigned char* in = &image.bytes[size_t(y) * stride];
+				unsigned char* out = &rgba[size_t(y) * width * 4];
+				for (int x = 0; x < width; x++) {
+					out[4 * x] = in[channels * x];
+					out[4 * x + 1] = in[channels * x + 1];
+					out[4 * x + 2] = in[channels * x + 2];
+					out[4 * x + 3] = channels == 4 ? in[4 * x + 3] : 255;
+				}
+			}
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layers_[i].layer, width, height, 1,
+			                GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+		}
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void
+DrawBatcher::build(const std::vector<Material>& materials, const std::vector<GLuint>& programs)
+{
+	pack(materials);
+
+	const size_t n = materials.size();
+	std::vector<int> array_of(n, -1);
+	std::vector<int> layer_of(n, -1);
+	for (size_t i = 0; i < n; i++) {
+		if (!materials[i].texture)
+			continue;
+		const Layer& layer = layers_[std::find(packed_.begin(), packed_.end(),
+		                                       materials[i].texture) - packed_.begin()];
+		array_of[i] = layer.array;
+		layer_of[i] = layer.layer;
+	}
+	// Untextured materials join their program's first textured batch.
+	for (size_t i = 0; i < n; i++) {
+		if (array_of[i] >= 0)
+			continue;
+		for (size_t j = 0; j < n; j++) {
+			if (layer_of[j] >= 0 && programs[j] == programs[i]) {
+				array_of[i] = array_of[j];
+				break;
+			}
+		}
+	}
+
+	std::vector<size_t> order(n);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return std::make_pair(programs[a], array_of[a]) < std::make_pair(programs[b], array_of[b]);
+	});
+
+	commands_.clear();
+	batches_.clear();
+	std::vector<MaterialData> data;
+	for (size_t i : order) {
+		const Material& material = materials[i];
+		GLuint index = commands_.size();
+		commands_.push_back(Command{ GLuint(material.nfaces * 3), 1,
+		                             GLuint(material.offset * 3), 0, index });
+		MaterialData d;
+		d.diffuse = material.diffuse;
+		d.ambient = material.ambient;
+		d.specular = material.specular;
+		d.shininess = material.shininess;
+		d.layer = layer_of[i];
+		d.pad[0] = d.pad[1] = 0;
+		data.push_back(d);
+
+		GLuint texture = array_of[i] >= 0 ? arrays_[array_of[i]] : 0;
+		if (batches_.empty() || batches_.back().program != programs[i] ||
+		    batches_.back().texture != texture)
+			batches_.push_back(Batch{ programs[i], texture, index, 0 });
+		batches_.back().count++;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, material_buffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(MaterialData) * data.size(), data.data(),
+	             GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	std::vector<GLuint> draw_index(n);
+	std::iota(draw_index.begin(), draw_index.end(), 0);
+	glBindBuffer(GL_ARRAY_BUFFER, draw_index_buffer_);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * n, draw_index.data(), GL_STATIC_DRAW);
+	glVertexAttribIPointer(kDrawIndexAttribute, 1, GL_UNSIGNED_INT, 0, 0);
+	glVertexAttribDivisor(kDrawIndexAttribute, 1);
+	glEnableVertexAttribArray(kDrawIndexAttribute);
+
+	// Uploaded by the next draw().
+	absolute_.clear();
+}
+
+void
+DrawBatcher::draw(GLuint first_index)
+{
+	Clock::time_point start = Clock::now();
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_);
+	if (absolute_.size() != commands_.size() || first_index != uploaded_first_) {
+		absolute_ = commands_;
+		for (Command& command : absolute_)
+			command.first_index += first_index;
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(Command) * absolute_.size(),
+		             absolute_.data(), GL_STATIC_DRAW);
+		uploaded_first_ = first_index;
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMaterialBinding, material_buffer_);
+	glActiveTexture(GL_TEXTURE0 + kMaterialTextureUnit);
+
+	GLuint program = 0, texture = 0;
+	for (const Batch& batch : batches_) {
+		if (batch.program != program)
+			glUseProgram(program = batch.program);
+		if (batch.texture != 0 && batch.texture != texture)
+			glBindTexture(GL_TEXTURE_2D_ARRAY, texture = batch.texture);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+		                            reinterpret_cast<const void*>(batch.first * sizeof(Command)),
+		                            batch.count, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	stats_.frames++;
+	stats_.draws += commands_.size();
+	stats_.calls += batches_.size();
+	stats_.submit_ms += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void
+DrawBatcher::print_stats(std::ostream& os) const
+{
+	if (stats_.frames == 0)
+		return;
+	double frames = stats_.frames;
+	os << std::fixed << std::setprecision(1)
+	   << "materials: " << stats_.draws / frames << " draws in " << stats_.calls / frames
+	   << " calls per frame, " << std::setprecision(3) << stats_.submit_ms / frames
+	   << " ms CPU submit per frame\n" << std::defaultfloat;
+}
@@ -0,0 +1,111 @@
+#ifndef DRAW_BATCHER_H
+#define DRAW_BATCHER_H
+
+#include <GL/glew.h>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include <material.h>
+
+// Where the batcher's shaders find their per-draw data.
+const unsigned kMaterialBinding = 1;     // Shader storage block.
+const int kMaterialTextureUnit = 3;      // sampler2DArray.
+const GLuint kDrawIndexAttribute = 2;    // Per instance; see DrawBatcher.
+
+/*
+ * Draws a mesh made of Material face ranges in as few calls as possible.
+ *
+ * build() sorts the materials by program and then by texture array.  Every
+ * texture goes into a layer of a GL_TEXTURE_2D_ARRAY holding all textures
+ * of its size, and materials without one ride along with the first array
+ * of their program, so each (program, array) pair is a single batch.  Each
+ * material becomes one indirect command in a GL_DRAW_INDIRECT_BUFFER and
+ * one MaterialData in a shader storage buffer, both in sorted order, and
+ * draw() submits each batch with one glMultiDrawElementsIndirect.
+ *
+ * Shaders find their material through kDrawIndexAttribute, an instanced
+ * attribute holding 0, 1, 2, ...: each command's baseInstance is its own
+ * index, so the attribute reads back the draw's index without
+ * ARB_shader_draw_parameters.
+ *
+ * Needs multi-draw-indirect and shader storage buffers (GL 4.3).
+ */
+class DrawBatcher {
+public:
+	// Matches the std430 layout of MaterialData in material_fragment_shader.
+	struct MaterialData {
+		glm::vec4 diffuse, ambient, specular;
+		float shininess;
+		int layer;  // In the batch's texture array, or -1 for none.
+		int pad[2];
+	};
+
+	struct Stats {
+		long frames = 0;
+		long draws = 0;  // Materials drawn, i.e. calls without batching.
+		long calls = 0;  // glMultiDrawElementsIndirect calls.
+		double submit_ms = 0.0;
+	};
+
+	static bool supported();
+
+	// Needs a current GL context.
+	void init();
+	// Replaces the batches; programs[i] draws materials[i].  The VAO the
+	// mesh is drawn with must be bound, as the draw index attribute is set
+	// up on it.  Textures are only repacked when they changed.
+	void build(const std::vector<Material>& materials, const std::vector<GLuint>& programs);
+	// Draws every material.  first_index is where the mesh's indices start
+	// in the bound element array buffer.  Leaves the last program bound.
+	void draw(GLuint first_index);
+
+	int draws() const { return commands_.size(); }
+	int batches() const { return batches_.size(); }
+	int texture_arrays() const { return arrays_.size(); }
+	const Stats& stats() const { return stats_; }
+	// Per-frame draws, calls and CPU submit time.
+	void print_stats(std::ostream& os) const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// Laid out as GL reads DrawElementsIndirectCommand.
+	struct Command {
+		GLuint count;
+		GLuint instance_count;
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance;
+	};
+
+	struct Batch {
+		GLuint program;
+		GLuint texture;  // Array, or 0.
+		size_t first;    // Command.
+		GLsizei count;
+	};
+
+	// Where a texture went.
+	struct Layer {
+		int array;
+		int layer;
+	};
+
+	void pack(const std::vector<Material>& materials);
+
+	GLuint command_buffer_ = 0;
+	GLuint material_buffer_ = 0;
+	GLuint draw_index_buffer_ = 0;
+	std::vector<Command> commands_;  // first_index relative to the mesh.
+	std::vector<Command> absolute_;  // As uploaded.
+	GLuint uploaded_first_ = 0;
+	std::vector<Batch> batches_;
+
+	std::vector<GLuint> arrays_;
+	std::vector<std::shared_ptr<Image>> packed_;  // In packing order.
+	std::vector<Layer> layers_;                   // Parallel to packed_.
+	Stats stats_;
+};
+
+#endif
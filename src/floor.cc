@@ -0,0 +1,140 @@
+#include "floor.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	int wrap(int i, int n) {
+		int r = i % n;
+		return r < 0 ? r + n : r;
+	}
+
+	void extend(FloorClipmap::Range& range, size_t slot) {
+		if (range.empty()) {
+			range.begin = slot;
+			range.end = slot + 1;
+		} else {
+			range.begin = std::min(range.begin, slot);
+			range.end = std::max(range.end, slot + 1);
+		}
+	}
+
+	bool inside(glm::ivec2 p, glm::ivec2 min, int size) {
+		return p.x >= min.x && p.x < min.x + size && p.y >= min.y && p.y < min.y + size;
+	}
+};
+
+FloorClipmap::FloorClipmap(const FloorLayout& layout)
+	: levels_(layout.levels), ring_(layout.ring), cell_(layout.cell), state_(layout.levels)
+{
+	vertices_.resize(4 * levels_ * ring_ * ring_);
+	flags_.assign(vertices_.size(), kFloorPatchCulled);
+}
+
+size_t
+FloorClipmap::patch_slot(int level, int x, int z) const
+{
+	return (size_t(level) * ring_ + wrap(z, ring_)) * ring_ + wrap(x, ring_);
+}
+
+bool
+FloorClipmap::update(const glm::vec3& eye)
+{
+	std::vector<bool> moved(levels_, false);
+	for (int l = 0; l < levels_; l++) {
+		// Snapping to two cells keeps the finer level's window on whole
+		// cells of this one.
+		float size = 2.0f * cell_ * float(1 << l);
+		glm::ivec2 centre(2 * int(std::floor(eye.x / size + 0.5f)),
+		                  2 * int(std::floor(eye.z / size + 0.5f)));
+		glm::ivec2 origin = centre - glm::ivec2(ring_ / 2);
+		if (state_[l].valid && state_[l].origin == origin)
+			continue;
+		move_window(l, origin);
+		moved[l] = true;
+	}
+
+	bool changed = false;
+	for (int l = 0; l < levels_; l++) {
+		if (moved[l] || (l > 0 && moved[l - 1])) {
+			update_flags(l);
+			changed = true;
+		}
+	}
+	if (changed)
+		visible_patches_ = std::count_if(flags_.begin(), flags_.end(),
+				[](uint32_t f) { return !(f & kFloorPatchCulled); }) / 4;
+	return changed;
+}
+
+void
+FloorClipmap::move_window(int l, glm::ivec2 origin)
+{
+	Level& level = state_[l];
+	float step = cell_ * float(1 << l);
+	for (int z = origin.y; z < origin.y + ring_; z++) {
+		for (int x = origin.x; x < origin.x + ring_; x++) {
+			if (level.valid && inside(glm::ivec2(x, z), level.origin, ring_))
+				continue;
+			size_t v = 4 * patch_slot(l, x, z);
+			vertices_[v] = glm::vec4(x * step, kFloorHeight, z * step, 1.0f);
+			vertices_[v + 1] = glm::vec4(x * step, kFloorHeight, (z + 1) * step, 1.0f);
+			vertices_[v + 2] = glm::vec4((x + 1) * step, kFloorHeight, (z + 1) * step, 1.0f);
+			vertices_[v + 3] = glm::vec4((x + 1) * step, kFloorHeight, z * step, 1.0f);
+			extend(level.dirty_vertices, v);
+			extend(level.dirty_vertices, v + 3);
+		}
+	}
+	level.origin = origin;
+	level.valid = true;
+}
+
+// Edge e of a patch follows the tessellation control shader's outer levels:
+// 0 is the +z side, 1 the -x side, 2 the -z side and 3 the +x side.
+void
+FloorClipmap::update_flags(int l)
+{
+	Level& level = state_[l];
+	glm::ivec2 lo = level.origin;
+	glm::ivec2 hi = level.origin + glm::ivec2(ring_ - 1);
+	bool has_coarser = l + 1 < levels_;
+	bool has_finer = l > 0;
+	int hole_size = ring_ / 2;
+	glm::ivec2 hole = has_finer ? state_[l - 1].origin / 2 : glm::ivec2(0);
+
+	for (int z = lo.y; z <= hi.y; z++) {
+		for (int x = lo.x; x <= hi.x; x++) {
+			uint32_t flags = 0;
+			if (has_finer && inside(glm::ivec2(x, z), hole, hole_size)) {
+				flags = kFloorPatchCulled;
+			} else {
+				if (has_coarser) {
+					flags |= (z == hi.y) << 0 | (x == lo.x) << 1 |
+					         (z == lo.y) << 2 | (x == hi.x) << 3;
+				}
+				if (has_finer) {
+					bool along_x = x >= hole.x && x < hole.x + hole_size;
+					bool along_z = z >= hole.y && z < hole.y + hole_size;
+					flags |= (along_x && z == hole.y - 1) << 4 |
+					         (along_z && x == hole.x + hole_size) << 5 |
+					         (along_x && z == hole.y + hole_size) << 6 |
+					         (along_z && x == hole.x - 1) << 7;
+				}
+			}
+			size_t v = 4 * patch_slot(l, x, z);
+			if (flags_[v] != flags) {
+				std::fill(flags_.begin() + v, flags_.begin() + v + 4, flags);
+				extend(level.dirty_flags, v);
+				extend(level.dirty_flags, v + 3);
+			}
+		}
+	}
+}
+
+void
+FloorClipmap::clear_dirty()
+{
+	for (Level& level : state_) {
+		level.dirty_vertices = Range();
+		level.dirty_flags = Range();
+	}
+}
@@ -0,0 +1,108 @@
+#ifndef FLOOR_H
+#define FLOOR_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Rest height of the floor and of the ocean surface.
+const float kFloorHeight = -2.0f;
+
+// Per-patch flags read by the floor's tessellation control shader, which
+// gets them as a vertex attribute on every corner of the patch.  Bit e
+// (0..3) marks outer edge e as lying on the coarser level around the
+// patch, bit 4 + e marks it as lying on the finer level inside.
+const uint32_t kFloorPatchCulled = 0x100;  // Covered by a finer level.
+
+// Limits of FloorLayout, for the keys that change it.
+const int kMinFloorLevels = 1, kMaxFloorLevels = 12;
+const int kMinFloorRing = 8, kMaxFloorRing = 64;
+
+/*
+ * Shape of the clipmap: `levels` windows of ring x ring patches, the
+ * finest with patches of `cell`.  ring must be a multiple of 4 and at
+ * least 8.
+ */
+struct FloorLayout {
+	int levels = 7;
+	int ring = 16;
+	float cell = 2.5f;
+
+	size_t patches() const { return size_t(levels) * ring * ring; }
+	// Distance from the eye to the edge of the coarsest window.
+	float extent() const { return 0.5f * ring * cell * float(1 << (levels - 1)); }
+
+	bool operator==(const FloorLayout& other) const
+	{
+		return levels == other.levels && ring == other.ring && cell == other.cell;
+	}
+	bool operator!=(const FloorLayout& other) const { return !(*this == other); }
+};
+
+/*
+ * Geometry clipmap floor: `levels` nested square windows of ring x ring
+ * quad patches, centred on the eye.  Level l has patches of cell * 2^l, so
+ * the floor reaches out to ring * cell * 2^(levels - 1) / 2 with a fixed
+ * number of patches.  The part of each level that a finer level covers is
+ * culled through the patch flags.
+ *
+ * Every level owns ring x ring patch slots addressed by world cell modulo
+ * the window size, each holding its own four corners so the flags can
+ * ride along as a vertex attribute.  Moving the eye only rewrites the rows
+ * and columns of cells that enter a window, and the flags of levels whose
+ * window or hole moved; the dirty ranges say what to upload.
+ *
+ * Patch corners are ordered (x, z), (x, z + 1), (x + 1, z + 1), (x + 1, z)
+ * as the tessellation stages expect, so the floor draws as GL_PATCHES of
+ * four straight from the arrays.
+ *
+ * procedural_floor_vertex_shader derives the same windows and flags from
+ * the eye on the GPU, with no arrays at all; keep the two in step.
+ */
+class FloorClipmap {
+public:
+	struct Range {
+		size_t begin = 0, end = 0;  // Elements, half-open.
+		bool empty() const { return begin >= end; }
+	};
+
+	explicit FloorClipmap(const FloorLayout& layout = FloorLayout());
+
+	// Re-centres every level on eye; returns true if any slot changed.
+	bool update(const glm::vec3& eye);
+
+	int levels() const { return levels_; }
+	// Four corners per patch slot, and the slot's flags for each corner.
+	const std::vector<glm::vec4>& vertices() const { return vertices_; }
+	const std::vector<uint32_t>& flags() const { return flags_; }
+	// Patches not culled after the last update.
+	size_t visible_patches() const { return visible_patches_; }
+
+	// Vertices of `level` written since the last clear_dirty().
+	Range dirty_vertices(int level) const { return state_[level].dirty_vertices; }
+	Range dirty_flags(int level) const { return state_[level].dirty_flags; }
+	void clear_dirty();
+
+private:
+	struct Level {
+		bool valid = false;
+		glm::ivec2 origin;  // Minimum cell of the window, in level cells.
+		Range dirty_vertices;
+		Range dirty_flags;
+	};
+
+	size_t patch_slot(int level, int x, int z) const;
+	void move_window(int level, glm::ivec2 origin);
+	void update_flags(int level);
+
+	int levels_;
+	int ring_;
+	float cell_;
+	std::vector<Level> state_;
+	std::vector<glm::vec4> vertices_;
+	std::vector<uint32_t> flags_;
+	size_t visible_patches_ = 0;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "frame_capture.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+	const GLuint64 kFenceTimeout = 1000000000; // 1s, in ns.
+
+	bool signalled(GLsync fence)
+	{
+		GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+	}
+};
+
+void
+FrameCapture::init()
+{
+	for (Slot& slot : slots_)
+		glGenBuffers(1, &slot.pbo);
+}
+
+void
+FrameCapture::screenshot(const std::string& file)
+{
+	screenshot_file_ = file;
+}
+
+void
+FrameCapture::start_recording(const std::string& prefix)
+{
+	prefix_ = prefix;
+	recording_ = true;
+	frame_ = 0;
+}
+
+void
+FrameCapture::stop_recording()
+{
+	recording_ = false;
+}
+
+void
+FrameCapture::capture(int width, int height)
+{
+	// Readbacks finish in order, so stop at the first one still running.
+	while (in_flight_ > 0) {
+		Slot& oldest = slots_[(next_ + kRingSize - in_flight_) % kRingSize];
+		if (!signalled(oldest.fence))
+			break;
+		retire(oldest, false);
+		in_flight_--;
+	}
+
+	bool screenshot = !screenshot_file_.empty();
+	if (!screenshot && !recording_)
+		return;
+	size_t queued = encoder_.pending();
+	// A screenshot that has to skip this frame takes the next one.
+	if (in_flight_ == kRingSize || queued + in_flight_ >= kMaxQueuedFrames) {
+		dropped_++;
+		return;
+	}
+
+	Slot& slot = slots_[next_];
+	slot.files.clear();
+	if (screenshot) {
+		slot.files.push_back(screenshot_file_);
+		screenshot_file_.clear();
+	}
+	if (recording_) {
+		char name[32];
+		std::snprintf(name, sizeof(name), "_%05ld.jpg", frame_++);
+		slot.files.push_back(prefix_ + name);
+	}
+	slot.width = width;
+	slot.height = height;
+	size_t bytes = size_t(width) * height * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	if (bytes > slot.allocated) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+		slot.allocated = bytes;
+	}
+	// RGBA is the format drivers read back without converting.
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	next_ = (next_ + 1) % kRingSize;
+	in_flight_++;
+	captured_++;
+}
+
+void
+FrameCapture::finish()
+{
+	while (in_flight_ > 0) {
+		retire(slots_[(next_ + kRingSize - in_flight_) % kRingSize], true);
+		in_flight_--;
+	}
+	encoder_.flush();
+}
+
+void
+FrameCapture::retire(Slot& slot, bool wait)
+{
+	if (wait) {
+		while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+		                        kFenceTimeout) == GL_TIMEOUT_EXPIRED)
+			;
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = nullptr;
+
+	size_t bytes = size_t(slot.width) * slot.height * 4;
+	std::vector<uint8_t> rgba = encoder_.spare_buffer();
+	rgba.resize(bytes);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	if (pixels) {
+		std::memcpy(rgba.data(), pixels, bytes);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (!pixels) {
+		std::cerr << "failed to map a frame readback\n";
+		return;
+	}
+	encoder_.submit(slot.files, slot.width, slot.height, 4, std::move(rgba));
+}
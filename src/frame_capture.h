@@ -0,0 +1,70 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include "jpeg_encoder.h"
+
+/*
+ * Screenshots and frame sequences without stalling the render loop.
+ *
+ * capture() queues a glReadPixels of the back buffer into the next of
+ * kRingSize pixel pack buffers and fences it; the pixels are only mapped
+ * once a later frame finds the fence signalled, by which time the copy has
+ * long finished.  Mapped frames go to a JpegEncoder, whose threads write
+ * them out.  When every buffer is still in flight, or the encoder is
+ * kMaxQueuedFrames behind, the frame is skipped rather than waited for and
+ * counted as dropped, so recorded sequences stay numbered consecutively.
+ */
+class FrameCapture {
+public:
+	static const int kRingSize = 3;
+	static const size_t kMaxQueuedFrames = 8;
+
+	// Needs a current GL context.
+	void init();
+
+	// Writes the next captured frame to file, as well as to the recording
+	// if one is running.
+	void screenshot(const std::string& file);
+	// Writes every frame from now on as <prefix>_<frame>.jpg.
+	void start_recording(const std::string& prefix);
+	void stop_recording();
+	bool recording() const { return recording_; }
+
+	// Call once per frame after drawing and before swapping buffers.
+	// Hands finished readbacks to the encoder and starts this frame's
+	// readback if a screenshot or recording wants it.
+	void capture(int width, int height);
+	// Blocks until every readback is mapped and every frame written.
+	void finish();
+
+	long captured_frames() const { return captured_; }
+	long dropped_frames() const { return dropped_; }
+	JpegEncoder& encoder() { return encoder_; }
+
+private:
+	struct Slot {
+		GLuint pbo = 0;
+		GLsync fence = nullptr;
+		size_t allocated = 0;
+		int width = 0, height = 0;
+		std::vector<std::string> files;
+	};
+
+	void retire(Slot& slot, bool wait);
+
+	Slot slots_[kRingSize];
+	int next_ = 0;
+	int in_flight_ = 0;
+	std::string screenshot_file_;
+	std::string prefix_;
+	bool recording_ = false;
+	long frame_ = 0;
+	long captured_ = 0;
+	long dropped_ = 0;
+	JpegEncoder encoder_;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef FRAME_SNAPSHOT_H
+#define FRAME_SNAPSHOT_H
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "camera.h"
+#include "camera_path.h"
+#include "floor.h"
+#include "memory_budget.h"
+#include "meshlet.h"
+
+// The sponge as the simulation generated it; never changed once shared.
+struct SpongeGeometry {
+	int level = 0;
+	std::vector<glm::vec4> vertices;
+	std::vector<glm::vec3> normals;  // Empty unless generated per face.
+	std::vector<glm::uvec3> faces;
+	// Empty unless built with --meshlets on; faces are then in meshlet order.
+	std::vector<Meshlet> meshlets;
+	std::vector<uint16_t> meshlet_indices;
+	MemoryCharge memory{ kMemoryMesh };  // Set to bytes() once built.
+
+	size_t bytes() const
+	{
+		return CapacityBytes(vertices) + CapacityBytes(normals) + CapacityBytes(faces) +
+		       CapacityBytes(meshlets) + CapacityBytes(meshlet_indices);
+	}
+};
+
+/*
+ * Everything the renderer needs to draw one frame, as of one simulation
+ * tick.  The simulation fills a fresh one every tick and the renderer only
+ * ever reads them, so the two never share mutable state.
+ *
+ * The renderer may skip snapshots, so one-off requests are counters and
+ * switches rather than events: a screenshot is due whenever screenshots
+ * went up since the last snapshot drawn.
+ */
+struct FrameSnapshot {
+	long tick = 0;
+	CameraPose pose;
+	ViewState state;
+	float elapsed_time = 0.0f;
+	float tide_time = 0.0f;
+	int width = 0, height = 0;  // Framebuffer.
+	std::shared_ptr<const SpongeGeometry> geometry;
+
+	int screenshots = 0;
+	int recordings = 0;  // Started so far.
+	bool recording = false;
+	bool overlay = false;
+	FloorLayout floor;
+
+	// Input events folded in so far, for input-to-photon latency.
+	long input_events = 0;
+};
+
+// What the renderer reports back after each swap.
+struct DisplayedFrame {
+	long tick = -1;
+	long input_events = 0;
+	std::chrono::steady_clock::time_point time;
+	std::string title;  // Empty unless the overlay changed it.
+};
+
+#endif
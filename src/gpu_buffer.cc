@@ -0,0 +1,100 @@
+#include "gpu_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	const GLbitfield kPersistentFlags =
+		GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const GLuint64 kFenceTimeout = 1000000000; // 1s, in ns.
+};
+
+GpuBuffer::GpuBuffer()
+{
+	std::fill(fences_, fences_ + kSegments, nullptr);
+}
+
+GpuBuffer::~GpuBuffer()
+{
+}
+
+bool
+GpuBuffer::persistent_supported()
+{
+	return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+}
+
+void
+GpuBuffer::init(GLenum target, bool persistent, size_t alignment)
+{
+	target_ = target;
+	persistent_ = persistent && persistent_supported();
+	alignment_ = alignment;
+	glGenBuffers(1, &id_);
+}
+
+void
+GpuBuffer::wait(int segment)
+{
+	if (!fences_[segment])
+		return;
+	while (glClientWaitSync(fences_[segment], GL_SYNC_FLUSH_COMMANDS_BIT,
+	                        kFenceTimeout) == GL_TIMEOUT_EXPIRED)
+		;
+	glDeleteSync(fences_[segment]);
+	fences_[segment] = nullptr;
+}
+
+void
+GpuBuffer::grow(size_t bytes)
+{
+	size_t size = std::max(bytes, segment_size_ * 2);
+	size = (size + alignment_ - 1) / alignment_ * alignment_;
+
+	// Whatever is still queued against the old storage keeps it alive, so
+	// the fences only matter for the memory we are about to write.
+	for (int i = 0; i < kSegments; i++) {
+		if (fences_[i])
+			glDeleteSync(fences_[i]);
+		fences_[i] = nullptr;
+	}
+	segment_size_ = size;
+	current_ = -1;
+	memory_.set(allocated_bytes());
+
+	if (persistent_) {
+		if (mapped_) {
+			glBindBuffer(target_, id_);
+			glUnmapBuffer(target_);
+			glDeleteBuffers(1, &id_);
+			glGenBuffers(1, &id_);
+		}
+		glBindBuffer(target_, id_);
+		glBufferStorage(target_, allocated_bytes(), nullptr, kPersistentFlags);
+		mapped_ = static_cast<char*>(glMapBufferRange(target_, 0, allocated_bytes(),
+		                                              kPersistentFlags));
+	} else {
+		glBindBuffer(target_, id_);
+		glBufferData(target_, allocated_bytes(), nullptr, GL_DYNAMIC_DRAW);
+	}
+}
+
+size_t
+GpuBuffer::upload(const void* data, size_t bytes)
+{
+	if (bytes > segment_size_ || (persistent_ && !mapped_))
+		grow(bytes);
+
+	int next = (current_ + 1) % kSegments;
+	if (current_ >= 0)
+		fences_[current_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	wait(next);
+	current_ = next;
+
+	size_t offset = segment_size_ * next;
+	glBindBuffer(target_, id_);
+	if (persistent_)
+		std::memcpy(mapped_ + offset, data, bytes);
+	else
+		glBufferSubData(target_, offset, bytes, data);
+	return offset;
+}
@@ -0,0 +1,62 @@
+#ifndef GPU_BUFFER_H
+#define GPU_BUFFER_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include "memory_budget.h"
+
+/*
+ * A GL buffer that the CPU rewrites from time to time, e.g. the sponge's
+ * vertex and index data whenever the nesting level changes.
+ *
+ * Storage grows geometrically and is never shrunk, so uploads only
+ * reallocate when the data outgrows everything seen before and otherwise go
+ * in with glBufferSubData.  The storage is split into kSegments segments
+ * used round-robin; a fence is placed on a segment when it is retired and
+ * waited on before it is written again, so an upload never touches memory
+ * a queued draw may still read.
+ *
+ * With GL_ARB_buffer_storage the storage is immutable and persistently
+ * mapped, and uploads are a memcpy straight into the mapped segment.
+ * Growing then needs a fresh buffer name, so callers must re-read id()
+ * after every upload and re-specify bindings that point at the buffer.
+ *
+ * Storage is charged to kMemoryGpu, all segments of it.
+ */
+class GpuBuffer {
+public:
+	static const int kSegments = 3;
+
+	GpuBuffer();
+	// Nothing is deleted here; the buffer goes away with the GL context.
+	~GpuBuffer();
+
+	void init(GLenum target, bool persistent, size_t alignment = 256);
+	// Copies bytes into the next segment and returns its byte offset in
+	// the buffer.  Element array buffers are bound to the current VAO.
+	size_t upload(const void* data, size_t bytes);
+
+	GLuint id() const { return id_; }
+	bool persistent() const { return persistent_; }
+	size_t segment_size() const { return segment_size_; }
+	size_t allocated_bytes() const { return segment_size_ * kSegments; }
+
+	// True when GL_ARB_buffer_storage can back persistent buffers.
+	static bool persistent_supported();
+
+private:
+	void grow(size_t bytes);
+	void wait(int segment);
+
+	GLenum target_ = GL_ARRAY_BUFFER;
+	GLuint id_ = 0;
+	bool persistent_ = false;
+	size_t alignment_ = 256;
+	size_t segment_size_ = 0;
+	int current_ = -1;
+	char* mapped_ = nullptr;
+	GLsync fences_[kSegments];
+	MemoryCharge memory_{ kMemoryGpu };
+};
+
+#endif
@@ -0,0 +1,329 @@
+#include "index_optimizer.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+	// Clusters for the overdraw pass end where the surface turns by more
+	// than this (cosine of 60 degrees), once they have enough faces to be
+	// worth the vertices the cut will transform twice.
+	const float kClusterTurnCos = 0.5f;
+	const size_t kMinClusterFaces = kVertexCacheSize;
+	// Below this ratio of net normal to total area a cluster has no facing.
+	const float kClusterFlatness = 0.5f;
+
+	const char* kPassNames[] = { "weld", "cache", "overdraw", "fetch" };
+	const int kNumPasses = 4;
+
+	const uint32_t kUnused = ~0u;
+
+	struct Cluster {
+		size_t begin, end;  // Faces, half-open.
+		float key;
+	};
+
+	// A vertex's position and normal, bit for bit.
+	struct VertexKey {
+		float data[7];
+		bool operator==(const VertexKey& other) const
+		{
+			return std::memcmp(data, other.data, sizeof(data)) == 0;
+		}
+	};
+
+	struct VertexKeyHash {
+		size_t operator()(const VertexKey& key) const
+		{
+			uint32_t bits[7];
+			std::memcpy(bits, key.data, sizeof(bits));
+			size_t h = 0;
+			for (uint32_t b : bits)
+				h = (h ^ b) * 0x100000001b3ull;
+			return h;
+		}
+	};
+};
+
+bool
+ParseIndexPasses(const std::string& list, unsigned* passes)
+{
+	*passes = 0;
+	if (list == "none")
+		return true;
+	if (list == "all") {
+		*passes = kIndexPassAll;
+		return true;
+	}
+	std::istringstream in(list);
+	std::string name;
+	while (std::getline(in, name, ',')) {
+		int pass = 0;
+		while (pass < kNumPasses && name != kPassNames[pass])
+			pass++;
+		if (pass == kNumPasses)
+			return false;
+		*passes |= 1u << pass;
+	}
+	return *passes != 0;
+}
+
+std::string
+IndexPassNames(unsigned passes)
+{
+	std::string names;
+	for (int pass = 0; pass < kNumPasses; pass++) {
+		if (!(passes & (1u << pass)))
+			continue;
+		if (!names.empty())
+			names += ",";
+		names += kPassNames[pass];
+	}
+	return names.empty() ? "none" : names;
+}
+
+double
+AverageCacheMissRatio(const std::vector<glm::uvec3>& faces, size_t vertex_count, int cache_size)
+{
+	if (faces.empty())
+		return 0.0;
+	// A vertex is cached if fewer than cache_size misses came after its own.
+	std::vector<long> inserted(vertex_count, -long(cache_size) - 1);
+	long misses = 0;
+	for (const glm::uvec3& face : faces) {
+		for (int c = 0; c < 3; c++) {
+			if (misses - inserted[face[c]] >= cache_size)
+				inserted[face[c]] = misses++;
+		}
+	}
+	return double(misses) / faces.size();
+}
+
+void
+WeldVertices(std::vector<glm::vec4>* vertices, std::vector<glm::vec3>* normals,
+             std::vector<glm::uvec3>* faces)
+{
+	const bool has_normals = !normals->empty();
+	std::unordered_map<VertexKey, uint32_t, VertexKeyHash> unique;
+	unique.reserve(vertices->size());
+	std::vector<uint32_t> remap(vertices->size());
+	uint32_t next = 0;
+	for (size_t v = 0; v < vertices->size(); v++) {
+		VertexKey key;
+		const glm::vec4& p = (*vertices)[v];
+		glm::vec3 n = has_normals ? (*normals)[v] : glm::vec3(0.0f);
+		float data[7] = { p.x, p.y, p.z, p.w, n.x, n.y, n.z };
+		std::memcpy(key.data, data, sizeof(data));
+		auto inserted = unique.emplace(key, next);
+		if (inserted.second) {
+			(*vertices)[next] = p;
+			if (has_normals)
+				(*normals)[next] = n;
+			next++;
+		}
+		remap[v] = inserted.first->second;
+	}
+	vertices->resize(next);
+	if (has_normals)
+		normals->resize(next);
+	for (glm::uvec3& face : *faces)
+		face = glm::uvec3(remap[face.x], remap[face.y], remap[face.z]);
+}
+
+void
+OptimizeVertexCache(std::vector<glm::uvec3>* faces, size_t vertex_count, int cache_size)
+{
+	const size_t n = vertex_count;
+	const std::vector<glm::uvec3>& in = *faces;
+
+	// Triangles around each vertex, and how many are still to be drawn.
+	std::vector<uint32_t> first(n + 1, 0);
+	for (const glm::uvec3& face : in)
+		for (int c = 0; c < 3; c++)
+			first[face[c] + 1]++;
+	for (size_t v = 0; v < n; v++)
+		first[v + 1] += first[v];
+	std::vector<int> live(n);
+	for (size_t v = 0; v < n; v++)
+		live[v] = first[v + 1] - first[v];
+	std::vector<uint32_t> adjacent(first[n]);
+	std::vector<uint32_t> fill(first.begin(), first.end() - 1);
+	for (size_t t = 0; t < in.size(); t++)
+		for (int c = 0; c < 3; c++)
+			adjacent[fill[in[t][c]]++] = t;
+
+	std::vector<long> cache_time(n, 0);
+	std::vector<char> emitted(in.size(), 0);
+	std::vector<uint32_t> dead_ends;  // Recently used vertices, a stack.
+	std::vector<uint32_t> candidates;
+	std::vector<glm::uvec3> out;
+	out.reserve(in.size());
+	long time = cache_size + 1;
+	size_t cursor = 0;
+
+	auto next_unfinished = [&]() -> long {
+		while (!dead_ends.empty()) {
+			uint32_t v = dead_ends.back();
+			dead_ends.pop_back();
+			if (live[v] > 0)
+				return v;
+		}
+		for (; cursor < n; cursor++) {
+			if (live[cursor] > 0)
+				return cursor;
+		}
+		return -1;
+	};
+
+	long fan = next_unfinished();
+	while (fan >= 0) {
+		candidates.clear();
+		for (uint32_t i = first[fan]; i < first[fan + 1]; i++) {
+			uint32_t t = adjacent[i];
+			if (emitted[t])
+				continue;
+			emitted[t] = 1;
+			out.push_back(in[t]);
+			for (int c = 0; c < 3; c++) {
+				uint32_t v = in[t][c];
+				dead_ends.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cache_time[v] > cache_size)
+					cache_time[v] = time++;
+			}
+		}
+
+		// Prefer the oldest vertex that will still be cached once its own
+		// fan is drawn; failing that, back off to a recent dead end.
+		fan = -1;
+		long best = -1;
+		for (uint32_t v : candidates) {
+			if (live[v] <= 0)
+				continue;
+			long priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= cache_size)
+				priority = time - cache_time[v];
+			if (priority > best) {
+				best = priority;
+				fan = v;
+			}
+		}
+		if (fan < 0)
+			fan = next_unfinished();
+	}
+	faces->swap(out);
+}
+
+void
+OptimizeOverdraw(const std::vector<glm::vec4>& vertices, std::vector<glm::uvec3>* faces)
+{
+	std::vector<glm::uvec3>& in = *faces;
+	if (in.empty())
+		return;
+
+	// Area-weighted face normals and the centroid of the whole surface.
+	std::vector<glm::vec3> normals(in.size());
+	std::vector<glm::vec3> centroids(in.size());
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for (size_t t = 0; t < in.size(); t++) {
+		glm::vec3 a(vertices[in[t][0]]), b(vertices[in[t][1]]), c(vertices[in[t][2]]);
+		normals[t] = glm::cross(b - a, c - a);
+		centroids[t] = (a + b + c) / 3.0f;
+		float area = glm::length(normals[t]);
+		mesh_centroid += area * centroids[t];
+		mesh_area += area;
+	}
+	if (mesh_area > 0.0f)
+		mesh_centroid /= mesh_area;
+
+	// A face joins the cluster before it if it shares a vertex with any
+	// face already in it.
+	std::vector<uint32_t> owner(vertices.size(), kUnused);
+	auto connected = [&](const glm::uvec3& face, uint32_t cluster) {
+		return owner[face.x] == cluster || owner[face.y] == cluster || owner[face.z] == cluster;
+	};
+
+	std::vector<Cluster> clusters;
+	glm::vec3 facing(0.0f);
+	for (size_t t = 0; t < in.size(); t++) {
+		glm::vec3 normal = glm::length(normals[t]) > 0.0f ? glm::normalize(normals[t]) : normals[t];
+		if (t == 0 || !connected(in[t], clusters.size() - 1) ||
+		    (glm::dot(normal, facing) < kClusterTurnCos &&
+		     t - clusters.back().begin >= kMinClusterFaces)) {
+			clusters.push_back(Cluster{ t, t, 0.0f });
+			facing = normal;
+		}
+		clusters.back().end = t + 1;
+		for (int c = 0; c < 3; c++)
+			owner[in[t][c]] = clusters.size() - 1;
+	}
+	for (Cluster& cluster : clusters) {
+		glm::vec3 normal(0.0f), centroid(0.0f);
+		float area = 0.0f;
+		for (size_t t = cluster.begin; t < cluster.end; t++) {
+			float a = glm::length(normals[t]);
+			normal += normals[t];
+			centroid += a * centroids[t];
+			area += a;
+		}
+		if (area <= 0.0f)
+			continue;
+		glm::vec3 offset = centroid / area - mesh_centroid;
+		if (glm::length(normal) >= kClusterFlatness * area)
+			cluster.key = glm::dot(offset, glm::normalize(normal));
+		else
+			cluster.key = glm::length(offset);
+	}
+	std::stable_sort(clusters.begin(), clusters.end(),
+	                 [](const Cluster& a, const Cluster& b) { return a.key > b.key; });
+
+	std::vector<glm::uvec3> out;
+	out.reserve(in.size());
+	for (const Cluster& cluster : clusters)
+		out.insert(out.end(), in.begin() + cluster.begin, in.begin() + cluster.end);
+	faces->swap(out);
+}
+
+void
+OptimizeVertexFetch(std::vector<glm::vec4>* vertices, std::vector<glm::vec3>* normals,
+                    std::vector<glm::uvec3>* faces)
+{
+	std::vector<uint32_t> remap(vertices->size(), kUnused);
+	uint32_t next = 0;
+	for (glm::uvec3& face : *faces) {
+		for (int c = 0; c < 3; c++) {
+			if (remap[face[c]] == kUnused)
+				remap[face[c]] = next++;
+			face[c] = remap[face[c]];
+		}
+	}
+
+	std::vector<glm::vec4> new_vertices(next);
+	std::vector<glm::vec3> new_normals(normals->empty() ? 0 : next);
+	for (size_t v = 0; v < remap.size(); v++) {
+		if (remap[v] == kUnused)
+			continue;
+		new_vertices[remap[v]] = (*vertices)[v];
+		if (!normals->empty())
+			new_normals[remap[v]] = (*normals)[v];
+	}
+	vertices->swap(new_vertices);
+	normals->swap(new_normals);
+}
+
+void
+OptimizeIndices(unsigned passes, std::vector<glm::vec4>* vertices,
+                std::vector<glm::vec3>* normals, std::vector<glm::uvec3>* faces)
+{
+	if (passes & kIndexPassWeld)
+		WeldVertices(vertices, normals, faces);
+	if (passes & kIndexPassCache)
+		OptimizeVertexCache(faces, vertices->size());
+	if (passes & kIndexPassOverdraw)
+		OptimizeOverdraw(*vertices, faces);
+	if (passes & kIndexPassFetch)
+		OptimizeVertexFetch(vertices, normals, faces);
+}
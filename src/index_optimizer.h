@@ -0,0 +1,72 @@
+#ifndef INDEX_OPTIMIZER_H
+#define INDEX_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Entries in the post-transform vertex cache the passes plan for.  Real
+// GPUs differ and few are plain FIFOs, but orders that do well on a small
+// FIFO do well on all of them.
+const int kVertexCacheSize = 16;
+
+// Passes of OptimizeIndices, as a bit set; they run in this order.
+enum {
+	kIndexPassWeld = 1,      // Identical vertices merged.
+	kIndexPassCache = 2,     // Tipsify triangle order for vertex reuse.
+	kIndexPassOverdraw = 4,  // Outward clusters first.
+	kIndexPassFetch = 8,     // Vertices renumbered in order of first use.
+	kIndexPassAll = 15,
+};
+
+// Parses "none", "all" or a comma-separated list of weld, cache, overdraw
+// and fetch; returns false if the list has anything else.
+bool ParseIndexPasses(const std::string& list, unsigned* passes);
+std::string IndexPassNames(unsigned passes);
+
+// Vertices transformed per triangle drawn through a FIFO cache of
+// cache_size entries: 3 with no reuse at all, about 0.5 at best for
+// large regular meshes.
+double AverageCacheMissRatio(const std::vector<glm::uvec3>& faces, size_t vertex_count,
+                             int cache_size = kVertexCacheSize);
+
+// Merges vertices whose position and normal, if there are normals, are
+// bit for bit the same.  The sponge repeats every corner that cubes or
+// faces share, and the cache can only reuse what is shared.
+void WeldVertices(std::vector<glm::vec4>* vertices, std::vector<glm::vec3>* normals,
+                  std::vector<glm::uvec3>* faces);
+
+/*
+ * Reorders triangles for the post-transform vertex cache with Tipsify
+ * (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+ * Locality and Reduced Overdraw", 2007): fan out the triangles around one
+ * vertex at a time, moving on to whichever vertex of the last fan will
+ * still be in the cache when its remaining triangles are drawn.  Linear in
+ * the number of triangles.
+ */
+void OptimizeVertexCache(std::vector<glm::uvec3>* faces, size_t vertex_count,
+                         int cache_size = kVertexCacheSize);
+
+/*
+ * Reorders clusters of triangles so that the ones most likely to occlude
+ * the rest from any direction come first.  Clusters are runs of the
+ * current order that stay connected, cut where the surface turns once
+ * they are long enough, so the cache order within each survives.  They are
+ * sorted by how far out along its own normal each lies from the mesh's
+ * centroid, as in the paper above; clusters that face every way at once,
+ * like a whole cube, go by plain distance from the centroid instead.
+ */
+void OptimizeOverdraw(const std::vector<glm::vec4>& vertices, std::vector<glm::uvec3>* faces);
+
+// Renumbers vertices in the order the faces first use them, so vertex
+// fetches walk memory forwards.  Permutes normals along if there are any
+// and drops vertices no face uses.
+void OptimizeVertexFetch(std::vector<glm::vec4>* vertices, std::vector<glm::vec3>* normals,
+                         std::vector<glm::uvec3>* faces);
+
+// Runs the selected passes in order.
+void OptimizeIndices(unsigned passes, std::vector<glm::vec4>* vertices,
+                     std::vector<glm::vec3>* normals, std::vector<glm::uvec3>* faces);
+
+#endif
@@ -0,0 +1,297 @@
+#include "job_system.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+namespace {
+	// How long a worker waiting on a group sleeps between looking for jobs
+	// to run meanwhile.
+	const std::chrono::microseconds kHelpInterval(100);
+
+	// The pool the current thread works for, and its index there.
+	thread_local JobSystem* t_system = nullptr;
+	thread_local int t_worker = -1;
+};
+
+struct Job {
+	std::function<void()> func;
+	JobGroup* group;
+	// Dependencies still to finish, plus one until the job is submitted.
+	std::atomic<int> blockers{ 1 };
+	std::vector<Job*> successors;
+};
+
+JobSystem g_jobs;
+
+JobSystem::JobSystem(int threads)
+	: threads_(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+JobSystem::~JobSystem()
+{
+	stop();
+}
+
+void
+JobSystem::set_threads(int threads)
+{
+	stop();
+	threads_ = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+void
+JobSystem::start()
+{
+	std::lock_guard<std::mutex> lock(start_mutex_);
+	if (started_.load(std::memory_order_relaxed))
+		return;
+	for (int i = 0; i < threads_; i++)
+		workers_.emplace_back(new Worker);
+	for (int i = 0; i < threads_; i++)
+		workers_[i]->thread = std::thread(&JobSystem::work, this, i);
+	started_.store(true, std::memory_order_release);
+}
+
+void
+JobSystem::stop()
+{
+	while (in_flight_.load() > 0)
+		std::this_thread::yield();
+	std::lock_guard<std::mutex> lock(start_mutex_);
+	if (!started_.load(std::memory_order_relaxed))
+		return;
+	{
+		std::lock_guard<std::mutex> sleep_lock(sleep_mutex_);
+		quit_ = true;
+	}
+	wake_.notify_all();
+	for (std::unique_ptr<Worker>& worker : workers_)
+		worker->thread.join();
+	workers_.clear();
+	quit_ = false;
+	started_.store(false, std::memory_order_relaxed);
+}
+
+Job*
+JobSystem::create(std::function<void()> func, JobGroup* group)
+{
+	Job* job = new Job;
+	job->func = std::move(func);
+	job->group = group;
+	in_flight_++;
+	if (group && group->pending_.fetch_add(1) == 0) {
+		std::lock_guard<std::mutex> lock(group->mutex_);
+		group->done_ = false;
+	}
+	return job;
+}
+
+void
+JobSystem::depend(Job* job, Job* before)
+{
+	before->successors.push_back(job);
+	job->blockers++;
+}
+
+void
+JobSystem::submit(Job* job)
+{
+	if (!started_.load(std::memory_order_acquire))
+		start();
+	if (--job->blockers == 0)
+		push(job);
+}
+
+void
+JobSystem::run(std::function<void()> func, JobGroup* group)
+{
+	submit(create(std::move(func), group));
+}
+
+void
+JobSystem::push(Job* job)
+{
+	if (t_system == this) {
+		Worker& self = *workers_[t_worker];
+		std::lock_guard<std::mutex> lock(self.mutex);
+		self.jobs.push_back(job);
+	} else {
+		std::lock_guard<std::mutex> lock(shared_mutex_);
+		shared_.push_back(job);
+	}
+	// Either a sleeper sees the job when it checks queued_, or this sees
+	// the sleeper and wakes it.
+	queued_++;
+	if (sleepers_.load() > 0) {
+		{ std::lock_guard<std::mutex> lock(sleep_mutex_); }
+		wake_.notify_one();
+	}
+}
+
+Job*
+JobSystem::take(int index)
+{
+	Worker& self = *workers_[index];
+	Job* job = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(self.mutex);
+		if (!self.jobs.empty()) {
+			job = self.jobs.back();
+			self.jobs.pop_back();
+		}
+	}
+	if (!job) {
+		std::lock_guard<std::mutex> lock(shared_mutex_);
+		if (!shared_.empty()) {
+			job = shared_.front();
+			shared_.pop_front();
+		}
+	}
+	for (int i = 1; !job && i < threads_; i++) {
+		Worker& victim = *workers_[(index + i) % threads_];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			self.stolen.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	if (job)
+		queued_--;
+	return job;
+}
+
+bool
+JobSystem::run_one(int index)
+{
+	if (queued_.load(std::memory_order_relaxed) == 0)
+		return false;
+	Job* job = take(index);
+	if (!job)
+		return false;
+	workers_[index]->run.fetch_add(1, std::memory_order_relaxed);
+	execute(job);
+	return true;
+}
+
+void
+JobSystem::execute(Job* job)
+{
+	job->func();
+	for (Job* next : job->successors) {
+		if (--next->blockers == 0)
+			push(next);
+	}
+	JobGroup* group = job->group;
+	delete job;
+	if (group)
+		finish(group);
+	in_flight_--;
+}
+
+void
+JobSystem::finish(JobGroup* group)
+{
+	if (group->pending_.fetch_sub(1) != 1)
+		return;
+	// A job created in the group since may have made it pending again.
+	std::lock_guard<std::mutex> lock(group->mutex_);
+	group->done_ = group->pending_.load() == 0;
+	if (group->done_)
+		group->finished_.notify_all();
+}
+
+void
+JobSystem::wait(JobGroup& group)
+{
+	if (t_system != this) {
+		std::unique_lock<std::mutex> lock(group.mutex_);
+		group.finished_.wait(lock, [&group] { return group.done_; });
+		return;
+	}
+	for (;;) {
+		{
+			std::lock_guard<std::mutex> lock(group.mutex_);
+			if (group.done_)
+				return;
+		}
+		if (!run_one(t_worker)) {
+			std::unique_lock<std::mutex> lock(group.mutex_);
+			if (group.finished_.wait_for(lock, kHelpInterval, [&group] { return group.done_; }))
+				return;
+		}
+	}
+}
+
+void
+JobSystem::work(int index)
+{
+	t_system = this;
+	t_worker = index;
+	for (;;) {
+		if (run_one(index))
+			continue;
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		sleepers_++;
+		wake_.wait(lock, [this] { return quit_ || queued_.load() > 0; });
+		sleepers_--;
+		if (quit_ && queued_.load() == 0)
+			break;
+	}
+	t_system = nullptr;
+	t_worker = -1;
+}
+
+void
+JobSystem::parallel_for(size_t begin, size_t end, size_t grain, const RangeFunc& body)
+{
+	grain = std::max<size_t>(grain, 1);
+	if (end <= begin)
+		return;
+	if (end - begin <= grain) {
+		body(begin, end);
+		return;
+	}
+	JobGroup group;
+	// Hands off the upper half until what is left fits in a grain.
+	std::function<void(size_t, size_t)> split = [&](size_t b, size_t e) {
+		while (e - b > grain) {
+			size_t mid = b + (e - b) / 2;
+			run([&split, mid, e] { split(mid, e); }, &group);
+			e = mid;
+		}
+		body(b, e);
+	};
+	if (t_system == this)
+		split(begin, end);
+	else
+		run([&split, begin, end] { split(begin, end); }, &group);
+	wait(group);
+}
+
+long
+JobSystem::jobs_run() const
+{
+	long run = 0;
+	for (const std::unique_ptr<Worker>& worker : workers_)
+		run += worker->run.load(std::memory_order_relaxed);
+	return run;
+}
+
+long
+JobSystem::jobs_stolen() const
+{
+	long stolen = 0;
+	for (const std::unique_ptr<Worker>& worker : workers_)
+		stolen += worker->stolen.load(std::memory_order_relaxed);
+	return stolen;
+}
+
+void
+JobSystem::print_stats(std::ostream& os) const
+{
+	long run = jobs_run();
+	os << "jobs: " << run << " run on " << threads_ << " workers, " << jobs_stolen()
+	   << " stolen\n";
+}
@@ -0,0 +1,129 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+struct Job;
+
+// Jobs to wait for together.  Every job created in a group counts until it
+// has run, including those still waiting on their dependencies.
+class JobGroup {
+public:
+	JobGroup() = default;
+	JobGroup(const JobGroup&) = delete;
+	JobGroup& operator=(const JobGroup&) = delete;
+
+private:
+	friend class JobSystem;
+
+	std::atomic<long> pending_{ 0 };
+	// Set by whichever job finishes last, under mutex_, so that a waiter
+	// that sees it may destroy the group at once.
+	bool done_ = true;
+	std::mutex mutex_;
+	std::condition_variable finished_;
+};
+
+/*
+ * One pool of worker threads for everything that runs in parallel.
+ *
+ * Each worker owns a deque of jobs: it pushes and pops at the back, so it
+ * works depth first on what it spawned while that is still in cache, and
+ * when it runs dry it steals from the front of another's, where the oldest
+ * and so usually largest pieces of work are.  Threads outside the pool
+ * submit to a shared queue that the workers drain the same way.
+ *
+ * A job runs once every job it depends on has finished.  Dependencies must
+ * be added before either job is submitted; a job is freed as soon as it
+ * has run.  wait() on a worker runs other jobs until its group is done, so
+ * jobs may wait on jobs they spawn; any other thread just blocks.
+ *
+ * Workers start with the first submit and sleep while there is nothing to
+ * do.  Jobs must not throw.
+ */
+class JobSystem {
+public:
+	typedef std::function<void(size_t begin, size_t end)> RangeFunc;
+
+	// threads = 0 uses one per hardware thread.
+	explicit JobSystem(int threads = 0);
+	// Waits for every job submitted so far.
+	~JobSystem();
+
+	// Changes the number of workers.  Only while no jobs are in flight.
+	void set_threads(int threads);
+	int threads() const { return threads_; }
+
+	// A job that runs func once submitted and its dependencies are done.
+	Job* create(std::function<void()> func, JobGroup* group = nullptr);
+	// job waits for before.
+	void depend(Job* job, Job* before);
+	void submit(Job* job);
+	// create() and submit() in one.
+	void run(std::function<void()> func, JobGroup* group = nullptr);
+	void wait(JobGroup& group);
+
+	// Calls body on disjoint subranges of [begin, end) of at most grain
+	// items each and returns once all have run.  Ranges are split in half
+	// as workers steal them, so a thief takes half of what is left.
+	void parallel_for(size_t begin, size_t end, size_t grain, const RangeFunc& body);
+
+	// Jobs run and stolen since the pool started.
+	long jobs_run() const;
+	long jobs_stolen() const;
+	void print_stats(std::ostream& os) const;
+
+private:
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Job*> jobs;
+		std::thread thread;
+		std::atomic<long> run{ 0 };
+		std::atomic<long> stolen{ 0 };
+	};
+
+	void start();
+	void stop();
+	void work(int index);
+	// Runs one job found anywhere; false if there was none.
+	bool run_one(int index);
+	Job* take(int index);
+	void execute(Job* job);
+	void push(Job* job);
+	void finish(JobGroup* group);
+
+	int threads_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::mutex start_mutex_;
+	std::atomic<bool> started_{ false };
+
+	// Submitted from outside the pool.
+	std::mutex shared_mutex_;
+	std::deque<Job*> shared_;
+
+	// Jobs queued anywhere, and workers asleep waiting for one.  A
+	// submitter only takes sleep_mutex_ when someone sleeps.
+	std::atomic<long> queued_{ 0 };
+	std::atomic<int> sleepers_{ 0 };
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_;
+	bool quit_ = false;
+
+	// Jobs created and not yet run, for stopping the pool.
+	std::atomic<long> in_flight_{ 0 };
+};
+
+// The pool every subsystem shares.
+extern JobSystem g_jobs;
+
+#endif
@@ -0,0 +1,274 @@
+#include "jpeg_encoder.h"
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include "job_system.h"
+
+namespace {
+	// Pixel buffers kept around for spare_buffer().
+	const size_t kMaxSpareBuffers = 8;
+	// Restart intervals are a 16-bit count of MCUs.
+	const int kMaxRestartInterval = 65535;
+
+	// Offset of the entropy-coded data after the SOS header, and of the
+	// frame header, in a JPEG written by libjpeg.
+	size_t scan_start(const std::vector<uint8_t>& data, size_t* sof)
+	{
+		size_t i = 2;  // Past SOI.
+		while (i + 4 <= data.size() && data[i] == 0xFF) {
+			uint8_t marker = data[i + 1];
+			size_t length = size_t(data[i + 2]) << 8 | data[i + 3];
+			if (marker >= 0xC0 && marker <= 0xC2)
+				*sof = i;
+			if (marker == 0xDA)
+				return i + 2 + length;
+			i += 2 + length;
+		}
+		return data.size();
+	}
+};
+
+JpegEncoder::~JpegEncoder()
+{
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	wake_.notify_all();
+	if (writer_.joinable())
+		writer_.join();
+}
+
+void
+JpegEncoder::set_options(const JpegOptions& options)
+{
+	options_ = options;
+}
+
+void
+JpegEncoder::submit(const std::vector<std::string>& files, int width, int height,
+		int channels, std::vector<uint8_t> pixels)
+{
+	std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+	frame->files = files;
+	frame->width = width;
+	frame->height = height;
+	frame->channels = channels;
+	frame->options = options_;
+	frame->pixels = std::move(pixels);
+
+	int strips = (height + kStripRows - 1) / kStripRows;
+	int mcus_per_row = (width + JpegMcuWidth(options_.subsampling) - 1) /
+	                   JpegMcuWidth(options_.subsampling);
+	int interval = kStripRows / JpegMcuHeight(options_.subsampling) * mcus_per_row;
+	if (strips > 1 && interval <= kMaxRestartInterval)
+		frame->options.restart_interval = interval;
+	else
+		strips = 1;
+	frame->strips.resize(strips);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (pending_ == 0)
+			busy_since_ = Clock::now();
+		pending_++;
+	}
+	Job* splice = g_jobs.create([this, frame] { finish(*frame); });
+	for (int i = 0; i < strips; i++) {
+		Job* strip = g_jobs.create([frame, i] { encode_strip(*frame, i); });
+		g_jobs.depend(splice, strip);
+		g_jobs.submit(strip);
+	}
+	g_jobs.submit(splice);
+}
+
+std::vector<uint8_t>
+JpegEncoder::spare_buffer()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<uint8_t> buffer;
+	if (!spare_.empty()) {
+		buffer = std::move(spare_.back());
+		spare_.pop_back();
+	}
+	return buffer;
+}
+
+size_t
+JpegEncoder::pending() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return pending_;
+}
+
+void
+JpegEncoder::flush()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_.wait(lock, [this] { return idle(); });
+}
+
+bool
+JpegEncoder::idle() const
+{
+	return pending_ == 0 && batch_.empty() && writes_.empty() && !writing_;
+}
+
+JpegEncoder::Stats
+JpegEncoder::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Stats stats = stats_;
+	if (pending_ > 0)
+		stats.seconds += std::chrono::duration<double>(Clock::now() - busy_since_).count();
+	return stats;
+}
+
+void
+JpegEncoder::print_stats(std::ostream& os) const
+{
+	Stats s = stats();
+	os << std::fixed << std::setprecision(2)
+	   << "jpeg: " << s.frames << " frames, " << s.bytes / 1048576.0 << " MiB in "
+	   << s.seconds << " s on " << g_jobs.threads() << " threads";
+	if (s.seconds > 0.0)
+		os << ", " << s.frames / s.seconds << " fps, " << s.megapixels / s.seconds << " MP/s";
+	os << "\n" << std::defaultfloat;
+}
+
+void
+JpegEncoder::finish(Frame& frame)
+{
+	Output output;
+	output.files = std::move(frame.files);
+	bool encoded = std::none_of(frame.strips.begin(), frame.strips.end(),
+			[](const std::vector<uint8_t>& strip) { return strip.empty(); });
+	if (encoded)
+		splice(frame, &output.data);
+	else
+		std::cerr << "failed to encode " << output.files.front() << "\n";
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	stats_.frames++;
+	stats_.megapixels += frame.width * 1e-6 * frame.height;
+	stats_.bytes += output.data.size();
+	if (spare_.size() < kMaxSpareBuffers)
+		spare_.push_back(std::move(frame.pixels));
+	if (encoded) {
+		batch_bytes_ += output.data.size();
+		batch_.push_back(std::move(output));
+	}
+	if (--pending_ == 0)
+		stats_.seconds += std::chrono::duration<double>(Clock::now() - busy_since_).count();
+
+	if ((batch_bytes_ >= kBatchBytes || pending_ == 0) && !batch_.empty()) {
+		writes_.push_back(std::move(batch_));
+		batch_.clear();
+		batch_bytes_ = 0;
+		if (!writer_.joinable())
+			writer_ = std::thread(&JpegEncoder::write_loop, this);
+		wake_.notify_one();
+	}
+	if (idle())
+		idle_.notify_all();
+}
+
+void
+JpegEncoder::write_loop()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (;;) {
+		wake_.wait(lock, [this] { return stopping_ || !writes_.empty(); });
+		if (writes_.empty())
+			return;
+		std::vector<Output> batch = std::move(writes_.front());
+		writes_.erase(writes_.begin());
+		writing_ = true;
+		lock.unlock();
+		write(batch);
+		lock.lock();
+		writing_ = false;
+		if (idle())
+			idle_.notify_all();
+	}
+}
+
+void
+JpegEncoder::encode_strip(Frame& frame, int strip)
+{
+	// Per thread, reused across strips.
+	thread_local std::vector<uint8_t> rgb;
+	thread_local std::vector<const unsigned char*> rows;
+
+	const int strips = frame.strips.size();
+	const int top = strip * kStripRows;
+	const int count = strips > 1 ? std::min(kStripRows, frame.height - top) : frame.height;
+	const size_t in_stride = size_t(frame.width) * frame.channels;
+	const size_t out_stride = size_t(frame.width) * 3;
+	rows.resize(count);
+	if (frame.channels == 4)
+		rgb.resize(out_stride * count);
+	for (int i = 0; i < count; i++) {
+		// Rows come bottom-up.
+		const uint8_t* in = &frame.pixels[(frame.height - 1 - top - i) * in_stride];
+		if (frame.channels == 4) {
+			uint8_t* out = &rgb[i * out_stride];
+			for (int x = 0; x < frame.width; x++) {
+				out[3 * x] = in[4 * x];
+				out[3 * x + 1] = in[4 * x + 1];
+				out[3 * x + 2] = in[4 * x + 2];
+			}
+			in = out;
+		}
+		rows[i] = in;
+	}
+	// A strip libjpeg gave up on stays empty, and finish drops its frame.
+	if (!EncodeJPEG(frame.width, count, rows.data(), frame.options, &frame.strips[strip]))
+		frame.strips[strip].clear();
+}
+
+// Restart markers reset the DC predictors and byte-align the bit stream,
+// so strip k's scan data can follow RST((k - 1) % 8) as it is.  Only the
+// frame height in the first strip's header needs fixing.
+void
+JpegEncoder::splice(Frame& frame, std::vector<uint8_t>* out)
+{
+	if (frame.strips.size() == 1) {
+		out->swap(frame.strips[0]);
+		return;
+	}
+	const std::vector<uint8_t>& first = frame.strips[0];
+	size_t sof = 0;
+	scan_start(first, &sof);
+	out->assign(first.begin(), first.end() - 2);  // Without EOI.
+	(*out)[sof + 5] = uint8_t(frame.height >> 8);
+	(*out)[sof + 6] = uint8_t(frame.height);
+	for (size_t k = 1; k < frame.strips.size(); k++) {
+		const std::vector<uint8_t>& strip = frame.strips[k];
+		size_t unused;
+		size_t start = scan_start(strip, &unused);
+		out->push_back(0xFF);
+		out->push_back(uint8_t(0xD0 + (k - 1) % 8));
+		out->insert(out->end(), strip.begin() + start, strip.end() - 2);
+	}
+	out->push_back(0xFF);
+	out->push_back(0xD9);
+}
+
+void
+JpegEncoder::write(const std::vector<Output>& batch)
+{
+	for (const Output& output : batch) {
+		for (const std::string& file : output.files) {
+			FILE* f = std::fopen(file.c_str(), "wb");
+			bool written = f && std::fwrite(output.data.data(), 1, output.data.size(), f) ==
+			                    output.data.size();
+			if (f)
+				written = std::fclose(f) == 0 && written;
+			if (!written)
+				std::cerr << "failed to write " << file << "\n";
+		}
+	}
+}
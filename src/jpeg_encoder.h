@@ -0,0 +1,112 @@
+#ifndef JPEG_ENCODER_H
+#define JPEG_ENCODER_H
+
+#include <jpegio.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Encodes streams of frames on the job system.
+ *
+ * Frames taller than kStripRows are cut into strips of kStripRows rows,
+ * each encoded on its own as a JPEG whose restart interval is exactly one
+ * strip.  The entropy-coded data of every strip is then spliced behind the
+ * first strip's headers with RSTn markers in between, which gives the same
+ * file a single encoder would write with that restart interval.  Each strip
+ * is a job, and the splice a job that depends on all of a frame's strips,
+ * so one large frame keeps every worker busy and a stream of small ones is
+ * encoded several at a time.
+ *
+ * Encoded frames collect in memory and are written out together once
+ * kBatchBytes have piled up, or whenever the queue runs dry, so a single
+ * screenshot still lands on disk right away.  Writing happens on a thread
+ * of the encoder's own rather than in a job, so a slow disk never holds up
+ * the workers that generation and simulation share.
+ */
+class JpegEncoder {
+public:
+	static const int kStripRows = 128;  // A multiple of every MCU height.
+	static const size_t kBatchBytes = 32 << 20;
+
+	struct Stats {
+		long frames = 0;
+		double megapixels = 0.0;
+		double seconds = 0.0;  // Wall time with frames in the queue.
+		size_t bytes = 0;      // Encoded.
+	};
+
+	// Writes out every frame submitted so far.
+	~JpegEncoder();
+
+	// Applies to frames submitted afterwards.  Frames of more than one
+	// strip always restart once per strip.
+	void set_options(const JpegOptions& options);
+	const JpegOptions& options() const { return options_; }
+
+	// Queues pixels, bottom row first with 3 (RGB) or 4 (RGBA) channels,
+	// to be written to every file in files.
+	void submit(const std::vector<std::string>& files, int width, int height,
+	            int channels, std::vector<uint8_t> pixels);
+	// A pixel buffer of a finished frame to refill, or an empty one.
+	std::vector<uint8_t> spare_buffer();
+	// Frames submitted but not yet encoded.
+	size_t pending() const;
+	// Blocks until every submitted frame is on disk.
+	void flush();
+
+	Stats stats() const;
+	// One line of frames per second and megapixels per second.
+	void print_stats(std::ostream& os) const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Frame {
+		std::vector<std::string> files;
+		int width, height, channels;
+		JpegOptions options;
+		std::vector<uint8_t> pixels;
+		std::vector<std::vector<uint8_t>> strips;  // Encoded.
+	};
+
+	struct Output {
+		std::vector<std::string> files;
+		std::vector<uint8_t> data;
+	};
+
+	static void encode_strip(Frame& frame, int strip);
+	// Splices a frame whose strips are all in and batches it for writing.
+	void finish(Frame& frame);
+	static void splice(Frame& frame, std::vector<uint8_t>* out);
+	static void write(const std::vector<Output>& batch);
+	// The writer thread: writes queued batches until told to stop.
+	void write_loop();
+	// With mutex_ held: every submitted frame is on disk.
+	bool idle() const;
+
+	JpegOptions options_;
+
+	// Shared with the jobs and the writer.
+	mutable std::mutex mutex_;
+	std::condition_variable idle_;
+	std::vector<Output> batch_;
+	size_t batch_bytes_ = 0;
+	size_t pending_ = 0;
+	std::vector<std::vector<Output>> writes_;  // Batches for the writer.
+	bool writing_ = false;  // The writer holds a batch.
+	bool stopping_ = false;
+	std::condition_variable wake_;  // For the writer.
+	std::thread writer_;  // Started with the first batch.
+	std::vector<std::vector<uint8_t>> spare_;
+	Clock::time_point busy_since_;
+	Stats stats_;
+};
+
+#endif
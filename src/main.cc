@@ -1,5 +1,7 @@
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <memory>
@@ -12,394 +14,110 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <debuggl.h>
+#include <jpegio.h>
 #include "menger.h"
 #include "camera.h"
+#include "camera_path.h"
+#include "draw_batcher.h"
+#include "floor.h"
+#include "frame_snapshot.h"
+#include "frame_capture.h"
+#include "gpu_buffer.h"
+#include "index_optimizer.h"
+#include "job_system.h"
+#include "memory_budget.h"
+#include "meshlet.h"
+#include "objio.h"
+#include "ocean.h"
+#include "per_frame.h"
+#include "profiler.h"
+#include "scene.h"
+#include "shader_cache.h"
+#include "shaders.h"
+#include "softraster.h"
+#include "texture_loader.h"
+#include "triple_buffer.h"
+#include "voxel_export.h"
+#include "waves.h"
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <ctime>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 
 int window_width = 800, window_height = 600;
 
 // VBO and VAO descriptors.
-enum { kVertexBuffer, kIndexBuffer, kNumVbos };
+enum { kVertexBuffer, kIndexBuffer, kNormalBuffer, kNumVbos };
 
 // These are our VAOs.
-enum { kGeometryVao, kFloorVao, kNumVaos };
+enum { kGeometryVao, kFloorVao, kSceneVao, kNumVaos };
 
 GLuint g_array_objects[kNumVaos];  // This will store the VAO descriptors.
 GLuint g_buffer_objects[kNumVaos][kNumVbos];  // These will store VBO descriptors.
+GpuBuffer g_geometry_buffers[kNumVbos];  // Owners of g_buffer_objects[kGeometryVao].
+std::atomic<size_t> g_geometry_gpu_bytes(0);  // Their storage, for the simulation to read.
+// Byte offset of the sponge faces in the index buffer: 32-bit, or the
+// meshlets' 16-bit local indices if it has meshlets.
+size_t g_index_offset = 0;
 
-// C++ 11 String Literal
-// See http://en.cppreference.com/w/cpp/language/string_literal
-const char* vertex_shader =
-R"zzz(#version 410 core
-in vec4 vertex_position;
-uniform mat4 view;
-uniform vec4 light_position;
-out vec4 vs_light_direction_0;
-out vec4 vertex_position_world_0;
-out vec4 vs_light_direction;
-out vec4 vertex_position_world;
-void main()
-{
-	gl_Position = view * vertex_position;
-	vs_light_direction_0 = -gl_Position + view * light_position;
-	vertex_position_world_0 = vertex_position;
-	vs_light_direction = -gl_Position + view * light_position;
-	vertex_position_world = vertex_position;
-}
-)zzz";
-
-
-
-
-// const char* triangleTessControlShader =
-// R"zzz(#version 410 core
-
-// in vec4 vs_light_direction_0[];
-// in vec4 vertex_position_world_0[];
-// uniform int innerLevel;
-// uniform int outerLevel;
-// out vec4 vs_light_direction_1[];
-// out vec4 vertex_position_world_1[];
-
-
-
-// layout (vertices = 3) out;
-// void main(void) {
-// 	if(gl_InvocationID == 0) {
-// 		gl_TessLevelInner[0] = 1.0 + innerLevel;
-// 		gl_TessLevelOuter[0] = 1.0 + outerLevel;
-// 		gl_TessLevelOuter[1] = 1.0 + outerLevel;
-// 		gl_TessLevelOuter[2] = 1.0 + outerLevel;
-// 	}
-// 	gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
-// 	vs_light_direction_1[gl_InvocationID] = vs_light_direction_0[gl_InvocationID];
-// 	vertex_position_world_1[gl_InvocationID] = vertex_position_world_0[gl_InvocationID];
-// }
-
-// )zzz";
-
-
-const char* quadTessControlShader =
-R"zzz(#version 410 core
-
-in vec4 vs_light_direction_0[];
-in vec4 vertex_position_world_0[];
-uniform int innerLevel;
-uniform int outerLevel;
-uniform float tide_time;
-uniform int isOceanMode;
-
-out vec4 vs_light_direction_1[];
-out vec4 vertex_position_world_1[];
-out vec4 control_tide_center[];
-
-layout (vertices = 4) out;
-void main(void) {
-	if(gl_InvocationID == 0) {
-		gl_TessLevelInner[0] = 1.0 + innerLevel;
-		gl_TessLevelInner[1] = 1.0 + innerLevel;
-		gl_TessLevelOuter[0] = 1.0 + outerLevel;
-		gl_TessLevelOuter[1] = 1.0 + outerLevel;
-		gl_TessLevelOuter[2] = 1.0 + outerLevel;
-		gl_TessLevelOuter[3] = 1.0 + outerLevel;
-	}
-	gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
-	vs_light_direction_1[gl_InvocationID] = vs_light_direction_0[gl_InvocationID];
-	vertex_position_world_1[gl_InvocationID] = vertex_position_world_0[gl_InvocationID];
-
-	// calculate tide center for adaptive tessellation
-	float tide_speed = 5.0;
-	vec4 tide_direct = vec4(1.0, 0.0, 0.0, 0.0);
-	vec4 tide_start = vec4(0.0, 0.0, 0.0, 0.0);
-	control_tide_center[gl_InvocationID] = tide_start + tide_direct * tide_time * tide_speed;
-	vec4 curr_pos = vertex_position_world_0[gl_InvocationID];
-	float adaptive_range = 5.0f;
-	
-	if(isOceanMode == 1 && distance(curr_pos, control_tide_center[gl_InvocationID]) < adaptive_range) {
-		gl_TessLevelInner[0] *= 3;
-		gl_TessLevelInner[1] *= 3;
-		gl_TessLevelOuter[0] *= 3;
-		gl_TessLevelOuter[1] *= 3;
-		gl_TessLevelOuter[2] *= 3;
-		gl_TessLevelOuter[3] *= 3;
-	}
-}
-
-)zzz";
-
-
-// const char* triangleTessEvaluationShader =
-// R"zzz(#version 410 core
-// in vec4 vs_light_direction_1[];
-// in vec4 vertex_position_world_1[];
-
-// out vec4 vs_light_direction;
-// out vec4 vertex_position_world;
-
-
-// layout(triangles, equal_spacing, cw) in;
-// void main(void) {
-// 	gl_Position = (gl_TessCoord.x * gl_in[0].gl_Position
-// 					+ gl_TessCoord.y * gl_in[1].gl_Position
-// 					+ gl_TessCoord.z * gl_in[2].gl_Position);
-
-// 	vs_light_direction = (gl_TessCoord.x * vs_light_direction_1[0]
-// 					+ gl_TessCoord.y * vs_light_direction_1[1]
-// 					+ gl_TessCoord.z * vs_light_direction_1[2]);
-
-// 	vertex_position_world = (gl_TessCoord.x * vertex_position_world_1[0]
-// 					+ gl_TessCoord.y * vertex_position_world_1[1]
-// 					+ gl_TessCoord.z * vertex_position_world_1[2]);
-// }
-
-// )zzz";
-
-
-const char* quadTessEvaluationShader =
-R"zzz(#version 410 core
-in vec4 vs_light_direction_1[];
-in vec4 vertex_position_world_1[];
-in vec4 control_tide_center[];
-
-out vec4 vs_light_direction;
-out vec4 vertex_position_world;
-out vec4 eval_tide_center;
-
-
-
-layout(quads, equal_spacing, cw) in;
-void main(void) {
-	vec4 p1 = mix(gl_in[1].gl_Position, gl_in[0].gl_Position, gl_TessCoord.x);
-	vec4 p2 = mix(gl_in[2].gl_Position, gl_in[3].gl_Position, gl_TessCoord.x);
-	gl_Position = mix(p1, p2, gl_TessCoord.y);
-
-	vec4 light_dir1 = mix(vs_light_direction_1[1], vs_light_direction_1[0], gl_TessCoord.x);
-	vec4 light_dir2 = mix(vs_light_direction_1[2], vs_light_direction_1[3], gl_TessCoord.x);
-	vs_light_direction = mix(light_dir1, light_dir2, gl_TessCoord.y);
-
-
-	vec4 vertex_pos1 = mix(vertex_position_world_1[1], vertex_position_world_1[0], gl_TessCoord.x);
-	vec4 vertex_pos2 = mix(vertex_position_world_1[2], vertex_position_world_1[3], gl_TessCoord.x);
-	vertex_position_world = mix(vertex_pos1, vertex_pos2, gl_TessCoord.y);
-
-	vec4 tide_center_pos1 = mix(control_tide_center[1], control_tide_center[0], gl_TessCoord.x);
-	vec4 tide_center_pos2 = mix(control_tide_center[2], control_tide_center[3], gl_TessCoord.x);
-	eval_tide_center = mix(tide_center_pos1, tide_center_pos2, gl_TessCoord.y);
-
-
-}
-
-)zzz";
-
-
-const char* geometry_shader =
-R"zzz(#version 410 core
-
-
-layout (triangles) in;
-layout (triangle_strip, max_vertices = 4) out;
-uniform mat4 view;
-uniform mat4 projection;
-uniform float elapsedTime;
-uniform float tide_time;
-uniform int isOceanMode;
-
-in vec4 vs_light_direction[];
-in vec4 vertex_position_world[];
-in vec4 eval_tide_center[];
-
-
-
-flat out vec4 normal;
-out vec4 light_direction;
-out vec4 vertex_position_world_;
-out vec3 v_bycentric;
-void main()
-{
-	mat4 inv = inverse(view);
-	vec4 a = inv * vec4(gl_in[0].gl_Position.xyz, 1.0f);
-	vec4 b = inv * vec4(gl_in[1].gl_Position.xyz, 1.0f);
-	vec4 c = inv * vec4(gl_in[2].gl_Position.xyz, 1.0f);
-	
-	vec3 temp_a = vec3(a.x, a.y, a.z);
-	vec3 temp_b = vec3(b.x, b.y, b.z);
-	vec3 temp_c = vec3(c.x, c.y, c.z);
-	// float area = length(cross(temp_b - temp_a, temp_c - temp_a));
-	float area = length(cross(gl_in[0].gl_Position.xyz - gl_in[1].gl_Position.xyz,
-								gl_in[0].gl_Position.xyz - gl_in[2].gl_Position.xyz));
-
-	if(isOceanMode == 0) {
-		int n = 0;
-		
-		normal = vec4(normalize(cross(temp_b - temp_a, temp_c - temp_a)), 1.0f);
-		for (n = 0; n < gl_in.length(); n++) {
-			light_direction = vs_light_direction[n];
-			vertex_position_world_ = vertex_position_world[n];
-			gl_Position = projection * gl_in[n].gl_Position;
-			if(n == 0) {
-				v_bycentric = vec3(1, 0, 0) * sqrt(area);
-			}
-			else if(n == 1) {
-				v_bycentric = vec3(0, 1, 0) * sqrt(area);
-			}
-			else {
-				v_bycentric = vec3(0, 0, 1) * sqrt(area);
-			}
-			EmitVertex();
-		}
-		EndPrimitive();
-	}
-	else {
-		int n = 0;
-
-		for (n = 0; n < gl_in.length(); n++) {
-			light_direction = vs_light_direction[n];
-			vertex_position_world_ = vertex_position_world[n];
-
-
-			/*---------------------------------------------------------------------------------------------*/
-			vec4 base_position = gl_in[n].gl_Position;
-
-
-			// rewrite gl_Position to create waves
-
-			float amp = 1.0;	// amplitude
-			float waveLen = 2.0;	// crest-to-crest distance
-			float w = 2.0 / waveLen;
-			float speed = 2.0;
-			float phi = speed * w;
-			vec4 wave_dir = normalize(vec4(1.0, 0.0, 1.0, 0.0));	// x and z direction
-			float Q = 2.0;	//Qi is a parameter that controls the steepness of the waves
-
-			vec4 wave_pos = base_position;
-			wave_pos.y += amp * sin(w * dot(wave_pos, wave_dir) + phi * elapsedTime);	// height
+// Textures the FFT ocean writes every frame, on units kOceanTextureUnit on.
+enum { kOceanDisplacementTexture, kOceanNormalTexture, kNumOceanTextures };
+const int kOceanTextureUnit = 1;
+GLuint g_ocean_textures[kNumOceanTextures];
+GpuBuffer g_ocean_uploads[kNumOceanTextures];  // Pixel unpack buffers.
 
-			
-			float heightDiffX = w * wave_dir.x * amp * cos(dot(wave_dir, wave_pos) * w + phi * elapsedTime);	
-			float heightDiffZ = w * wave_dir.z * amp * cos(dot(wave_dir, wave_pos) * w + phi * elapsedTime);	
-			vec3 wave_normal = vec3(-heightDiffX, 1.0, -heightDiffZ);
-			normal = vec4(wave_normal, 1);
-			
+// Clipmap patch flags, attribute 1 of the floor VAO.
+GLuint g_floor_flags_buffer;
 
-			// // Gassian tide
-			float PI = 3.14;
-			float tide_speed = 5.0;
-			float tide_amp = 20.0;
-			float sigma = 2.0;
+// Transforms of the scene's instances in view, grouped by level and
+// rewritten every frame.  Each is a mat4 spanning attributes
+// kInstanceAttribute to kInstanceAttribute + 3 of the scene VAO.
+const GLuint kInstanceAttribute = 2;
+GpuBuffer g_instance_buffer;
 
-			vec4 curr_pos = vertex_position_world_;
-			vec4 tide_center = eval_tide_center[n];
+// Linked program binaries are cached here, relative to the working directory.
+const char* kShaderCacheDir = "shader_cache";
 
-			float distance_square = dot(curr_pos - tide_center, curr_pos - tide_center);
-			float tide_height = tide_amp * exp(- distance_square / (2.0 * sigma * sigma));
+// The sponge as last generated; the simulation's, not the renderer's.
+std::shared_ptr<const SpongeGeometry> g_geometry;
 
-			wave_pos.y += tide_height;
-			
-			gl_Position = projection * wave_pos;
+const glm::vec4 kLightPosition = glm::vec4(-10.0f, 10.0f, 0.0f, 1.0f);
 
-			/*---------------------------------------------------------------------------------------------*/
-
-
-
-			
-			if(n == 0) {
-				v_bycentric = vec3(1, 0, 0) * sqrt(area);
-			}
-			else if(n == 1) {
-				v_bycentric = vec3(0, 1, 0) * sqrt(area);
-			}
-			else {
-				v_bycentric = vec3(0, 0, 1) * sqrt(area);
-			}
-			EmitVertex();
-		}
-		EndPrimitive();
-	}
-	
-}
-)zzz";
-
-
-
-
-
-const char* fragment_shader =
-R"zzz(#version 410 core
-
-flat in vec4 normal;
-
-in vec4 light_direction;
-out vec4 fragment_color;
-void main()
-{
-	vec4 color = abs(normal) + vec4(0.0, 0.0, 0.0, 1.0);
-	float dot_nl = dot(normalize(light_direction), normal);
-	dot_nl = clamp(dot_nl, 0.0, 1.0);
-	fragment_color = clamp(dot_nl * color, 0.0, 1.0);
-	
-
-
-}
-)zzz";
-
-// FIXME: Implement shader effects with an alternative shader.
-const char* floor_fragment_shader =
-R"zzz(#version 410 core
-flat in vec4 normal;
-
-uniform float wireframeThresh;
-uniform int isOceanMode;
-uniform vec3 eye_position;
-uniform vec4 light_position;
-
-in vec3 v_bycentric;
-in vec4 light_direction;
-in vec4 vertex_position_world_;
-out vec4 fragment_color;
-
-void main()
-{
-
-	vec4 color;
-	if(isOceanMode != 0) {
-		color = vec4(normalize(vec3(0.0, 41.0, 58.0)), 1.0);
-	}
-	else {
-		if (mod(floor(vertex_position_world_[0]) + floor(vertex_position_world_[2]), 2.0) == 0) {
-			color = vec4(0.0, 0.0, 0.0, 1.0);
-		} else {
-			color = vec4(1.0, 1.0, 1.0, 1.0);
-		}
-	}
-
-	// add specular effects
-	vec3 water_ks = vec3(0.45, 0.45, 0.45);
-	float alpha = 1.0;
-	vec3 look_dir = normalize(eye_position - vertex_position_world_.xyz);
-	vec3 light_pixel_dir = normalize(light_position.xyz - vertex_position_world_.xyz);
-	vec3 R = 2 * dot(normal.xyz, light_pixel_dir) * normal.xyz - light_pixel_dir;
-	color += vec4(water_ks * pow(max(0.0, dot(look_dir, R)), alpha), 0.0);
-
-
-	float dot_nl = dot(normalize(light_direction), normalize(normal) );
-	dot_nl = clamp(dot_nl, 0.0, 1.0);
-	fragment_color = clamp(dot_nl * color, 0.0, 1.0);
-	float minBc = min(min(v_bycentric.x, v_bycentric.y), v_bycentric.z);
-	if(minBc < wireframeThresh) {
-		fragment_color = vec4(0.0, 1.0, 0.0, 1.0);
-	}
-}
-)zzz";
-
-std::vector<glm::vec4> obj_vertices;
-std::vector<glm::uvec3> obj_faces;
+// Shade the cube from per-face normal attributes rather than normals the
+// geometry shader derives per triangle.
+bool g_cube_normals = true;
+// Materials shade from those normals, so they pin the cube pipeline.
+bool g_materials = false;
 
 float wireframeThresh = 0.0f;
 auto polygonMode = GL_FILL;
 int innerLevel = 0, outerLevel = 0;
+// Floor tessellation follows projected edge length, aiming for one segment
+// every g_tess_pixels on screen; otherwise innerLevel/outerLevel apply.
+bool g_adaptive_tess = true;
+float g_tess_pixels = 16.0f;
 int isOceanMode = 0;
+// Shape of the floor clipmap.  The procedural floor takes changes from the
+// bracket keys on its next frame; the buffer floor keeps its first shape.
+FloorLayout g_floor_layout;
+bool g_procedural_floor = true;
+
+// With a render thread, the main thread handles input and simulates at
+// this rate, whatever the display does.  Without one it simulates once per
+// frame, at the display's rate; either way a tick is a frame of a camera
+// path.
+const int kTickRate = 60;
+
+// Replays step simulated time by a fixed amount per tick and ignore input.
+const float kReplayStep = 1.0f / kTickRate;
+bool g_replaying = false;
+
+// What --memory-budget defaults to, in MiB; 0 is no budget.
+const int kDefaultMemoryBudget = 2048;
 
 
 auto start_time = std::chrono::system_clock::now();
@@ -440,38 +158,205 @@ togglePolygonMode() {
 	else {
 		polygonMode = GL_FILL;
 	}
-	glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
 }
 
+// Cycles the floor through flat, sine waves with a tide, and the FFT ocean.
 void
 toggleOceanMode() {
-	if(isOceanMode == 0) {
-		isOceanMode = 1;
+	isOceanMode = (isOceanMode + 1) % 3;
+	std::cout << "ocean mode: " << isOceanMode << std::endl;
+}
+
+// Copies the sponge into the geometry buffers and points the geometry VAO,
+// which must be bound, at them.
+void
+UploadGeometry(const SpongeGeometry& geometry)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	GpuBuffer& vertex_buffer = g_geometry_buffers[kVertexBuffer];
+	size_t vertex_bytes = sizeof(float) * geometry.vertices.size() * 4;
+	size_t vertex_offset = vertex_buffer.upload(geometry.vertices.data(), vertex_bytes);
+	g_buffer_objects[kGeometryVao][kVertexBuffer] = vertex_buffer.id();
+	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer.id()));
+	CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0,
+				reinterpret_cast<const void*>(vertex_offset)));
+
+	GpuBuffer& index_buffer = g_geometry_buffers[kIndexBuffer];
+	size_t index_bytes;
+	if (geometry.meshlets.empty()) {
+		index_bytes = sizeof(uint32_t) * geometry.faces.size() * 3;
+		g_index_offset = index_buffer.upload(geometry.faces.data(), index_bytes);
+	} else {
+		index_bytes = sizeof(uint16_t) * geometry.meshlet_indices.size();
+		g_index_offset = index_buffer.upload(geometry.meshlet_indices.data(), index_bytes);
 	}
-	else {
-		isOceanMode = 0;
+	g_buffer_objects[kGeometryVao][kIndexBuffer] = index_buffer.id();
+	CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer.id()));
+
+	size_t normal_bytes = sizeof(float) * geometry.normals.size() * 3;
+	if (normal_bytes > 0) {
+		GpuBuffer& normal_buffer = g_geometry_buffers[kNormalBuffer];
+		size_t normal_offset = normal_buffer.upload(geometry.normals.data(), normal_bytes);
+		g_buffer_objects[kGeometryVao][kNormalBuffer] = normal_buffer.id();
+		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, normal_buffer.id()));
+		CHECK_GL_ERROR(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0,
+					reinterpret_cast<const void*>(normal_offset)));
+		CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+	} else {
+		CHECK_GL_ERROR(glDisableVertexAttribArray(1));
 	}
+
+	size_t allocated = 0;
+	for (int i = 0; i < kNumVbos; i++)
+		allocated += g_geometry_buffers[i].allocated_bytes();
+	g_geometry_gpu_bytes = allocated;
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "uploaded level " << geometry.level << ": "
+	          << (vertex_bytes + index_bytes + normal_bytes) / (1024.0 * 1024.0) << " MiB in "
+	          << elapsed.count() << " ms ("
+	          << (vertex_buffer.persistent() ? "persistent map" : "glBufferSubData") << ")\n";
+}
+
+// Ways to build the sponge, from the configured one down to the cheapest.
+struct SpongeMode {
+	bool normals;
+	bool meshlets;
+};
+
+std::string
+SpongeModeName(const SpongeMode& mode)
+{
+	return std::string(mode.normals ? "per-face normals" : "shared vertices") +
+	       (mode.meshlets ? " and meshlets" : "");
 }
 
-// FIXME: Save geometry to OBJ file
+// Bytes that building the sponge at level in mode would add, at its peak,
+// to what is allocated now.  The old sponge lives on until the renderer
+// has moved past it, but scratch is gone by the time the upload grows the
+// geometry buffers.  They never shrink; when they grow, GpuBuffer may
+// double them, but the estimates are too rough to tell when it would.
+size_t
+PredictSpongeBytes(int level, const SpongeMode& mode, MemoryFootprint* footprint)
+{
+	*footprint = Menger::footprint(level, mode.normals);
+	if (mode.meshlets) {
+		size_t vertices, faces;
+		Menger::mesh_size(level, mode.normals, &vertices, &faces);
+		*footprint = MeshletFootprint(*footprint, vertices, faces, mode.normals);
+	}
+	size_t allocated = g_geometry_gpu_bytes;
+	size_t needed = GpuBuffer::kSegments * footprint->gpu;
+	size_t growth = needed <= allocated ? 0 : needed - allocated;
+	return footprint->mesh + std::max(footprint->scratch, growth);
+}
+
+// Splits the sponge's faces into count materials of consecutive faces, as a
+// stand-in for a multi-material model.  Every other material is textured,
+// from checkerboards of two sizes, so batches have arrays to sort by.
 void
-SaveObj(const std::string& file,
-        const std::vector<glm::vec4>& vertices,
-        const std::vector<glm::uvec3>& indices)
+MakeMaterials(int count, size_t faces, std::vector<Material>* materials)
 {
-	std::cout << "writing obj file" << std::endl;
-	std::ofstream outfile;
-	outfile.open(file);
-	for(auto& v : vertices) {
-		outfile << "v " << v.x << " " << v.y << " " << v.z << "\n";
+	static std::vector<std::shared_ptr<Image>> checkers;
+	if (checkers.empty()) {
+		for (int i = 0; i < 4; i++) {
+			std::shared_ptr<Image> image = std::make_shared<Image>();
+			image->width = image->height = i % 2 ? 128 : 64;
+			image->stride = image->width * 3;
+			image->bytes.resize(image->stride * image->height);
+			for (int y = 0; y < image->height; y++) {
+				for (int x = 0; x < image->width; x++) {
+					bool check = (x * 8 / image->width + y * 8 / image->height) % 2;
+					unsigned char* p = &image->bytes[y * image->stride + x * 3];
+					p[0] = check ? 230 : 40 + 60 * i;
+					p[1] = check ? 230 : 200 - 50 * i;
+					p[2] = check ? 230 : 90;
+				}
+			}
+			checkers.push_back(image);
+		}
 	}
-	// std::cout << "indices size: " << indices.size() << std::endl;
-	for(auto& idx : indices) {
-		// std::cout << "f " << idx.x + 1 << " " << idx.y + 1<< " " << idx.z + 1 << std::endl;
-		outfile << "f " << idx.x + 1 << " " << idx.y + 1 << " " << idx.z + 1 << "\n";
+	materials->resize(count);
+	for (int i = 0; i < count; i++) {
+		Material& material = (*materials)[i];
+		float hue = 6.0f * i / count;
+		glm::vec3 rgb(std::abs(hue - 3.0f) - 1.0f, 2.0f - std::abs(hue - 2.0f),
+		              2.0f - std::abs(hue - 4.0f));
+		material.diffuse = glm::vec4(glm::clamp(rgb, 0.0f, 1.0f), 1.0f);
+		material.ambient = 0.1f * material.diffuse;
+		material.specular = glm::vec4(0.3f, 0.3f, 0.3f, 1.0f);
+		material.shininess = 32.0f;
+		material.texture = i % 2 ? checkers[i / 2 % checkers.size()] : nullptr;
+		material.offset = faces * i / count;
+		material.nfaces = faces * (i + 1) / count - material.offset;
 	}
-	outfile.close();
-	std::cout << "write obj file done " << std::endl;
+}
+
+// Points a program's PerFrame uniform block at kPerFrameBinding.
+void
+BindPerFrameBlock(GLuint program_id)
+{
+	GLuint block_index = 0;
+	CHECK_GL_ERROR(block_index = glGetUniformBlockIndex(program_id, "PerFrame"));
+	CHECK_GL_ERROR(glUniformBlockBinding(program_id, block_index, kPerFrameBinding));
+}
+
+// Copies the clipmap slots that changed since the last call into the
+// floor's buffers.
+void
+UploadFloor(FloorClipmap& floor)
+{
+	for (int l = 0; l < floor.levels(); l++) {
+		FloorClipmap::Range range = floor.dirty_vertices(l);
+		if (!range.empty()) {
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kVertexBuffer]));
+			CHECK_GL_ERROR(glBufferSubData(GL_ARRAY_BUFFER, range.begin * sizeof(glm::vec4),
+						(range.end - range.begin) * sizeof(glm::vec4),
+						floor.vertices().data() + range.begin));
+		}
+		range = floor.dirty_flags(l);
+		if (!range.empty()) {
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_floor_flags_buffer));
+			CHECK_GL_ERROR(glBufferSubData(GL_ARRAY_BUFFER, range.begin * sizeof(uint32_t),
+						(range.end - range.begin) * sizeof(uint32_t),
+						floor.flags().data() + range.begin));
+		}
+	}
+	floor.clear_dirty();
+}
+
+// Copies every level of the scene's sponge into the scene VAO's buffers,
+// where they stay, and makes the transform attributes per instance.
+// Returns the bytes uploaded.
+size_t
+UploadSceneMeshes(const SceneMeshes& meshes)
+{
+	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kSceneVao]));
+	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kSceneVao][0]));
+	size_t vertex_bytes = sizeof(glm::vec4) * meshes.vertices.size();
+	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kSceneVao][kVertexBuffer]));
+	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, vertex_bytes, meshes.vertices.data(),
+				GL_STATIC_DRAW));
+	CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
+	CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+	size_t normal_bytes = sizeof(glm::vec3) * meshes.normals.size();
+	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kSceneVao][kNormalBuffer]));
+	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, normal_bytes, meshes.normals.data(),
+				GL_STATIC_DRAW));
+	CHECK_GL_ERROR(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0));
+	CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+	size_t index_bytes = sizeof(glm::uvec3) * meshes.faces.size();
+	CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+				g_buffer_objects[kSceneVao][kIndexBuffer]));
+	CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, meshes.faces.data(),
+				GL_STATIC_DRAW));
+	// The render loop points these into g_instance_buffer per level.
+	for (int column = 0; column < 4; column++) {
+		CHECK_GL_ERROR(glEnableVertexAttribArray(kInstanceAttribute + column));
+		CHECK_GL_ERROR(glVertexAttribDivisor(kInstanceAttribute + column, 1));
+	}
+	return vertex_bytes + normal_bytes + index_bytes;
 }
 
 void
@@ -482,6 +367,78 @@ ErrorCallback(int error, const char* description)
 
 std::shared_ptr<Menger> g_menger;
 Camera g_camera;
+FrameProfiler g_profiler;  // Renderer only.
+FrameCapture g_capture;    // Renderer only.
+
+// Requests from the keyboard, passed on through FrameSnapshot.
+int g_screenshots = 0;
+int g_recordings = 0;
+bool g_recording = false;
+bool g_overlay = false;
+
+// Input events so far, and when the ones not yet on screen came in.
+long g_input_events = 0;
+std::deque<std::chrono::steady_clock::time_point> g_pending_inputs;
+
+void
+NoteInput()
+{
+	g_input_events++;
+	g_pending_inputs.push_back(std::chrono::steady_clock::now());
+}
+
+// What the camera path records besides the camera.
+ViewState
+CurrentViewState()
+{
+	ViewState state;
+	state.nesting_level = g_menger ? g_menger->nesting_level() : 0;
+	state.ocean_mode = isOceanMode;
+	state.wireframe_thresh = wireframeThresh;
+	state.line_polygons = polygonMode == GL_LINE;
+	state.cube_normals = g_cube_normals;
+	state.adaptive_tess = g_adaptive_tess;
+	state.tess_pixels = g_tess_pixels;
+	state.inner_level = innerLevel;
+	state.outer_level = outerLevel;
+	return state;
+}
+
+void
+ApplyViewState(const ViewState& state)
+{
+	bool cube_normals = state.cube_normals || g_materials;
+	bool regenerate = cube_normals != g_cube_normals;
+	if (g_menger && (regenerate || state.nesting_level != g_menger->nesting_level()))
+		g_menger->set_nesting_level(state.nesting_level);
+	if (state.line_polygons != (polygonMode == GL_LINE))
+		togglePolygonMode();
+	isOceanMode = state.ocean_mode;
+	wireframeThresh = state.wireframe_thresh;
+	g_cube_normals = cube_normals;
+	g_adaptive_tess = state.adaptive_tess;
+	g_tess_pixels = state.tess_pixels;
+	innerLevel = state.inner_level;
+	outerLevel = state.outer_level;
+}
+
+// Bracket keys: more or fewer levels stretch the floor's reach, and with
+// Ctrl a wider or narrower ring changes how many patches cover each level.
+void
+ResizeFloor(int step, bool ring)
+{
+	if (!g_procedural_floor) {
+		std::cout << "the floor's shape is fixed with --floor buffers" << std::endl;
+		return;
+	}
+	FloorLayout& layout = g_floor_layout;
+	if (ring)
+		layout.ring = std::max(kMinFloorRing, std::min(kMaxFloorRing, layout.ring + 4 * step));
+	else
+		layout.levels = std::max(kMinFloorLevels, std::min(kMaxFloorLevels, layout.levels + step));
+	std::cout << "floor: " << layout.levels << " levels of " << layout.ring << "^2 patches, "
+	          << layout.extent() << " units out" << std::endl;
+}
 
 void
 KeyCallback(GLFWwindow* window,
@@ -493,11 +450,25 @@ KeyCallback(GLFWwindow* window,
 	// Note:
 	// This is only a list of functions to implement.
 	// you may want to re-organize this piece of code.
+	if (g_replaying && key != GLFW_KEY_ESCAPE && key != GLFW_KEY_J && key != GLFW_KEY_P)
+		return;  // The path drives everything else.
+	NoteInput();
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GL_TRUE);
 	else if (key == GLFW_KEY_S && mods == GLFW_MOD_CONTROL && action == GLFW_RELEASE) {
 		// FIXME: save geometry to OBJ
-		SaveObj("geometry.obj", obj_vertices, obj_faces);
+		std::cout << "writing obj file" << std::endl;
+		// Save the shared-vertex mesh even when the per-face one is on screen.
+		std::vector<glm::vec4> shared_vertices;
+		std::vector<glm::uvec3> shared_faces;
+		bool per_face = !g_geometry->normals.empty();
+		if (per_face)
+			g_menger->generate_geometry(shared_vertices, shared_faces);
+		if (SaveObj("geometry.obj", per_face ? shared_vertices : g_geometry->vertices,
+					per_face ? shared_faces : g_geometry->faces))
+			std::cout << "write obj file done " << std::endl;
+		else
+			std::cerr << "failed to write geometry.obj" << std::endl;
 	} else if (key == GLFW_KEY_W && action != GLFW_RELEASE) {
 		// FIXME: WASD
 		g_camera.keyZoom(1);
@@ -525,6 +496,12 @@ KeyCallback(GLFWwindow* window,
 		toggleWireframe();
 	} else if(key == GLFW_KEY_O && mods == GLFW_MOD_CONTROL && action == GLFW_RELEASE) {
 		toggleOceanMode();
+	} else if(key == GLFW_KEY_MINUS && action != GLFW_RELEASE && g_adaptive_tess) {
+		g_tess_pixels = std::min(64.0f, g_tess_pixels * 2.0f);
+		std::cout << "floor segment target: " << g_tess_pixels << " px" << std::endl;
+	} else if(key == GLFW_KEY_EQUAL && action != GLFW_RELEASE && g_adaptive_tess) {
+		g_tess_pixels = std::max(1.0f, g_tess_pixels * 0.5f);
+		std::cout << "floor segment target: " << g_tess_pixels << " px" << std::endl;
 	} else if(key == GLFW_KEY_MINUS && action != GLFW_RELEASE) {
 		outerLevel = std::max(0, outerLevel - 1);
 	} else if(key == GLFW_KEY_EQUAL && action != GLFW_RELEASE) {
@@ -536,6 +513,32 @@ KeyCallback(GLFWwindow* window,
 	} else if(key == GLFW_KEY_T && action != GLFW_RELEASE) {
 		tideStartTime = getElapsedTime();
 		std::cout << "tide start time updated. value: " << tideStartTime << std::endl;
+	} else if(key == GLFW_KEY_P && action == GLFW_RELEASE) {
+		g_overlay = !g_overlay;
+		std::cout << "stats overlay " << (g_overlay ? "on" : "off") << std::endl;
+	} else if(key == GLFW_KEY_G && action == GLFW_RELEASE && g_materials) {
+		std::cout << "--materials needs the normal attribute cube pipeline" << std::endl;
+	} else if(key == GLFW_KEY_G && action == GLFW_RELEASE) {
+		g_cube_normals = !g_cube_normals;
+		std::cout << "cube pipeline: "
+		          << (g_cube_normals ? "normal attributes" : "geometry shader") << std::endl;
+		if (g_menger)
+			g_menger->set_nesting_level(g_menger->nesting_level());
+	} else if(key == GLFW_KEY_J && action == GLFW_RELEASE) {
+		std::cout << "saving screenshot_" << g_screenshots++ << ".jpg" << std::endl;
+	} else if(key == GLFW_KEY_R && action == GLFW_RELEASE) {
+		g_recording = !g_recording;
+		if (g_recording)
+			std::cout << "recording to recording_" << g_recordings++ << "_*.jpg" << std::endl;
+		else
+			std::cout << "recording stopped" << std::endl;
+	} else if(key == GLFW_KEY_V && action == GLFW_RELEASE) {
+		g_adaptive_tess = !g_adaptive_tess;
+		std::cout << "floor tessellation: "
+		          << (g_adaptive_tess ? "screen-space adaptive" : "fixed levels") << std::endl;
+	} else if((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) &&
+	          action != GLFW_RELEASE) {
+		ResizeFloor(key == GLFW_KEY_RIGHT_BRACKET ? 1 : -1, mods == GLFW_MOD_CONTROL);
 	}
 
 
@@ -568,8 +571,9 @@ bool mouse_clicked = false;
 
 void MousePosCallback(GLFWwindow* window, double mouse_x, double mouse_y)
 {
-	if(!g_mouse_pressed)
+	if(!g_mouse_pressed || g_replaying)
 		return;
+	NoteInput();
 	if(mouse_clicked) {
 		g_camera.setMouseCoord(mouse_x, mouse_y);
 		mouse_clicked = false;
@@ -584,80 +588,222 @@ void MousePosCallback(GLFWwindow* window, double mouse_x, double mouse_y)
 
 void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 {
+	if (g_replaying)
+		return;
+	NoteInput();
 	mouse_clicked = true;
 	g_mouse_pressed = (action == GLFW_PRESS);
 	g_current_button = button;
 }
 
-// void make_floor(std::vector<glm::vec4>& floor_vertices,
-// 					 std::vector<glm::uvec3>& floor_faces) 
-// {
-// 	float max = 1000.0f;
-// 	float min = -1000.0f;
-
-// 	floor_vertices.push_back(glm::vec4(min, -2.0f, min, 1.0f));
-// 	floor_vertices.push_back(glm::vec4(min, -2.0f, max, 1.0f));
-// 	floor_vertices.push_back(glm::vec4(max, -2.0f, max, 1.0f));
-// 	floor_vertices.push_back(glm::vec4(max, -2.0f, min, 1.0f));
-
-// 	floor_faces.push_back(glm::uvec3(0, 1, 2));
-// 	floor_faces.push_back(glm::uvec3(3, 4, 5));
-// }
-
-unsigned int getVertexIdx(int x, int y, int width) {
-	return (unsigned int) x * width + y;
-}
-
-void make_floor(std::vector<glm::vec4>& floor_vertices,
-					 std::vector<glm::uvec4>& floor_faces) {
-	float min = -20.0f, max = 20.0f;
-	int fragmentNums = 16;
-	float step = (max - min) / fragmentNums;
-	// push vertices
-	for(int x = 0; x <= fragmentNums; x++) {
-		for(int y = 0; y <= fragmentNums; y++) {
-			floor_vertices.push_back(glm::vec4(min + step * x, -2.0f, min + step * y, 1.0f));
-		}
-	}
-	// push faces
-	for(int x = 0; x < fragmentNums; x++) {
-		for(int y = 0; y < fragmentNums; y++) {
-			floor_faces.push_back(glm::uvec4(
-				getVertexIdx(x, y, fragmentNums + 1),
-				getVertexIdx(x, y + 1, fragmentNums + 1),
-				getVertexIdx(x + 1, y + 1, fragmentNums + 1),
-				getVertexIdx(x + 1, y, fragmentNums + 1)
-			));
+// Renders `frames` frames of every nesting level from the default camera
+// with the software rasterizer, reports their rate and saves the last one
+// of each level as software_level_<level>.jpg.  Needs no window or GL.
+void
+RunSoftware(int frames)
+{
+	Menger menger(glm::vec3(-0.5f), glm::vec3(0.5f));
+	FloorClipmap floor;
+	floor.update(g_camera.get_eye_position());
+	SoftRasterizer raster(window_width, window_height);
+	SoftUniforms uniforms;
+	uniforms.projection = glm::perspective(glm::radians(45.0f),
+			static_cast<float>(window_width) / window_height, 0.0001f, 1000.0f);
+	uniforms.view = g_camera.get_view_matrix();
+	uniforms.light_position = kLightPosition;
+	uniforms.eye_position = g_camera.get_eye_position();
+
+	std::cout << std::fixed << std::setprecision(2);
+	for (int level = 0; level <= 4; level++) {
+		std::vector<glm::vec4> vertices;
+		std::vector<glm::uvec3> faces;
+		menger.set_nesting_level(level);
+		menger.generate_geometry(vertices, faces);
+
+		auto begin = std::chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++) {
+			raster.begin_frame(uniforms);
+			raster.draw_mesh(vertices, faces);
+			raster.draw_floor(floor);
+			raster.end_frame();
 		}
+		std::chrono::duration<double, std::milli> elapsed =
+			std::chrono::steady_clock::now() - begin;
+		double ms = elapsed.count() / frames;
+		std::cout << "software level " << level << ": "
+		          << raster.submitted_triangles() << " triangles ("
+		          << raster.rasterized_triangles() << " rasterized), "
+		          << ms << " ms/frame, " << 1000.0 / ms << " fps\n";
+
+		std::string file = "software_level_" + std::to_string(level) + ".jpg";
+		if (!SaveJPEG(file, raster.width(), raster.height(), raster.pixels().data()))
+			std::cerr << "failed to write " << file << "\n";
 	}
-
-	// float max = 20.0f;
-	// float min = -20.0f;
-	// float planey = -2.0f;
-
-	// float step = float((max - min) / 16.0);
-
-	// for (int i = min; i < max; i += step) {
-	// 	for (int j = min; j < max; j += step) {
-	// 		floor_vertices.push_back(glm::vec4(i, planey, j, 1.0f));
-	// 		floor_vertices.push_back(glm::vec4(i + step, planey, j, 1.0f));
-	// 		floor_vertices.push_back(glm::vec4(i + step, planey, j + step, 1.0f));
-	// 		floor_vertices.push_back(glm::vec4(i, planey, j + step, 1.0f));
-
-	// 		int v = floor_vertices.size();
-	// 		floor_faces.push_back(glm::vec4(v, v+1, v+2, v+3));
-	// 	}
-	// }
+	std::cout << std::defaultfloat;
 }
 
-
+// Writes the sponge of the given level as voxels_level_<level>.<format>.
+// Needs no window or GL.
+bool
+RunVoxelExport(int level, VoxelFormat format)
+{
+	std::string file = "voxels_level_" + std::to_string(level) + "." + VoxelFormatName(format);
+	auto begin = std::chrono::steady_clock::now();
+	VoxelExportStats stats;
+	if (!ExportVoxels(file, level, glm::vec3(-0.5f), glm::vec3(0.5f), format, &stats)) {
+		std::cerr << "failed to write " << file << "\n";
+		return false;
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+	std::cout << std::fixed << std::setprecision(1) << file << ": " << stats.filled
+	          << " voxels filled, " << stats.records << " records, " << MiB(stats.bytes)
+	          << " MiB in " << elapsed.count() << " ms, " << MiB(stats.buffer_bytes)
+	          << " MiB buffered\n" << std::defaultfloat;
+	return true;
+}
 
 int main(int argc, char* argv[])
 {
+	auto startup_time = std::chrono::steady_clock::now();
 	float elapsedTime = getElapsedTime();	// in miliseconds
 	std::cout << "elapsedTime: " << elapsedTime << std::endl;
  
 
+	std::string trace_file;
+	bool show_stats = false;
+	DebugGLMode gl_check_mode = kDebugGLAsync;
+	bool persistent_buffers = true;
+	bool use_shader_cache = true;
+	int software_frames = 0;
+	int voxel_level = -1;
+	VoxelFormat voxel_format = kVoxelBricks;
+	std::vector<std::string> texture_files;
+	int texture_max_size = 0;
+	int material_count = 0;
+	std::string record_path_file;
+	std::string replay_file;
+	std::string record_prefix;
+	bool render_thread = true;
+	unsigned index_passes = 0;
+	bool use_meshlets = true;
+	size_t memory_budget = size_t(kDefaultMemoryBudget) << 20;
+	int scene_instances = 0;
+	JpegOptions jpeg_options;
+	OceanParams ocean_params;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		std::string value = i + 1 < argc ? argv[i + 1] : "";
+		int number = std::atoi(value.c_str());
+		if (arg == "--stats") {
+			show_stats = true;
+		} else if (arg == "--trace" && i + 1 < argc) {
+			trace_file = argv[++i];
+		} else if (arg == "--gl-check" && (value == "off" || value == "async" || value == "sync")) {
+			gl_check_mode = value == "off" ? kDebugGLOff :
+			                value == "async" ? kDebugGLAsync : kDebugGLSync;
+			i++;
+		} else if (arg == "--buffers" && (value == "subdata" || value == "persistent")) {
+			persistent_buffers = value == "persistent";
+			i++;
+		} else if (arg == "--cube-pipeline" && (value == "gs" || value == "attrib")) {
+			g_cube_normals = value == "attrib";
+			i++;
+		} else if (arg == "--ocean-grid" && number >= 16 && number <= 1024 &&
+		           (number & (number - 1)) == 0) {
+			ocean_params.grid = number;
+			i++;
+		} else if (arg == "--tess-pixels" && i + 1 < argc && number >= 0 && number <= 64) {
+			g_adaptive_tess = number > 0;
+			if (number > 0)
+				g_tess_pixels = number;
+			i++;
+		} else if (arg == "--no-shader-cache") {
+			use_shader_cache = false;
+		} else if (arg == "--record" && i + 1 < argc) {
+			record_prefix = argv[++i];
+		} else if (arg == "--jpeg-quality" && number >= 1 && number <= 100) {
+			jpeg_options.quality = number;
+			i++;
+		} else if (arg == "--jpeg-subsampling" && (value == "444" || value == "422" || value == "420")) {
+			jpeg_options.subsampling = value == "444" ? kJpeg444 :
+			                           value == "422" ? kJpeg422 : kJpeg420;
+			i++;
+		} else if (arg == "--texture" && i + 1 < argc) {
+			texture_files.push_back(argv[++i]);
+		} else if (arg == "--texture-max-size" && number >= 1 && number <= 16384) {
+			texture_max_size = number;
+			i++;
+		} else if (arg == "--materials" && number >= 1 && number <= 65536) {
+			material_count = number;
+			i++;
+		} else if (arg == "--record-path" && i + 1 < argc) {
+			record_path_file = argv[++i];
+		} else if (arg == "--replay" && i + 1 < argc) {
+			replay_file = argv[++i];
+		} else if (arg == "--render-thread" && (value == "on" || value == "off")) {
+			render_thread = value == "on";
+			i++;
+		} else if (arg == "--index-passes" && ParseIndexPasses(value, &index_passes)) {
+			i++;
+		} else if (arg == "--meshlets" && (value == "on" || value == "off")) {
+			use_meshlets = value == "on";
+			i++;
+		} else if (arg == "--floor" && (value == "buffers" || value == "procedural")) {
+			g_procedural_floor = value == "procedural";
+			i++;
+		} else if (arg == "--memory-budget" && i + 1 < argc && number >= 0) {
+			memory_budget = size_t(number) << 20;
+			i++;
+		} else if (arg == "--export-voxels" && i + 1 < argc && number >= 0 &&
+		           number <= kMaxVoxelLevel) {
+			voxel_level = number;
+			i++;
+		} else if (arg == "--voxel-format" && ParseVoxelFormat(value, &voxel_format)) {
+			i++;
+		} else if (arg == "--jobs" && number >= 0 && number <= 256) {
+			g_jobs.set_threads(number);
+			i++;
+		} else if (arg == "--scene" && number > 0 && number <= 1000000) {
+			scene_instances = number;
+			i++;
+		} else if (arg == "--software" && number > 0) {
+			software_frames = number;
+			i++;
+		} else {
+			std::cerr << "usage: " << argv[0] << " [--stats] [--trace <file.csv>]"
+			          << " [--gl-check off|async|sync] [--buffers subdata|persistent]"
+			          << " [--cube-pipeline gs|attrib] [--ocean-grid <16..1024, power of 2>]"
+			          << " [--tess-pixels <0..64, 0 for fixed levels>] [--no-shader-cache]"
+			          << " [--record <prefix>] [--jpeg-quality <1..100>]"
+			          << " [--jpeg-subsampling 444|422|420] [--texture <file.jpg>]..."
+			          << " [--texture-max-size <1..16384>] [--materials <1..65536>]"
+			          << " [--record-path <file>] [--replay <file>] [--render-thread on|off]"
+			          << " [--index-passes none|all|<cache,overdraw,fetch>] [--meshlets on|off]"
+			          << " [--memory-budget <MiB, 0 for none>] [--software <frames>]"
+			          << " [--export-voxels <0..10>] [--voxel-format bits|rle|bricks]"
+			          << " [--jobs <threads, 0 for one per core>] [--scene <instances>]"
+			          << " [--floor buffers|procedural]\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (software_frames > 0) {
+		RunSoftware(software_frames);
+		return 0;
+	}
+	if (voxel_level >= 0)
+		return RunVoxelExport(voxel_level, voxel_format) ? 0 : EXIT_FAILURE;
+
+	CameraPath replay_path, recorded_path;
+	if (!replay_file.empty()) {
+		if (!replay_path.load(replay_file)) {
+			std::cerr << "cannot read camera path " << replay_file << "\n";
+			exit(EXIT_FAILURE);
+		}
+		std::cout << "replaying " << replay_path.frames() << " frames from " << replay_file
+		          << " with vsync off\n";
+		g_replaying = true;
+	}
+
 	std::string window_title = "Menger";
 	if (!glfwInit()) exit(EXIT_FAILURE);
 	g_menger = std::make_shared<Menger>(glm::vec3(-0.5, -0.5, -0.5), glm::vec3(0.5, 0.5, 0.5));
@@ -669,6 +815,9 @@ int main(int argc, char* argv[])
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	// Some drivers only send debug messages to debug contexts.
+	if (DEBUGGL_ENABLED && gl_check_mode == kDebugGLAsync)
+		glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
 	GLFWwindow* window = glfwCreateWindow(window_width, window_height,
 			&window_title[0], nullptr, nullptr);
 	CHECK_SUCCESS(window != nullptr);
@@ -677,26 +826,35 @@ int main(int argc, char* argv[])
 
 	CHECK_SUCCESS(glewInit() == GLEW_OK);
 	glGetError();  // clear GLEW's error for it
+	gl_check_mode = debugglSetMode(gl_check_mode);
+	std::cout << "GL error checks: " << debugglModeName(gl_check_mode) << "\n";
 	glfwSetKeyCallback(window, KeyCallback);
 	glfwSetCursorPosCallback(window, MousePosCallback);
 	glfwSetMouseButtonCallback(window, MouseButtonCallback);
-	glfwSwapInterval(1);
+	glfwSwapInterval(g_replaying ? 0 : 1);
 	const GLubyte* renderer = glGetString(GL_RENDERER);  // get renderer string
 	const GLubyte* version = glGetString(GL_VERSION);    // version as a string
 	std::cout << "Renderer: " << renderer << "\n";
 	std::cout << "OpenGL version supported:" << version << "\n";
+	g_capture.init();
+	g_capture.encoder().set_options(jpeg_options);
+	g_recording = !record_prefix.empty();
 
 	
 
         //FIXME: Create the geometry from a Menger object.
         //CreateTriangle(obj_vertices, obj_faces);
 
+	// The first tick regenerates this with the configured pipeline.
+	std::shared_ptr<SpongeGeometry> first_geometry = std::make_shared<SpongeGeometry>();
 	g_menger->set_nesting_level(0);
-	g_menger->generate_geometry(obj_vertices, obj_faces);
+	g_menger->generate_geometry(first_geometry->vertices, first_geometry->faces);
+	first_geometry->memory.set(first_geometry->bytes());
+	g_geometry = first_geometry;
 
 	glm::vec4 min_bounds = glm::vec4(std::numeric_limits<float>::max());
 	glm::vec4 max_bounds = glm::vec4(-std::numeric_limits<float>::max());
-	for (const auto& vert : obj_vertices) {
+	for (const auto& vert : g_geometry->vertices) {
 		min_bounds = glm::min(vert, min_bounds);
 		max_bounds = glm::max(vert, max_bounds);
 	}
@@ -709,24 +867,18 @@ int main(int argc, char* argv[])
 	// Switch to the VAO for Geometry.
 	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kGeometryVao]));
 
-	// Generate buffer objects
-	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kGeometryVao][0]));
-
-	// Setup vertex data in a VBO.
-	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kVertexBuffer]));
-	// NOTE: We do not send anything right now, we just describe it to OpenGL.
-	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				sizeof(float) * obj_vertices.size() * 4, obj_vertices.data(),
-				GL_STATIC_DRAW));
-	CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
+	// Generate buffer objects. They are filled by UploadGeometry whenever
+	// the sponge is dirty, which includes the first frame.
+	persistent_buffers = persistent_buffers && GpuBuffer::persistent_supported();
+	std::cout << "geometry buffers: "
+	          << (persistent_buffers ? "persistent map" : "glBufferSubData") << "\n";
+	g_geometry_buffers[kVertexBuffer].init(GL_ARRAY_BUFFER, persistent_buffers);
+	g_geometry_buffers[kIndexBuffer].init(GL_ELEMENT_ARRAY_BUFFER, persistent_buffers);
+	g_geometry_buffers[kNormalBuffer].init(GL_ARRAY_BUFFER, persistent_buffers);
+	for (int i = 0; i < kNumVbos; i++)
+		g_buffer_objects[kGeometryVao][i] = g_geometry_buffers[i].id();
 	CHECK_GL_ERROR(glEnableVertexAttribArray(0));
 
-	// Setup element array buffer.
-	CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kIndexBuffer]));
-	CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-				sizeof(uint32_t) * obj_faces.size() * 3,
-				obj_faces.data(), GL_STATIC_DRAW));
-
 	/*
  	 * By far, the geometry is loaded into g_buffer_objects[kGeometryVao][*].
 	 * These buffers are binded to g_array_objects[kGeometryVao]
@@ -734,201 +886,417 @@ int main(int argc, char* argv[])
 
 	// FIXME: load the floor into g_buffer_objects[kFloorVao][*],
 	//        and bind these VBO to g_array_objects[kFloorVao]
-	std::vector<glm::vec4> floor_vertices;
-	std::vector<glm::uvec4> floor_faces;
-
-	make_floor(floor_vertices, floor_faces);
+	// The procedural floor draws from the empty floor VAO.  Otherwise the
+	// buffers keep one slot per clipmap patch; the render loop rewrites the
+	// slots that change as the eye moves.
+	std::unique_ptr<FloorClipmap> floor;
+	MemoryCharge floor_memory(kMemoryFloor);
 
 	// Switch to the VAO for floor
 	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kFloorVao]));
 
-	// Generate floor buffer objects
-	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kFloorVao][0]));
+	if (g_procedural_floor) {
+		std::cout << "floor clipmap: " << g_floor_layout.levels << " levels, "
+		          << g_floor_layout.patches() << " patch slots, procedural\n";
+	} else {
+		floor.reset(new FloorClipmap(g_floor_layout));
+		floor->update(g_camera.get_eye_position());
+		floor->clear_dirty();
+		std::cout << "floor clipmap: " << floor->levels() << " levels, "
+		          << floor->vertices().size() / 4 << " patch slots, "
+		          << floor->visible_patches() << " drawn\n";
+		// Its arrays never grow; the buffers below hold a copy of each.
+		floor_memory.set(2 * (CapacityBytes(floor->vertices()) + CapacityBytes(floor->flags())));
+
+		// Generate floor buffer objects
+		CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kFloorVao][0]));
+
+		// Setup floor vertex data in a VBO.
+		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kVertexBuffer]));
+		// NOTE: We do not send anything right now, we just describe it to OpenGL.
+		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+					sizeof(float) * floor->vertices().size() * 4, floor->vertices().data(),
+					GL_DYNAMIC_DRAW));
+		CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
+		CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+
+		// Setup the patch flags; the floor has no index buffer.
+		CHECK_GL_ERROR(glGenBuffers(1, &g_floor_flags_buffer));
+		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_floor_flags_buffer));
+		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+					sizeof(uint32_t) * floor->flags().size(),
+					floor->flags().data(), GL_DYNAMIC_DRAW));
+		CHECK_GL_ERROR(glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, 0, 0));
+		CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+	}
 
-	// Setup floor vertex data in a VBO.
-	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kVertexBuffer]));
-	// NOTE: We do not send anything right now, we just describe it to OpenGL.
-	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				sizeof(float) * floor_vertices.size() * 4, floor_vertices.data(),
-				GL_STATIC_DRAW));
-	CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
-	CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+	// A scene of many sponges takes the single sponge's place.  Its meshes
+	// go up once; each frame only streams the transforms of those in view.
+	SpongeScene scene;
+	SceneMeshes scene_meshes;
+	MemoryCharge scene_gpu_memory(kMemoryGpu);
+	if (scene_instances > 0) {
+		auto start = std::chrono::steady_clock::now();
+		MakeSceneGrid(scene_instances, &scene);
+		BuildSceneMeshes(&scene_meshes);
+		scene_gpu_memory.set(UploadSceneMeshes(scene_meshes));
+		// Only the offsets of each level are needed from here on.
+		std::vector<glm::vec4>().swap(scene_meshes.vertices);
+		std::vector<glm::vec3>().swap(scene_meshes.normals);
+		std::vector<glm::uvec3>().swap(scene_meshes.faces);
+		g_instance_buffer.init(GL_ARRAY_BUFFER, persistent_buffers);
+		// The nesting level keys now cap the instances' levels.
+		g_menger->set_nesting_level(kSceneMaxLevel);
+		std::cout << "scene: " << scene.size() << " instances, " << MiB(scene_gpu_memory.bytes())
+		          << " MiB of meshes for levels 0 to " << kSceneMaxLevel << " ("
+		          << std::chrono::duration<double, std::milli>(
+		                 std::chrono::steady_clock::now() - start).count()
+		          << " ms)\n";
+	}
 
-	// Setup floor element array buffer.
-	CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_buffer_objects[kFloorVao][kIndexBuffer]));
-	CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-				sizeof(uint32_t) * floor_faces.size() * 4,
-				floor_faces.data(), GL_STATIC_DRAW));
-
-	// Setup vertex shader.
-	GLuint vertex_shader_id = 0;
-	const char* vertex_source_pointer = vertex_shader;
-	CHECK_GL_ERROR(vertex_shader_id = glCreateShader(GL_VERTEX_SHADER));
-	CHECK_GL_ERROR(glShaderSource(vertex_shader_id, 1, &vertex_source_pointer, nullptr));
-	glCompileShader(vertex_shader_id);
-	CHECK_GL_SHADER_ERROR(vertex_shader_id);
-
-
-	/*---------------------our codes ---------------------------*/
-	// Setup tessllation control shader
-	GLuint tess_control_shader_id = 0;
-	// const char* tess_control_source_pointer = triangleTessControlShader;
-	// CHECK_GL_ERROR(tess_control_shader_id = glCreateShader(GL_TESS_CONTROL_SHADER));
-	// CHECK_GL_ERROR(glShaderSource(tess_control_shader_id, 1, &tess_control_source_pointer, nullptr));
-	// glCompileShader(tess_control_shader_id);
-	// CHECK_GL_SHADER_ERROR(tess_control_shader_id);
-	const char* tess_control_source_pointer = quadTessControlShader;
-	CHECK_GL_ERROR(tess_control_shader_id = glCreateShader(GL_TESS_CONTROL_SHADER));
-	CHECK_GL_ERROR(glShaderSource(tess_control_shader_id, 1, &tess_control_source_pointer, nullptr));
-	glCompileShader(tess_control_shader_id);
-	CHECK_GL_SHADER_ERROR(tess_control_shader_id);
-
-
-	// Setup tessllation evaluation shader
-	GLuint tess_eval_shader_id = 0;
-	// const char* tess_eval_source_pointer = triangleTessEvaluationShader;
-	// CHECK_GL_ERROR(tess_eval_shader_id = glCreateShader(GL_TESS_EVALUATION_SHADER));
-	// CHECK_GL_ERROR(glShaderSource(tess_eval_shader_id, 1, &tess_eval_source_pointer, nullptr));
-	// glCompileShader(tess_eval_shader_id);
-	// CHECK_GL_SHADER_ERROR(tess_eval_shader_id);
-	const char* tess_eval_source_pointer = quadTessEvaluationShader;
-	CHECK_GL_ERROR(tess_eval_shader_id = glCreateShader(GL_TESS_EVALUATION_SHADER));
-	CHECK_GL_ERROR(glShaderSource(tess_eval_shader_id, 1, &tess_eval_source_pointer, nullptr));
-	glCompileShader(tess_eval_shader_id);
-	CHECK_GL_SHADER_ERROR(tess_eval_shader_id);
-
-	// Setup geometry shader.
-	GLuint geometry_shader_id = 0;
-	const char* geometry_source_pointer = geometry_shader;
-	CHECK_GL_ERROR(geometry_shader_id = glCreateShader(GL_GEOMETRY_SHADER));
-	CHECK_GL_ERROR(glShaderSource(geometry_shader_id, 1, &geometry_source_pointer, nullptr));
-	glCompileShader(geometry_shader_id);
-	CHECK_GL_SHADER_ERROR(geometry_shader_id);
-
-	// Setup ocean geometry shader.
-	// GLuint ocean_geometry_shader_id = 0;
-	// const char* ocean_geometry_source_pointer = ocean_geometry_shader;
-	// CHECK_GL_ERROR(ocean_geometry_shader_id = glCreateShader(GL_GEOMETRY_SHADER));
-	// CHECK_GL_ERROR(glShaderSource(ocean_geometry_shader_id, 1, &ocean_geometry_source_pointer, nullptr));
-	// glCompileShader(ocean_geometry_shader_id);
-	// CHECK_GL_SHADER_ERROR(ocean_geometry_shader_id);
-
-
-	// Setup fragment shader.
-	GLuint fragment_shader_id = 0;
-	const char* fragment_source_pointer = fragment_shader;
-	CHECK_GL_ERROR(fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(fragment_shader_id, 1, &fragment_source_pointer, nullptr));
-	glCompileShader(fragment_shader_id);
-	CHECK_GL_SHADER_ERROR(fragment_shader_id);
-
-	// Let's create our program.
-	GLuint program_id = 0;
-	CHECK_GL_ERROR(program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(program_id, vertex_shader_id));
-	CHECK_GL_ERROR(glAttachShader(program_id, fragment_shader_id));
-	CHECK_GL_ERROR(glAttachShader(program_id, geometry_shader_id));
-
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindFragDataLocation(program_id, 0, "fragment_color"));
-	glLinkProgram(program_id);
-	CHECK_GL_PROGRAM_ERROR(program_id);
-
-	// Get the uniform locations.
-	GLint projection_matrix_location = 0;
-	CHECK_GL_ERROR(projection_matrix_location = 
-			glGetUniformLocation(program_id, "projection"));
-	GLint view_matrix_location = 0;
-	CHECK_GL_ERROR(view_matrix_location =
-			glGetUniformLocation(program_id, "view"));
-	GLint light_position_location = 0;
-	CHECK_GL_ERROR(light_position_location =
-			glGetUniformLocation(program_id, "light_position"));
-
-	// Setup fragment shader for the floor
-	GLuint floor_fragment_shader_id = 0;
-	const char* floor_fragment_source_pointer = floor_fragment_shader;
-	CHECK_GL_ERROR(floor_fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER));
-	CHECK_GL_ERROR(glShaderSource(floor_fragment_shader_id, 1,
-				&floor_fragment_source_pointer, nullptr));
-	glCompileShader(floor_fragment_shader_id);
-	CHECK_GL_SHADER_ERROR(floor_fragment_shader_id);
-
-	// FIXME: Setup another program for the floor, and get its locations.
-	// Note: you can reuse the vertex and geometry shader objects
-	// GLuint floor_program_id = 0;
-	// GLint floor_projection_matrix_location = 0;
-	// GLint floor_view_matrix_location = 0;
-	// GLint floor_light_position_location = 0;
-
-	GLuint floor_program_id = 0;
-	CHECK_GL_ERROR(floor_program_id = glCreateProgram());
-	CHECK_GL_ERROR(glAttachShader(floor_program_id, vertex_shader_id));
-
-	/* our shaders attached here */
-	// CHECK_GL_ERROR(glAttachShader(floor_program_id, tess_control_shader_id));
-	// CHECK_GL_ERROR(glAttachShader(floor_program_id, tess_eval_shader_id));
-	CHECK_GL_ERROR(glAttachShader(floor_program_id, tess_control_shader_id));
-	CHECK_GL_ERROR(glAttachShader(floor_program_id, tess_eval_shader_id));
-	
-	CHECK_GL_ERROR(glAttachShader(floor_program_id, geometry_shader_id));
-	// CHECK_GL_ERROR(glAttachShader(floor_program_id, ocean_geometry_shader_id));
-
-	CHECK_GL_ERROR(glAttachShader(floor_program_id, floor_fragment_shader_id));
-
-	// Bind attributes.
-	CHECK_GL_ERROR(glBindAttribLocation(floor_program_id, 0, "vertex_position"));
-	CHECK_GL_ERROR(glBindFragDataLocation(floor_program_id, 0, "fragment_color"));
-	glLinkProgram(floor_program_id);
-	CHECK_GL_PROGRAM_ERROR(floor_program_id);
-
-	// Get the uniform locations.
-	GLint floor_projection_matrix_location = 0;
-	CHECK_GL_ERROR(floor_projection_matrix_location =
-			glGetUniformLocation(floor_program_id, "projection"));
-	GLint floor_view_matrix_location = 0;
-	CHECK_GL_ERROR(floor_view_matrix_location =
-			glGetUniformLocation(floor_program_id, "view"));
-	GLint eye_position_location = 0;
-	CHECK_GL_ERROR(eye_position_location =
-			glGetUniformLocation(floor_program_id, "eye_position"));
-
-	GLint floor_light_position_location = 0;
-	CHECK_GL_ERROR(floor_light_position_location =
-			glGetUniformLocation(floor_program_id, "light_position"));
-	GLint floor_wireframe_thresh_location = 0;
-	CHECK_GL_ERROR(floor_wireframe_thresh_location =
-			glGetUniformLocation(floor_program_id, "wireframeThresh"));
-	GLint tess_inner_level_location = 0;
-	CHECK_GL_ERROR(tess_inner_level_location =
-			glGetUniformLocation(floor_program_id, "innerLevel"));
-	GLint tess_outer_level_location = 0;
-	CHECK_GL_ERROR(tess_outer_level_location =
-			glGetUniformLocation(floor_program_id, "outerLevel"));
-	GLint elapsed_time_location = 0;
-	CHECK_GL_ERROR(elapsed_time_location =
-			glGetUniformLocation(floor_program_id, "elapsedTime"));
-	GLint tide_time_location = 0;
-	CHECK_GL_ERROR(tide_time_location =
-			glGetUniformLocation(floor_program_id, "tide_time"));
-	GLint is_ocean_mode_location = 0;
-	CHECK_GL_ERROR(is_ocean_mode_location =
-			glGetUniformLocation(floor_program_id, "isOceanMode"));
-
-
-
-
-
-	// glm::vec4 light_position = glm::vec4(10.0f, 10.0f, 10.0f, 1.0f);
-	glm::vec4 light_position = glm::vec4(-10.0f, 10.0f, 0.0f, 1.0f);
+	// Build the programs; the geometry shader is shared by the floor and the
+	// geometry-shader cube.
+	const std::vector<std::pair<GLuint, std::string>> attributes = {
+		{ 0, "vertex_position" },
+	};
+	const std::vector<std::pair<GLuint, std::string>> floor_attributes = {
+		{ 0, "vertex_position" },
+		{ 1, "patch_flags" },
+	};
+	const std::vector<std::pair<GLuint, std::string>> cube_attributes = {
+		{ 0, "vertex_position" },
+		{ 1, "vertex_normal" },
+	};
+	const std::vector<std::pair<GLuint, std::string>> frag_data = {
+		{ 0, "fragment_color" },
+	};
+	std::vector<ProgramSpec> program_specs = {
+		{ "cube",
+		  { { GL_VERTEX_SHADER, vertex_shader },
+		    { GL_GEOMETRY_SHADER, geometry_shader },
+		    { GL_FRAGMENT_SHADER, fragment_shader } },
+		  attributes, frag_data },
+		{ "floor",
+		  { { GL_VERTEX_SHADER,
+		      g_procedural_floor ? procedural_floor_vertex_shader : floor_vertex_shader },
+		    { GL_TESS_CONTROL_SHADER, quadTessControlShader },
+		    { GL_TESS_EVALUATION_SHADER, quadTessEvaluationShader },
+		    { GL_GEOMETRY_SHADER, geometry_shader },
+		    { GL_FRAGMENT_SHADER, floor_fragment_shader } },
+		  g_procedural_floor ? std::vector<std::pair<GLuint, std::string>>() : floor_attributes,
+		  frag_data },
+		{ "cube_normals",
+		  { { GL_VERTEX_SHADER, cube_vertex_shader },
+		    { GL_FRAGMENT_SHADER, fragment_shader } },
+		  cube_attributes, frag_data },
+	};
+	// Multi-material drawing needs GL 4.3 features on top of the 4.1 core.
+	if (material_count > 0 && !DrawBatcher::supported()) {
+		std::cerr << "--materials needs GL 4.3 for multi-draw-indirect and shader storage buffers\n";
+		material_count = 0;
+	}
+	// The material program shades from per-face normal attributes.
+	if (material_count > 0 && !g_cube_normals) {
+		std::cerr << "--materials needs per-face normals; using --cube-pipeline attrib\n";
+		g_cube_normals = true;
+	}
+	g_materials = material_count > 0;
+	if (material_count > 0) {
+		program_specs.push_back(
+			{ "material",
+			  { { GL_VERTEX_SHADER, material_vertex_shader },
+			    { GL_FRAGMENT_SHADER, material_fragment_shader } },
+			  { { 0, "vertex_position" },
+			    { 1, "vertex_normal" },
+			    { kDrawIndexAttribute, "draw_index" } },
+			  frag_data, true });
+	}
+	if (!scene.empty()) {
+		program_specs.push_back(
+			{ "instances",
+			  { { GL_VERTEX_SHADER, instance_vertex_shader },
+			    { GL_FRAGMENT_SHADER, fragment_shader } },
+			  { { 0, "vertex_position" },
+			    { 1, "vertex_normal" },
+			    { kInstanceAttribute, "instance_transform" } },
+			  frag_data });
+	}
+	auto shader_start = std::chrono::steady_clock::now();
+	ShaderCache shader_cache(use_shader_cache ? kShaderCacheDir : "");
+	std::vector<GLuint> programs = shader_cache.build(program_specs);
+	double shader_ms = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - shader_start).count();
+	std::cout << "shaders: " << shader_ms << " ms, "
+	          << shader_cache.hits() << " cached, "
+	          << shader_cache.misses() << " compiled\n";
+	GLuint program_id = programs[0];
+	GLuint floor_program_id = programs[1];
+	GLuint cube_program_id = programs[2];
+	GLuint material_program_id = material_count > 0 ? programs[3] : 0;
+	if (material_count > 0 && material_program_id == 0) {
+		std::cerr << "--materials ignored: the driver cannot build the material program\n";
+		material_count = 0;
+		g_materials = false;
+	}
+	GLuint scene_program_id = !scene.empty() ? programs.back() : 0;
+
+	// All uniforms come from the shared per-frame block.
+	BindPerFrameBlock(program_id);
+	BindPerFrameBlock(cube_program_id);
+	DrawBatcher batcher;
+	std::vector<Material> materials;
+	if (material_count > 0) {
+		BindPerFrameBlock(material_program_id);
+		batcher.init();
+	}
+	if (!scene.empty())
+		BindPerFrameBlock(scene_program_id);
+
+	// Only the floor gets ocean waves from the shared geometry shader.
+	BindPerFrameBlock(floor_program_id);
+	GLint is_floor_location = 0;
+	CHECK_GL_ERROR(is_floor_location =
+			glGetUniformLocation(floor_program_id, "is_floor"));
+	CHECK_GL_ERROR(glUseProgram(floor_program_id));
+	CHECK_GL_ERROR(glUniform1i(is_floor_location, 1));
+	GLint ocean_location = 0;
+	CHECK_GL_ERROR(ocean_location =
+			glGetUniformLocation(floor_program_id, "ocean_displacement"));
+	CHECK_GL_ERROR(glUniform1i(ocean_location, kOceanTextureUnit + kOceanDisplacementTexture));
+	CHECK_GL_ERROR(ocean_location =
+			glGetUniformLocation(floor_program_id, "ocean_normals"));
+	CHECK_GL_ERROR(glUniform1i(ocean_location, kOceanTextureUnit + kOceanNormalTexture));
+	// The procedural floor's shape, set again whenever it changes.
+	GLint floor_levels_location = -1, floor_ring_location = -1, floor_cell_location = -1;
+	FloorLayout floor_uniforms;
+	if (g_procedural_floor) {
+		CHECK_GL_ERROR(floor_levels_location =
+				glGetUniformLocation(floor_program_id, "floor_levels"));
+		CHECK_GL_ERROR(floor_ring_location =
+				glGetUniformLocation(floor_program_id, "floor_ring"));
+		CHECK_GL_ERROR(floor_cell_location =
+				glGetUniformLocation(floor_program_id, "floor_cell"));
+		CHECK_GL_ERROR(glUniform1i(floor_levels_location, floor_uniforms.levels));
+		CHECK_GL_ERROR(glUniform1i(floor_ring_location, floor_uniforms.ring));
+		CHECK_GL_ERROR(glUniform1f(floor_cell_location, floor_uniforms.cell));
+		CHECK_GL_ERROR(glUniform1f(glGetUniformLocation(floor_program_id, "floor_height"),
+					kFloorHeight));
+	}
+
+	// The FFT ocean only runs while it is on screen, but its textures and
+	// spectrum are set up front.
+	Ocean ocean(ocean_params);
+	std::cout << "ocean: " << ocean.grid() << "^2 grid over "
+	          << ocean.length() << " units\n";
+	// Ocean mode 1, as the CPU sees it.
+	WaveField waves(kFloorHeight);
+	CHECK_GL_ERROR(glGenTextures(kNumOceanTextures, g_ocean_textures));
+	for (int i = 0; i < kNumOceanTextures; i++) {
+		CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + kOceanTextureUnit + i));
+		CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, g_ocean_textures[i]));
+		CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, ocean.grid(), ocean.grid(),
+					0, GL_RGB, GL_FLOAT, nullptr));
+		CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+		CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+		CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+		CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+		g_ocean_uploads[i].init(GL_PIXEL_UNPACK_BUFFER, persistent_buffers);
+	}
+	CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+	CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
+
+	// Ring of per-frame uniform blocks, written once per frame.
+	GLint uniform_alignment = 256;
+	CHECK_GL_ERROR(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment));
+	GpuBuffer per_frame_buffer;
+	per_frame_buffer.init(GL_UNIFORM_BUFFER, persistent_buffers, uniform_alignment);
+
+	// Textures stream in over the first frames; nothing waits for them.
+	TextureLoader textures(texture_max_size);
+	textures.init(persistent_buffers);
+	for (const std::string& file : texture_files)
+		textures.load(file);
+	std::vector<bool> texture_reported(texture_files.size(), false);
+
+	// Instrumentation scopes, in the order the loop enters them.
+	int frame_scope = g_profiler.add_scope("frame", false);
+	int upload_scope = g_profiler.add_scope("upload", true);
+	int ocean_scope = g_profiler.add_scope("ocean", false);
+	int ocean_upload_scope = g_profiler.add_scope("ocean upload", true);
+	int texture_scope = g_profiler.add_scope("textures", false);
+	int cube_scope = g_profiler.add_scope("cube", true);
+	int clipmap_scope = g_profiler.add_scope("clipmap", false);
+	int floor_scope = g_profiler.add_scope("floor", true, true);
+	int capture_scope = g_profiler.add_scope("capture", false);
+	int swap_scope = g_profiler.add_scope("swap", false);
+	g_overlay = show_stats;
+	if (!trace_file.empty() && !g_profiler.open_trace(trace_file))
+		std::cerr << "cannot open trace file " << trace_file << "\n";
+
+	// The main thread simulates: it folds input into the camera and the
+	// sponge once per tick and publishes the result as a snapshot.  The
+	// renderer draws whichever snapshot is newest, on its own thread with
+	// --render-thread on, so neither waits for the other.
+	TripleBuffer<FrameSnapshot> snapshots;
+	TripleBuffer<DisplayedFrame> displayed;
+	// Only for waking an idle render thread; the snapshots need no lock.
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+
+	auto simulate = [&](long tick) {
+		float elapsed = getElapsedTime();
+		if (g_replaying) {
+			CameraPose pose;
+			ViewState state;
+			replay_path.at(tick, &pose, &state);
+			g_camera.set_pose(pose);
+			ApplyViewState(state);
+			elapsed = tick * kReplayStep;
+			tideStartTime = 0.0f;
+		}
+		if (!record_path_file.empty())
+			recorded_path.record(tick, g_camera.get_pose(), CurrentViewState());
+
+		if (g_menger && g_menger->is_dirty() && !scene.empty()) {
+			// The scene brought every level along; the level is only a cap.
+			g_menger->set_clean();
+		} else if (g_menger && g_menger->is_dirty()) {
+			// Materials are ranges of whole faces, drawn with 32-bit indices,
+			// and need normals, so they have no cheaper mode to fall back to.
+			bool meshlets = use_meshlets && material_count == 0;
+			const SpongeMode modes[] = {
+				{ g_cube_normals, meshlets }, { false, meshlets }, { false, false },
+			};
+			const int num_modes = material_count > 0 ? 1 : sizeof(modes) / sizeof(modes[0]);
+			int level = g_menger->nesting_level();
+			int mode = 0;
+			MemoryFootprint footprint;
+			size_t need = 0;
+			for (; mode < num_modes; mode++) {
+				need = g_memory.total() + PredictSpongeBytes(level, modes[mode], &footprint);
+				if (memory_budget == 0 || need <= memory_budget)
+					break;
+				std::cout << "level " << level << " with " << SpongeModeName(modes[mode])
+				          << " needs " << MiB(need) << " MiB, over the "
+				          << MiB(memory_budget) << " MiB memory budget\n";
+			}
+			if (mode == num_modes) {
+				std::cerr << "not enough memory for level " << level << "; staying at level "
+				          << g_geometry->level << "\n";
+				g_menger->set_nesting_level(g_geometry->level);
+				g_menger->set_clean();
+			} else {
+				std::cout << "level " << level << " with " << SpongeModeName(modes[mode])
+				          << ": " << MiB(need) << " MiB at peak predicted (scratch "
+				          << MiB(footprint.scratch) << ", mesh " << MiB(footprint.mesh)
+				          << ", upload " << MiB(footprint.gpu) << ")\n";
+				auto start = std::chrono::steady_clock::now();
+				std::shared_ptr<SpongeGeometry> geometry = std::make_shared<SpongeGeometry>();
+				geometry->level = level;
+				if (modes[mode].normals)
+					g_menger->generate_geometry(geometry->vertices, geometry->normals, geometry->faces);
+				else
+					g_menger->generate_geometry(geometry->vertices, geometry->faces);
+				g_menger->set_clean();
+				geometry->memory.set(geometry->bytes());
+				std::cout << "generate geometry called. level: " << geometry->level << " ("
+				          << std::chrono::duration<double, std::milli>(
+				                 std::chrono::steady_clock::now() - start).count()
+				          << " ms)" << std::endl;
+				if (index_passes != 0) {
+					start = std::chrono::steady_clock::now();
+					double acmr = AverageCacheMissRatio(geometry->faces, geometry->vertices.size());
+					OptimizeIndices(index_passes, &geometry->vertices, &geometry->normals,
+					                &geometry->faces);
+					std::cout << "index passes " << IndexPassNames(index_passes) << ": ACMR "
+					          << acmr << " -> "
+					          << AverageCacheMissRatio(geometry->faces, geometry->vertices.size())
+					          << " (" << std::chrono::duration<double, std::milli>(
+					                 std::chrono::steady_clock::now() - start).count()
+					          << " ms)" << std::endl;
+					geometry->memory.set(geometry->bytes());
+				}
+				if (modes[mode].meshlets) {
+					start = std::chrono::steady_clock::now();
+					BuildMeshlets(&geometry->vertices, &geometry->normals, &geometry->faces,
+					              &geometry->meshlets, &geometry->meshlet_indices);
+					geometry->memory.set(geometry->bytes());
+					std::cout << "meshlets: " << geometry->meshlets.size() << " for "
+					          << geometry->faces.size() << " triangles, "
+					          << geometry->vertices.size() << " vertices ("
+					          << std::chrono::duration<double, std::milli>(
+					                 std::chrono::steady_clock::now() - start).count()
+					          << " ms)" << std::endl;
+				}
+				g_geometry = geometry;
+			}
+		}
+		glfwGetFramebufferSize(window, &window_width, &window_height);
+
+		FrameSnapshot& snap = snapshots.back();
+		snap.tick = tick;
+		snap.pose = g_camera.get_pose();
+		snap.state = CurrentViewState();
+		snap.elapsed_time = elapsed;
+		snap.tide_time = elapsed - tideStartTime;
+		snap.width = window_width;
+		snap.height = window_height;
+		snap.geometry = g_geometry;
+		snap.screenshots = g_screenshots;
+		snap.recordings = g_recordings;
+		snap.recording = g_recording;
+		snap.overlay = g_overlay;
+		snap.floor = g_floor_layout;
+		snap.input_events = g_input_events;
+		snapshots.publish();
+		{ std::lock_guard<std::mutex> lock(wake_mutex); }
+		wake.notify_one();
+	};
+
+	// Everything below belongs to the renderer.
+	glm::vec4 light_position = kLightPosition;
 	float aspect = 0.0f;
-	float theta = 0.0f;
-	while (!glfwWindowShouldClose(window)) {
-		elapsedTime = getElapsedTime();
+	std::shared_ptr<const SpongeGeometry> uploaded;
+	bool line_polygons = false;
+	int screenshots = 0;
+	int recordings = 0;
+	std::vector<float> frame_ms;  // Between swaps; the first from its start.
+	std::vector<uint32_t> visible_meshlets;
+	std::vector<GLsizei> meshlet_counts;
+	std::vector<const void*> meshlet_offsets;
+	std::vector<GLint> meshlet_base_vertices;
+	MeshletCullStats meshlet_stats;  // Over all frames.
+	MeshletCullStats frame_meshlet_stats;
+	SceneDrawList scene_draws;
+	SceneCullStats scene_stats;  // Over all frames.
+	SceneCullStats frame_scene_stats;
+	std::chrono::steady_clock::time_point last_swap;
+
+	auto render_frame = [&](const FrameSnapshot& snap) {
+		if (g_profiler.frame_count() == 0)
+			last_swap = std::chrono::steady_clock::now();
+		g_profiler.set_overlay(snap.overlay);
+		g_profiler.begin_frame();
+		g_profiler.begin(frame_scope);
+		const ViewState& state = snap.state;
+		if (state.line_polygons != line_polygons) {
+			line_polygons = state.line_polygons;
+			glPolygonMode(GL_FRONT_AND_BACK, line_polygons ? GL_LINE : GL_FILL);
+		}
+		if (snap.screenshots != screenshots) {
+			screenshots = snap.screenshots;
+			g_capture.screenshot("screenshot_" + std::to_string(screenshots - 1) + ".jpg");
+		}
+		if (g_capture.recording() && (!snap.recording || snap.recordings != recordings))
+			g_capture.stop_recording();
+		if (snap.recording && !g_capture.recording()) {
+			g_capture.start_recording(snap.recordings > 0 ?
+					"recording_" + std::to_string(snap.recordings - 1) : record_prefix);
+		}
+		recordings = snap.recordings;
+
 		// Setup some basic window stuff.
-		glfwGetFramebufferSize(window, &window_width, &window_height);
-		glViewport(0, 0, window_width, window_height);
+		glViewport(0, 0, snap.width, snap.height);
 		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 		glEnable(GL_DEPTH_TEST);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -937,43 +1305,162 @@ int main(int argc, char* argv[])
 		// Switch to the Geometry VAO.
 		CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kGeometryVao]));
 
-		if (g_menger && g_menger->is_dirty()) {
-			g_menger->generate_geometry(obj_vertices, obj_faces);
-			g_menger->set_clean();
-
+		const SpongeGeometry& geometry = *snap.geometry;
+		if (snap.geometry != uploaded) {
 			// FIXME: Upload your vertex data here.
-			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kVertexBuffer]));
-			CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-		                            sizeof(float) * obj_vertices.size() * 4,
-		                            obj_vertices.data(), GL_STATIC_DRAW));
-			CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_buffer_objects[kGeometryVao][kIndexBuffer]));
-			CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
-									sizeof(uint32_t) * obj_faces.size() * 3,
-									obj_faces.data(), GL_STATIC_DRAW));
+			ProfileScope upload(g_profiler, upload_scope);
+			UploadGeometry(geometry);
+			uploaded = snap.geometry;
+			if (material_count > 0) {
+				MakeMaterials(material_count, geometry.faces.size(), &materials);
+				batcher.build(materials,
+				              std::vector<GLuint>(materials.size(), material_program_id));
+				std::cout << "materials: " << batcher.draws() << " draws in "
+				          << batcher.batches() << " batches, " << batcher.texture_arrays()
+				          << " texture arrays\n";
+			}
 		}
 
 		// Compute the projection matrix.
-		aspect = static_cast<float>(window_width) / window_height;
+		aspect = static_cast<float>(snap.width) / snap.height;
 		glm::mat4 projection_matrix =
 			glm::perspective(glm::radians(45.0f), aspect, 0.0001f, 1000.0f);
 
 		// Compute the view matrix
 		// FIXME: change eye and center through mouse/keyboard events.
-		glm::mat4 view_matrix = g_camera.get_view_matrix();
-		glm::vec3 eye_position = g_camera.get_eye_position();
+		Camera camera;
+		camera.set_pose(snap.pose);
+		glm::mat4 view_matrix = camera.get_view_matrix();
+		glm::vec3 eye_position = camera.get_eye_position();
+
+		// Pass uniforms in, once for both programs.
+		PerFrameUniforms per_frame = PerFrameUniforms();
+		per_frame.projection = projection_matrix;
+		per_frame.view = view_matrix;
+		per_frame.light_position = light_position;
+		per_frame.eye_position = glm::vec4(eye_position, 1.0f);
+		per_frame.elapsed_time = snap.elapsed_time;	// elapsed time for waves
+		per_frame.tide_time = snap.tide_time;
+		per_frame.wireframe_thresh = state.wireframe_thresh;
+		per_frame.inner_level = state.inner_level;
+		per_frame.outer_level = state.outer_level;
+		per_frame.viewport = glm::vec2(snap.width, snap.height);
+		per_frame.tess_pixels = state.adaptive_tess ? state.tess_pixels : 0.0f;
+		per_frame.is_ocean_mode = state.ocean_mode;
+		per_frame.ocean_length = ocean.length();
+		waves.set_time(per_frame.elapsed_time, per_frame.tide_time);
+		per_frame.waves = waves.params();
+		size_t per_frame_offset = per_frame_buffer.upload(&per_frame, sizeof(per_frame));
+		CHECK_GL_ERROR(glBindBufferRange(GL_UNIFORM_BUFFER, kPerFrameBinding,
+					per_frame_buffer.id(), per_frame_offset, sizeof(per_frame)));
+
+		// Step the FFT ocean and stream its maps through the unpack buffers.
+		if (state.ocean_mode == 2) {
+			g_profiler.begin(ocean_scope);
+			ocean.simulate(snap.elapsed_time);
+			g_profiler.end(ocean_scope);
+
+			ProfileScope upload(g_profiler, ocean_upload_scope);
+			const std::vector<float>* maps[kNumOceanTextures] = {
+				&ocean.displacement(), &ocean.normals()
+			};
+			for (int i = 0; i < kNumOceanTextures; i++) {
+				size_t offset = g_ocean_uploads[i].upload(maps[i]->data(),
+						sizeof(float) * maps[i]->size());
+				CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + kOceanTextureUnit + i));
+				CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, g_ocean_textures[i]));
+				CHECK_GL_ERROR(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, ocean.grid(), ocean.grid(),
+							GL_RGB, GL_FLOAT, reinterpret_cast<const void*>(offset)));
+			}
+			CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+			CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
+		}
 
-		// Use our program.
-		CHECK_GL_ERROR(glUseProgram(program_id));
+		if (textures.pending() > 0) {
+			g_profiler.begin(texture_scope);
+			textures.update();
+			g_profiler.end(texture_scope);
+			for (size_t i = 0; i < texture_reported.size(); i++) {
+				if (texture_reported[i] || textures.texture(i) == 0)
+					continue;
+				texture_reported[i] = true;
+				std::cout << "texture " << textures.file(i) << ": " << textures.width(i)
+				          << "x" << textures.height(i) << " after "
+				          << std::chrono::duration<double, std::milli>(
+				                 std::chrono::steady_clock::now() - startup_time).count()
+				          << " ms\n";
+			}
+		}
 
-		// Pass uniforms in.
-		CHECK_GL_ERROR(glUniformMatrix4fv(projection_matrix_location, 1, GL_FALSE,
-					&projection_matrix[0][0]));
-		CHECK_GL_ERROR(glUniformMatrix4fv(view_matrix_location, 1, GL_FALSE,
-					&view_matrix[0][0]));
-		CHECK_GL_ERROR(glUniform4fv(light_position_location, 1, &light_position[0]));
+		// Use our program.  The sponge is closed and wound outwards, so
+		// faces pointing away are never seen.
+		g_profiler.begin(cube_scope);
+		glEnable(GL_CULL_FACE);
+		if (!scene.empty()) {
+			// The sponges in view, one instanced call for each level.
+			frame_scene_stats = SceneCullStats();
+			scene.cull(projection_matrix * view_matrix, eye_position,
+			           0.5f * snap.height * projection_matrix[1][1], state.nesting_level,
+			           &scene_draws, &frame_scene_stats);
+			scene_stats.add(frame_scene_stats);
+			if (!scene_draws.transforms.empty()) {
+				size_t offset = g_instance_buffer.upload(scene_draws.transforms.data(),
+						sizeof(glm::mat4) * scene_draws.transforms.size());
+				CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kSceneVao]));
+				CHECK_GL_ERROR(glUseProgram(scene_program_id));
+				CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_instance_buffer.id()));
+				for (int level = 0; level <= kSceneMaxLevel; level++) {
+					if (scene_draws.count(level) == 0)
+						continue;
+					size_t first = offset + sizeof(glm::mat4) * scene_draws.first[level];
+					for (int column = 0; column < 4; column++) {
+						CHECK_GL_ERROR(glVertexAttribPointer(kInstanceAttribute + column, 4,
+									GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+									reinterpret_cast<const void*>(
+										first + sizeof(glm::vec4) * column)));
+					}
+					CHECK_GL_ERROR(glDrawElementsInstancedBaseVertex(GL_TRIANGLES,
+								3 * scene_meshes.face_count[level], GL_UNSIGNED_INT,
+								reinterpret_cast<const void*>(
+									sizeof(glm::uvec3) * scene_meshes.first_face[level]),
+								scene_draws.count(level), scene_meshes.base_vertex[level]));
+				}
+			}
+		} else if (material_count > 0 && !geometry.normals.empty()) {
+			// One call per batch; the material program needs normal attributes.
+			batcher.draw(g_index_offset / sizeof(uint32_t));
+		} else if (!geometry.meshlets.empty()) {
+			// Only the meshlets that may show, each at its own base vertex.
+			CHECK_GL_ERROR(glUseProgram(!geometry.normals.empty() ? cube_program_id : program_id));
+			visible_meshlets.clear();
+			frame_meshlet_stats = MeshletCullStats();
+			CullMeshlets(geometry.meshlets, projection_matrix * view_matrix, eye_position,
+			             &visible_meshlets, &frame_meshlet_stats);
+			meshlet_stats.add(frame_meshlet_stats);
+			meshlet_counts.clear();
+			meshlet_offsets.clear();
+			meshlet_base_vertices.clear();
+			for (uint32_t i : visible_meshlets) {
+				const Meshlet& m = geometry.meshlets[i];
+				meshlet_counts.push_back(m.triangle_count * 3);
+				meshlet_offsets.push_back(reinterpret_cast<const void*>(
+						g_index_offset + sizeof(uint16_t) * 3 * m.triangle_offset));
+				meshlet_base_vertices.push_back(m.vertex_offset);
+			}
+			if (!visible_meshlets.empty()) {
+				CHECK_GL_ERROR(glMultiDrawElementsBaseVertex(GL_TRIANGLES, meshlet_counts.data(),
+							GL_UNSIGNED_SHORT, meshlet_offsets.data(),
+							visible_meshlets.size(), meshlet_base_vertices.data()));
+			}
+		} else {
+			CHECK_GL_ERROR(glUseProgram(!geometry.normals.empty() ? cube_program_id : program_id));
 
-		// Draw our triangles.
-		CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, obj_faces.size() * 3, GL_UNSIGNED_INT, 0));
+			// Draw our triangles.
+			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, geometry.faces.size() * 3, GL_UNSIGNED_INT,
+						reinterpret_cast<const void*>(g_index_offset)));
+		}
+		glDisable(GL_CULL_FACE);
+		g_profiler.end(cube_scope);
 
 		// FIXME: Render the floor
 		// Note: What you need to do is
@@ -983,44 +1470,218 @@ int main(int argc, char* argv[])
 		// 	4. Call glDrawElements, since input geometry is
 		// 	indicated by VAO.
 
+		// Re-centre the floor, uploading only the rows that moved.
+		g_profiler.begin(clipmap_scope);
+		if (floor && floor->update(eye_position))
+			UploadFloor(*floor);
+		g_profiler.end(clipmap_scope);
+
+		g_profiler.begin(floor_scope);
 		CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kFloorVao]));
 		
 		CHECK_GL_ERROR(glUseProgram(floor_program_id));
 
-		CHECK_GL_ERROR(glUniformMatrix4fv(floor_projection_matrix_location, 1, GL_FALSE,
-					&projection_matrix[0][0]));
-		CHECK_GL_ERROR(glUniformMatrix4fv(floor_view_matrix_location, 1, GL_FALSE,
-					&view_matrix[0][0]));
-		CHECK_GL_ERROR(glUniform4fv(floor_light_position_location, 1, &light_position[0]));
-
-		CHECK_GL_ERROR(glUniform3fv(eye_position_location, 1, &eye_position[0]));
-
-		CHECK_GL_ERROR(glUniform1f(floor_wireframe_thresh_location, wireframeThresh));
-
-		CHECK_GL_ERROR(glUniform1i(tess_inner_level_location, innerLevel));
-
-		CHECK_GL_ERROR(glUniform1i(tess_outer_level_location, outerLevel));
-
-		CHECK_GL_ERROR(glUniform1f(elapsed_time_location, elapsedTime));	// elapsed time for waves
-		
-		CHECK_GL_ERROR(glUniform1f(tide_time_location, elapsedTime - tideStartTime));	// elapsed time for waves
-
-		CHECK_GL_ERROR(glUniform1i(is_ocean_mode_location, isOceanMode));
-
-
-
-
-
-		// std::cout << "tide time: " << elapsedTime - tideStartTime << std::endl;
-
 		glPatchParameteri(GL_PATCH_VERTICES, 4);
-		CHECK_GL_ERROR(glDrawElements(GL_PATCHES, floor_faces.size() * 4, GL_UNSIGNED_INT, 0));
+		if (floor) {
+			CHECK_GL_ERROR(glDrawArrays(GL_PATCHES, 0, floor->vertices().size()));
+		} else {
+			// One instance per level; the shader re-centres the floor.
+			if (snap.floor != floor_uniforms) {
+				floor_uniforms = snap.floor;
+				CHECK_GL_ERROR(glUniform1i(floor_levels_location, floor_uniforms.levels));
+				CHECK_GL_ERROR(glUniform1i(floor_ring_location, floor_uniforms.ring));
+				CHECK_GL_ERROR(glUniform1f(floor_cell_location, floor_uniforms.cell));
+			}
+			CHECK_GL_ERROR(glDrawArraysInstanced(GL_PATCHES, 0,
+						4 * floor_uniforms.ring * floor_uniforms.ring, floor_uniforms.levels));
+		}
+		g_profiler.end(floor_scope);
 
+		// Queue the readback of this frame and hand earlier ones on to the
+		// encoder, for screenshots and recordings.
+		g_profiler.begin(capture_scope);
+		g_capture.capture(snap.width, snap.height);
+		g_profiler.end(capture_scope);
 
-		// Poll and swap.
-		glfwPollEvents();
+		g_profiler.begin(swap_scope);
 		glfwSwapBuffers(window);
+		g_profiler.end(swap_scope);
+		if (g_profiler.frame_count() == 0) {
+			std::cout << "time to first frame: "
+			          << std::chrono::duration<double, std::milli>(
+			                 std::chrono::steady_clock::now() - startup_time).count()
+			          << " ms\n";
+		}
+
+		g_profiler.end(frame_scope);
+		g_profiler.end_frame();
+
+		// Window titles can only be set on the main thread.
+		DisplayedFrame& shown = displayed.back();
+		shown.tick = snap.tick;
+		shown.input_events = snap.input_events;
+		shown.time = std::chrono::steady_clock::now();
+		frame_ms.push_back(std::chrono::duration<float, std::milli>(shown.time - last_swap).count());
+		last_swap = shown.time;
+		shown.title.clear();
+		if (snap.overlay && g_profiler.frame_count() % 30 == 0) {
+			std::ostringstream title;
+			title << window_title << " - " << g_profiler.summary(frame_scope)
+			      << " - floor " << static_cast<long>(g_profiler.primitives(floor_scope, 0.50))
+			      << " tris, " << std::fixed << std::setprecision(2)
+			      << g_profiler.percentile(floor_scope, 0.50, true) << " ms";
+			if (!scene.empty()) {
+				title << " - scene " << frame_scene_stats.instances - frame_scene_stats.outside
+				      << " drawn in " << frame_scene_stats.draws << " calls";
+			} else if (!geometry.meshlets.empty()) {
+				title << " - cube " << std::setprecision(0)
+				      << 100.0 * frame_meshlet_stats.culled_triangles /
+				             frame_meshlet_stats.triangles << "% culled";
+			}
+			shown.title = title.str();
+		}
+		displayed.publish();
+	};
+
+	// Input-to-photon latency: from the callback that saw an event to the
+	// end of the swap of the first frame simulated after it.  Without a
+	// render thread callbacks only run between frames, so this misses the
+	// time an event waited for them.
+	std::vector<float> input_ms;
+	long displayed_tick = -1;
+	auto read_displayed = [&]() {
+		if (!displayed.update())
+			return;
+		const DisplayedFrame& shown = displayed.front();
+		displayed_tick = shown.tick;
+		long first_pending = g_input_events - long(g_pending_inputs.size()) + 1;
+		for (; !g_pending_inputs.empty() && first_pending <= shown.input_events; first_pending++) {
+			input_ms.push_back(std::chrono::duration<float, std::milli>(
+					shown.time - g_pending_inputs.front()).count());
+			g_pending_inputs.pop_front();
+		}
+		if (!shown.title.empty())
+			glfwSetWindowTitle(window, shown.title.c_str());
+		if (g_replaying && displayed_tick + 1 >= replay_path.frames())
+			glfwSetWindowShouldClose(window, GL_TRUE);
+	};
+
+	long tick = 0;
+	if (!render_thread) {
+		while (!glfwWindowShouldClose(window)) {
+			glfwPollEvents();
+			simulate(tick++);
+			snapshots.update();
+			render_frame(snapshots.front());
+			read_displayed();
+		}
+	} else {
+		std::cout << "render thread on, simulating at " << kTickRate << " Hz\n";
+		simulate(tick++);
+		glfwMakeContextCurrent(nullptr);
+		std::atomic<bool> quit(false);
+		std::thread renderer([&]() {
+			glfwMakeContextCurrent(window);
+			while (!quit.load()) {
+				// Each snapshot is drawn at most once; between them there
+				// is nothing new to show.
+				if (snapshots.update()) {
+					render_frame(snapshots.front());
+					glfwPostEmptyEvent();  // Wake the main thread to read it.
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(wake_mutex);
+				wake.wait(lock, [&]() { return snapshots.fresh() || quit.load(); });
+			}
+			glfwMakeContextCurrent(nullptr);
+		});
+
+		// Ticks come at a fixed rate, events are handled as they arrive in
+		// between.  Replays instead step in lockstep with the renderer so
+		// that every recorded frame is drawn once, as fast as it can be.
+		const std::chrono::duration<double> tick_period(1.0 / kTickRate);
+		auto next_tick = std::chrono::steady_clock::now() + tick_period;
+		while (!glfwWindowShouldClose(window)) {
+			if (g_replaying) {
+				glfwWaitEvents();
+				read_displayed();
+				if (displayed_tick + 1 >= tick && tick < replay_path.frames())
+					simulate(tick++);
+				continue;
+			}
+			std::chrono::duration<double> remaining =
+				next_tick - std::chrono::steady_clock::now();
+			if (remaining.count() > 0.0)
+				glfwWaitEventsTimeout(remaining.count());
+			else
+				glfwPollEvents();
+			read_displayed();
+			auto now = std::chrono::steady_clock::now();
+			if (now < next_tick)
+				continue;
+			// After a stall, start over rather than catch up.
+			next_tick += std::chrono::duration_cast<std::chrono::steady_clock::duration>(tick_period);
+			if (next_tick < now)
+				next_tick = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(tick_period);
+			simulate(tick++);
+		}
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			quit = true;
+		}
+		wake.notify_one();
+		renderer.join();
+		glfwMakeContextCurrent(window);
+	}
+	g_profiler.close_trace();
+	g_capture.finish();
+	batcher.print_stats(std::cout);
+	g_memory.print_report(std::cout);
+	g_jobs.print_stats(std::cout);
+	if (meshlet_stats.meshlets > 0) {
+		std::cout << std::fixed << std::setprecision(1) << "meshlets culled: "
+		          << 100.0 * (meshlet_stats.backfacing + meshlet_stats.outside) /
+		                 meshlet_stats.meshlets
+		          << "% (" << 100.0 * meshlet_stats.backfacing / meshlet_stats.meshlets
+		          << "% backfacing, " << 100.0 * meshlet_stats.outside / meshlet_stats.meshlets
+		          << "% outside the frustum), triangles culled: "
+		          << 100.0 * meshlet_stats.culled_triangles / meshlet_stats.triangles << "%\n"
+		          << std::defaultfloat;
+	}
+	if (scene_stats.instances > 0) {
+		double frames = double(scene_stats.instances) / scene.size();
+		std::cout << std::fixed << std::setprecision(1) << "scene culled: "
+		          << 100.0 * scene_stats.outside / scene_stats.instances << "%, drawn at levels";
+		for (int level = 0; level <= kSceneMaxLevel; level++) {
+			std::cout << " " << level << ": "
+			          << 100.0 * scene_stats.at_level[level] / scene_stats.instances << "%";
+		}
+		std::cout << "; per frame " << scene_stats.triangles / frames / 1e6
+		          << "M triangles in " << scene_stats.draws / frames << " calls\n"
+		          << std::defaultfloat;
+	}
+	PrintFrameTimeReport(std::cout, frame_ms);
+	if (!input_ms.empty()) {
+		std::cout << "input events: " << input_ms.size() << "\n";
+		PrintPercentiles(std::cout, "input latency", input_ms);
+	}
+	if (g_replaying)
+		g_profiler.print_report(std::cout);
+	if (!record_path_file.empty()) {
+		if (recorded_path.save(record_path_file))
+			std::cout << "recorded " << recorded_path.frames() << " frames ("
+			          << recorded_path.pose_keys() << " poses, " << recorded_path.state_keys()
+			          << " states) to " << record_path_file << "\n";
+		else
+			std::cerr << "failed to write " << record_path_file << "\n";
+	}
+	if (g_capture.captured_frames() > 0 || g_capture.dropped_frames() > 0) {
+		std::cout << "captured " << g_capture.captured_frames() << " frames, dropped "
+		          << g_capture.dropped_frames() << "\n";
+		g_capture.encoder().print_stats(std::cout);
 	}
+	if (gl_check_mode == kDebugGLAsync && debugglAsyncErrorCount() > 0)
+		std::cerr << debugglAsyncErrorCount() << " OpenGL errors were reported\n";
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
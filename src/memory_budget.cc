@@ -0,0 +1,71 @@
+#include "memory_budget.h"
+#include <iomanip>
+
+MemoryAccount g_memory;
+
+MemoryAccount::MemoryAccount() : total_(0), total_peak_(0)
+{
+	for (int i = 0; i < kNumMemorySubsystems; i++) {
+		current_[i] = 0;
+		peak_[i] = 0;
+	}
+}
+
+void
+MemoryAccount::raise(std::atomic<long>& peak, long value)
+{
+	long seen = peak.load(std::memory_order_relaxed);
+	while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed))
+		;
+}
+
+void
+MemoryAccount::charge(MemorySubsystem subsystem, long bytes)
+{
+	raise(peak_[subsystem], current_[subsystem].fetch_add(bytes) + bytes);
+	raise(total_peak_, total_.fetch_add(bytes) + bytes);
+}
+
+const char*
+MemoryAccount::name(MemorySubsystem subsystem)
+{
+	static const char* names[kNumMemorySubsystems] = {
+		"generator scratch", "cpu mesh", "gpu buffers", "floor"
+	};
+	return names[subsystem];
+}
+
+void
+MemoryAccount::print_report(std::ostream& os) const
+{
+	std::ios::fmtflags flags = os.flags();
+	std::streamsize precision = os.precision();
+	os << std::fixed << std::setprecision(1);
+	for (int i = 0; i < kNumMemorySubsystems; i++) {
+		MemorySubsystem subsystem = MemorySubsystem(i);
+		os << "memory " << name(subsystem) << ": " << MiB(current(subsystem))
+		   << " MiB, peak " << MiB(peak(subsystem)) << " MiB\n";
+	}
+	os << "memory total: " << MiB(total()) << " MiB, peak " << MiB(total_peak()) << " MiB\n";
+	os.flags(flags);
+	os.precision(precision);
+}
+
+MemoryCharge::MemoryCharge(MemorySubsystem subsystem, size_t bytes)
+	: subsystem_(subsystem)
+{
+	set(bytes);
+}
+
+MemoryCharge::~MemoryCharge()
+{
+	set(0);
+}
+
+void
+MemoryCharge::set(size_t bytes)
+{
+	if (bytes != bytes_)
+		g_memory.charge(subsystem_, long(bytes) - long(bytes_));
+	bytes_ = bytes;
+}
@@ -0,0 +1,87 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Where accounted memory goes.
+enum MemorySubsystem {
+	kMemoryScratch,  // Generator scratch: the cube queue and corner list.
+	kMemoryMesh,     // Sponges on the CPU, for as long as anything holds one.
+	kMemoryGpu,      // GpuBuffer storage, all segments, and the scene's meshes.
+	kMemoryFloor,    // The floor clipmap and its vertex buffers.
+	kNumMemorySubsystems
+};
+
+/*
+ * Current and peak bytes per subsystem, as charged by their owners.  Only
+ * the big, growing allocations are charged, so the totals are a floor on
+ * the process's use rather than all of it.  Counters are atomic so that
+ * the simulation and the renderer can charge from their own threads.
+ */
+class MemoryAccount {
+public:
+	MemoryAccount();
+
+	// Adds bytes, or releases them if negative.
+	void charge(MemorySubsystem subsystem, long bytes);
+
+	size_t current(MemorySubsystem subsystem) const { return current_[subsystem]; }
+	size_t peak(MemorySubsystem subsystem) const { return peak_[subsystem]; }
+	size_t total() const { return total_; }
+	size_t total_peak() const { return total_peak_; }
+
+	void print_report(std::ostream& os) const;
+	static const char* name(MemorySubsystem subsystem);
+
+private:
+	static void raise(std::atomic<long>& peak, long value);
+
+	std::atomic<long> current_[kNumMemorySubsystems];
+	std::atomic<long> peak_[kNumMemorySubsystems];
+	std::atomic<long> total_;
+	std::atomic<long> total_peak_;
+};
+
+extern MemoryAccount g_memory;
+
+// Bytes held against a subsystem for as long as this lives.
+class MemoryCharge {
+public:
+	explicit MemoryCharge(MemorySubsystem subsystem, size_t bytes = 0);
+	~MemoryCharge();
+	MemoryCharge(const MemoryCharge&) = delete;
+	MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+	void set(size_t bytes);
+	size_t bytes() const { return bytes_; }
+
+private:
+	MemorySubsystem subsystem_;
+	size_t bytes_ = 0;
+};
+
+template <typename T>
+size_t
+CapacityBytes(const std::vector<T>& v)
+{
+	return sizeof(T) * v.capacity();
+}
+
+// What building something will take: scratch that goes away once it is
+// built, what it then keeps on the CPU, and GPU storage for it.
+struct MemoryFootprint {
+	size_t scratch = 0;
+	size_t mesh = 0;
+	size_t gpu = 0;
+};
+
+inline double
+MiB(size_t bytes)
+{
+	return bytes / (1024.0 * 1024.0);
+}
+
+#endif
@@ -1,11 +1,14 @@
 #include "menger.h"
 #include <queue>
 #include <iostream>
+#include "job_system.h"
 
 using namespace std;
 namespace {
     const int kMinLevel = 0;
     const int kMaxLevel = 4;
+    // Cubes each job writes.
+    const size_t kCubesPerJob = 4096;
 };
 
 Menger::Menger(glm::vec3 min, glm::vec3 max) : min(min), max(max), dirty_(true) {}
@@ -21,6 +24,12 @@ Menger::set_nesting_level(int level)
     dirty_ = true;
 }
 
+int
+Menger::nesting_level() const
+{
+    return nesting_level_;
+}
+
 bool
 Menger::is_dirty() const
 {
@@ -38,18 +47,74 @@ void
 Menger::generate_geometry(std::vector<glm::vec4>& obj_vertices, 
                           std::vector<glm::uvec3>& obj_faces) const
 {
+    obj_vertices.clear();
+    obj_faces.clear();
+    std::vector<glm::vec3> mins = cube_mins();
+    MemoryCharge mins_memory(kMemoryScratch, CapacityBytes(mins));
+    obj_vertices.resize(mins.size() * 8);
+    obj_faces.resize(mins.size() * 12);
+    glm::vec3 d = (max - min) * float(1.0 / pow(3.0f, nesting_level_));
+    // Every cube has its own slots, so cubes can be written in any order.
+    g_jobs.parallel_for(0, mins.size(), kCubesPerJob, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            write_cube(&obj_vertices[8 * i], &obj_faces[12 * i], 8 * i, mins[i], mins[i] + d);
+    });
+}
 
-    cout << "generate geometry called. level: " << nesting_level_ << endl;
+void
+Menger::generate_geometry(std::vector<glm::vec4>& obj_vertices,
+                          std::vector<glm::vec3>& obj_normals,
+                          std::vector<glm::uvec3>& obj_faces) const
+{
     obj_vertices.clear();
+    obj_normals.clear();
     obj_faces.clear();
-    if(!this->nesting_level_) {
-        generate_menger(obj_vertices, obj_faces, min, max);
-        return;
-    }
+    std::vector<glm::vec3> mins = cube_mins();
+    MemoryCharge mins_memory(kMemoryScratch, CapacityBytes(mins));
+    obj_vertices.resize(mins.size() * 24);
+    obj_normals.resize(mins.size() * 24);
+    obj_faces.resize(mins.size() * 12);
+    glm::vec3 d = (max - min) * float(1.0 / pow(3.0f, nesting_level_));
+    g_jobs.parallel_for(0, mins.size(), kCubesPerJob, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            write_cube(&obj_vertices[24 * i], &obj_normals[24 * i], &obj_faces[12 * i], 24 * i,
+                       mins[i], mins[i] + d);
+        }
+    });
+}
 
+void
+Menger::mesh_size(int level, bool normals, size_t* vertices, size_t* faces)
+{
+    size_t cubes = 1;
+    for (int i = 0; i < level; i++)
+        cubes *= 20;
+    *vertices = (normals ? 24 : 8) * cubes;
+    *faces = 12 * cubes;
+}
+
+MemoryFootprint
+Menger::footprint(int level, bool normals)
+{
+    size_t vertices, faces;
+    mesh_size(level, normals, &vertices, &faces);
+    MemoryFootprint footprint;
+    // The queue peaks at every cube, and the list it drains into overlaps it.
+    footprint.scratch = 2 * sizeof(glm::vec3) * (faces / 12);
+    footprint.mesh = sizeof(glm::vec4) * vertices + sizeof(glm::uvec3) * faces;
+    if (normals)
+        footprint.mesh += sizeof(glm::vec3) * vertices;
+    footprint.gpu = footprint.mesh;
+    return footprint;
+}
+
+// Minimum corners of the cubes that make up the sponge at nesting_level_.
+std::vector<glm::vec3>
+Menger::cube_mins() const
+{
     std::queue<glm::vec3> mins;
+    MemoryCharge queue_memory(kMemoryScratch);
     mins.push(this->min);
-
     for(int i = 1; i <= nesting_level_; i++) {
         // cout << "computing level: " << i << endl;
 
@@ -85,68 +150,103 @@ Menger::generate_geometry(std::vector<glm::vec4>& obj_vertices,
 
         }
         // cout << "level " << i << ", cube number: " << mins.size() << endl;
+        queue_memory.set(sizeof(glm::vec3) * mins.size());
     }
 
     std::vector<glm::vec3> min_vec;
+    min_vec.reserve(mins.size());
+    MemoryCharge list_memory(kMemoryScratch, CapacityBytes(min_vec));
     while(!mins.empty()) {
         min_vec.push_back(mins.front());
         mins.pop();
     }
-
-    glm::vec3 d = (max - min) * float(1.0 / pow(3.0f, nesting_level_));
-    for(auto it = min_vec.begin(); it != min_vec.end(); ++it) {
-        generate_menger(obj_vertices, obj_faces, *it, *it + d);
-    }
+    return min_vec;
 }
 
+
 void
 Menger::generate_menger(std::vector<glm::vec4> &obj_vertices,
                             std::vector<glm::uvec3> &obj_faces, glm::vec3 min, glm::vec3 max) const {
+    size_t v = obj_vertices.size(), f = obj_faces.size();
+    obj_vertices.resize(v + 8);
+    obj_faces.resize(f + 12);
+    write_cube(&obj_vertices[v], &obj_faces[f], v, min, max);
+}
 
-    unsigned long v = obj_vertices.size();
-    obj_vertices.push_back(glm::vec4(min.x, min.y, min.z, 1.0f));
-    obj_vertices.push_back(glm::vec4(max.x, min.y, min.z, 1.0f));
-    obj_vertices.push_back(glm::vec4(max.x, max.y, min.z, 1.0f));
-    obj_vertices.push_back(glm::vec4(min.x, max.y, min.z, 1.0f));
-    obj_vertices.push_back(glm::vec4(min.x, min.y, max.z, 1.0f));
-    obj_vertices.push_back(glm::vec4(max.x, min.y, max.z, 1.0f));
-    obj_vertices.push_back(glm::vec4(max.x, max.y, max.z, 1.0f));
-    obj_vertices.push_back(glm::vec4(min.x, max.y, max.z, 1.0f));
-    
-    
-
-    obj_faces.push_back(glm::uvec3(v + 2, v + 1, v));
-    obj_faces.push_back(glm::uvec3(v, v + 3, v + 2));
-
-    obj_faces.push_back(glm::uvec3(v + 4, v + 5, v + 6));
-    obj_faces.push_back(glm::uvec3(v + 6, v + 7, v + 4));
-
-    obj_faces.push_back(glm::uvec3(v + 6, v + 5, v + 1));
-    obj_faces.push_back(glm::uvec3(v + 1, v + 2, v + 6));
-
-    obj_faces.push_back(glm::uvec3(v + 4, v + 7, v + 3));
-    obj_faces.push_back(glm::uvec3(v + 3, v, v + 4));
-
-    obj_faces.push_back(glm::uvec3(v + 5, v + 4, v));
-    obj_faces.push_back(glm::uvec3(v, v + 1, v + 5));
-
-    obj_faces.push_back(glm::uvec3(v + 3, v + 7, v + 6));
-    obj_faces.push_back(glm::uvec3(v + 6, v + 2, v + 3));  
-
-   
-
-    // obj_faces.push_back(glm::uvec3(v, v + 1, v + 2));
-    // obj_faces.push_back(glm::uvec3(v, v + 2, v + 3));
-    // obj_faces.push_back(glm::uvec3(v + 4, v + 5, v + 6));
-    // obj_faces.push_back(glm::uvec3(v + 4, v + 6, v + 7));
-    // obj_faces.push_back(glm::uvec3(v + 8, v + 9, v + 10));
-    // obj_faces.push_back(glm::uvec3(v + 8, v + 10, v + 11));
-    // obj_faces.push_back(glm::uvec3(v + 12, v + 13, v + 14));
-    // obj_faces.push_back(glm::uvec3(v + 12, v + 14, v + 15));
-    // obj_faces.push_back(glm::uvec3(v + 16, v + 17, v + 18));
-    // obj_faces.push_back(glm::uvec3(v + 16, v + 18, v + 19));
-    // obj_faces.push_back(glm::uvec3(v + 20, v + 21, v + 22));
-    // obj_faces.push_back(glm::uvec3(v + 20, v + 22, v + 23));
+void
+Menger::generate_menger(std::vector<glm::vec4> &obj_vertices,
+                        std::vector<glm::vec3> &obj_normals,
+                        std::vector<glm::uvec3> &obj_faces, glm::vec3 min, glm::vec3 max) const {
+    size_t v = obj_vertices.size(), f = obj_faces.size();
+    obj_vertices.resize(v + 24);
+    obj_normals.resize(v + 24);
+    obj_faces.resize(f + 12);
+    write_cube(&obj_vertices[v], &obj_normals[v], &obj_faces[f], v, min, max);
 }
 
+void
+Menger::write_cube(glm::vec4* vertices, glm::uvec3* faces, uint32_t v, glm::vec3 min, glm::vec3 max)
+{
+    vertices[0] = glm::vec4(min.x, min.y, min.z, 1.0f);
+    vertices[1] = glm::vec4(max.x, min.y, min.z, 1.0f);
+    vertices[2] = glm::vec4(max.x, max.y, min.z, 1.0f);
+    vertices[3] = glm::vec4(min.x, max.y, min.z, 1.0f);
+    vertices[4] = glm::vec4(min.x, min.y, max.z, 1.0f);
+    vertices[5] = glm::vec4(max.x, min.y, max.z, 1.0f);
+    vertices[6] = glm::vec4(max.x, max.y, max.z, 1.0f);
+    vertices[7] = glm::vec4(min.x, max.y, max.z, 1.0f);
+
+    faces[0] = glm::uvec3(v + 2, v + 1, v);
+    faces[1] = glm::uvec3(v, v + 3, v + 2);
 
+    faces[2] = glm::uvec3(v + 4, v + 5, v + 6);
+    faces[3] = glm::uvec3(v + 6, v + 7, v + 4);
+
+    faces[4] = glm::uvec3(v + 6, v + 5, v + 1);
+    faces[5] = glm::uvec3(v + 1, v + 2, v + 6);
+
+    faces[6] = glm::uvec3(v + 4, v + 7, v + 3);
+    faces[7] = glm::uvec3(v + 3, v, v + 4);
+
+    faces[8] = glm::uvec3(v + 5, v + 4, v);
+    faces[9] = glm::uvec3(v, v + 1, v + 5);
+
+    faces[10] = glm::uvec3(v + 3, v + 7, v + 6);
+    faces[11] = glm::uvec3(v + 6, v + 2, v + 3);
+}
+
+void
+Menger::write_cube(glm::vec4* vertices, glm::vec3* normals, glm::uvec3* faces, uint32_t v,
+                   glm::vec3 min, glm::vec3 max)
+{
+    const glm::vec4 corners[8] = {
+        glm::vec4(min.x, min.y, min.z, 1.0f),
+        glm::vec4(max.x, min.y, min.z, 1.0f),
+        glm::vec4(max.x, max.y, min.z, 1.0f),
+        glm::vec4(min.x, max.y, min.z, 1.0f),
+        glm::vec4(min.x, min.y, max.z, 1.0f),
+        glm::vec4(max.x, min.y, max.z, 1.0f),
+        glm::vec4(max.x, max.y, max.z, 1.0f),
+        glm::vec4(min.x, max.y, max.z, 1.0f),
+    };
+    // Corners of each face, ordered so that (0, 1, 2) and (2, 3, 0) give the
+    // same triangles, and so the same winding, as the shared-vertex cube.
+    const int quads[6][4] = {
+        { 2, 1, 0, 3 }, { 4, 5, 6, 7 }, { 6, 5, 1, 2 },
+        { 4, 7, 3, 0 }, { 5, 4, 0, 1 }, { 3, 7, 6, 2 },
+    };
+    const glm::vec3 face_normals[6] = {
+        glm::vec3(0, 0, -1), glm::vec3(0, 0, 1), glm::vec3(1, 0, 0),
+        glm::vec3(-1, 0, 0), glm::vec3(0, -1, 0), glm::vec3(0, 1, 0),
+    };
+
+    for (int f = 0; f < 6; f++) {
+        for (int c = 0; c < 4; c++) {
+            vertices[4 * f + c] = corners[quads[f][c]];
+            normals[4 * f + c] = face_normals[f];
+        }
+        uint32_t q = v + 4 * f;
+        faces[2 * f] = glm::uvec3(q, q + 1, q + 2);
+        faces[2 * f + 1] = glm::uvec3(q + 2, q + 3, q);
+    }
+}
@@ -3,20 +3,45 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include "memory_budget.h"
 
 class Menger {
 public:
 	Menger(glm::vec3 min, glm::vec3 max);
 	~Menger();
 	void set_nesting_level(int);
+	int nesting_level() const;
 	bool is_dirty() const;
 	void set_clean();
 	void generate_geometry(std::vector<glm::vec4>& obj_vertices,
 	                       std::vector<glm::uvec3>& obj_faces) const;
-private:
+	// Same sponge with 4 unshared vertices per face, each carrying its
+	// face's outward normal, so no geometry shader is needed to shade it.
+	void generate_geometry(std::vector<glm::vec4>& obj_vertices,
+	                       std::vector<glm::vec3>& obj_normals,
+	                       std::vector<glm::uvec3>& obj_faces) const;
+	// Appends one axis-aligned cube spanning [min, max].
+	void generate_menger(std::vector<glm::vec4>& obj_vertices,
+						std::vector<glm::uvec3>& obj_faces,
+						glm::vec3 min, glm::vec3 max) const;
 	void generate_menger(std::vector<glm::vec4>& obj_vertices,
+						std::vector<glm::vec3>& obj_normals,
 						std::vector<glm::uvec3>& obj_faces,
 						glm::vec3 min, glm::vec3 max) const;
+	// What generate_geometry would take at a level, without generating it:
+	// scratch at its peak, the mesh it leaves, and the bytes one upload of
+	// that mesh copies.
+	static MemoryFootprint footprint(int level, bool normals);
+	static void mesh_size(int level, bool normals, size_t* vertices, size_t* faces);
+private:
+	std::vector<glm::vec3> cube_mins() const;
+	// Write a cube's 8 shared or 24 per-face vertices and its 12 faces,
+	// numbering vertices from v.
+	static void write_cube(glm::vec4* vertices, glm::uvec3* faces, uint32_t v,
+	                       glm::vec3 min, glm::vec3 max);
+	static void write_cube(glm::vec4* vertices, glm::vec3* normals, glm::uvec3* faces,
+	                       uint32_t v, glm::vec3 min, glm::vec3 max);
+
 	int nesting_level_ = 0;
 	bool dirty_ = false;
 	glm::vec3 min;
@@ -0,0 +1,293 @@
+#include "meshlet.h"
+#include <algorithm>
+#include <cmath>
+#include "job_system.h"
+
+namespace {
+	const uint32_t kUnused = ~0u;
+	const int kMortonBits = 10;  // Per axis.
+	const uint64_t kFaceMask = (1ull << 31) - 1;
+
+	// Below this cosine between a triangle's normal and the average the
+	// cone would be too wide to ever cull anything.
+	const float kMinConeDot = 0.1f;
+
+	// Below this many meshlets culling stays on the calling thread.
+	const size_t kParallelMeshlets = 8192;
+	const size_t kMeshletsPerJob = 2048;
+
+	// Spreads the low 10 bits of x out to every third bit.
+	uint32_t spread_bits(uint32_t x)
+	{
+		x = (x | (x << 16)) & 0x030000ff;
+		x = (x | (x << 8)) & 0x0300f00f;
+		x = (x | (x << 4)) & 0x030c30c3;
+		x = (x | (x << 2)) & 0x09249249;
+		return x;
+	}
+
+	// 0..5 for +x, -x, +y, -y, +z, -z.
+	int dominant_axis(const glm::vec3& n)
+	{
+		glm::vec3 a(std::abs(n.x), std::abs(n.y), std::abs(n.z));
+		int axis = a.x >= a.y && a.x >= a.z ? 0 : a.y >= a.z ? 1 : 2;
+		return 2 * axis + (n[axis] < 0.0f ? 1 : 0);
+	}
+
+	// normals is scratch space for the unit normals of the triangles.
+	void compute_bounds(const std::vector<glm::vec4>& vertices,
+	                    const std::vector<glm::uvec3>& faces, std::vector<glm::vec3>* normals,
+	                    Meshlet* m)
+	{
+		glm::vec3 lo(vertices[m->vertex_offset]), hi = lo;
+		for (uint32_t v = m->vertex_offset; v < m->vertex_offset + m->vertex_count; v++) {
+			lo = glm::min(lo, glm::vec3(vertices[v]));
+			hi = glm::max(hi, glm::vec3(vertices[v]));
+		}
+		m->center = 0.5f * (lo + hi);
+		m->radius = 0.0f;
+		for (uint32_t v = m->vertex_offset; v < m->vertex_offset + m->vertex_count; v++)
+			m->radius = std::max(m->radius, glm::length(glm::vec3(vertices[v]) - m->center));
+
+		// The cone as meshoptimizer's meshopt_computeClusterBounds makes it:
+		// around the average normal, wide enough for the one furthest from
+		// it, with its apex pulled back behind every triangle's plane.
+		// Degenerate triangles face nowhere and are left out.
+		normals->clear();
+		glm::vec3 axis(0.0f);
+		size_t end = m->triangle_offset + m->triangle_count;
+		for (size_t t = m->triangle_offset; t < end; t++) {
+			glm::vec3 a(vertices[faces[t].x]), b(vertices[faces[t].y]), c(vertices[faces[t].z]);
+			glm::vec3 n = glm::cross(b - a, c - a);
+			float length = glm::length(n);
+			normals->push_back(length > 0.0f ? n / length : n);
+			axis += normals->back();
+		}
+		m->cone_apex = m->center;
+		m->cone_axis = axis;
+		m->cone_cutoff = 1.0f;
+		if (glm::length(axis) == 0.0f)
+			return;
+		axis = glm::normalize(axis);
+		m->cone_axis = axis;
+		float min_dot = 1.0f;
+		for (const glm::vec3& n : *normals) {
+			if (n != glm::vec3(0.0f))
+				min_dot = std::min(min_dot, glm::dot(n, axis));
+		}
+		if (min_dot <= kMinConeDot)
+			return;
+		float max_t = 0.0f;
+		for (size_t t = m->triangle_offset; t < end; t++) {
+			const glm::vec3& n = (*normals)[t - m->triangle_offset];
+			if (n != glm::vec3(0.0f)) {
+				glm::vec3 a(vertices[faces[t].x]);
+				max_t = std::max(max_t, glm::dot(m->center - a, n) / glm::dot(axis, n));
+			}
+		}
+		m->cone_apex = m->center - axis * max_t;
+		m->cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+	}
+
+	void cull_range(const std::vector<Meshlet>& meshlets, const glm::vec4 planes[6],
+	                const glm::vec3& eye, size_t begin, size_t end,
+	                std::vector<uint32_t>* visible, MeshletCullStats* stats)
+	{
+		for (size_t i = begin; i < end; i++) {
+			const Meshlet& m = meshlets[i];
+			stats->meshlets++;
+			stats->triangles += m.triangle_count;
+			if (m.cone_cutoff < 1.0f &&
+			    glm::dot(glm::normalize(m.cone_apex - eye), m.cone_axis) >= m.cone_cutoff) {
+				stats->backfacing++;
+				stats->culled_triangles += m.triangle_count;
+				continue;
+			}
+			bool inside = true;
+			for (int p = 0; p < 6; p++) {
+				if (glm::dot(glm::vec3(planes[p]), m.center) + planes[p].w < -m.radius) {
+					inside = false;
+					break;
+				}
+			}
+			if (!inside) {
+				stats->outside++;
+				stats->culled_triangles += m.triangle_count;
+				continue;
+			}
+			visible->push_back(i);
+		}
+	}
+};
+
+void
+BuildMeshlets(std::vector<glm::vec4>* vertices, std::vector<glm::vec3>* normals,
+              std::vector<glm::uvec3>* faces, std::vector<Meshlet>* meshlets,
+              std::vector<uint16_t>* local_indices)
+{
+	const std::vector<glm::vec4>& in_vertices = *vertices;
+	const std::vector<glm::uvec3>& in = *faces;
+	const bool has_normals = !normals->empty();
+	meshlets->clear();
+	local_indices->clear();
+	if (in.empty())
+		return;
+
+	// Sort keys: facing, then position along the curve.
+	std::vector<int> axes(in.size());
+	std::vector<glm::vec3> centroids(in.size());
+	glm::vec3 lo(in_vertices[in[0].x]), hi = lo;
+	for (size_t t = 0; t < in.size(); t++) {
+		glm::vec3 a(in_vertices[in[t].x]), b(in_vertices[in[t].y]), c(in_vertices[in[t].z]);
+		axes[t] = dominant_axis(glm::cross(b - a, c - a));
+		centroids[t] = (a + b + c) / 3.0f;
+		lo = glm::min(lo, centroids[t]);
+		hi = glm::max(hi, centroids[t]);
+	}
+	glm::vec3 extent = glm::max(hi - lo, glm::vec3(1e-20f));
+	const float cells = float((1 << kMortonBits) - 1);
+	// Axis in the top 3 bits, the curve in the next 30 and the face in the
+	// low 31, so that a plain sort keeps faces in a cell in order.
+	std::vector<uint64_t> order(in.size());
+	for (size_t t = 0; t < in.size(); t++) {
+		glm::uvec3 cell((centroids[t] - lo) / extent * cells + 0.5f);
+		uint64_t morton = spread_bits(cell.x) | spread_bits(cell.y) << 1 | spread_bits(cell.z) << 2;
+		order[t] = uint64_t(axes[t]) << 61 | morton << 31 | t;
+	}
+	std::sort(order.begin(), order.end());
+
+	// Fill each meshlet until a face would overflow it or faces another way.
+	std::vector<glm::vec4> out_vertices;
+	std::vector<glm::vec3> out_normals;
+	std::vector<glm::uvec3> out_faces;
+	// As MeshletFootprint expects, so that the sponge never reallocates.
+	out_vertices.reserve(std::max(in_vertices.size(), in.size() * 17 / 8));
+	if (has_normals)
+		out_normals.reserve(out_vertices.capacity());
+	out_faces.reserve(in.size());
+	local_indices->reserve(3 * in.size());
+	std::vector<uint32_t> local(in_vertices.size(), kUnused);
+	MemoryCharge scratch(kMemoryScratch,
+			CapacityBytes(axes) + CapacityBytes(centroids) + CapacityBytes(order) +
+			CapacityBytes(local) + CapacityBytes(out_vertices) + CapacityBytes(out_normals) +
+			CapacityBytes(out_faces) + CapacityBytes(*local_indices));
+	std::vector<uint32_t> used;  // Input vertices of the open meshlet.
+	std::vector<glm::vec3> face_normals;
+	int axis = -1;
+
+	auto close = [&]() {
+		if (used.empty())
+			return;
+		Meshlet& m = meshlets->back();
+		m.vertex_count = used.size();
+		m.triangle_count = out_faces.size() - m.triangle_offset;
+		compute_bounds(out_vertices, out_faces, &face_normals, &m);
+		for (uint32_t v : used)
+			local[v] = kUnused;
+		used.clear();
+	};
+
+	for (uint64_t key : order) {
+		uint32_t t = key & kFaceMask;
+		int added = 0;
+		for (int c = 0; c < 3; c++)
+			added += local[in[t][c]] == kUnused;
+		if (axes[t] != axis || used.size() + added > size_t(kMeshletMaxVertices) ||
+		    out_faces.size() - meshlets->back().triangle_offset >= size_t(kMeshletMaxTriangles)) {
+			close();
+			Meshlet m;
+			m.vertex_offset = out_vertices.size();
+			m.triangle_offset = out_faces.size();
+			meshlets->push_back(m);
+			axis = axes[t];
+		}
+		glm::uvec3 face;
+		for (int c = 0; c < 3; c++) {
+			uint32_t v = in[t][c];
+			if (local[v] == kUnused) {
+				local[v] = used.size();
+				used.push_back(v);
+				out_vertices.push_back(in_vertices[v]);
+				if (has_normals)
+					out_normals.push_back((*normals)[v]);
+			}
+			face[c] = meshlets->back().vertex_offset + local[v];
+			local_indices->push_back(local[v]);
+		}
+		out_faces.push_back(face);
+	}
+	close();
+
+	vertices->swap(out_vertices);
+	normals->swap(out_normals);
+	faces->swap(out_faces);
+}
+
+MemoryFootprint
+MeshletFootprint(const MemoryFootprint& base, size_t vertices, size_t faces, bool normals)
+{
+	// Quads split by facing keep 2 vertices a triangle, plus the ones
+	// repeated where meshlets meet: 2.08 to 2.12 for sponges of levels 2 to
+	// 4.  At least kMeshletMaxTriangles / 2 triangles fit in each.
+	size_t out_vertices = std::max(vertices, faces * 17 / 8);
+	size_t vertex_size = sizeof(glm::vec4) + (normals ? sizeof(glm::vec3) : 0);
+	size_t meshlets = faces / (kMeshletMaxTriangles / 2) + 1;
+	MemoryFootprint footprint;
+	footprint.gpu = vertex_size * out_vertices + 3 * sizeof(uint16_t) * faces;
+	footprint.mesh = footprint.gpu + sizeof(glm::uvec3) * faces + sizeof(Meshlet) * meshlets;
+	size_t build = base.mesh + (sizeof(int) + sizeof(glm::vec3) + sizeof(uint64_t)) * faces +
+	               sizeof(uint32_t) * vertices;
+	footprint.scratch = std::max(base.scratch + base.mesh, build + footprint.mesh) - footprint.mesh;
+	return footprint;
+}
+
+void
+MeshletCullStats::add(const MeshletCullStats& other)
+{
+	meshlets += other.meshlets;
+	triangles += other.triangles;
+	backfacing += other.backfacing;
+	outside += other.outside;
+	culled_triangles += other.culled_triangles;
+}
+
+void
+CullMeshlets(const std::vector<Meshlet>& meshlets, const glm::mat4& view_projection,
+             const glm::vec3& eye, std::vector<uint32_t>* visible, MeshletCullStats* stats)
+{
+	// Planes of the frustum from the rows of the matrix, as Gribb and
+	// Hartmann derive them, facing inwards and normalized so that they
+	// give distances.
+	glm::vec4 planes[6];
+	for (int i = 0; i < 3; i++) {
+		for (int side = 0; side < 2; side++) {
+			glm::vec4 plane;
+			for (int col = 0; col < 4; col++) {
+				float w = view_projection[col][3], r = view_projection[col][i];
+				plane[col] = side ? w - r : w + r;
+			}
+			planes[2 * i + side] = plane / glm::length(glm::vec3(plane));
+		}
+	}
+
+	if (meshlets.size() < kParallelMeshlets) {
+		cull_range(meshlets, planes, eye, 0, meshlets.size(), visible, stats);
+		return;
+	}
+	// Each range culls into its own list, and the lists are joined in
+	// order so that meshlets draw in the same order either way.
+	size_t ranges = (meshlets.size() + kMeshletsPerJob - 1) / kMeshletsPerJob;
+	std::vector<std::vector<uint32_t>> range_visible(ranges);
+	std::vector<MeshletCullStats> range_stats(ranges);
+	g_jobs.parallel_for(0, ranges, 1, [&](size_t begin, size_t end) {
+		for (size_t r = begin; r < end; r++) {
+			cull_range(meshlets, planes, eye, r * kMeshletsPerJob,
+			           std::min(meshlets.size(), (r + 1) * kMeshletsPerJob),
+			           &range_visible[r], &range_stats[r]);
+		}
+	});
+	for (size_t r = 0; r < ranges; r++) {
+		visible->insert(visible->end(), range_visible[r].begin(), range_visible[r].end());
+		stats->add(range_stats[r]);
+	}
+}
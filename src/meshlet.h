@@ -0,0 +1,82 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "memory_budget.h"
+
+// Limits per meshlet.  Draws go through glMultiDrawElementsBaseVertex rather
+// than mesh shaders, so vertices are only bounded by the 16-bit local
+// indices; the sponge's unwelded quads need 2 vertices a triangle.
+const int kMeshletMaxVertices = 256;
+const int kMeshletMaxTriangles = 128;
+
+/*
+ * A small cluster of triangles facing about the same way, with what the CPU
+ * needs to skip all of them at once: a bounding sphere for the frustum and
+ * a cone around their normals for facing.  Its local indices are relative
+ * to vertex_offset, the base vertex of its draw.
+ */
+struct Meshlet {
+	uint32_t vertex_offset;
+	uint32_t vertex_count;
+	uint32_t triangle_offset;  // In triangles, into the local indices.
+	uint32_t triangle_count;
+	glm::vec3 center;
+	float radius;
+	// Every triangle faces away from an eye for which the direction from
+	// the eye to cone_apex is within acos(cone_cutoff) of cone_axis.  A
+	// cutoff of 1 means the normals spread too far for that to happen.
+	glm::vec3 cone_apex;
+	glm::vec3 cone_axis;
+	float cone_cutoff;
+};
+
+/*
+ * Partitions faces into meshlets.  Faces are grouped by the axis their
+ * normal is closest to, so that the axis-aligned sponge gives cones of a
+ * single direction, then ordered along a Morton curve through their
+ * centroids so that each meshlet covers a compact patch.  Faces within a
+ * cell of the curve keep their order.
+ *
+ * Vertices and normals, if any, are rewritten in meshlet order, with those
+ * shared between meshlets repeated, and faces index them in the new order,
+ * so the whole mesh still draws as before.  local_indices holds three per
+ * triangle.
+ */
+void BuildMeshlets(std::vector<glm::vec4>* vertices, std::vector<glm::vec3>* normals,
+                   std::vector<glm::uvec3>* faces, std::vector<Meshlet>* meshlets,
+                   std::vector<uint16_t>* local_indices);
+
+/*
+ * What BuildMeshlets would take for a mesh of quads like the sponge's, of
+ * the given size and footprint before the build.  Scratch includes the
+ * mesh it replaces, which lives until the build is done; mesh and gpu
+ * replace the base's.
+ */
+MemoryFootprint MeshletFootprint(const MemoryFootprint& base, size_t vertices, size_t faces,
+                                 bool normals);
+
+// What one pass of CullMeshlets rejected, and why.
+struct MeshletCullStats {
+	size_t meshlets = 0;
+	size_t triangles = 0;
+	size_t backfacing = 0;  // Meshlets.
+	size_t outside = 0;     // Meshlets outside the frustum.
+	size_t culled_triangles = 0;
+
+	void add(const MeshletCullStats& other);
+};
+
+/*
+ * Appends to visible the indices of the meshlets that may show from eye
+ * through view_projection, skipping those facing away first and then those
+ * whose spheres lie wholly outside a plane of the frustum.
+ */
+void CullMeshlets(const std::vector<Meshlet>& meshlets, const glm::mat4& view_projection,
+                  const glm::vec3& eye, std::vector<uint32_t>* visible,
+                  MeshletCullStats* stats);
+
+#endif
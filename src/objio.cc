@@ -0,0 +1,21 @@
+#include "objio.h"
+#include <fstream>
+
+bool
+SaveObj(const std::string& file,
+        const std::vector<glm::vec4>& vertices,
+        const std::vector<glm::uvec3>& indices)
+{
+	std::ofstream outfile;
+	outfile.open(file);
+	if (!outfile)
+		return false;
+	for(auto& v : vertices) {
+		outfile << "v " << v.x << " " << v.y << " " << v.z << "\n";
+	}
+	for(auto& idx : indices) {
+		outfile << "f " << idx.x + 1 << " " << idx.y + 1 << " " << idx.z + 1 << "\n";
+	}
+	outfile.close();
+	return true;
+}
@@ -0,0 +1,12 @@
+#ifndef OBJIO_H
+#define OBJIO_H
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+bool SaveObj(const std::string& file,
+             const std::vector<glm::vec4>& vertices,
+             const std::vector<glm::uvec3>& indices);
+
+#endif
@@ -0,0 +1,236 @@
+#include "ocean.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "job_system.h"
+
+namespace {
+	const float kGravity = 9.81f;
+	const float kPi = 3.14159265358979f;
+	const int kTransposeBlock = 32;
+	// Rows of the grid each job handles.
+	const size_t kRowsPerJob = 8;
+
+	// FFT bin i of n as a signed frequency, so that k runs over -n/2..n/2-1.
+	int signed_bin(int i, int n)
+	{
+		return i < n / 2 ? i : i - n;
+	}
+};
+
+Ocean::Ocean(const OceanParams& params)
+	: params_(params)
+{
+	const int n = params_.grid;
+	const size_t count = size_t(n) * n;
+	h0_re_.assign(count, 0.0f);
+	h0_im_.assign(count, 0.0f);
+	h0_conj_re_.assign(count, 0.0f);
+	h0_conj_im_.assign(count, 0.0f);
+	omega_.assign(count, 0.0f);
+	kx_hat_.assign(count, 0.0f);
+	kz_hat_.assign(count, 0.0f);
+	a_re_.resize(count);
+	a_im_.resize(count);
+	b_re_.resize(count);
+	b_im_.resize(count);
+	displacement_.resize(count * 3);
+	normals_.resize(count * 3);
+
+	// Phillips spectrum: waves up to the largest one the wind can raise,
+	// aligned with the wind, with the tiny ones damped away.
+	std::mt19937 rng(params_.seed);
+	std::normal_distribution<float> gauss(0.0f, 1.0f);
+	float wind_speed = glm::length(params_.wind);
+	glm::vec2 wind_dir = params_.wind / wind_speed;
+	float big_l = wind_speed * wind_speed / kGravity;
+	float small_l = big_l / 1000.0f;
+	for (int z = 0; z < n; z++) {
+		for (int x = 0; x < n; x++) {
+			size_t i = size_t(z) * n + x;
+			glm::vec2 k = 2.0f * kPi / params_.length *
+				glm::vec2(signed_bin(x, n), signed_bin(z, n));
+			float xi_re = gauss(rng);
+			float xi_im = gauss(rng);
+			float k_len = glm::length(k);
+			// The Nyquist bins have no -k partner, so they would leave an
+			// imaginary residue in the displacement; leave them empty.
+			if (k_len < 1e-6f || x == n / 2 || z == n / 2)
+				continue;
+			float k2 = k_len * k_len;
+			float k_dot_w = glm::dot(k / k_len, wind_dir);
+			float phillips = params_.amplitude * std::exp(-1.0f / (k2 * big_l * big_l)) /
+				(k2 * k2) * k_dot_w * k_dot_w * std::exp(-k2 * small_l * small_l);
+			float scale = std::sqrt(phillips * 0.5f);
+			h0_re_[i] = xi_re * scale;
+			h0_im_[i] = xi_im * scale;
+			omega_[i] = std::sqrt(kGravity * k_len);
+			kx_hat_[i] = k.x / k_len;
+			kz_hat_[i] = k.y / k_len;
+		}
+	}
+	for (int z = 0; z < n; z++) {
+		for (int x = 0; x < n; x++) {
+			size_t i = size_t(z) * n + x;
+			size_t j = size_t((n - z) % n) * n + (n - x) % n;
+			h0_conj_re_[i] = h0_re_[j];
+			h0_conj_im_[i] = -h0_im_[j];
+		}
+	}
+
+	// Inverse transform, so the twiddles turn counter-clockwise.
+	twiddle_re_.resize(n / 2);
+	twiddle_im_.resize(n / 2);
+	for (int j = 0; j < n / 2; j++) {
+		twiddle_re_[j] = std::cos(2.0f * kPi * j / n);
+		twiddle_im_[j] = std::sin(2.0f * kPi * j / n);
+	}
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	bit_reverse_.resize(n);
+	for (int i = 0; i < n; i++) {
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		bit_reverse_[i] = r;
+	}
+}
+
+void
+Ocean::simulate(float time)
+{
+	const int n = params_.grid;
+	const float chop = params_.choppiness;
+
+	// h(k, t) = h0(k) e^(iwt) + conj(h0(-k)) e^(-iwt).  The horizontal
+	// displacement -chop * (-i k/|k|) h pulls points towards the crests;
+	// packing it as the imaginary part of the height transform gives
+	// A = h (1 - chop kx/|k|), and z goes on its own as B.
+	g_jobs.parallel_for(0, n, kRowsPerJob, [&](size_t z_begin, size_t z_end) {
+		for (int z = z_begin; z < int(z_end); z++) {
+			for (int x = 0; x < n; x++) {
+				size_t i = size_t(z) * n + x;
+				float c = std::cos(omega_[i] * time);
+				float s = std::sin(omega_[i] * time);
+				float h_re = (h0_re_[i] + h0_conj_re_[i]) * c - (h0_im_[i] - h0_conj_im_[i]) * s;
+				float h_im = (h0_re_[i] - h0_conj_re_[i]) * s + (h0_im_[i] + h0_conj_im_[i]) * c;
+				float ax = 1.0f - chop * kx_hat_[i];
+				a_re_[i] = h_re * ax;
+				a_im_[i] = h_im * ax;
+				b_re_[i] = -chop * kz_hat_[i] * h_im;
+				b_im_[i] = chop * kz_hat_[i] * h_re;
+			}
+		}
+	});
+	// The two transforms are independent, and each is parallel within.
+	JobGroup transforms;
+	g_jobs.run([this] { ifft2(a_re_, a_im_); }, &transforms);
+	g_jobs.run([this] { ifft2(b_re_, b_im_); }, &transforms);
+	g_jobs.wait(transforms);
+
+	g_jobs.parallel_for(0, n, kRowsPerJob, [&](size_t z_begin, size_t z_end) {
+		for (size_t i = z_begin * n; i < z_end * n; i++) {
+			displacement_[3 * i + 0] = a_im_[i];
+			displacement_[3 * i + 1] = a_re_[i];
+			displacement_[3 * i + 2] = b_re_[i];
+		}
+	});
+
+	const float texel = params_.length / n;
+	const int mask = n - 1;
+	g_jobs.parallel_for(0, n, kRowsPerJob, [&](size_t z_begin, size_t z_end) {
+		for (int z = z_begin; z < int(z_end); z++) {
+			const float* row = &displacement_[size_t(z) * n * 3];
+			const float* up = &displacement_[size_t((z + 1) & mask) * n * 3];
+			const float* down = &displacement_[size_t((z - 1) & mask) * n * 3];
+			for (int x = 0; x < n; x++) {
+				const float* right = &row[((x + 1) & mask) * 3];
+				const float* left = &row[((x - 1) & mask) * 3];
+				glm::vec3 dpdx(2.0f * texel + right[0] - left[0],
+				               right[1] - left[1], right[2] - left[2]);
+				glm::vec3 dpdz(up[3 * x] - down[3 * x], up[3 * x + 1] - down[3 * x + 1],
+				               2.0f * texel + up[3 * x + 2] - down[3 * x + 2]);
+				glm::vec3 normal = glm::normalize(glm::cross(dpdz, dpdx));
+				float* out = &normals_[(size_t(z) * n + x) * 3];
+				out[0] = normal.x;
+				out[1] = normal.y;
+				out[2] = normal.z;
+			}
+		}
+	});
+}
+
+void
+Ocean::ifft2(std::vector<float>& re, std::vector<float>& im)
+{
+	ifft_columns(re.data(), im.data());
+	transpose(re.data());
+	transpose(im.data());
+	ifft_columns(re.data(), im.data());
+	transpose(re.data());
+	transpose(im.data());
+}
+
+// Transforms every column at once: each butterfly pairs two whole rows.
+void
+Ocean::ifft_columns(float* re, float* im)
+{
+	const int n = params_.grid;
+	g_jobs.parallel_for(0, n, kRowsPerJob, [&](size_t r_begin, size_t r_end) {
+		for (int r = r_begin; r < int(r_end); r++) {
+			int s = bit_reverse_[r];
+			if (s > r) {
+				std::swap_ranges(re + size_t(r) * n, re + size_t(r + 1) * n, re + size_t(s) * n);
+				std::swap_ranges(im + size_t(r) * n, im + size_t(r + 1) * n, im + size_t(s) * n);
+			}
+		}
+	});
+	for (int size = 2; size <= n; size *= 2) {
+		const int half = size / 2;
+		const int stride = n / size;
+		g_jobs.parallel_for(0, n / 2, kRowsPerJob, [&](size_t b_begin, size_t b_end) {
+			for (int b = b_begin; b < int(b_end); b++) {
+				int j = b % half;
+				size_t top = size_t(b / half * size + j) * n;
+				size_t bottom = top + size_t(half) * n;
+				const float wr = twiddle_re_[j * stride];
+				const float wi = twiddle_im_[j * stride];
+				float* __restrict__ top_re = re + top;
+				float* __restrict__ top_im = im + top;
+				float* __restrict__ bottom_re = re + bottom;
+				float* __restrict__ bottom_im = im + bottom;
+				#pragma omp simd
+				for (int x = 0; x < n; x++) {
+					float tr = wr * bottom_re[x] - wi * bottom_im[x];
+					float ti = wr * bottom_im[x] + wi * bottom_re[x];
+					bottom_re[x] = top_re[x] - tr;
+					bottom_im[x] = top_im[x] - ti;
+					top_re[x] += tr;
+					top_im[x] += ti;
+				}
+			}
+		});
+	}
+}
+
+void
+Ocean::transpose(float* data)
+{
+	const int n = params_.grid;
+	// Block rows shrink towards the bottom, so each is a job of its own.
+	g_jobs.parallel_for(0, (n + kTransposeBlock - 1) / kTransposeBlock, 1,
+		[&](size_t row_begin, size_t row_end) {
+			for (int bz = row_begin * kTransposeBlock; bz < int(row_end) * kTransposeBlock;
+			     bz += kTransposeBlock) {
+				for (int bx = bz; bx < n; bx += kTransposeBlock) {
+					int z_end = std::min(bz + kTransposeBlock, n);
+					int x_end = std::min(bx + kTransposeBlock, n);
+					for (int z = bz; z < z_end; z++) {
+						for (int x = std::max(bx, z + 1); x < x_end; x++)
+							std::swap(data[size_t(z) * n + x], data[size_t(x) * n + z]);
+					}
+				}
+			}
+		});
+}
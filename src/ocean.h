@@ -0,0 +1,64 @@
+#ifndef OCEAN_H
+#define OCEAN_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct OceanParams {
+	int grid = 256;           // Samples per side; a power of two.
+	float length = 20.0f;     // World units covered by one tile.
+	float amplitude = 4e-4f;  // Phillips spectrum constant.
+	glm::vec2 wind = glm::vec2(6.0f, 4.0f);  // Wind velocity, units/s.
+	float choppiness = 1.0f;  // Horizontal displacement scale.
+	unsigned seed = 1;
+};
+
+/*
+ * A tileable spectral ocean after Tessendorf, "Simulating Ocean Water".
+ *
+ * The constructor draws the initial Phillips spectrum once; simulate(t)
+ * advances it to time t with the deep-water dispersion relation and
+ * inverse-FFTs height and choppy displacement into grid x grid maps.
+ * Normals are central differences of the displaced surface, so they stay
+ * right for choppy waves.
+ *
+ * The FFT is radix-2 over split real/imaginary arrays.  Each butterfly
+ * combines two whole rows, which keeps the inner loops contiguous and
+ * vectorizable, and the butterflies of a stage are spread over the job
+ * system.  Height and x displacement share one complex transform since
+ * both are real, and that transform and z's run side by side.
+ */
+class Ocean {
+public:
+	explicit Ocean(const OceanParams& params);
+
+	void simulate(float time);
+
+	int grid() const { return params_.grid; }
+	float length() const { return params_.length; }
+	// grid x grid texels of (dx, height, dz), row-major by z.
+	const std::vector<float>& displacement() const { return displacement_; }
+	// grid x grid texels of unit normals (x, y, z).
+	const std::vector<float>& normals() const { return normals_; }
+
+private:
+	void ifft2(std::vector<float>& re, std::vector<float>& im);
+	void ifft_columns(float* re, float* im);
+	void transpose(float* data);
+
+	OceanParams params_;
+	std::vector<float> h0_re_, h0_im_;          // h0(k)
+	std::vector<float> h0_conj_re_, h0_conj_im_; // conj(h0(-k))
+	std::vector<float> omega_;                   // w(k)
+	std::vector<float> kx_hat_, kz_hat_;         // k / |k|
+	std::vector<float> twiddle_re_, twiddle_im_;
+	std::vector<int> bit_reverse_;
+
+	// Scratch spectra: height + i * x displacement, and z displacement.
+	std::vector<float> a_re_, a_im_, b_re_, b_im_;
+
+	std::vector<float> displacement_;
+	std::vector<float> normals_;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef PER_FRAME_H
+#define PER_FRAME_H
+
+#include <glm/glm.hpp>
+#include "waves.h"
+
+/*
+ * Per-frame state shared by every shader program through one std140
+ * uniform block.  The render loop fills one PerFrameUniforms per frame,
+ * uploads it to a ring of uniform buffer segments and binds it to
+ * kPerFrameBinding; each program's PerFrame block is pointed at that
+ * binding once after linking.
+ *
+ * The C++ struct must match the GLSL block member for member; std140 puts
+ * the scalars after the vec4s back to back and rounds the block up to a
+ * multiple of 16 bytes.
+ */
+const unsigned kPerFrameBinding = 0;
+
+struct PerFrameUniforms {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec4 light_position;
+	glm::vec4 eye_position;
+	float elapsed_time;
+	float tide_time;
+	float wireframe_thresh;
+	int inner_level;
+	int outer_level;
+	int is_ocean_mode;
+	float ocean_length;  // World size of one FFT ocean tile.
+	int pad[1];
+	WaveParams waves;
+	glm::vec2 viewport;  // Framebuffer size in pixels.
+	float tess_pixels;   // Screen length of a floor segment; 0 for fixed levels.
+	float pad2[1];
+};
+
+static_assert(sizeof(PerFrameUniforms) == 288, "PerFrameUniforms must match std140");
+
+#define PER_FRAME_BLOCK                         \
+	"layout(std140) uniform PerFrame {\n"        \
+	"	mat4 projection;\n"                      \
+	"	mat4 view;\n"                            \
+	"	vec4 light_position;\n"                  \
+	"	vec4 eye_position;\n"                    \
+	"	float elapsedTime;\n"                    \
+	"	float tide_time;\n"                      \
+	"	float wireframeThresh;\n"                \
+	"	int innerLevel;\n"                       \
+	"	int outerLevel;\n"                       \
+	"	int isOceanMode;\n"                      \
+	"	float oceanLength;\n"                    \
+	WAVE_PARAMS_MEMBERS                          \
+	"	vec2 viewport;\n"                        \
+	"	float tess_pixels;\n"                    \
+	"};\n"
+
+#endif
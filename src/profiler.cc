@@ -0,0 +1,243 @@
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace {
+	const float kNoSample = std::numeric_limits<float>::quiet_NaN();
+};
+
+FrameProfiler::FrameProfiler() : last_report_(Clock::now())
+{
+}
+
+FrameProfiler::~FrameProfiler()
+{
+	close_trace();
+}
+
+int
+FrameProfiler::add_scope(const std::string& name, bool gpu, bool count_primitives)
+{
+	Scope scope;
+	scope.name = name;
+	scope.gpu = gpu;
+	scope.count_primitives = gpu && count_primitives;
+	std::fill(scope.queries, scope.queries + kQueryLatency, 0);
+	std::fill(scope.primitive_queries, scope.primitive_queries + kQueryLatency, 0);
+	std::fill(scope.issued, scope.issued + kQueryLatency, false);
+	std::fill(scope.cpu_ms, scope.cpu_ms + kQueryLatency, -1.0);
+	scope.cpu_history.assign(kHistory, kNoSample);
+	scope.gpu_history.assign(kHistory, kNoSample);
+	scope.primitive_history.assign(kHistory, kNoSample);
+	if (gpu)
+		glGenQueries(kQueryLatency, scope.queries);
+	if (scope.count_primitives)
+		glGenQueries(kQueryLatency, scope.primitive_queries);
+	scopes_.push_back(scope);
+	return scopes_.size() - 1;
+}
+
+bool
+FrameProfiler::open_trace(const std::string& file)
+{
+	trace_.open(file);
+	if (!trace_)
+		return false;
+	trace_ << "frame";
+	for (const Scope& scope : scopes_) {
+		trace_ << "," << scope.name << "_cpu_ms";
+		if (scope.gpu)
+			trace_ << "," << scope.name << "_gpu_ms";
+		if (scope.count_primitives)
+			trace_ << "," << scope.name << "_primitives";
+	}
+	trace_ << "\n";
+	return true;
+}
+
+void
+FrameProfiler::close_trace()
+{
+	if (trace_.is_open())
+		trace_.close();
+}
+
+void
+FrameProfiler::begin_frame()
+{
+	int slot = frame_ % kQueryLatency;
+	// The slot still holds the frame from kQueryLatency frames ago.
+	if (frame_ >= kQueryLatency)
+		resolve(slot);
+	for (Scope& scope : scopes_) {
+		scope.issued[slot] = false;
+		scope.cpu_ms[slot] = -1.0;
+	}
+}
+
+void
+FrameProfiler::end_frame()
+{
+	frame_++;
+	if (!overlay_)
+		return;
+	Clock::time_point now = Clock::now();
+	if (now - last_report_ >= std::chrono::seconds(1)) {
+		print_report(std::cout);
+		last_report_ = now;
+	}
+}
+
+void
+FrameProfiler::begin(int id)
+{
+	Scope& scope = scopes_[id];
+	int slot = frame_ % kQueryLatency;
+	if (scope.gpu && open_gpu_scope_ < 0) {
+		glBeginQuery(GL_TIME_ELAPSED, scope.queries[slot]);
+		if (scope.count_primitives)
+			glBeginQuery(GL_PRIMITIVES_GENERATED, scope.primitive_queries[slot]);
+		scope.issued[slot] = true;
+		open_gpu_scope_ = id;
+	}
+	scope.start = Clock::now();
+}
+
+void
+FrameProfiler::end(int id)
+{
+	Scope& scope = scopes_[id];
+	int slot = frame_ % kQueryLatency;
+	std::chrono::duration<double, std::milli> elapsed = Clock::now() - scope.start;
+	// A scope entered twice in one frame reports the sum.
+	scope.cpu_ms[slot] = std::max(scope.cpu_ms[slot], 0.0) + elapsed.count();
+	if (open_gpu_scope_ == id) {
+		glEndQuery(GL_TIME_ELAPSED);
+		if (scope.count_primitives)
+			glEndQuery(GL_PRIMITIVES_GENERATED);
+		open_gpu_scope_ = -1;
+	}
+}
+
+void
+FrameProfiler::resolve(int slot)
+{
+	long frame = frame_ - kQueryLatency;
+	if (trace_.is_open())
+		trace_ << frame;
+	for (Scope& scope : scopes_) {
+		float gpu_ms = kNoSample;
+		float primitives = kNoSample;
+		if (scope.issued[slot]) {
+			GLint available = 0;
+			glGetQueryObjectiv(scope.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(scope.queries[slot], GL_QUERY_RESULT, &ns);
+				gpu_ms = ns * 1e-6;
+				// Both queries ended together, so this one is done too.
+				if (scope.count_primitives) {
+					GLuint count = 0;
+					glGetQueryObjectuiv(scope.primitive_queries[slot], GL_QUERY_RESULT, &count);
+					primitives = count;
+				}
+			} else {
+				dropped_queries_++;
+			}
+		}
+		float cpu_ms = scope.cpu_ms[slot] >= 0.0 ? scope.cpu_ms[slot] : kNoSample;
+		scope.cpu_history[history_pos_] = cpu_ms;
+		scope.gpu_history[history_pos_] = gpu_ms;
+		scope.primitive_history[history_pos_] = primitives;
+
+		if (trace_.is_open()) {
+			trace_ << ",";
+			if (!std::isnan(cpu_ms))
+				trace_ << cpu_ms;
+			if (scope.gpu) {
+				trace_ << ",";
+				if (!std::isnan(gpu_ms))
+					trace_ << gpu_ms;
+			}
+			if (scope.count_primitives) {
+				trace_ << ",";
+				if (!std::isnan(primitives))
+					trace_ << static_cast<long>(primitives);
+			}
+		}
+	}
+	if (trace_.is_open())
+		trace_ << "\n";
+	history_pos_ = (history_pos_ + 1) % kHistory;
+	history_size_ = std::min(history_size_ + 1, kHistory);
+}
+
+double
+FrameProfiler::percentile_of(std::vector<float> samples, double p)
+{
+	samples.erase(std::remove_if(samples.begin(), samples.end(),
+				[](float v) { return std::isnan(v); }), samples.end());
+	if (samples.empty())
+		return -1.0;
+	size_t k = std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+	std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+	return samples[k];
+}
+
+double
+FrameProfiler::percentile(int id, double p, bool gpu) const
+{
+	const Scope& scope = scopes_[id];
+	return percentile_of(gpu ? scope.gpu_history : scope.cpu_history, p);
+}
+
+double
+FrameProfiler::primitives(int id, double p) const
+{
+	return percentile_of(scopes_[id].primitive_history, p);
+}
+
+void
+FrameProfiler::print_report(std::ostream& os) const
+{
+	os << std::fixed << std::setprecision(3);
+	os << "---- frame " << frame_ << ", last " << history_size_ << " frames"
+	   << ", " << dropped_queries_ << " GPU queries dropped ----\n";
+	os << std::left << std::setw(14) << "scope"
+	   << std::right << std::setw(10) << "cpu p50" << std::setw(10) << "p95"
+	   << std::setw(10) << "p99" << std::setw(10) << "gpu p50"
+	   << std::setw(10) << "p95" << std::setw(10) << "p99" << "  (ms)"
+	   << std::setw(12) << "prims p50" << "\n";
+	for (size_t i = 0; i < scopes_.size(); i++) {
+		os << std::left << std::setw(14) << scopes_[i].name << std::right;
+		for (int gpu = 0; gpu <= 1; gpu++) {
+			for (double p : {0.50, 0.95, 0.99}) {
+				double ms = percentile(i, p, gpu);
+				if (ms < 0.0)
+					os << std::setw(10) << "-";
+				else
+					os << std::setw(10) << ms;
+			}
+		}
+		if (scopes_[i].count_primitives && primitives(i, 0.50) >= 0.0)
+			os << std::setw(17) << static_cast<long>(primitives(i, 0.50));
+		os << "\n";
+	}
+	os << std::defaultfloat << std::flush;
+}
+
+std::string
+FrameProfiler::summary(int frame_scope) const
+{
+	std::ostringstream os;
+	double p50 = percentile(frame_scope, 0.50, false);
+	double p99 = percentile(frame_scope, 0.99, false);
+	os << std::fixed << std::setprecision(2);
+	if (p50 > 0.0)
+		os << p50 << " ms p50, " << p99 << " ms p99 (" << 1000.0 / p50 << " fps)";
+	return os.str();
+}
@@ -0,0 +1,101 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <GL/glew.h>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+ * Per-frame CPU/GPU timing of the render loop.
+ *
+ * Every scope measures CPU time with std::chrono::steady_clock.  Scopes
+ * created with gpu = true also wrap their GL commands in a GL_TIME_ELAPSED
+ * query.  Queries live in a ring kQueryLatency frames deep and are only read
+ * back once GL_QUERY_RESULT_AVAILABLE says so, so timing never stalls the
+ * pipeline; a result that is still pending when its slot comes around again
+ * is dropped.  GL_TIME_ELAPSED queries cannot nest, so at most one GPU scope
+ * may be open at a time.  A GPU scope can also count the primitives its
+ * draws generate with a GL_PRIMITIVES_GENERATED query read the same way.
+ *
+ * Samples are kept for the last kHistory frames to report rolling
+ * percentiles, and each frame can be streamed as one row of a CSV trace.
+ */
+class FrameProfiler {
+public:
+	static const int kQueryLatency = 4;
+	static const int kHistory = 240;
+
+	// Query objects are not deleted here; they go away with the GL context.
+	FrameProfiler();
+	~FrameProfiler();
+
+	// Registers a scope and returns its id. Must be called before the first
+	// frame and, for GPU scopes, with a current GL context.
+	int add_scope(const std::string& name, bool gpu, bool count_primitives = false);
+
+	void begin_frame();
+	void end_frame();
+	void begin(int scope);
+	void end(int scope);
+
+	bool open_trace(const std::string& file);
+	void close_trace();
+	void set_overlay(bool on) { overlay_ = on; }
+	bool overlay() const { return overlay_; }
+
+	// Prints p50/p95/p99 of every scope over the rolling history.
+	void print_report(std::ostream& os) const;
+	// One-line summary of a scope that spans the whole frame, e.g. for a
+	// window title.
+	std::string summary(int frame_scope) const;
+	// Rolling percentile of a scope in milliseconds, -1 if no samples yet.
+	double percentile(int scope, double p, bool gpu) const;
+	// Rolling percentile of the primitives a counting scope generated.
+	double primitives(int scope, double p) const;
+	long frame_count() const { return frame_; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Scope {
+		std::string name;
+		bool gpu;
+		bool count_primitives;
+		GLuint queries[kQueryLatency];
+		GLuint primitive_queries[kQueryLatency];
+		bool issued[kQueryLatency];
+		Clock::time_point start;
+		double cpu_ms[kQueryLatency];  // Pending until the GPU side resolves.
+		std::vector<float> cpu_history;
+		std::vector<float> gpu_history;
+		std::vector<float> primitive_history;
+	};
+
+	void resolve(int slot);
+	static double percentile_of(std::vector<float> samples, double p);
+
+	std::vector<Scope> scopes_;
+	int open_gpu_scope_ = -1;
+	long frame_ = 0;
+	long dropped_queries_ = 0;
+	int history_pos_ = 0;
+	int history_size_ = 0;
+	bool overlay_ = false;
+	Clock::time_point last_report_;
+	std::ofstream trace_;
+};
+
+// Times the enclosing block as one profiler scope.
+class ProfileScope {
+public:
+	ProfileScope(FrameProfiler& profiler, int scope)
+		: profiler_(profiler), scope_(scope) { profiler_.begin(scope_); }
+	~ProfileScope() { profiler_.end(scope_); }
+private:
+	FrameProfiler& profiler_;
+	int scope_;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "scene.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "floor.h"
+#include "job_system.h"
+#include "menger.h"
+
+namespace {
+	// Below this many instances threads cost more than they save.
+	const size_t kParallelInstances = 16384;
+	const size_t kInstancesPerJob = 4096;
+
+	const uint8_t kCulled = 0xff;
+
+	// Grid spacing in units of the largest sponge, and the seed of its
+	// sizes, turns and levels.
+	const float kGridSpacing = 1.5f;
+	const float kMinGridSize = 0.5f, kMaxGridSize = 1.5f;
+	const unsigned kGridSeed = 20;
+
+	// Everything classify needs besides the instances, split into scalars
+	// so that the loop over instances vectorizes.
+	struct CullTerms {
+		float plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+		float eye_x, eye_y, eye_z;
+		// Level l + 1 is drawn once edge^2 >= lod_step[l] * distance^2.
+		float lod_step[kSceneMaxLevel];
+		int max_level;
+	};
+
+	// Level of each instance, or kCulled.  At level l an instance's smallest
+	// cubes are its edge over 3^l, which spans edge * focal / distance / 3^l
+	// pixels; comparing squares keeps the loop free of roots and logarithms,
+	// and it has no branches so that it vectorizes.
+	void classify(const CullTerms& t, size_t begin, size_t end,
+	              const float* __restrict__ x, const float* __restrict__ y,
+	              const float* __restrict__ z, const float* __restrict__ radius,
+	              const float* __restrict__ edge, const uint8_t* __restrict__ max_level,
+	              uint8_t* __restrict__ levels)
+	{
+		#pragma omp simd
+		for (size_t i = begin; i < end; i++) {
+			int outside = 0;
+			for (int p = 0; p < 6; p++) {
+				float distance = t.plane_x[p] * x[i] + t.plane_y[p] * y[i] +
+				                 t.plane_z[p] * z[i] + t.plane_w[p];
+				outside |= distance < -radius[i];
+			}
+			float dx = x[i] - t.eye_x, dy = y[i] - t.eye_y, dz = z[i] - t.eye_z;
+			float distance2 = dx * dx + dy * dy + dz * dz;
+			float edge2 = edge[i] * edge[i];
+			int level = 0;
+			for (int l = 0; l < kSceneMaxLevel; l++)
+				level += edge2 >= t.lod_step[l] * distance2;
+			int cap = max_level[i] < t.max_level ? max_level[i] : t.max_level;
+			level = level < cap ? level : cap;
+			// kCulled is every bit set.
+			levels[i] = level | -outside;
+		}
+	}
+};
+
+void
+BuildSceneMeshes(SceneMeshes* meshes)
+{
+	Menger menger(glm::vec3(-0.5f), glm::vec3(0.5f));
+	meshes->vertices.clear();
+	meshes->normals.clear();
+	meshes->faces.clear();
+	std::vector<glm::vec4> vertices;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::uvec3> faces;
+	for (int level = 0; level <= kSceneMaxLevel; level++) {
+		menger.set_nesting_level(level);
+		menger.generate_geometry(vertices, normals, faces);
+		meshes->base_vertex[level] = meshes->vertices.size();
+		meshes->first_face[level] = meshes->faces.size();
+		meshes->face_count[level] = faces.size();
+		meshes->vertices.insert(meshes->vertices.end(), vertices.begin(), vertices.end());
+		meshes->normals.insert(meshes->normals.end(), normals.begin(), normals.end());
+		meshes->faces.insert(meshes->faces.end(), faces.begin(), faces.end());
+	}
+}
+
+void
+SceneCullStats::add(const SceneCullStats& other)
+{
+	instances += other.instances;
+	outside += other.outside;
+	for (int l = 0; l <= kSceneMaxLevel; l++)
+		at_level[l] += other.at_level[l];
+	triangles += other.triangles;
+	draws += other.draws;
+}
+
+void
+SpongeScene::add(const glm::mat4& transform, int max_level)
+{
+	float edge = std::max(glm::length(glm::vec3(transform[0])),
+	                      std::max(glm::length(glm::vec3(transform[1])),
+	                               glm::length(glm::vec3(transform[2]))));
+	x_.push_back(transform[3].x);
+	y_.push_back(transform[3].y);
+	z_.push_back(transform[3].z);
+	radius_.push_back(0.5f * std::sqrt(3.0f) * edge);
+	edge_.push_back(edge);
+	max_level_.push_back(std::max(0, std::min(max_level, kSceneMaxLevel)));
+	transforms_.push_back(transform);
+	memory_.set(bytes());
+}
+
+void
+SpongeScene::clear()
+{
+	x_.clear();
+	y_.clear();
+	z_.clear();
+	radius_.clear();
+	edge_.clear();
+	max_level_.clear();
+	transforms_.clear();
+	memory_.set(bytes());
+}
+
+size_t
+SpongeScene::bytes() const
+{
+	return CapacityBytes(x_) + CapacityBytes(y_) + CapacityBytes(z_) + CapacityBytes(radius_) +
+	       CapacityBytes(edge_) + CapacityBytes(max_level_) + CapacityBytes(transforms_);
+}
+
+void
+SpongeScene::cull(const glm::mat4& view_projection, const glm::vec3& eye, float focal_pixels,
+                  int max_level, SceneDrawList* draws, SceneCullStats* stats) const
+{
+	// Inward frustum planes, normalized, as CullMeshlets derives them.
+	CullTerms t;
+	for (int i = 0; i < 3; i++) {
+		for (int side = 0; side < 2; side++) {
+			glm::vec4 plane;
+			for (int col = 0; col < 4; col++) {
+				float w = view_projection[col][3], r = view_projection[col][i];
+				plane[col] = side ? w - r : w + r;
+			}
+			plane /= glm::length(glm::vec3(plane));
+			int p = 2 * i + side;
+			t.plane_x[p] = plane.x;
+			t.plane_y[p] = plane.y;
+			t.plane_z[p] = plane.z;
+			t.plane_w[p] = plane.w;
+		}
+	}
+	t.eye_x = eye.x;
+	t.eye_y = eye.y;
+	t.eye_z = eye.z;
+	float pixels = kSceneLodPixels / focal_pixels;
+	float step = pixels * pixels;
+	for (int l = 0; l < kSceneMaxLevel; l++) {
+		step *= 9.0f;
+		t.lod_step[l] = step;
+	}
+	t.max_level = max_level;
+
+	const size_t count = size();
+	std::vector<uint8_t>& levels = draws->levels;
+	levels.resize(count);
+	auto run = [&](size_t begin, size_t end) {
+		classify(t, begin, end, x_.data(), y_.data(), z_.data(), radius_.data(),
+		         edge_.data(), max_level_.data(), levels.data());
+	};
+	if (count < kParallelInstances)
+		run(0, count);
+	else
+		g_jobs.parallel_for(0, count, kInstancesPerJob, run);
+
+	// Group the survivors by level, keeping their order within each.
+	size_t at_level[kSceneMaxLevel + 1] = {};
+	for (size_t i = 0; i < count; i++) {
+		if (levels[i] != kCulled)
+			at_level[levels[i]]++;
+	}
+	size_t next[kSceneMaxLevel + 1];
+	draws->first[0] = 0;
+	for (int l = 0; l <= kSceneMaxLevel; l++) {
+		next[l] = draws->first[l];
+		draws->first[l + 1] = draws->first[l] + at_level[l];
+	}
+	draws->transforms.resize(draws->first[kSceneMaxLevel + 1]);
+	for (size_t i = 0; i < count; i++) {
+		if (levels[i] != kCulled)
+			draws->transforms[next[levels[i]]++] = transforms_[i];
+	}
+
+	stats->instances += count;
+	stats->outside += count - draws->transforms.size();
+	for (int l = 0; l <= kSceneMaxLevel; l++) {
+		size_t vertices, faces;
+		Menger::mesh_size(l, true, &vertices, &faces);
+		stats->at_level[l] += at_level[l];
+		stats->triangles += at_level[l] * faces;
+		stats->draws += at_level[l] > 0;
+	}
+}
+
+void
+MakeSceneGrid(size_t count, SpongeScene* scene)
+{
+	std::mt19937 random(kGridSeed);
+	std::uniform_real_distribution<float> size(kMinGridSize, kMaxGridSize);
+	std::uniform_real_distribution<float> turn(0.0f, glm::radians(90.0f));
+	std::uniform_int_distribution<int> level(1, kSceneMaxLevel);
+
+	scene->clear();
+	size_t side = std::ceil(std::sqrt(double(count)));
+	float spacing = kGridSpacing * kMaxGridSize;
+	float origin = -0.5f * spacing * (side - 1);
+	for (size_t i = 0; i < count; i++) {
+		float s = size(random);
+		glm::vec3 position(origin + spacing * (i % side), kFloorHeight + 0.5f * s,
+		                   origin + spacing * (i / side));
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+		transform = glm::rotate(transform, turn(random), glm::vec3(0.0f, 1.0f, 0.0f));
+		transform = glm::scale(transform, glm::vec3(s));
+		scene->add(transform, level(random));
+	}
+}
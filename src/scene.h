@@ -0,0 +1,97 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "memory_budget.h"
+
+// Highest level an instance is drawn at.  Level 4 is 1.9 million triangles
+// a copy, which only pays off for a sponge that fills the screen.
+const int kSceneMaxLevel = 3;
+// Screen size below which a level's smallest cubes are not worth drawing.
+const float kSceneLodPixels = 4.0f;
+
+/*
+ * Every level's sponge of the unit cube centred on the origin, with
+ * per-face normals, packed into one set of arrays so that one vertex and
+ * one index buffer serve all of them.  Faces index from their level's
+ * base_vertex.
+ */
+struct SceneMeshes {
+	std::vector<glm::vec4> vertices;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::uvec3> faces;
+	uint32_t base_vertex[kSceneMaxLevel + 1];
+	uint32_t first_face[kSceneMaxLevel + 1];
+	uint32_t face_count[kSceneMaxLevel + 1];
+};
+
+void BuildSceneMeshes(SceneMeshes* meshes);
+
+// What one pass of SpongeScene::cull did.
+struct SceneCullStats {
+	size_t instances = 0;
+	size_t outside = 0;  // Instances outside the frustum.
+	size_t at_level[kSceneMaxLevel + 1] = {};  // Drawn instances.
+	size_t triangles = 0;  // Drawn.
+	size_t draws = 0;  // Instanced calls, one per level drawn at.
+
+	void add(const SceneCullStats& other);
+};
+
+// The instances one frame draws, grouped by level: those at level l are
+// transforms[first[l]] up to transforms[first[l + 1]].
+struct SceneDrawList {
+	std::vector<glm::mat4> transforms;
+	size_t first[kSceneMaxLevel + 2];
+	std::vector<uint8_t> levels;  // Scratch, per instance.
+
+	size_t count(int level) const { return first[level + 1] - first[level]; }
+};
+
+/*
+ * Many sponges, each the unit sponge under its own transform and drawn at
+ * no more than its own nesting level.  Instances are kept as a structure of
+ * arrays, bounding sphere and size apart from the transforms, so that cull
+ * decides visibility and level for all of them in one vectorized loop and
+ * only touches the transforms of those it keeps.
+ */
+class SpongeScene {
+public:
+	// Adds a sponge; transform may rotate and scale, but uniformly.
+	void add(const glm::mat4& transform, int max_level);
+	void clear();
+	size_t size() const { return transforms_.size(); }
+	bool empty() const { return transforms_.empty(); }
+	size_t bytes() const;
+
+	/*
+	 * Fills draws with the instances whose bounding spheres reach into the
+	 * frustum of view_projection, each at the level where its smallest
+	 * cubes still span kSceneLodPixels: focal_pixels is the projection's
+	 * focal length in pixels, projection[1][1] times half the viewport
+	 * height.  Levels are also capped at max_level.
+	 */
+	void cull(const glm::mat4& view_projection, const glm::vec3& eye, float focal_pixels,
+	          int max_level, SceneDrawList* draws, SceneCullStats* stats) const;
+
+private:
+	std::vector<float> x_, y_, z_;  // Centres.
+	std::vector<float> radius_;
+	std::vector<float> edge_;  // World length of an edge of the sponge.
+	std::vector<uint8_t> max_level_;
+	std::vector<glm::mat4> transforms_;
+	MemoryCharge memory_{ kMemoryMesh };
+};
+
+/*
+ * A square grid of count sponges standing on the floor, centred on the
+ * origin, with sizes, turns about the vertical and levels from 1 to
+ * kSceneMaxLevel drawn from a fixed seed, so that every run sees the same
+ * scene.
+ */
+void MakeSceneGrid(size_t count, SpongeScene* scene);
+
+#endif
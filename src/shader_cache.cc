@@ -0,0 +1,242 @@
+#include "shader_cache.h"
+#include <debuggl.h>
+#include <sys/stat.h>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace {
+	const uint32_t kCacheMagic = 0x6d677362; // "mgsb"
+
+	// 64-bit FNV-1a.
+	uint64_t hash_bytes(uint64_t h, const void* data, size_t size)
+	{
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++) {
+			h ^= p[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	uint64_t hash_string(uint64_t h, const std::string& s)
+	{
+		// Include the terminator so that "ab"+"c" and "a"+"bc" differ.
+		return hash_bytes(h, s.c_str(), s.size() + 1);
+	}
+
+	// Prints the info log of a shader, or of a program, if it has one.
+	void print_log(GLuint id, bool program)
+	{
+		GLint length = 0;
+		if (program)
+			glGetProgramiv(id, GL_INFO_LOG_LENGTH, &length);
+		else
+			glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
+		if (length <= 1)
+			return;
+		std::string log(length, 0);
+		if (program)
+			glGetProgramInfoLog(id, length, nullptr, &log[0]);
+		else
+			glGetShaderInfoLog(id, length, nullptr, &log[0]);
+		std::cerr << log.c_str() << "\n";
+	}
+
+	std::string gl_string(GLenum name)
+	{
+		const GLubyte* s = glGetString(name);
+		return s ? reinterpret_cast<const char*>(s) : "";
+	}
+
+	void allow_parallel_compile()
+	{
+#ifdef GL_KHR_parallel_shader_compile
+		if (GLEW_KHR_parallel_shader_compile) {
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+			return;
+		}
+#endif
+#ifdef GL_ARB_parallel_shader_compile
+		if (GLEW_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+#endif
+	}
+};
+
+ShaderCache::ShaderCache(const std::string& directory)
+	: directory_(directory)
+{
+	driver_ = gl_string(GL_VENDOR) + "\n" + gl_string(GL_RENDERER) + "\n" +
+	          gl_string(GL_VERSION) + "\n" + gl_string(GL_SHADING_LANGUAGE_VERSION);
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats == 0)
+		directory_.clear();
+	if (!directory_.empty())
+		mkdir(directory_.c_str(), 0755);
+}
+
+std::string
+ShaderCache::key(const ProgramSpec& spec) const
+{
+	uint64_t h = 14695981039346656037ULL;
+	h = hash_string(h, driver_);
+	for (const ShaderStage& stage : spec.stages) {
+		h = hash_bytes(h, &stage.type, sizeof(stage.type));
+		h = hash_string(h, stage.source);
+	}
+	for (const auto& binding : spec.attributes) {
+		h = hash_bytes(h, &binding.first, sizeof(binding.first));
+		h = hash_string(h, binding.second);
+	}
+	for (const auto& binding : spec.frag_data) {
+		h = hash_bytes(h, &binding.first, sizeof(binding.first));
+		h = hash_string(h, binding.second);
+	}
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(h));
+	return hex;
+}
+
+std::string
+ShaderCache::path(const std::string& key) const
+{
+	return directory_ + "/" + key + ".bin";
+}
+
+bool
+ShaderCache::load(GLuint program, const std::string& key)
+{
+	if (directory_.empty())
+		return false;
+	std::ifstream in(path(key), std::ios::binary);
+	uint32_t magic = 0;
+	GLenum format = 0;
+	uint32_t length = 0;
+	in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	in.read(reinterpret_cast<char*>(&format), sizeof(format));
+	in.read(reinterpret_cast<char*>(&length), sizeof(length));
+	if (!in || magic != kCacheMagic || length == 0)
+		return false;
+	std::vector<char> binary(length);
+	if (!in.read(binary.data(), length))
+		return false;
+
+	// The driver may still reject a blob, e.g. after an update that kept
+	// its version string; that is a miss, once the GL_INVALID_* it raised
+	// is drained so that the next CHECK_GL_ERROR does not report it.
+	glProgramBinary(program, format, binary.data(), length);
+	GLint status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_TRUE)
+		return true;
+	while (glGetError() != GL_NO_ERROR)
+		;
+	return false;
+}
+
+void
+ShaderCache::store(GLuint program, const std::string& key)
+{
+	if (directory_.empty())
+		return;
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+	std::ofstream out(path(key), std::ios::binary);
+	uint32_t size = length;
+	out.write(reinterpret_cast<const char*>(&kCacheMagic), sizeof(kCacheMagic));
+	out.write(reinterpret_cast<const char*>(&format), sizeof(format));
+	out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	out.write(binary.data(), length);
+}
+
+std::vector<GLuint>
+ShaderCache::build(const std::vector<ProgramSpec>& specs)
+{
+	std::vector<GLuint> programs(specs.size(), 0);
+	std::vector<std::string> keys(specs.size());
+	std::vector<size_t> missing;
+	for (size_t i = 0; i < specs.size(); i++) {
+		keys[i] = key(specs[i]);
+		CHECK_GL_ERROR(programs[i] = glCreateProgram());
+		if (load(programs[i], keys[i])) {
+			hits_++;
+		} else {
+			// A rejected binary leaves the program failed; link a fresh
+			// one from source.
+			CHECK_GL_ERROR(glDeleteProgram(programs[i]));
+			CHECK_GL_ERROR(programs[i] = glCreateProgram());
+			misses_++;
+			missing.push_back(i);
+		}
+	}
+	if (missing.empty())
+		return programs;
+
+	allow_parallel_compile();
+
+	// Issue every compile first; stages shared between programs, like the
+	// vertex shader, are compiled once.
+	std::map<std::pair<GLenum, const char*>, GLuint> shaders;
+	for (size_t i : missing) {
+		for (const ShaderStage& stage : specs[i].stages) {
+			GLuint& id = shaders[std::make_pair(stage.type, stage.source)];
+			if (id)
+				continue;
+			CHECK_GL_ERROR(id = glCreateShader(stage.type));
+			CHECK_GL_ERROR(glShaderSource(id, 1, &stage.source, nullptr));
+			glCompileShader(id);
+		}
+	}
+
+	// Then every link.
+	for (size_t i : missing) {
+		GLuint program_id = programs[i];
+		for (const ShaderStage& stage : specs[i].stages)
+			CHECK_GL_ERROR(glAttachShader(program_id, shaders[std::make_pair(stage.type, stage.source)]));
+		for (const auto& binding : specs[i].attributes)
+			CHECK_GL_ERROR(glBindAttribLocation(program_id, binding.first, binding.second.c_str()));
+		for (const auto& binding : specs[i].frag_data)
+			CHECK_GL_ERROR(glBindFragDataLocation(program_id, binding.first, binding.second.c_str()));
+		CHECK_GL_ERROR(glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+		glLinkProgram(program_id);
+	}
+
+	// Only now wait for the results.
+	for (size_t i : missing) {
+		GLuint program_id = programs[i];
+		GLint status = GL_FALSE;
+		glGetProgramiv(program_id, GL_LINK_STATUS, &status);
+		if (status != GL_TRUE && specs[i].optional) {
+			std::cerr << "failed to build program " << specs[i].name << "; leaving it out\n";
+			for (const ShaderStage& stage : specs[i].stages)
+				print_log(shaders[std::make_pair(stage.type, stage.source)], false);
+			print_log(program_id, true);
+			glDeleteProgram(program_id);
+			programs[i] = 0;
+			continue;
+		}
+		if (status != GL_TRUE) {
+			std::cerr << "failed to build program " << specs[i].name << "\n";
+			for (const ShaderStage& stage : specs[i].stages)
+				CHECK_GL_SHADER_ERROR(shaders[std::make_pair(stage.type, stage.source)]);
+			CHECK_GL_PROGRAM_ERROR(program_id);
+		}
+		store(program_id, keys[i]);
+		for (const ShaderStage& stage : specs[i].stages)
+			glDetachShader(program_id, shaders[std::make_pair(stage.type, stage.source)]);
+	}
+	for (const auto& shader : shaders)
+		glDeleteShader(shader.second);
+	return programs;
+}
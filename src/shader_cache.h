@@ -0,0 +1,61 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <GL/glew.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ShaderStage {
+	GLenum type;
+	const char* source;
+};
+
+struct ProgramSpec {
+	std::string name;
+	std::vector<ShaderStage> stages;
+	std::vector<std::pair<GLuint, std::string>> attributes;  // glBindAttribLocation
+	std::vector<std::pair<GLuint, std::string>> frag_data;   // glBindFragDataLocation
+	// If it fails to build, build() gives 0 for it rather than exiting.
+	bool optional = false;
+};
+
+/*
+ * Builds linked programs, from an on-disk cache of glGetProgramBinary blobs
+ * where possible.  Entries are keyed by a hash of every stage's source, the
+ * attribute and output bindings, and the driver's vendor, renderer and
+ * version strings, so a shader edit or a driver update simply misses.
+ *
+ * On a miss every shader of every missing program is compiled and every
+ * program linked before any status is queried, which lets the driver work
+ * on them concurrently; with KHR_parallel_shader_compile it is also told to
+ * use as many compiler threads as it likes.  Compile and link errors are
+ * fatal, as with CHECK_GL_SHADER_ERROR, except in optional programs, whose
+ * logs are printed before they are left out.
+ *
+ * Uniform values and block bindings are not part of a program binary, so
+ * callers set them after build() as usual.
+ */
+class ShaderCache {
+public:
+	// An empty directory disables the on-disk cache.
+	explicit ShaderCache(const std::string& directory);
+
+	std::vector<GLuint> build(const std::vector<ProgramSpec>& specs);
+
+	int hits() const { return hits_; }
+	int misses() const { return misses_; }
+
+private:
+	std::string key(const ProgramSpec& spec) const;
+	std::string path(const std::string& key) const;
+	bool load(GLuint program, const std::string& key);
+	void store(GLuint program, const std::string& key);
+
+	std::string directory_;
+	std::string driver_;
+	int hits_ = 0;
+	int misses_ = 0;
+};
+
+#endif
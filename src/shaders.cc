@@ -0,0 +1,619 @@
+#include "shaders.h"
+#include "per_frame.h"
+#include "waves.h"
+
+// C++ 11 String Literal
+// See http://en.cppreference.com/w/cpp/language/string_literal
+const char* vertex_shader =
+R"zzz(#version 410 core
+)zzz" PER_FRAME_BLOCK R"zzz(
+in vec4 vertex_position;
+out vec4 vs_light_direction_0;
+out vec4 vertex_position_world_0;
+out vec4 vs_light_direction;
+out vec4 vertex_position_world;
+void main()
+{
+	gl_Position = view * vertex_position;
+	vs_light_direction_0 = -gl_Position + view * light_position;
+	vertex_position_world_0 = vertex_position;
+	vs_light_direction = -gl_Position + view * light_position;
+	vertex_position_world = vertex_position;
+}
+)zzz";
+
+
+
+
+// Floor vertex shader; passes the clipmap patch flags on to the control
+// shader.
+const char* floor_vertex_shader =
+R"zzz(#version 410 core
+)zzz" PER_FRAME_BLOCK R"zzz(
+in vec4 vertex_position;
+in uint patch_flags;
+out vec4 vs_light_direction_0;
+out vec4 vertex_position_world_0;
+flat out uint patch_flags_0;
+void main()
+{
+	gl_Position = view * vertex_position;
+	vs_light_direction_0 = -gl_Position + view * light_position;
+	vertex_position_world_0 = vertex_position;
+	patch_flags_0 = patch_flags;
+}
+)zzz";
+
+// The floor with no vertex or index buffers: drawn as 4 * ring * ring
+// vertices of GL_PATCHES, one instance per clipmap level, it places each
+// patch and works out its flags from the eye the way FloorClipmap::update
+// does on the CPU.  Window slots come in row order rather than by world
+// cell, which only changes the order patches are drawn in.
+const char* procedural_floor_vertex_shader =
+R"zzz(#version 410 core
+)zzz" PER_FRAME_BLOCK R"zzz(
+uniform int floor_levels;
+uniform int floor_ring;
+uniform float floor_cell;
+uniform float floor_height;
+out vec4 vs_light_direction_0;
+out vec4 vertex_position_world_0;
+flat out uint patch_flags_0;
+
+// Minimum cell of level l's window, in that level's cells.
+ivec2 window_origin(int l)
+{
+	float size = 2.0 * floor_cell * float(1 << l);
+	return 2 * ivec2(floor(eye_position.xz / size + 0.5)) - floor_ring / 2;
+}
+
+void main()
+{
+	int l = gl_InstanceID;
+	int slot = gl_VertexID / 4;
+	int corner = gl_VertexID % 4;
+	ivec2 lo = window_origin(l);
+	ivec2 hi = lo + floor_ring - 1;
+	ivec2 cell = lo + ivec2(slot % floor_ring, slot / floor_ring);
+
+	// Bit e marks edge e on the coarser level around, bit 4 + e on the
+	// finer level inside; edges run +z, -x, -z, +x.  Origins are even, so
+	// the shift halves them exactly.
+	uint flags = 0u;
+	int hole_size = floor_ring / 2;
+	ivec2 hole = l > 0 ? window_origin(l - 1) >> 1 : ivec2(0);
+	// Whether cell.x, and cell.y, lie within the finer window's span.
+	bvec2 along = equal(clamp(cell, hole, hole + hole_size - 1), cell);
+	if(l > 0 && all(along)) {
+		flags = 0x100u;
+	} else {
+		if(l + 1 < floor_levels) {
+			flags |= uint(cell.y == hi.y) | uint(cell.x == lo.x) << 1 |
+			         uint(cell.y == lo.y) << 2 | uint(cell.x == hi.x) << 3;
+		}
+		if(l > 0) {
+			flags |= uint(along.x && cell.y == hole.y - 1) << 4 |
+			         uint(along.y && cell.x == hole.x + hole_size) << 5 |
+			         uint(along.x && cell.y == hole.y + hole_size) << 6 |
+			         uint(along.y && cell.x == hole.x - 1) << 7;
+		}
+	}
+
+	// Corners (x, z), (x, z + 1), (x + 1, z + 1), (x + 1, z).
+	ivec2 offset = ivec2(corner >> 1, ((corner + 1) >> 1) & 1);
+	float step = floor_cell * float(1 << l);
+	vec2 xz = vec2(cell + offset) * step;
+	vec4 vertex_position = vec4(xz.x, floor_height, xz.y, 1.0);
+
+	gl_Position = view * vertex_position;
+	vs_light_direction_0 = -gl_Position + view * light_position;
+	vertex_position_world_0 = vertex_position;
+	patch_flags_0 = flags;
+}
+)zzz";
+
+// Cube-only vertex shader for sponges generated with per-face normals; it
+// replaces the geometry shader, which the cube needs only for flat normals.
+const char* cube_vertex_shader =
+R"zzz(#version 410 core
+)zzz" PER_FRAME_BLOCK R"zzz(
+in vec4 vertex_position;
+in vec3 vertex_normal;
+flat out vec4 normal;
+out vec4 light_direction;
+void main()
+{
+	vec4 view_position = view * vertex_position;
+	gl_Position = projection * view_position;
+	light_direction = -view_position + view * light_position;
+	normal = vec4(vertex_normal, 1.0);
+}
+)zzz";
+
+// The cube vertex shader for sponges of a SpongeScene, drawn instanced:
+// each instance brings its model transform as a per-instance mat4.
+const char* instance_vertex_shader =
+R"zzz(#version 410 core
+)zzz" PER_FRAME_BLOCK R"zzz(
+in vec4 vertex_position;
+in vec3 vertex_normal;
+in mat4 instance_transform;
+flat out vec4 normal;
+out vec4 light_direction;
+void main()
+{
+	vec4 view_position = view * (instance_transform * vertex_position);
+	gl_Position = projection * view_position;
+	light_direction = -view_position + view * light_position;
+	normal = vec4(normalize(mat3(instance_transform) * vertex_normal), 1.0);
+}
+)zzz";
+
+// const char* triangleTessControlShader =
+// R"zzz(#version 410 core
+
+// in vec4 vs_light_direction_0[];
+// in vec4 vertex_position_world_0[];
+// uniform int innerLevel;
+// uniform int outerLevel;
+// out vec4 vs_light_direction_1[];
+// out vec4 vertex_position_world_1[];
+
+
+
+// layout (vertices = 3) out;
+// void main(void) {
+// 	if(gl_InvocationID == 0) {
+// 		gl_TessLevelInner[0] = 1.0 + innerLevel;
+// 		gl_TessLevelOuter[0] = 1.0 + outerLevel;
+// 		gl_TessLevelOuter[1] = 1.0 + outerLevel;
+// 		gl_TessLevelOuter[2] = 1.0 + outerLevel;
+// 	}
+// 	gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
+// 	vs_light_direction_1[gl_InvocationID] = vs_light_direction_0[gl_InvocationID];
+// 	vertex_position_world_1[gl_InvocationID] = vertex_position_world_0[gl_InvocationID];
+// }
+
+// )zzz";
+
+
+const char* quadTessControlShader =
+R"zzz(#version 410 core
+)zzz" PER_FRAME_BLOCK WAVE_FUNCTIONS R"zzz(
+in vec4 vs_light_direction_0[];
+in vec4 vertex_position_world_0[];
+flat in uint patch_flags_0[];  // Clipmap patch flags, see floor.h.
+
+out vec4 vs_light_direction_1[];
+out vec4 vertex_position_world_1[];
+
+layout (vertices = 4) out;
+
+// Tessellation level of the edge a-b, sized so each segment covers about
+// tess_pixels on screen.  Only the edge's own endpoints go in, in a fixed
+// order, so the two patches that share it compute the same level and no
+// cracks open between them.  Edges that reach behind the eye fall back to
+// the size of their bounding sphere.
+float edge_level(vec4 a, vec4 b) {
+	vec4 lo = min(a, b);
+	vec4 hi = max(a, b);
+	vec4 clip_lo = projection * view * vec4(lo.xyz, 1.0);
+	vec4 clip_hi = projection * view * vec4(hi.xyz, 1.0);
+	float pixels;
+	if(min(clip_lo.w, clip_hi.w) > 0.1) {
+		// Only the part of the edge near the screen counts; without the
+		// guard band, edges that pass just beside the eye come out huge.
+		vec2 d = clamp(clip_hi.xy / clip_hi.w, -1.5, 1.5) -
+		         clamp(clip_lo.xy / clip_lo.w, -1.5, 1.5);
+		pixels = length(d * 0.5 * viewport);
+	} else {
+		vec4 centre = view * vec4(0.5 * (lo.xyz + hi.xyz), 1.0);
+		float diameter = distance(lo.xyz, hi.xyz);
+		pixels = diameter / max(length(centre.xyz), 1e-3) * projection[1][1] * 0.5 * viewport.y;
+	}
+	float level = pixels / tess_pixels;
+	if(isOceanMode == 1 && distance(0.5 * (lo.xz + hi.xz), tide_center()) < tide_range)
+		level *= 3.0;
+	return clamp(level, 1.0, 64.0);
+}
+
+// True if the patch, grown vertically by how far waves can move it, lies
+// wholly outside one frustum plane.
+bool outside_frustum(vec4 p[4]) {
+	float rise = 1.0;
+	if(isOceanMode == 1)
+		rise += abs(wave_amplitude) + abs(tide_amplitude);
+	else if(isOceanMode == 2)
+		rise += 0.25 * oceanLength;
+	vec4 clip[8];
+	for(int i = 0; i < 4; i++) {
+		clip[2 * i] = projection * view * vec4(p[i].x, p[i].y - rise, p[i].z, 1.0);
+		clip[2 * i + 1] = projection * view * vec4(p[i].x, p[i].y + rise, p[i].z, 1.0);
+	}
+	for(int axis = 0; axis < 3; axis++) {
+		bool below = true, above = true;
+		for(int i = 0; i < 8; i++) {
+			below = below && clip[i][axis] < -clip[i].w;
+			above = above && clip[i][axis] > clip[i].w;
+		}
+		if(below || above)
+			return true;
+	}
+	return false;
+}
+
+// Grows the edge a-b to the edge of the next coarser clipmap level that
+// contains it, which has twice its length and starts on a multiple of that.
+void coarser_edge(inout vec4 a, inout vec4 b) {
+	vec4 lo = min(a, b);
+	float len = distance(a.xyz, b.xyz);
+	vec3 along = abs(b.xyz - a.xyz) / len;
+	vec3 start = floor(lo.xyz / (2.0 * len)) * 2.0 * len;
+	a.xyz = mix(lo.xyz, start, along);
+	b.xyz = a.xyz + along * 2.0 * len;
+}
+
+void main(void) {
+	gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
+	vs_light_direction_1[gl_InvocationID] = vs_light_direction_0[gl_InvocationID];
+	vertex_position_world_1[gl_InvocationID] = vertex_position_world_0[gl_InvocationID];
+	if(gl_InvocationID != 0)
+		return;
+
+	// Outer edges as the evaluation shader lays out the patch:
+	// u = 0 runs 1-2, v = 0 runs 1-0, u = 1 runs 0-3, v = 1 runs 2-3.
+	vec4 p0 = vertex_position_world_0[0];
+	vec4 p1 = vertex_position_world_0[1];
+	vec4 p2 = vertex_position_world_0[2];
+	vec4 p3 = vertex_position_world_0[3];
+
+	// Drop patches a finer level covers and patches off screen.
+	uint flags = patch_flags_0[0];
+	if((flags & 0x100u) != 0u || outside_frustum(vec4[4](p0, p1, p2, p3))) {
+		for(int e = 0; e < 4; e++)
+			gl_TessLevelOuter[e] = 0.0;
+		return;
+	}
+	vec4 edges[8] = vec4[8](p1, p2, p1, p0, p0, p3, p2, p3);
+
+	float inner = 1.0 + innerLevel;
+	float outer = 1.0 + outerLevel;
+	// The FFT ocean has detail everywhere; tessellate finely enough to
+	// show it.
+	if(isOceanMode == 2) {
+		inner *= 16;
+		outer *= 16;
+	}
+	// adaptive tessellation around the tide
+	if(isOceanMode == 1 && distance(p0.xz, tide_center()) < tide_range) {
+		inner *= 3;
+		outer *= 3;
+	}
+
+	// Where levels meet, a coarse edge faces two fine ones.  The fine
+	// edges take half the level of the coarse edge they lie on, rounded
+	// up, and the coarse edge twice that, so their vertices line up.
+	float levels[4];
+	for(int e = 0; e < 4; e++) {
+		vec4 a = edges[2 * e];
+		vec4 b = edges[2 * e + 1];
+		bool coarser = (flags & (1u << e)) != 0u;
+		bool finer = (flags & (16u << e)) != 0u;
+		if(coarser)
+			coarser_edge(a, b);
+		float level = tess_pixels > 0.0 ? edge_level(a, b) : 2.0 * outer;
+		if(coarser)
+			level = ceil(max(level, 2.0) * 0.5);
+		else if(finer)
+			level = 2.0 * ceil(max(level, 2.0) * 0.5);
+		else if(tess_pixels <= 0.0)
+			level = outer;
+		levels[e] = level;
+		gl_TessLevelOuter[e] = level;
+	}
+
+	if(tess_pixels > 0.0) {
+		gl_TessLevelInner[0] = max(levels[1], levels[3]);
+		gl_TessLevelInner[1] = max(levels[0], levels[2]);
+	} else {
+		gl_TessLevelInner[0] = inner;
+		gl_TessLevelInner[1] = inner;
+	}
+}
+
+)zzz";
+
+
+// const char* triangleTessEvaluationShader =
+// R"zzz(#version 410 core
+// in vec4 vs_light_direction_1[];
+// in vec4 vertex_position_world_1[];
+
+// out vec4 vs_light_direction;
+// out vec4 vertex_position_world;
+
+
+// layout(triangles, equal_spacing, cw) in;
+// void main(void) {
+// 	gl_Position = (gl_TessCoord.x * gl_in[0].gl_Position
+// 					+ gl_TessCoord.y * gl_in[1].gl_Position
+// 					+ gl_TessCoord.z * gl_in[2].gl_Position);
+
+// 	vs_light_direction = (gl_TessCoord.x * vs_light_direction_1[0]
+// 					+ gl_TessCoord.y * vs_light_direction_1[1]
+// 					+ gl_TessCoord.z * vs_light_direction_1[2]);
+
+// 	vertex_position_world = (gl_TessCoord.x * vertex_position_world_1[0]
+// 					+ gl_TessCoord.y * vertex_position_world_1[1]
+// 					+ gl_TessCoord.z * vertex_position_world_1[2]);
+// }
+
+// )zzz";
+
+
+const char* quadTessEvaluationShader =
+R"zzz(#version 410 core
+)zzz" PER_FRAME_BLOCK R"zzz(
+uniform sampler2D ocean_displacement;
+uniform sampler2D ocean_normals;
+
+in vec4 vs_light_direction_1[];
+in vec4 vertex_position_world_1[];
+
+out vec4 vs_light_direction;
+out vec4 vertex_position_world;
+out vec4 eval_ocean_normal;
+
+
+layout(quads, equal_spacing, cw) in;
+void main(void) {
+	vec4 p1 = mix(gl_in[1].gl_Position, gl_in[0].gl_Position, gl_TessCoord.x);
+	vec4 p2 = mix(gl_in[2].gl_Position, gl_in[3].gl_Position, gl_TessCoord.x);
+	gl_Position = mix(p1, p2, gl_TessCoord.y);
+
+	vec4 light_dir1 = mix(vs_light_direction_1[1], vs_light_direction_1[0], gl_TessCoord.x);
+	vec4 light_dir2 = mix(vs_light_direction_1[2], vs_light_direction_1[3], gl_TessCoord.x);
+	vs_light_direction = mix(light_dir1, light_dir2, gl_TessCoord.y);
+
+
+	vec4 vertex_pos1 = mix(vertex_position_world_1[1], vertex_position_world_1[0], gl_TessCoord.x);
+	vec4 vertex_pos2 = mix(vertex_position_world_1[2], vertex_position_world_1[3], gl_TessCoord.x);
+	vertex_position_world = mix(vertex_pos1, vertex_pos2, gl_TessCoord.y);
+
+	// Displace by the simulated ocean, which tiles every oceanLength.
+	if(isOceanMode == 2) {
+		vec2 uv = vertex_position_world.xz / oceanLength +
+			0.5 / vec2(textureSize(ocean_displacement, 0));
+		vertex_position_world.xyz += texture(ocean_displacement, uv).xyz;
+		eval_ocean_normal = vec4(texture(ocean_normals, uv).xyz, 0.0);
+		gl_Position = view * vertex_position_world;
+		vs_light_direction = -gl_Position + view * light_position;
+	}
+
+}
+
+)zzz";
+
+
+const char* geometry_shader =
+R"zzz(#version 410 core
+)zzz" PER_FRAME_BLOCK WAVE_FUNCTIONS R"zzz(
+
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 4) out;
+uniform int is_floor;	// only the floor program gets ocean waves
+
+in vec4 vs_light_direction[];
+in vec4 vertex_position_world[];
+in vec4 eval_ocean_normal[];
+
+
+
+flat out vec4 normal;
+out vec4 light_direction;
+out vec4 vertex_position_world_;
+out vec3 v_bycentric;
+out vec4 ocean_normal;	// smooth normal of the FFT ocean
+void main()
+{
+	mat4 inv = inverse(view);
+	vec4 a = inv * vec4(gl_in[0].gl_Position.xyz, 1.0f);
+	vec4 b = inv * vec4(gl_in[1].gl_Position.xyz, 1.0f);
+	vec4 c = inv * vec4(gl_in[2].gl_Position.xyz, 1.0f);
+	
+	vec3 temp_a = vec3(a.x, a.y, a.z);
+	vec3 temp_b = vec3(b.x, b.y, b.z);
+	vec3 temp_c = vec3(c.x, c.y, c.z);
+	// float area = length(cross(temp_b - temp_a, temp_c - temp_a));
+	float area = length(cross(gl_in[0].gl_Position.xyz - gl_in[1].gl_Position.xyz,
+								gl_in[0].gl_Position.xyz - gl_in[2].gl_Position.xyz));
+
+	if(is_floor == 0 || isOceanMode != 1) {
+		int n = 0;
+		
+		normal = vec4(normalize(cross(temp_b - temp_a, temp_c - temp_a)), 1.0f);
+		for (n = 0; n < gl_in.length(); n++) {
+			light_direction = vs_light_direction[n];
+			vertex_position_world_ = vertex_position_world[n];
+			ocean_normal = eval_ocean_normal[n];
+			gl_Position = projection * gl_in[n].gl_Position;
+			if(n == 0) {
+				v_bycentric = vec3(1, 0, 0) * sqrt(area);
+			}
+			else if(n == 1) {
+				v_bycentric = vec3(0, 1, 0) * sqrt(area);
+			}
+			else {
+				v_bycentric = vec3(0, 0, 1) * sqrt(area);
+			}
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+	else {
+		int n = 0;
+
+		for (n = 0; n < gl_in.length(); n++) {
+			// Waves and tide are functions of world xz; WaveField::query
+			// evaluates the same thing on the CPU.
+			vec4 wave_pos = vertex_position_world[n];
+			vec2 slope;
+			wave_pos.y += wave_height(wave_pos.xz, slope);
+			normal = vec4(normalize(vec3(-slope.x, 1.0, -slope.y)), 1.0);
+
+			vertex_position_world_ = wave_pos;
+			vec4 view_position = view * wave_pos;
+			light_direction = -view_position + view * light_position;
+			gl_Position = projection * view_position;
+
+			if(n == 0) {
+				v_bycentric = vec3(1, 0, 0) * sqrt(area);
+			}
+			else if(n == 1) {
+				v_bycentric = vec3(0, 1, 0) * sqrt(area);
+			}
+			else {
+				v_bycentric = vec3(0, 0, 1) * sqrt(area);
+			}
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+	
+}
+)zzz";
+
+
+
+
+
+const char* fragment_shader =
+R"zzz(#version 410 core
+
+flat in vec4 normal;
+
+in vec4 light_direction;
+out vec4 fragment_color;
+void main()
+{
+	vec4 color = abs(normal) + vec4(0.0, 0.0, 0.0, 1.0);
+	float dot_nl = dot(normalize(light_direction), normal);
+	dot_nl = clamp(dot_nl, 0.0, 1.0);
+	fragment_color = clamp(dot_nl * color, 0.0, 1.0);
+	
+
+
+}
+)zzz";
+
+// FIXME: Implement shader effects with an alternative shader.
+const char* floor_fragment_shader =
+R"zzz(#version 410 core
+)zzz" PER_FRAME_BLOCK R"zzz(
+flat in vec4 normal;
+in vec4 ocean_normal;
+
+in vec3 v_bycentric;
+in vec4 light_direction;
+in vec4 vertex_position_world_;
+out vec4 fragment_color;
+
+void main()
+{
+
+	vec4 color;
+	if(isOceanMode != 0) {
+		color = vec4(normalize(vec3(0.0, 41.0, 58.0)), 1.0);
+	}
+	else {
+		if (mod(floor(vertex_position_world_[0]) + floor(vertex_position_world_[2]), 2.0) == 0) {
+			color = vec4(0.0, 0.0, 0.0, 1.0);
+		} else {
+			color = vec4(1.0, 1.0, 1.0, 1.0);
+		}
+	}
+
+	// The FFT ocean brings its own smooth normals.
+	vec4 surface_normal = normal;
+	if(isOceanMode == 2) {
+		surface_normal = vec4(normalize(ocean_normal.xyz), 0.0);
+	}
+
+	// add specular effects
+	vec3 water_ks = vec3(0.45, 0.45, 0.45);
+	float alpha = 1.0;
+	vec3 look_dir = normalize(eye_position.xyz - vertex_position_world_.xyz);
+	vec3 light_pixel_dir = normalize(light_position.xyz - vertex_position_world_.xyz);
+	vec3 R = 2 * dot(surface_normal.xyz, light_pixel_dir) * surface_normal.xyz - light_pixel_dir;
+	color += vec4(water_ks * pow(max(0.0, dot(look_dir, R)), alpha), 0.0);
+
+
+	float dot_nl = dot(normalize(light_direction), normalize(surface_normal) );
+	dot_nl = clamp(dot_nl, 0.0, 1.0);
+	fragment_color = clamp(dot_nl * color, 0.0, 1.0);
+	float minBc = min(min(v_bycentric.x, v_bycentric.y), v_bycentric.z);
+	if(minBc < wireframeThresh) {
+		fragment_color = vec4(0.0, 1.0, 0.0, 1.0);
+	}
+}
+)zzz";
+
+// DrawBatcher's program: every draw looks its Material up by the instanced
+// draw_index.  Bindings match kMaterialBinding and kMaterialTextureUnit.
+const char* material_vertex_shader =
+R"zzz(#version 430 core
+)zzz" PER_FRAME_BLOCK R"zzz(
+in vec4 vertex_position;
+in vec3 vertex_normal;
+in uint draw_index;
+flat out vec3 normal;
+flat out uint material;
+out vec3 world_position;
+void main()
+{
+	gl_Position = projection * view * vertex_position;
+	normal = vertex_normal;
+	material = draw_index;
+	world_position = vertex_position.xyz;
+}
+)zzz";
+
+const char* material_fragment_shader =
+R"zzz(#version 430 core
+)zzz" PER_FRAME_BLOCK R"zzz(
+struct MaterialData {
+	vec4 diffuse;
+	vec4 ambient;
+	vec4 specular;
+	float shininess;
+	int layer;	// -1 without a texture
+};
+layout(std430, binding = 1) readonly buffer Materials {
+	MaterialData materials[];
+};
+layout(binding = 3) uniform sampler2DArray material_textures;
+
+flat in vec3 normal;
+flat in uint material;
+in vec3 world_position;
+out vec4 fragment_color;
+void main()
+{
+	MaterialData m = materials[material];
+	vec3 n = normalize(normal);
+	vec4 kd = m.diffuse;
+	if (m.layer >= 0) {
+		// The sponge has no texture coordinates, so project along the
+		// face's axis.
+		vec3 a = abs(n);
+		vec2 uv = a.x > 0.5 ? world_position.zy :
+		          a.y > 0.5 ? world_position.xz : world_position.xy;
+		kd = texture(material_textures, vec3(uv, m.layer));
+	}
+	vec3 l = normalize(light_position.xyz - world_position);
+	vec3 v = normalize(eye_position.xyz - world_position);
+	float dot_nl = max(dot(n, l), 0.0);
+	float spec = dot_nl > 0.0 ? pow(max(dot(n, normalize(l + v)), 0.0), m.shininess) : 0.0;
+	fragment_color = vec4(m.ambient.rgb * kd.rgb + dot_nl * kd.rgb + spec * m.specular.rgb, 1.0);
+}
+)zzz";
@@ -0,0 +1,18 @@
+#ifndef SHADERS_H
+#define SHADERS_H
+
+// GLSL sources for every program, shared by the viewer and menger_bench.
+extern const char* vertex_shader;
+extern const char* floor_vertex_shader;
+extern const char* procedural_floor_vertex_shader;
+extern const char* cube_vertex_shader;
+extern const char* instance_vertex_shader;
+extern const char* quadTessControlShader;
+extern const char* quadTessEvaluationShader;
+extern const char* geometry_shader;
+extern const char* fragment_shader;
+extern const char* floor_fragment_shader;
+extern const char* material_vertex_shader;
+extern const char* material_fragment_shader;
+
+#endif
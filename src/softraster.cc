@@ -0,0 +1,412 @@
+#include "softraster.h"
+#include "floor.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "job_system.h"
+
+namespace {
+	// Faces one job sets up at a time.
+	const size_t kChunkFaces = 16384;
+	// Vertices one job transforms at a time.
+	const size_t kVerticesPerJob = 16384;
+	// Triangles are clipped against the sides of the frustum only once
+	// they reach this many times the viewport; rasterization clips the rest.
+	const float kGuardBand = 4.0f;
+	// Clip planes as dot(plane, clip position) >= 0: near, far, then the
+	// guard band sides.
+	const int kClipPlanes = 6;
+	const glm::vec4 kPlanes[kClipPlanes] = {
+		glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+		glm::vec4(0.0f, 0.0f, -1.0f, 1.0f),
+		glm::vec4(1.0f, 0.0f, 0.0f, kGuardBand),
+		glm::vec4(-1.0f, 0.0f, 0.0f, kGuardBand),
+		glm::vec4(0.0f, 1.0f, 0.0f, kGuardBand),
+		glm::vec4(0.0f, -1.0f, 0.0f, kGuardBand),
+	};
+	// Polygon out of clipping a triangle against kClipPlanes planes.
+	const int kMaxClipVertices = 3 + kClipPlanes;
+
+	// Bits 0..5 for the clip planes, 6..9 for the viewport sides.
+	unsigned outcode(const glm::vec4& p)
+	{
+		unsigned code = 0;
+		for (int i = 0; i < kClipPlanes; i++)
+			code |= unsigned(glm::dot(kPlanes[i], p) < 0.0f) << i;
+		code |= unsigned(p.x < -p.w) << 6 | unsigned(p.x > p.w) << 7 |
+		        unsigned(p.y < -p.w) << 8 | unsigned(p.y > p.w) << 9;
+		return code;
+	}
+
+	const unsigned kClipMask = (1u << kClipPlanes) - 1;
+
+	const float kInvSqrt2 = 0.70710678f;
+
+	uint8_t to_unorm8(float c)
+	{
+		return uint8_t(glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+
+	// Largest value of the plane a * x + b * y + c over the pixel box.
+	float plane_max(float a, float b, float c, const glm::ivec4& box)
+	{
+		return c + std::max(a * box.x, a * box.z) + std::max(b * box.y, b * box.w);
+	}
+};
+
+SoftRasterizer::SoftRasterizer(int width, int height)
+	: width_(width), height_(height),
+	  tiles_x_((width + kTile - 1) / kTile), tiles_y_((height + kTile - 1) / kTile),
+	  blocks_x_((width + kBlock - 1) / kBlock), blocks_y_((height + kBlock - 1) / kBlock)
+{
+	pixels_.resize(size_t(width_) * height_ * 3);
+	depth_.resize(size_t(blocks_x_) * blocks_y_ * kBlock * kBlock);
+	block_far_.resize(size_t(blocks_x_) * blocks_y_);
+}
+
+void
+SoftRasterizer::begin_frame(const SoftUniforms& uniforms)
+{
+	uniforms_ = uniforms;
+	view_projection_ = uniforms.projection * uniforms.view;
+	meshes_.clear();
+	floor_vertices_.clear();
+	floor_faces_.clear();
+	draw_floor_ = false;
+}
+
+void
+SoftRasterizer::draw_mesh(const std::vector<glm::vec4>& vertices,
+		const std::vector<glm::uvec3>& faces)
+{
+	meshes_.push_back(Mesh{ &vertices, &faces, kCubeMaterial, true });
+}
+
+// Two triangles per patch, wound so cross(b - a, c - a) points up like the
+// normals the geometry shader gives the tessellated floor.
+void
+SoftRasterizer::draw_floor(const FloorClipmap& floor)
+{
+	const std::vector<glm::vec4>& corners = floor.vertices();
+	const std::vector<uint32_t>& flags = floor.flags();
+	for (size_t v = 0; v < corners.size(); v += 4) {
+		if (flags[v] & kFloorPatchCulled)
+			continue;
+		uint32_t i = floor_vertices_.size();
+		floor_vertices_.insert(floor_vertices_.end(), &corners[v], &corners[v] + 4);
+		floor_faces_.push_back(glm::uvec3(i, i + 1, i + 2));
+		floor_faces_.push_back(glm::uvec3(i, i + 2, i + 3));
+	}
+	draw_floor_ = true;
+}
+
+void
+SoftRasterizer::end_frame()
+{
+	// The floor's arrays may grow until here, so point at them last.
+	if (draw_floor_)
+		meshes_.push_back(Mesh{ &floor_vertices_, &floor_faces_, kFloorMaterial, false });
+
+	clip_vertices_.resize(meshes_.size());
+	clip_codes_.resize(meshes_.size());
+	size_t chunk_count = 0;
+	submitted_ = 0;
+	for (size_t m = 0; m < meshes_.size(); m++) {
+		const std::vector<glm::vec4>& vertices = *meshes_[m].vertices;
+		std::vector<glm::vec4>& clip = clip_vertices_[m];
+		std::vector<uint16_t>& codes = clip_codes_[m];
+		clip.resize(vertices.size());
+		codes.resize(vertices.size());
+		g_jobs.parallel_for(0, vertices.size(), kVerticesPerJob, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				clip[i] = view_projection_ * vertices[i];
+				codes[i] = outcode(clip[i]);
+			}
+		});
+
+		size_t faces = meshes_[m].faces->size();
+		submitted_ += faces;
+		for (size_t begin = 0; begin < faces; begin += kChunkFaces) {
+			if (chunk_count == chunks_.size())
+				chunks_.emplace_back();
+			Chunk& chunk = chunks_[chunk_count++];
+			chunk.mesh = m;
+			chunk.begin = begin;
+			chunk.end = std::min(faces, begin + kChunkFaces);
+		}
+	}
+	chunks_.resize(chunk_count);
+
+	g_jobs.parallel_for(0, chunks_.size(), 1, [this](size_t begin, size_t end) {
+		for (size_t c = begin; c < end; c++)
+			setup_chunk(chunks_[c]);
+	});
+	rasterized_ = 0;
+	for (const Chunk& chunk : chunks_)
+		rasterized_ += chunk.triangles.size();
+
+	// Tiles own disjoint pixels, so they need no locking.
+	g_jobs.parallel_for(0, tiles_x_ * tiles_y_, 1, [this](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; t++)
+			raster_tile(t);
+	});
+}
+
+void
+SoftRasterizer::setup_chunk(Chunk& chunk)
+{
+	const Mesh& mesh = meshes_[chunk.mesh];
+	const std::vector<glm::vec4>& vertices = *mesh.vertices;
+	const std::vector<glm::vec4>& clip = clip_vertices_[chunk.mesh];
+	const std::vector<uint16_t>& clip_codes = clip_codes_[chunk.mesh];
+	chunk.triangles.clear();
+	chunk.bins.resize(tiles_x_ * tiles_y_);
+	for (std::vector<uint32_t>& bin : chunk.bins)
+		bin.clear();
+
+	for (size_t f = chunk.begin; f < chunk.end; f++) {
+		const glm::uvec3& face = (*mesh.faces)[f];
+		unsigned codes[3] = { clip_codes[face[0]], clip_codes[face[1]], clip_codes[face[2]] };
+		// Entirely outside one plane or one side of the viewport.
+		if (codes[0] & codes[1] & codes[2])
+			continue;
+
+		glm::vec4 in_clip[3] = { clip[face[0]], clip[face[1]], clip[face[2]] };
+
+		glm::vec3 in_world[3] = {
+			glm::vec3(vertices[face[0]]), glm::vec3(vertices[face[1]]),
+			glm::vec3(vertices[face[2]])
+		};
+		// Normalized only for the triangles that survive.
+		glm::vec3 normal = glm::cross(in_world[1] - in_world[0], in_world[2] - in_world[0]);
+		if (!((codes[0] | codes[1] | codes[2]) & kClipMask)) {
+			emit(chunk, in_clip, in_world, normal, mesh);
+			continue;
+		}
+
+		// Sutherland-Hodgman against the planes the triangle crosses, then
+		// a fan over what is left.
+		glm::vec4 poly_clip[2][kMaxClipVertices];
+		glm::vec3 poly_world[2][kMaxClipVertices];
+		std::copy(in_clip, in_clip + 3, poly_clip[0]);
+		std::copy(in_world, in_world + 3, poly_world[0]);
+		int count = 3, src = 0;
+		unsigned crossed = (codes[0] | codes[1] | codes[2]) & kClipMask;
+		for (int p = 0; p < kClipPlanes && count >= 3; p++) {
+			if (!(crossed & (1u << p)))
+				continue;
+			int out = 0;
+			for (int i = 0; i < count; i++) {
+				int j = (i + 1) % count;
+				float di = glm::dot(kPlanes[p], poly_clip[src][i]);
+				float dj = glm::dot(kPlanes[p], poly_clip[src][j]);
+				if (di >= 0.0f) {
+					poly_clip[1 - src][out] = poly_clip[src][i];
+					poly_world[1 - src][out++] = poly_world[src][i];
+				}
+				if ((di >= 0.0f) != (dj >= 0.0f)) {
+					float t = di / (di - dj);
+					poly_clip[1 - src][out] = glm::mix(poly_clip[src][i], poly_clip[src][j], t);
+					poly_world[1 - src][out++] = glm::mix(poly_world[src][i], poly_world[src][j], t);
+				}
+			}
+			count = out;
+			src = 1 - src;
+		}
+		for (int i = 1; i + 1 < count; i++) {
+			glm::vec4 fan_clip[3] = { poly_clip[src][0], poly_clip[src][i], poly_clip[src][i + 1] };
+			glm::vec3 fan_world[3] = { poly_world[src][0], poly_world[src][i], poly_world[src][i + 1] };
+			emit(chunk, fan_clip, fan_world, normal, mesh);
+		}
+	}
+}
+
+void
+SoftRasterizer::emit(Chunk& chunk, const glm::vec4* clip, const glm::vec3* world,
+		const glm::vec3& normal, const Mesh& mesh)
+{
+	glm::vec2 s[3];
+	float inv_w[3];
+	for (int i = 0; i < 3; i++) {
+		inv_w[i] = 1.0f / clip[i].w;
+		s[i] = (glm::vec2(clip[i]) * inv_w[i] * 0.5f + 0.5f) *
+		       glm::vec2(width_, height_);
+	}
+	float area = (s[1].x - s[0].x) * (s[2].y - s[0].y) -
+	             (s[2].x - s[0].x) * (s[1].y - s[0].y);
+	if (!(std::abs(area) > 0.0f) || (mesh.cull_back && area < 0.0f))
+		return;
+
+	// Pixels whose centres fall inside the bounding box.
+	glm::vec2 lo = glm::min(glm::min(s[0], s[1]), s[2]);
+	glm::vec2 hi = glm::max(glm::max(s[0], s[1]), s[2]);
+	glm::ivec4 bounds(std::max(0, int(std::ceil(lo.x - 0.5f))),
+	                  std::max(0, int(std::ceil(lo.y - 0.5f))),
+	                  std::min(width_ - 1, int(std::floor(hi.x - 0.5f))),
+	                  std::min(height_ - 1, int(std::floor(hi.y - 0.5f))));
+	if (bounds.x > bounds.z || bounds.y > bounds.w)
+		return;
+
+	// Barycentric i is the edge function of the edge opposite vertex i.
+	Triangle tri;
+	for (int i = 0; i < 3; i++) {
+		const glm::vec2& p = s[(i + 1) % 3];
+		const glm::vec2& q = s[(i + 2) % 3];
+		float a = (p.y - q.y) / area;
+		float b = (q.x - p.x) / area;
+		float c = (p.x * q.y - q.x * p.y) / area;
+		tri.bary_a[i] = a;
+		tri.bary_b[i] = b;
+		tri.bary_c[i] = c + 0.5f * (a + b);
+	}
+	glm::vec3 w(inv_w[0], inv_w[1], inv_w[2]);
+	tri.inv_w = glm::vec3(glm::dot(tri.bary_a, w), glm::dot(tri.bary_b, w),
+	                      glm::dot(tri.bary_c, w));
+	tri.world_a = tri.world_b = tri.world_c = glm::vec3(0.0f);
+	for (int i = 0; i < 3; i++) {
+		glm::vec3 world_w = world[i] * inv_w[i];
+		tri.world_a += tri.bary_a[i] * world_w;
+		tri.world_b += tri.bary_b[i] * world_w;
+		tri.world_c += tri.bary_c[i] * world_w;
+	}
+	tri.bounds = bounds;
+	tri.max_inv_w = std::max(std::max(inv_w[0], inv_w[1]), inv_w[2]);
+	tri.normal = glm::normalize(normal);
+	tri.light_normal = glm::transpose(glm::mat3(uniforms_.view)) * tri.normal;
+	tri.material = mesh.material;
+
+	uint32_t index = chunk.triangles.size();
+	chunk.triangles.push_back(tri);
+	for (int ty = bounds.y / kTile; ty <= bounds.w / kTile; ty++) {
+		for (int tx = bounds.x / kTile; tx <= bounds.z / kTile; tx++)
+			chunk.bins[ty * tiles_x_ + tx].push_back(index);
+	}
+}
+
+void
+SoftRasterizer::raster_tile(int tile)
+{
+	glm::ivec4 rect(tile % tiles_x_ * kTile, tile / tiles_x_ * kTile, 0, 0);
+	rect.z = std::min(rect.x + kTile, width_) - 1;
+	rect.w = std::min(rect.y + kTile, height_) - 1;
+
+	// Depth past the edge of the screen reads as nearest so that partial
+	// blocks can still fill up.
+	const int stride = blocks_x_ * kBlock;
+	int pad_x = std::min(rect.x + kTile, stride);
+	int pad_y = std::min(rect.y + kTile, blocks_y_ * kBlock);
+	for (int y = rect.y; y < pad_y; y++) {
+		for (int x = rect.x; x < pad_x; x++)
+			depth_[size_t(y) * stride + x] = x < width_ && y < height_ ? 0.0f : FLT_MAX;
+		if (y < height_) {
+			std::fill(pixels_.begin() + (size_t(y) * width_ + rect.x) * 3,
+			          pixels_.begin() + (size_t(y) * width_ + rect.z + 1) * 3, 0);
+		}
+	}
+	for (int by = rect.y / kBlock; by * kBlock < pad_y; by++) {
+		for (int bx = rect.x / kBlock; bx * kBlock < pad_x; bx++)
+			block_far_[by * blocks_x_ + bx] = 0.0f;
+	}
+
+	// Chunks in submission order keep draw order for equal depths.
+	for (const Chunk& chunk : chunks_) {
+		for (uint32_t index : chunk.bins[tile]) {
+			const Triangle& tri = chunk.triangles[index];
+			glm::ivec4 clipped(std::max(rect.x, tri.bounds.x), std::max(rect.y, tri.bounds.y),
+			                   std::min(rect.z, tri.bounds.z), std::min(rect.w, tri.bounds.w));
+			raster_triangle(tri, clipped);
+		}
+	}
+}
+
+void
+SoftRasterizer::raster_triangle(const Triangle& tri, const glm::ivec4& rect)
+{
+	const int stride = blocks_x_ * kBlock;
+	for (int by = rect.y / kBlock; by <= rect.w / kBlock; by++) {
+		for (int bx = rect.x / kBlock; bx <= rect.z / kBlock; bx++) {
+			// Everything already in the block is nearer.
+			float& block_far = block_far_[by * blocks_x_ + bx];
+			if (tri.max_inv_w <= block_far)
+				continue;
+			glm::ivec4 box(std::max(rect.x, bx * kBlock), std::max(rect.y, by * kBlock),
+			               std::min(rect.z, bx * kBlock + kBlock - 1),
+			               std::min(rect.w, by * kBlock + kBlock - 1));
+			bool outside = false;
+			for (int i = 0; i < 3; i++)
+				outside = outside || plane_max(tri.bary_a[i], tri.bary_b[i], tri.bary_c[i], box) < 0.0f;
+			if (outside)
+				continue;
+
+			bool wrote = false;
+			const int x0 = bx * kBlock;
+			for (int y = box.y; y <= box.w; y++) {
+				float* depth = &depth_[size_t(y) * stride + x0];
+				glm::vec3 row = tri.bary_b * float(y) + tri.bary_c;
+				float row_w = tri.inv_w.y * y + tri.inv_w.z;
+				float inv_w[kBlock];
+				bool pass[kBlock];
+				#pragma omp simd
+				for (int k = 0; k < kBlock; k++) {
+					float x = float(x0 + k);
+					float l0 = tri.bary_a.x * x + row.x;
+					float l1 = tri.bary_a.y * x + row.y;
+					float l2 = tri.bary_a.z * x + row.z;
+					inv_w[k] = tri.inv_w.x * x + row_w;
+					pass[k] = l0 >= 0.0f && l1 >= 0.0f && l2 >= 0.0f &&
+					          x0 + k >= box.x && x0 + k <= box.z && inv_w[k] > depth[k];
+				}
+				for (int k = 0; k < kBlock; k++) {
+					if (!pass[k])
+						continue;
+					int x = x0 + k;
+					depth[k] = inv_w[k];
+					glm::vec3 world = (tri.world_a * float(x) + tri.world_b * float(y) +
+					                   tri.world_c) / inv_w[k];
+					glm::vec3 color = shade(tri, world);
+					uint8_t* pixel = &pixels_[(size_t(y) * width_ + x) * 3];
+					pixel[0] = to_unorm8(color.r);
+					pixel[1] = to_unorm8(color.g);
+					pixel[2] = to_unorm8(color.b);
+					wrote = true;
+				}
+			}
+			if (wrote) {
+				float farthest = FLT_MAX;
+				for (int y = by * kBlock; y < (by + 1) * kBlock; y++) {
+					const float* depth = &depth_[size_t(y) * stride + x0];
+					for (int k = 0; k < kBlock; k++)
+						farthest = std::min(farthest, depth[k]);
+				}
+				block_far = farthest;
+			}
+		}
+	}
+}
+
+// Mirrors fragment_shader for the cube and floor_fragment_shader for the
+// flat floor, including their quirks: the light direction is taken in view
+// space but dotted with a world-space normal, and the floor normal is
+// normalized with a w of 1.  The view is a rotation, so the view-space dot
+// product is the world one against light_normal and needs no transform.
+glm::vec3
+SoftRasterizer::shade(const Triangle& tri, const glm::vec3& world) const
+{
+	glm::vec3 to_light = glm::vec3(uniforms_.light_position) - world;
+	float inv_light_distance = 1.0f / std::sqrt(glm::dot(to_light, to_light));
+	float dot_nl = glm::dot(to_light, tri.light_normal) * inv_light_distance;
+	const glm::vec3& n = tri.normal;
+	if (tri.material == kCubeMaterial)
+		return glm::clamp(dot_nl, 0.0f, 1.0f) * glm::abs(n);
+
+	float checker = std::floor(world.x) + std::floor(world.z);
+	float color = checker - 2.0f * std::floor(checker * 0.5f) == 0.0f ? 0.0f : 1.0f;
+	// dot(look, 2 * dot(n, l) * n - l) with look and l normalized.
+	glm::vec3 to_eye = uniforms_.eye_position - world;
+	float inv_eye_distance = 1.0f / std::sqrt(glm::dot(to_eye, to_eye));
+	float n_l = glm::dot(n, to_light) * inv_light_distance;
+	float specular = (2.0f * n_l * glm::dot(to_eye, n) - glm::dot(to_eye, to_light) *
+	                  inv_light_distance) * inv_eye_distance;
+	color += 0.45f * std::max(0.0f, specular);
+	return glm::vec3(glm::clamp(dot_nl * kInvSqrt2, 0.0f, 1.0f) * color);
+}
@@ -0,0 +1,122 @@
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class FloorClipmap;
+
+// What the shaders get from the PerFrame block, as far as the software
+// path needs it.
+struct SoftUniforms {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec4 light_position;
+	glm::vec3 eye_position;
+};
+
+/*
+ * CPU rasterizer for machines without a usable GPU.  It draws the sponge
+ * with the cube fragment shader's flat Lambert shading and the flat floor
+ * with its checkerboard, so it can stand in for the GL path when dumping
+ * frames.
+ *
+ * Draw calls only record geometry.  end_frame() transforms and clips the
+ * triangles, bins them into kTile x kTile screen tiles and rasterizes the
+ * tiles in parallel, each tile touching only its own pixels.  Coverage and
+ * 1/w are evaluated a row of kBlock pixels at a time in SIMD loops.  Depth
+ * is stored as 1/w, nearer is larger, and every kBlock x kBlock block keeps
+ * its farthest depth so triangles hidden behind a filled block are rejected
+ * without looking at its pixels.
+ *
+ * Rows of pixels() run bottom-up, like glReadPixels, so they go straight to
+ * SaveJPEG.
+ */
+class SoftRasterizer {
+public:
+	static const int kTile = 64;
+	static const int kBlock = 8;
+
+	SoftRasterizer(int width, int height);
+
+	void begin_frame(const SoftUniforms& uniforms);
+	// Closed meshes only: back faces are culled.  The vectors must outlive
+	// end_frame().
+	void draw_mesh(const std::vector<glm::vec4>& vertices,
+	               const std::vector<glm::uvec3>& faces);
+	// Draws every patch of the clipmap that is not culled, untessellated.
+	void draw_floor(const FloorClipmap& floor);
+	void end_frame();
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	// RGB8, bottom row first.
+	const std::vector<uint8_t>& pixels() const { return pixels_; }
+	// Triangles submitted and those left to rasterize after culling and
+	// clipping, for the last frame.
+	size_t submitted_triangles() const { return submitted_; }
+	size_t rasterized_triangles() const { return rasterized_; }
+
+private:
+	enum Material { kCubeMaterial, kFloorMaterial };
+
+	struct Mesh {
+		const std::vector<glm::vec4>* vertices;
+		const std::vector<glm::uvec3>* faces;
+		Material material;
+		bool cull_back;
+	};
+
+	// A screen-space triangle ready to rasterize.  Barycentrics, 1/w and
+	// world position over w are planes a * x + b * y + c over pixel
+	// indices, already offset to pixel centres.
+	struct Triangle {
+		glm::vec3 bary_a, bary_b, bary_c;
+		glm::vec3 inv_w;
+		glm::vec3 world_a, world_b, world_c;
+		glm::ivec4 bounds;  // Pixels, inclusive: x0, y0, x1, y1.
+		float max_inv_w;
+		glm::vec3 normal;  // World space, normalized.
+		glm::vec3 light_normal;  // The view rotation applied backwards.
+		Material material;
+	};
+
+	// A slice of one mesh's faces, set up by one thread.
+	struct Chunk {
+		size_t mesh;
+		size_t begin, end;
+		std::vector<Triangle> triangles;
+		std::vector<std::vector<uint32_t>> bins;  // Per tile, into triangles.
+	};
+
+	void setup_chunk(Chunk& chunk);
+	void emit(Chunk& chunk, const glm::vec4* clip, const glm::vec3* world,
+	          const glm::vec3& normal, const Mesh& mesh);
+	void raster_tile(int tile);
+	void raster_triangle(const Triangle& tri, const glm::ivec4& rect);
+	glm::vec3 shade(const Triangle& tri, const glm::vec3& world) const;
+
+	int width_, height_;
+	int tiles_x_, tiles_y_;
+	int blocks_x_, blocks_y_;
+	SoftUniforms uniforms_;
+	glm::mat4 view_projection_;
+
+	std::vector<Mesh> meshes_;
+	std::vector<glm::vec4> floor_vertices_;
+	std::vector<glm::uvec3> floor_faces_;
+	bool draw_floor_ = false;
+	std::vector<std::vector<glm::vec4>> clip_vertices_;  // Per mesh.
+	std::vector<std::vector<uint16_t>> clip_codes_;  // Outside planes, per vertex.
+	std::vector<Chunk> chunks_;
+
+	std::vector<uint8_t> pixels_;
+	std::vector<float> depth_;  // Padded to whole blocks.
+	std::vector<float> block_far_;  // Smallest 1/w in each block.
+	size_t submitted_ = 0;
+	size_t rasterized_ = 0;
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include "texture_loader.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <jpegio.h>
+
+namespace {
+	// Averages 2x2 blocks; an odd last row or column is dropped, as GL
+	// sizes mip levels by rounding down.
+	void downsample(const TextureLoader::Mip& in, TextureLoader::Mip* out)
+	{
+		out->width = std::max(1, in.width / 2);
+		out->height = std::max(1, in.height / 2);
+		out->rgba.resize(size_t(out->width) * out->height * 4);
+		const size_t in_stride = size_t(in.width) * 4;
+		const int dx = in.width > 1 ? 4 : 0;
+		for (int y = 0; y < out->height; y++) {
+			const uint8_t* row0 = &in.rgba[2 * y * in_stride];
+			const uint8_t* row1 = in.height > 1 ? row0 + in_stride : row0;
+			uint8_t* dst = &out->rgba[y * size_t(out->width) * 4];
+			for (int x = 0; x < out->width; x++) {
+				const uint8_t* a = row0 + 8 * x;
+				const uint8_t* b = row1 + 8 * x;
+				for (int c = 0; c < 4; c++)
+					dst[4 * x + c] = uint8_t((a[c] + a[c + dx] + b[c] + b[c + dx] + 2) >> 2);
+			}
+		}
+	}
+};
+
+TextureLoader::TextureLoader(int max_size)
+	: max_size_(max_size)
+{
+}
+
+TextureLoader::~TextureLoader()
+{
+	quit_ = true;
+	g_jobs.wait(decoding_);
+}
+
+void
+TextureLoader::init(bool persistent)
+{
+	upload_.init(GL_PIXEL_UNPACK_BUFFER, persistent);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+int
+TextureLoader::load(const std::string& file)
+{
+	int handle = entries_.size();
+	entries_.emplace_back();
+	entries_.back().file = file;
+	pending_++;
+	g_jobs.run([this, handle, file] { decode_job(handle, file); }, &decoding_);
+	return handle;
+}
+
+void
+TextureLoader::update()
+{
+	std::vector<std::unique_ptr<Decoded>> batch;
+	size_t bytes = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		while (!decoded_.empty()) {
+			size_t size = 0;
+			for (const Mip& mip : decoded_.front()->mips)
+				size += mip.rgba.size();
+			if (!batch.empty() && bytes + size > kUploadBudget)
+				break;
+			bytes += size;
+			batch.push_back(std::move(decoded_.front()));
+			decoded_.pop_front();
+		}
+	}
+	if (batch.empty())
+		return;
+
+	// One upload per frame, so the ring only ever waits on a fence placed
+	// kSegments frames ago.
+	staging_.resize(bytes);
+	size_t offset = 0;
+	for (const std::unique_ptr<Decoded>& decoded : batch) {
+		for (const Mip& mip : decoded->mips) {
+			std::memcpy(&staging_[offset], mip.rgba.data(), mip.rgba.size());
+			offset += mip.rgba.size();
+		}
+	}
+	offset = bytes > 0 ? upload_.upload(staging_.data(), bytes) : 0;
+
+	for (const std::unique_ptr<Decoded>& decoded : batch) {
+		Entry& entry = entries_[decoded->handle];
+		pending_--;
+		if (!decoded->ok) {
+			entry.failed = true;
+			std::cerr << "failed to load texture " << entry.file << "\n";
+			continue;
+		}
+		const std::vector<Mip>& mips = decoded->mips;
+		entry.width = mips[0].width;
+		entry.height = mips[0].height;
+		glGenTextures(1, &entry.texture);
+		glBindTexture(GL_TEXTURE_2D, entry.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mips.size() - 1);
+		for (size_t level = 0; level < mips.size(); level++) {
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, mips[level].width, mips[level].height,
+			             0, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<const void*>(offset));
+			offset += mips[level].rgba.size();
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+bool
+TextureLoader::decode(const std::string& file, int max_size, std::vector<Mip>* mips)
+{
+	JpegDecodeOptions options;
+	options.rgba = true;
+	options.max_size = max_size;
+	Image image;
+	mips->clear();
+	if (!LoadJPEG(file, &image, options) || image.width <= 0 || image.height <= 0)
+		return false;
+
+	// Images too big even at 1/8 scale are halved here until they fit.
+	int skip = 0;
+	while (max_size > 0 && std::max(image.width, image.height) >> skip > max_size)
+		skip++;
+	mips->emplace_back();
+	Mip* mip = &mips->back();
+	mip->width = image.width;
+	mip->height = image.height;
+	mip->rgba.swap(image.bytes);
+	for (; skip > 0; skip--)
+		downsample(Mip(*mip), mip);
+	while (mip->width > 1 || mip->height > 1) {
+		mips->emplace_back();
+		mip = &mips->back();
+		downsample((*mips)[mips->size() - 2], mip);
+	}
+	return true;
+}
+
+void
+TextureLoader::decode_job(int handle, const std::string& file)
+{
+	if (quit_)
+		return;
+	std::unique_ptr<Decoded> decoded(new Decoded);
+	decoded->handle = handle;
+	decoded->ok = decode(file, max_size_, &decoded->mips);
+	std::lock_guard<std::mutex> lock(mutex_);
+	decoded_.push_back(std::move(decoded));
+}
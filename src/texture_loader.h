@@ -0,0 +1,94 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <GL/glew.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "gpu_buffer.h"
+#include "job_system.h"
+
+/*
+ * Streams JPEG textures in without stalling the render loop.
+ *
+ * load() queues a job on the job system that decodes the file straight
+ * to RGBA and builds the whole mip chain.  Images larger than
+ * max_size are decoded at 1/2, 1/4 or 1/8 scale by libjpeg's scaled inverse
+ * DCT, which skips most of the decode instead of throwing the detail away
+ * afterwards; smaller levels are box-filtered down from the decoded one.
+ *
+ * update(), called once per frame on the GL thread, copies finished chains
+ * into one segment of a pixel unpack GpuBuffer and points glTexImage2D at
+ * it, so the driver copies out of the buffer on its own time.  At most
+ * kUploadBudget bytes go up per frame, except that one texture always
+ * does; the rest wait for the next frame.
+ */
+class TextureLoader {
+public:
+	static const size_t kUploadBudget = 16 << 20;
+
+	// One mip level, rows top first as in the file, so v runs down the image.
+	struct Mip {
+		int width = 0, height = 0;
+		std::vector<uint8_t> rgba;
+	};
+
+	// max_size = 0 keeps every image at full size.
+	explicit TextureLoader(int max_size = 0);
+	// Waits for decodes in progress and drops those not yet started.
+	~TextureLoader();
+
+	// Needs a current GL context.
+	void init(bool persistent);
+
+	// Queues file and returns its handle.
+	int load(const std::string& file);
+	// Uploads decoded textures, within the per-frame budget.
+	void update();
+
+	// 0 until the texture is uploaded, and for files that failed to decode.
+	GLuint texture(int handle) const { return entries_[handle].texture; }
+	bool failed(int handle) const { return entries_[handle].failed; }
+	const std::string& file(int handle) const { return entries_[handle].file; }
+	int width(int handle) const { return entries_[handle].width; }
+	int height(int handle) const { return entries_[handle].height; }
+	// Handles neither uploaded nor failed yet.
+	size_t pending() const { return pending_; }
+
+	// Decodes file into a full mip chain down to 1x1.
+	static bool decode(const std::string& file, int max_size, std::vector<Mip>* mips);
+
+private:
+	struct Entry {
+		std::string file;
+		GLuint texture = 0;
+		int width = 0, height = 0;
+		bool failed = false;
+	};
+
+	struct Decoded {
+		int handle;
+		bool ok;
+		std::vector<Mip> mips;
+	};
+
+	void decode_job(int handle, const std::string& file);
+
+	int max_size_;
+	GpuBuffer upload_;
+	std::vector<uint8_t> staging_;
+	std::vector<Entry> entries_;  // GL thread only.
+	size_t pending_ = 0;
+	JobGroup decoding_;
+
+	// Shared with the jobs.
+	std::mutex mutex_;
+	std::deque<std::unique_ptr<Decoded>> decoded_;
+	std::atomic<bool> quit_{ false };
+};
+
+#endif
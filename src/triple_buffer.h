@@ -0,0 +1,49 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+/*
+ * Hands the latest of a stream of values from one writer thread to one
+ * reader thread without locks or waiting on either side.
+ *
+ * Of the three slots the writer owns one, the reader owns one and the third
+ * sits in the middle.  publish() swaps the writer's slot with the middle
+ * one and marks it fresh; update() swaps the middle slot with the reader's
+ * if it is fresh.  Neither side ever touches a slot the other owns, so a
+ * slow reader simply skips values and a slow writer never holds it up.
+ * Slots are reused, so the writer should overwrite every field of back().
+ */
+template <typename T>
+class TripleBuffer {
+public:
+	// Writer side.
+	T& back() { return slots_[back_]; }
+	void publish()
+	{
+		back_ = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel) & kIndex;
+	}
+
+	// Reader side.  Returns whether front() changed.
+	bool update()
+	{
+		if (!(middle_.load(std::memory_order_relaxed) & kFresh))
+			return false;
+		front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndex;
+		return true;
+	}
+	const T& front() const { return slots_[front_]; }
+	// Whether update() would change front(), for deciding to sleep.
+	bool fresh() const { return middle_.load(std::memory_order_relaxed) & kFresh; }
+
+private:
+	static const int kIndex = 3;
+	static const int kFresh = 4;
+
+	T slots_[3];
+	int back_ = 0;
+	int front_ = 1;
+	std::atomic<int> middle_{ 2 };
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "voxel_export.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "job_system.h"
+#include "memory_budget.h"
+
+namespace {
+	// Encoded records held per chunk; two chunks are alive at once.
+	const size_t kChunkBytes = 16 << 20;
+	// Rows, or rows of bricks, each job encodes.
+	const size_t kUnitsPerJob = 16;
+	const size_t kBrickRecordBytes = 3 * sizeof(int32_t) + kVoxelBrickSize * kVoxelBrickSize;
+
+	const char* kFormatNames[] = { "bits", "rle", "bricks" };
+	const int kNumFormats = 3;
+
+	// The distinct rows, each encoded once.  Row mask is the set of digits
+	// where y or z has a 1; index 1 << level is the empty row, for rows
+	// where both do.
+	struct RowTable {
+		std::vector<uint8_t> data;
+		std::vector<size_t> offset;  // One past the last row too.
+
+		const uint8_t* row(uint32_t index) const { return data.data() + offset[index]; }
+		size_t row_bytes(uint32_t index) const { return offset[index + 1] - offset[index]; }
+	};
+
+	struct Chunk {
+		std::vector<uint8_t> data;  // unit_bytes per unit, used or not.
+		std::vector<size_t> sizes;
+	};
+
+	void append_varint(uint32_t value, std::vector<uint8_t>* out)
+	{
+		while (value >= 0x80) {
+			out->push_back(uint8_t(value | 0x80));
+			value >>= 7;
+		}
+		out->push_back(uint8_t(value));
+	}
+
+	// Bit i of ones[x] is set where x has a 1 in base 3 digit i.
+	std::vector<uint32_t> digit_ones(uint32_t size)
+	{
+		std::vector<uint32_t> ones(size, 0);
+		for (uint32_t x = 1; x < size; x++)
+			ones[x] = ones[x / 3] << 1 | (x % 3 == 1);
+		return ones;
+	}
+
+	RowTable build_bits(int level, const std::vector<uint32_t>& ones)
+	{
+		const uint32_t size = ones.size();
+		const size_t row_bytes = (size + 7) / 8;
+		const int rows = (1 << level) + 1;
+		RowTable table;
+		table.data.assign(row_bytes * rows, 0);
+		table.offset.resize(rows + 1);
+		for (int r = 0; r <= rows; r++)
+			table.offset[r] = row_bytes * r;
+		g_jobs.parallel_for(0, rows - 1, 1, [&](size_t begin, size_t end) {
+			for (uint32_t mask = begin; mask < end; mask++) {
+				uint8_t* row = table.data.data() + table.offset[mask];
+				for (uint32_t x = 0; x < size; x++) {
+					if (!(ones[x] & mask))
+						row[x / 8] |= 1 << (x % 8);
+				}
+			}
+		});
+		return table;
+	}
+
+	RowTable build_runs(int level, const std::vector<uint32_t>& ones)
+	{
+		const uint32_t size = ones.size();
+		const int rows = (1 << level) + 1;
+		RowTable table;
+		table.offset.push_back(0);
+		std::vector<uint32_t> runs;
+		for (int r = 0; r < rows; r++) {
+			runs.assign(1, 0);
+			bool filled = false;
+			for (uint32_t x = 0; r < rows - 1 && x < size; x++) {
+				if (!(ones[x] & r) != filled) {
+					filled = !filled;
+					runs.push_back(0);
+				}
+				runs.back()++;
+			}
+			if (r == rows - 1)
+				runs[0] = size;
+			append_varint(runs.size(), &table.data);
+			for (uint32_t run : runs)
+				append_varint(run, &table.data);
+			table.offset.push_back(table.data.size());
+		}
+		return table;
+	}
+};
+
+bool
+ParseVoxelFormat(const std::string& name, VoxelFormat* format)
+{
+	for (int f = 0; f < kNumFormats; f++) {
+		if (name == kFormatNames[f]) {
+			*format = VoxelFormat(f);
+			return true;
+		}
+	}
+	return false;
+}
+
+const char*
+VoxelFormatName(VoxelFormat format)
+{
+	return kFormatNames[format];
+}
+
+bool
+ExportVoxels(const std::string& file, int level, glm::vec3 min, glm::vec3 max,
+             VoxelFormat format, VoxelExportStats* stats)
+{
+	if (level < 0 || level > kMaxVoxelLevel)
+		return false;
+	std::ofstream out(file, std::ios::binary);
+	if (!out)
+		return false;
+
+	uint32_t size = 1;
+	uint64_t filled = 1;
+	for (int i = 0; i < level; i++) {
+		size *= 3;
+		filled *= 20;
+	}
+	const uint32_t empty = 1u << level;
+	const uint32_t bricks = (size + kVoxelBrickSize - 1) / kVoxelBrickSize;
+	std::vector<uint32_t> ones = digit_ones(size);
+	// Bricks take their rows a byte at a time from the packed rows.
+	RowTable table = format == kVoxelRle ? build_runs(level, ones) : build_bits(level, ones);
+	auto row_index = [&](uint32_t y, uint32_t z) {
+		return y < size && z < size && !(ones[y] & ones[z]) ? ones[y] | ones[z] : empty;
+	};
+
+	// A unit is a row for rows, and a row of bricks along x for bricks.
+	uint64_t units;
+	size_t unit_bytes = 0;
+	if (format == kVoxelBricks) {
+		units = uint64_t(bricks) * bricks;
+		unit_bytes = bricks * kBrickRecordBytes;
+	} else {
+		units = uint64_t(size) * size;
+		for (uint32_t r = 0; r <= empty; r++)
+			unit_bytes = std::max(unit_bytes, table.row_bytes(r));
+	}
+	const size_t chunk_units = std::max<size_t>(1, kChunkBytes / unit_bytes);
+	Chunk chunks[2];
+	for (Chunk& chunk : chunks) {
+		chunk.data.resize(std::min<uint64_t>(chunk_units, units) * unit_bytes);
+		chunk.sizes.resize(std::min<uint64_t>(chunk_units, units));
+	}
+	MemoryCharge memory(kMemoryScratch, CapacityBytes(ones) + CapacityBytes(table.data) +
+			CapacityBytes(table.offset) + 2 * (CapacityBytes(chunks[0].data) +
+			CapacityBytes(chunks[0].sizes)));
+
+	VoxelHeader header;
+	std::memcpy(header.magic, "MVOX", 4);
+	header.version = 1;
+	header.format = format;
+	header.level = level;
+	header.size = size;
+	header.brick_size = kVoxelBrickSize;
+	header.filled = filled;
+	header.records = format == kVoxelBricks ? 0 : units;
+	for (int i = 0; i < 3; i++) {
+		header.min[i] = min[i];
+		header.max[i] = max[i];
+	}
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	auto encode = [&](uint64_t unit, uint8_t* data) -> size_t {
+		if (format != kVoxelBricks) {
+			uint32_t index = row_index(unit % size, unit / size);
+			std::memcpy(data, table.row(index), table.row_bytes(index));
+			return table.row_bytes(index);
+		}
+		uint32_t by = unit % bricks, bz = unit / bricks;
+		const uint8_t* rows[kVoxelBrickSize * kVoxelBrickSize];
+		for (int k = 0; k < kVoxelBrickSize; k++) {
+			for (int j = 0; j < kVoxelBrickSize; j++) {
+				rows[k * kVoxelBrickSize + j] = table.row(row_index(
+						by * kVoxelBrickSize + j, bz * kVoxelBrickSize + k));
+			}
+		}
+		size_t used = 0;
+		for (uint32_t bx = 0; bx < bricks; bx++) {
+			uint8_t* record = data + used;
+			uint8_t* mask = record + 3 * sizeof(int32_t);
+			uint8_t any = 0;
+			for (int i = 0; i < kVoxelBrickSize * kVoxelBrickSize; i++) {
+				mask[i] = rows[i][bx];
+				any |= mask[i];
+			}
+			if (!any)
+				continue;
+			int32_t origin[3] = {
+				int32_t(bx * kVoxelBrickSize), int32_t(by * kVoxelBrickSize),
+				int32_t(bz * kVoxelBrickSize),
+			};
+			std::memcpy(record, origin, sizeof(origin));
+			used += kBrickRecordBytes;
+		}
+		return used;
+	};
+
+	// Encode a chunk while the one before it is written.
+	JobGroup writing;
+	uint64_t records = 0;
+	int current = 0;
+	for (uint64_t first = 0; first < units; first += chunk_units, current ^= 1) {
+		Chunk& chunk = chunks[current];
+		const size_t count = std::min<uint64_t>(chunk_units, units - first);
+		g_jobs.parallel_for(0, count, kUnitsPerJob, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				chunk.sizes[i] = encode(first + i, chunk.data.data() + i * unit_bytes);
+		});
+		if (format == kVoxelBricks) {
+			for (size_t i = 0; i < count; i++)
+				records += chunk.sizes[i] / kBrickRecordBytes;
+		}
+		g_jobs.wait(writing);
+		g_jobs.run([&out, &chunk, count, unit_bytes] {
+			for (size_t i = 0; i < count; i++) {
+				out.write(reinterpret_cast<const char*>(chunk.data.data() + i * unit_bytes),
+				          chunk.sizes[i]);
+			}
+		}, &writing);
+	}
+	g_jobs.wait(writing);
+
+	if (format == kVoxelBricks) {
+		header.records = records;
+		out.seekp(0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.seekp(0, std::ios::end);
+	}
+	if (stats) {
+		stats->filled = filled;
+		stats->records = header.records;
+		stats->bytes = out.tellp();
+		stats->buffer_bytes = memory.bytes();
+	}
+	out.close();
+	return bool(out);
+}
@@ -0,0 +1,74 @@
+#ifndef VOXEL_EXPORT_H
+#define VOXEL_EXPORT_H
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+
+/*
+ * Voxels of the sponge, written straight from its lattice rather than from
+ * triangles.  At level L the sponge is a grid of 3^L voxels a side, and a
+ * voxel is filled unless two of its coordinates have a 1 in the same base 3
+ * digit.  A row along x is therefore fixed by which digits its y and z put
+ * a 1 in, so only 2^L distinct rows exist; each is encoded once and the
+ * file is copied together from them.
+ *
+ * Every file starts with a VoxelHeader and is in the host's byte order.
+ * The payload is one of:
+ *
+ *   kVoxelBits    Every row of the grid, z slowest and x fastest, packed
+ *                 8 voxels a byte from the low bit and padded to a byte.
+ *   kVoxelRle     The same rows run-length encoded: per row, the number of
+ *                 runs and then their lengths, as LEB128 varints.  Runs
+ *                 alternate starting with an empty one, which may be 0.
+ *   kVoxelBricks  Only the 8^3 bricks that have a filled voxel, as leaves
+ *                 of an OpenVDB tree: the voxel coordinates of the brick's
+ *                 minimum as 3 int32, then a 64-byte mask of its voxels,
+ *                 x fastest so that each row of a brick is one byte.
+ *
+ * The sponge looks the same along every axis, so rows along x serve any.
+ */
+enum VoxelFormat {
+	kVoxelBits,
+	kVoxelRle,
+	kVoxelBricks,
+};
+
+// The row table grows as 6^level bits, and level 10 is already 25 TB dense.
+const int kMaxVoxelLevel = 10;
+const int kVoxelBrickSize = 8;
+
+struct VoxelHeader {
+	char magic[4];       // "MVOX"
+	uint32_t version;    // 1
+	uint32_t format;     // A VoxelFormat.
+	uint32_t level;
+	uint32_t size;       // Voxels a side, 3^level.
+	uint32_t brick_size; // kVoxelBrickSize.
+	uint64_t filled;     // Filled voxels, 20^level.
+	uint64_t records;    // Rows, or bricks for kVoxelBricks.
+	float min[3];        // World-space corners of the grid.
+	float max[3];
+};
+
+struct VoxelExportStats {
+	uint64_t filled = 0;
+	uint64_t records = 0;
+	uint64_t bytes = 0;  // Of the whole file.
+	size_t buffer_bytes = 0;  // Row table and chunks, held throughout.
+};
+
+bool ParseVoxelFormat(const std::string& name, VoxelFormat* format);
+const char* VoxelFormatName(VoxelFormat format);
+
+/*
+ * Writes the sponge of the given level spanning [min, max] to file.
+ * Records are encoded in parallel a chunk at a time, and each chunk is
+ * written while the next is encoded, so memory stays bounded by two chunks
+ * and the row table however large the level.  Returns false if the level
+ * is out of range or the file cannot be written.
+ */
+bool ExportVoxels(const std::string& file, int level, glm::vec3 min, glm::vec3 max,
+                  VoxelFormat format, VoxelExportStats* stats = nullptr);
+
+#endif
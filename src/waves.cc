@@ -0,0 +1,95 @@
+#include "waves.h"
+#include <algorithm>
+#include <cmath>
+#include "job_system.h"
+
+namespace {
+	// Below this many points threads cost more than they save.
+	const size_t kParallelQueries = 16384;
+	const size_t kQueryBlock = 1024;
+
+	struct WaveTerms {
+		float w, phi, dir_x, dir_z;
+		float tide_x, tide_z, tide_amplitude, inv_sigma2;
+		float amplitude, rest;
+	};
+
+	template<bool kNormals>
+	void query_block(const WaveTerms& t, size_t begin, size_t end,
+	                 const float* __restrict__ x, const float* __restrict__ z,
+	                 float* __restrict__ height, float* __restrict__ normal_x,
+	                 float* __restrict__ normal_y, float* __restrict__ normal_z)
+	{
+		#pragma omp simd
+		for (size_t i = begin; i < end; i++) {
+			float phase = t.w * (x[i] * t.dir_x + z[i] * t.dir_z) + t.phi;
+			float ox = x[i] - t.tide_x;
+			float oz = z[i] - t.tide_z;
+			float tide = t.tide_amplitude * std::exp(-0.5f * (ox * ox + oz * oz) * t.inv_sigma2);
+			height[i] = t.rest + t.amplitude * std::sin(phase) + tide;
+			if (kNormals) {
+				float swell = t.w * t.amplitude * std::cos(phase);
+				float slope_x = swell * t.dir_x - tide * ox * t.inv_sigma2;
+				float slope_z = swell * t.dir_z - tide * oz * t.inv_sigma2;
+				float inv_length = 1.0f / std::sqrt(slope_x * slope_x + 1.0f + slope_z * slope_z);
+				normal_x[i] = -slope_x * inv_length;
+				normal_y[i] = inv_length;
+				normal_z[i] = -slope_z * inv_length;
+			}
+		}
+	}
+};
+
+WaveField::WaveField(float rest_height, const WaveParams& params)
+	: rest_height_(rest_height), params_(params)
+{
+}
+
+void
+WaveField::set_time(float elapsed_time, float tide_time)
+{
+	elapsed_time_ = elapsed_time;
+	tide_time_ = tide_time;
+}
+
+void
+WaveField::query(size_t count, const float* x, const float* z, float* height,
+                 float* normal_x, float* normal_y, float* normal_z) const
+{
+	// Everything but the per-point terms of wave_height() in WAVE_FUNCTIONS.
+	WaveTerms t;
+	t.w = 2.0f / params_.wave_length;
+	t.phi = params_.wave_speed * t.w * elapsed_time_;
+	t.dir_x = params_.wave_direction.x;
+	t.dir_z = params_.wave_direction.z;
+	float travel = params_.tide_speed * tide_time_;
+	t.tide_x = params_.tide_origin.x + params_.tide_direction.x * travel;
+	t.tide_z = params_.tide_origin.z + params_.tide_direction.z * travel;
+	t.tide_amplitude = params_.tide_amplitude;
+	t.inv_sigma2 = 1.0f / (params_.tide_sigma * params_.tide_sigma);
+	t.amplitude = params_.wave_amplitude;
+	t.rest = rest_height_;
+
+	bool normals = normal_x && normal_y && normal_z;
+	auto run = [&](size_t begin, size_t end) {
+		if (normals)
+			query_block<true>(t, begin, end, x, z, height, normal_x, normal_y, normal_z);
+		else
+			query_block<false>(t, begin, end, x, z, height, nullptr, nullptr, nullptr);
+	};
+	// Handing a batch to the job system and waiting for it costs about as
+	// much as a few hundred points, so small batches stay on this thread.
+	if (count < kParallelQueries) {
+		run(0, count);
+		return;
+	}
+	g_jobs.parallel_for(0, count, kQueryBlock, run);
+}
+
+float
+WaveField::height(float x, float z) const
+{
+	float h;
+	query(1, &x, &z, &h);
+	return h;
+}
@@ -0,0 +1,93 @@
+#ifndef WAVES_H
+#define WAVES_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+
+/*
+ * Ocean mode 1: one sine swell plus a Gaussian tide that travels across
+ * the floor.  The parameters are part of the per-frame uniform block, so
+ * the shaders and WaveField always see the same values; the layout follows
+ * std140 (vec4s first, then the scalars, padded to 16 bytes).
+ */
+struct WaveParams {
+	glm::vec4 wave_direction = glm::vec4(0.70710678f, 0.0f, 0.70710678f, 0.0f);  // xz, unit
+	glm::vec4 tide_origin = glm::vec4(0.0f);     // xz at tide_time 0
+	glm::vec4 tide_direction = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);  // xz, unit
+	float wave_amplitude = 1.0f;
+	float wave_length = 2.0f;  // The phase advances 2 / wave_length per unit.
+	float wave_speed = 2.0f;
+	float tide_speed = 5.0f;
+	float tide_amplitude = 20.0f;
+	float tide_sigma = 2.0f;
+	float tide_range = 5.0f;   // Radius the TCS tessellates more finely.
+	float pad = 0.0f;
+};
+
+static_assert(sizeof(WaveParams) == 80, "WaveParams must match std140");
+
+// GLSL members of WaveParams, for PER_FRAME_BLOCK.
+#define WAVE_PARAMS_MEMBERS                     \
+	"	vec4 wave_direction;\n"                  \
+	"	vec4 tide_origin;\n"                     \
+	"	vec4 tide_direction;\n"                  \
+	"	float wave_amplitude;\n"                 \
+	"	float wave_length;\n"                    \
+	"	float wave_speed;\n"                     \
+	"	float tide_speed;\n"                     \
+	"	float tide_amplitude;\n"                 \
+	"	float tide_sigma;\n"                     \
+	"	float tide_range;\n"                     \
+	"	float wave_pad;\n"
+
+// GLSL twin of WaveField::query for one point; needs PER_FRAME_BLOCK.
+#define WAVE_FUNCTIONS                                                       \
+	"vec2 tide_center()\n"                                                    \
+	"{\n"                                                                     \
+	"	return tide_origin.xz + tide_direction.xz * tide_speed * tide_time;\n" \
+	"}\n"                                                                     \
+	"\n"                                                                      \
+	"float wave_height(vec2 p, out vec2 slope)\n"                             \
+	"{\n"                                                                     \
+	"	float w = 2.0 / wave_length;\n"                                        \
+	"	float phase = w * dot(p, wave_direction.xz) + wave_speed * w * elapsedTime;\n" \
+	"	vec2 offset = p - tide_center();\n"                                    \
+	"	float tide = tide_amplitude *\n"                                       \
+	"		exp(-dot(offset, offset) / (2.0 * tide_sigma * tide_sigma));\n"    \
+	"	slope = w * wave_amplitude * cos(phase) * wave_direction.xz -\n"       \
+	"		tide * offset / (tide_sigma * tide_sigma);\n"                       \
+	"	return wave_amplitude * sin(phase) + tide;\n"                          \
+	"}\n"
+
+/*
+ * CPU side of ocean mode 1, for game logic and anything that floats.
+ *
+ * Heights are exact at the tessellated vertices the GPU displaces; between
+ * them the rendered surface is the linear interpolation of those.  Queries
+ * take and return structure-of-arrays batches: the loop body is
+ * branch-free so it vectorizes, and large batches are split across the
+ * job system.
+ */
+class WaveField {
+public:
+	explicit WaveField(float rest_height, const WaveParams& params = WaveParams());
+
+	const WaveParams& params() const { return params_; }
+	void set_params(const WaveParams& params) { params_ = params; }
+	// Same clocks as PerFrameUniforms::elapsed_time and tide_time.
+	void set_time(float elapsed_time, float tide_time);
+
+	// Surface height at each (x[i], z[i]); normals may be null.
+	void query(size_t count, const float* x, const float* z, float* height,
+	           float* normal_x = nullptr, float* normal_y = nullptr,
+	           float* normal_z = nullptr) const;
+	float height(float x, float z) const;
+
+private:
+	float rest_height_;
+	WaveParams params_;
+	float elapsed_time_ = 0.0f;
+	float tide_time_ = 0.0f;
+};
+
+#endif